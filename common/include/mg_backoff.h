@@ -0,0 +1,66 @@
+#ifndef MG_BACKOFF_H
+#define MG_BACKOFF_H
+
+#include <stdint.h>
+
+/* Reconnect scheduler: decorrelated-jitter exponential backoff. Each delay
+ * is drawn uniformly between base_ms and three times the previous delay,
+ * capped at max_ms, so it grows about exponentially while clients that
+ * lost the same broker at the same moment drift apart instead of retrying
+ * in lockstep.
+ *
+ * The first retry after a connection that lasted stable_ms or more is
+ * fast, up to first_ms, since one lost connection is usually a blip. A
+ * connection that drops sooner does not reset the backoff, so a broker
+ * that accepts and then drops clients is not hammered either.
+ *
+ * Times are passed in by the caller, which lets a host simulation run
+ * thousands of schedulers on a virtual clock.
+ */
+struct mg_backoff_config {
+  uint32_t first_ms;
+  uint32_t base_ms;
+  uint32_t max_ms;
+  uint32_t stable_ms;
+};
+
+struct mg_backoff_stats {
+  /* Delays handed out, connections made and backoff resets after stable
+   * connections.
+   */
+  uint32_t retries;
+  uint32_t connects;
+  uint32_t resets;
+  /* Retries since the last reset, and the longest delay handed out. */
+  uint32_t failures;
+  uint32_t max_delay_ms;
+  uint64_t total_delay_ms;
+};
+
+struct mg_backoff {
+  const struct mg_backoff_config *cfg;
+  /* Previous delay; zero until the first retry after a reset. */
+  uint32_t prev_ms;
+  /* When the current connection was made, or -1 while disconnected. */
+  int64_t connected_at;
+  struct mg_backoff_stats stats;
+};
+
+/* @p cfg must outlive @p bo. */
+void mg_backoff_init(struct mg_backoff *bo,
+                     const struct mg_backoff_config *cfg);
+
+/* Returns how long to wait before the next connection attempt, after a
+ * failed one or a lost connection.
+ */
+uint32_t mg_backoff_next(struct mg_backoff *bo);
+
+/* Records a connection made at @p now. */
+void mg_backoff_connected(struct mg_backoff *bo, int64_t now);
+
+/* Records the connection being lost at @p now, and resets the backoff if it
+ * had lasted stable_ms.
+ */
+void mg_backoff_disconnected(struct mg_backoff *bo, int64_t now);
+
+#endif
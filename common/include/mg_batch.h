@@ -0,0 +1,82 @@
+#ifndef MG_BATCH_H
+#define MG_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mg_telemetry.h"
+
+/* Flush thresholds. A batch is due when any of them is reached; zero
+ * disables the byte and age limits.
+ */
+struct mg_batch_config {
+  /* SenML base name put in front of every record name, or NULL. */
+  const char *base_name;
+  size_t max_count;
+  size_t max_bytes;
+  int64_t max_age_ms;
+};
+
+struct mg_batch_sample {
+  sensor_data_t data;
+  int64_t timestamp;
+};
+
+/* Accumulates readings and encodes them as one SenML pack. The first record
+ * carries bn and bt, and every later record only a t offset relative to it.
+ * bt is Unix time where the port knows it, otherwise relative to when the
+ * pack is sent (mg_senml_time()).
+ * Records are grouped per field, so the unit is given once per field as bu.
+ * Storage is supplied by the caller, and the encoded pack size is tracked
+ * as samples are added, so the size threshold needs no trial encoding.
+ */
+struct mg_batch {
+  const struct mg_batch_config *config;
+  struct mg_batch_sample *samples;
+  size_t capacity;
+  size_t count;
+  size_t record_bytes;
+};
+
+void mg_batch_init(struct mg_batch *batch, const struct mg_batch_config *config,
+                   struct mg_batch_sample *storage, size_t capacity);
+
+/* Queues a reading taken at @p timestamp (milliseconds). Returns -ENOSPC and
+ * leaves the batch unchanged if it is full or the pack would grow past
+ * max_bytes; flush it and add the reading again.
+ */
+int mg_batch_add(struct mg_batch *batch, const sensor_data_t *data,
+                 int64_t timestamp);
+
+/* True once the count or size threshold is reached, or the oldest reading
+ * is max_age_ms old at @p now.
+ */
+bool mg_batch_due(const struct mg_batch *batch, int64_t now);
+
+/* Size of the SenML-CBOR pack mg_batch_encode_senml_cbor() would write. */
+size_t mg_batch_encoded_len(const struct mg_batch *batch);
+
+/* Encodes all queued readings into @p buf for sending at @p now
+ * (milliseconds). The batch is left intact so the pack can be re-encoded if
+ * sending fails; call mg_batch_reset() once it is delivered. Returns the
+ * encoded length, -ENODATA if the batch is empty or -E2BIG if @p len is too
+ * small.
+ */
+int mg_batch_encode_senml_cbor(const struct mg_batch *batch, int64_t now,
+                               uint8_t *buf, size_t len);
+
+/* Writes bytes [@p offset, @p offset + @p len) of the pack that
+ * mg_batch_encode_senml_cbor() would write, for block-wise transfers that
+ * never hold the whole pack. The pack is encoded up to the end of the
+ * block on every call, so every block of it must be given the same @p now.
+ * Returns the bytes written, less than @p len only for the last block, or
+ * -ENODATA if the batch is empty.
+ */
+int mg_batch_encode_senml_cbor_block(const struct mg_batch *batch,
+                                     int64_t now, size_t offset,
+                                     uint8_t *buf, size_t len);
+
+void mg_batch_reset(struct mg_batch *batch);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef MG_CBOR_H
+#define MG_CBOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Minimal definite-length CBOR (RFC 8949) writer. It encodes straight into a
+ * caller supplied buffer, typically the transport's transmit buffer, and
+ * records overflow instead of failing every call, so a message can be
+ * written unconditionally and checked once with mg_cbor_finish(). A writer
+ * without a buffer only counts, to size a message before writing it.
+ */
+struct mg_cbor_writer {
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+  bool overflow;
+  /* Window writers have no room of their own (cap 0), so every item takes
+   * the slow path: it is put together in the stage, and the part inside the
+   * window is copied out when the next item starts. skip counts the bytes
+   * still to drop before the window starts.
+   */
+  bool window;
+  uint8_t staged;
+  size_t skip;
+  size_t window_len;
+  size_t window_cap;
+  uint8_t stage[9];
+};
+
+static inline void mg_cbor_init(struct mg_cbor_writer *w, uint8_t *buf,
+                                size_t cap) {
+  w->buf = buf;
+  w->len = 0;
+  w->cap = cap;
+  w->overflow = false;
+  w->window = false;
+}
+
+/* Keeps only bytes [offset, offset + cap) of the message, so a message can
+ * be produced a block at a time by encoding it once per block.
+ * mg_cbor_finish() then returns the bytes kept, which is less than cap only
+ * for the block the message ends in.
+ */
+static inline void mg_cbor_init_window(struct mg_cbor_writer *w, uint8_t *buf,
+                                       size_t cap, size_t offset) {
+  mg_cbor_init(w, buf, 0);
+  w->window = true;
+  w->staged = 0;
+  w->skip = offset;
+  w->window_len = 0;
+  w->window_cap = cap;
+}
+
+static inline void mg_cbor_init_sizing(struct mg_cbor_writer *w) {
+  mg_cbor_init(w, NULL, SIZE_MAX);
+}
+
+/* Returns the encoded length, or -E2BIG if anything did not fit. */
+int mg_cbor_finish(struct mg_cbor_writer *w);
+
+void mg_cbor_put_array(struct mg_cbor_writer *w, size_t count);
+void mg_cbor_put_map(struct mg_cbor_writer *w, size_t pairs);
+void mg_cbor_put_int(struct mg_cbor_writer *w, int64_t value);
+void mg_cbor_put_text(struct mg_cbor_writer *w, const char *str, size_t len);
+void mg_cbor_put_bool(struct mg_cbor_writer *w, bool value);
+
+/* Writes @p value in the shortest form that represents it exactly: an
+ * integer when it is integral, otherwise a half, single or double float.
+ */
+void mg_cbor_put_number(struct mg_cbor_writer *w, double value);
+
+/* Writes @p value as a double float whatever it is, for an item whose size
+ * has to be known before its value is.
+ */
+void mg_cbor_put_double(struct mg_cbor_writer *w, double value);
+
+#endif
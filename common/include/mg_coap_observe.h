@@ -0,0 +1,79 @@
+#ifndef MG_COAP_OBSERVE_H
+#define MG_COAP_OBSERVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Client side of a CoAP Observe registration (RFC 7641).
+ *
+ * The client registers once with a GET carrying Observe 0 and the server
+ * pushes a notification whenever the resource changes, so downlink
+ * commands arrive as they are published instead of on the next poll.
+ *
+ * Notifications may be reordered on the way: only those with a newer
+ * Observe value than the last one, or arriving more than 128 s after it,
+ * are fresh (section 3.4). Each fresh notification is valid for its
+ * Max-Age. If none follows in that time the registration may have been
+ * dropped by the server, so it is renewed with the same token (section
+ * 3.3.1). A registration that fails, or a response without Observe from a
+ * server that does not support it, is retried after retry_ms.
+ *
+ * Times are passed in by the caller.
+ */
+struct mg_coap_observe_stats {
+  uint32_t registrations;
+  uint32_t notifications;
+  /* Notifications dropped as older than the last one. */
+  uint32_t stale;
+  /* Renewals after Max-Age passed without a notification. */
+  uint32_t renewals;
+  uint32_t failures;
+};
+
+struct mg_coap_observe {
+  /* A registration is in flight, or has been answered. */
+  bool pending;
+  bool active;
+  uint32_t seq;
+  /* When the last fresh notification arrived. */
+  int64_t received;
+  /* When the registration is sent or renewed next. */
+  int64_t due;
+  struct mg_coap_observe_stats stats;
+};
+
+/* Default Max-Age (RFC 7252 section 5.10.5). */
+#define MG_COAP_OBSERVE_MAX_AGE_S 60
+/* Time past Max-Age a notification may still be in transit. */
+#define MG_COAP_OBSERVE_GRACE_MS 2000
+
+/* The first registration is due at once. */
+void mg_coap_observe_init(struct mg_coap_observe *obs, int64_t now);
+
+/* Whether the registration is to be sent or renewed at @p now. */
+bool mg_coap_observe_due(const struct mg_coap_observe *obs, int64_t now);
+
+/* How long until the registration is due, or 0. */
+uint32_t mg_coap_observe_wait_ms(const struct mg_coap_observe *obs,
+                                 int64_t now);
+
+/* Records a registration sent at @p now. A reply is awaited for
+ * @p timeout_ms before it is sent again.
+ */
+void mg_coap_observe_sent(struct mg_coap_observe *obs, int64_t now,
+                          uint32_t timeout_ms);
+
+/* Records a 2.xx response carrying Observe @p seq, and returns whether it
+ * is fresh. @p max_age_s is the Max-Age option, MG_COAP_OBSERVE_MAX_AGE_S
+ * if absent.
+ */
+bool mg_coap_observe_notified(struct mg_coap_observe *obs, uint32_t seq,
+                              uint32_t max_age_s, int64_t now);
+
+/* Records the registration failing at @p now: no reply, an error or a
+ * response without Observe. It is sent again after @p retry_ms.
+ */
+void mg_coap_observe_failed(struct mg_coap_observe *obs, int64_t now,
+                            uint32_t retry_ms);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef MG_COAP_PACER_H
+#define MG_COAP_PACER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* NON telemetry with CON checkpoints (RFC 7252 sections 4.3 and 4.7).
+ *
+ * Loss-tolerant streams go out as NON, so no message waits for a round
+ * trip. Every con_every-th message of a class, and at least one every
+ * con_interval_ms, goes as CON instead. Its acknowledgement shows that the
+ * server is still there and that the path still delivers.
+ *
+ * Only one checkpoint is outstanding at a time; a checkpoint that falls
+ * due meanwhile goes out as NON. Once a checkpoint has gone unanswered,
+ * the server counts as not responding. The next message then goes as CON
+ * again, and NON messages are held to an average of probing_rate bytes/s
+ * (PROBING_RATE, 1 byte/s in RFC 7252) until a response arrives. CON
+ * messages are paced by their own retransmission backoff instead.
+ *
+ * Classes share the pacer of their server, so a burst in one class does
+ * not slip past the probing limit of another. Times are passed in by the
+ * caller.
+ */
+struct mg_coap_class_config {
+  /* 1 sends every message as CON; 0 makes no checkpoints by count. */
+  uint32_t con_every;
+  /* 0 makes no checkpoints by time. */
+  uint32_t con_interval_ms;
+};
+
+struct mg_coap_class {
+  const struct mg_coap_class_config *cfg;
+  /* Messages since the class's last CON, and when it was sent. */
+  uint32_t since_con;
+  int64_t last_con;
+};
+
+struct mg_coap_pacer_stats {
+  uint32_t con;
+  uint32_t non;
+  /* Checkpoints answered, with any response, and given up on. */
+  uint32_t answered;
+  uint32_t lost;
+  /* NON messages sent while the server was not responding. */
+  uint32_t probing;
+};
+
+struct mg_coap_pacer {
+  uint32_t probing_rate;
+  uint32_t outstanding;
+  bool responding;
+  /* Start of the current probing period and the bytes sent since. */
+  int64_t quiet_since;
+  uint64_t quiet_bytes;
+  struct mg_coap_pacer_stats stats;
+};
+
+/* The server counts as not responding until the first checkpoint is
+ * answered, so the first message of every class is a CON.
+ */
+void mg_coap_pacer_init(struct mg_coap_pacer *pacer, uint32_t probing_rate,
+                        int64_t now);
+
+/* @p cfg must outlive @p cls. */
+void mg_coap_class_init(struct mg_coap_class *cls,
+                        const struct mg_coap_class_config *cfg);
+
+/* Whether the next message of @p cls goes as CON. */
+bool mg_coap_pacer_confirmable(const struct mg_coap_pacer *pacer,
+                               const struct mg_coap_class *cls, int64_t now);
+
+/* How long a NON message must wait for PROBING_RATE, or 0. */
+uint32_t mg_coap_pacer_wait_ms(const struct mg_coap_pacer *pacer,
+                               int64_t now);
+
+/* Records a message of @p len bytes sent at @p now. @p cls may be NULL for
+ * a message outside any class.
+ */
+void mg_coap_pacer_sent(struct mg_coap_pacer *pacer, struct mg_coap_class *cls,
+                        bool con, size_t len, int64_t now);
+
+/* Records the outcome of a CON message: -ETIMEDOUT when retransmissions
+ * ran out or the response never came. -ECANCELED only frees the slot;
+ * any other result is a response.
+ */
+void mg_coap_pacer_done(struct mg_coap_pacer *pacer, int result, int64_t now);
+
+#endif
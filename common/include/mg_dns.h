@@ -0,0 +1,62 @@
+#ifndef MG_DNS_H
+#define MG_DNS_H
+
+#include <stdint.h>
+
+#include "mg_platform.h"
+
+/* Defaults; ports may override them in mg_port.h. */
+#ifndef MG_DNS_CACHE_SIZE
+#define MG_DNS_CACHE_SIZE 4
+#endif
+
+/* How long a resolved address is used before it is looked up again. */
+#ifndef MG_DNS_TTL_MS
+#define MG_DNS_TTL_MS (300 * 1000)
+#endif
+
+/* How long past its TTL an address is still used while the resolver is
+ * unreachable.
+ */
+#ifndef MG_DNS_STALE_MS
+#define MG_DNS_STALE_MS (24 * 3600 * 1000)
+#endif
+
+#define MG_DNS_HOST_MAX 64
+
+struct mg_dns_stats {
+  /* mg_dns_resolve() calls, those served from the cache and those of them
+   * past the TTL.
+   */
+  uint32_t resolutions;
+  uint32_t hits;
+  uint32_t stale;
+  /* Resolver queries made, in the foreground or background, and failed. */
+  uint32_t lookups;
+  uint32_t failures;
+};
+
+extern struct mg_dns_stats mg_dns_stats;
+
+/* Resolver cache shared by every transport, keyed by host name and address
+ * family. An address is reused for MG_DNS_TTL_MS; after that it is looked
+ * up again in the background, where the port can run one, and the old
+ * address is served meanwhile. If the lookup fails the old address keeps
+ * being served for up to MG_DNS_STALE_MS, so an unreachable DNS server
+ * does not hold up reconnecting to a broker whose address has not changed.
+ */
+
+/* Fills the address of @p addr for @p host; the caller sets the port.
+ * Returns 0, or a negative errno if there is no usable address.
+ */
+int mg_dns_resolve(sa_family_t family, const char *host, int type,
+                   struct sockaddr *addr, socklen_t addr_len);
+
+/* Marks the addresses cached for @p host as past their TTL, e.g. after
+ * connecting to one failed. The next resolution looks the host up in the
+ * foreground instead of serving the old address during a background
+ * refresh, and only falls back to it if the lookup fails.
+ */
+void mg_dns_expire(const char *host);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef MG_HTTP_CONN_H
+#define MG_HTTP_CONN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* One persistent HTTP/1.1 connection to a server, for clients that POST
+ * telemetry one request at a time. The connection is opened lazily by the
+ * first request and kept open while the server allows it, so later POSTs
+ * skip the TCP handshake.
+ *
+ * A server may close an idle connection at any time. Before a request goes
+ * out on a connection that was used before, it is polled without waiting:
+ * if it is readable or hung up, the server has closed it, and a new one is
+ * opened. A connection idle for idle_ms is not trusted either. The server
+ * can still close it while the request is on its way; a request that fails
+ * on a reused connection before any response arrived may be sent once more,
+ * on a new connection (mg_http_conn_failed()).
+ *
+ * Times are passed in by the caller.
+ */
+struct mg_http_conn_stats {
+  /* Connections opened and requests sent on an already open one. */
+  uint32_t connects;
+  uint32_t reuses;
+  /* Open connections found closed by the server, or idle too long, before
+   * a request, and requests sent again after a reused connection failed.
+   */
+  uint32_t stale;
+  uint32_t retries;
+};
+
+struct mg_http_conn {
+  const char *host;
+  int port;
+  /* Longest idle time a connection is reused after; 0 for no limit. */
+  uint32_t idle_ms;
+  int sock;
+  /* Whether the current request went out on a connection used before. */
+  bool reused;
+  /* Requests sent and awaiting their response. Pipelined requests go out
+   * on the connection without the check for the server closing it, which
+   * would take the responses on their way for that.
+   */
+  uint32_t pending;
+  int64_t last_used;
+  struct mg_http_conn_stats stats;
+};
+
+/* @p host must outlive @p conn. */
+void mg_http_conn_init(struct mg_http_conn *conn, const char *host, int port,
+                       uint32_t idle_ms);
+
+/* Returns the socket to send the next request on, opening a connection if
+ * there is none or the open one can no longer be used, or a negative errno.
+ * Every request acquired is ended with mg_http_conn_release() or
+ * mg_http_conn_failed(); several may be outstanding, pipelined.
+ */
+int mg_http_conn_acquire(struct mg_http_conn *conn, int64_t now);
+
+/* Ends the oldest request, which got its whole response at @p now. The
+ * connection is kept for the next request if @p keep_alive, as the
+ * response allows (see mg_http_response_keep_alive()), and closed
+ * otherwise, with any requests pipelined behind it.
+ */
+void mg_http_conn_release(struct mg_http_conn *conn, bool keep_alive,
+                          int64_t now);
+
+/* Ends a request that failed before any of its response arrived, and closes
+ * the connection. Returns true if the request went out on a reused
+ * connection and may be sent once more; the next mg_http_conn_acquire()
+ * opens a new connection, so a request is never retried twice.
+ */
+bool mg_http_conn_failed(struct mg_http_conn *conn);
+
+void mg_http_conn_close(struct mg_http_conn *conn);
+
+/* Whether the response head @p head (status line and headers, @p len
+ * bytes) lets the connection be kept: HTTP/1.1 unless it says
+ * "Connection: close", HTTP/1.0 only if it says "Connection: keep-alive".
+ */
+bool mg_http_response_keep_alive(const char *head, size_t len);
+
+/* Finds header @p name (lower case) in the head @p head of @p len bytes,
+ * matching names case-insensitively. Returns its value with the
+ * surrounding blanks trimmed and sets *value_len, or returns NULL.
+ */
+const char *mg_http_header(const char *head, size_t len, const char *name,
+                           size_t *value_len);
+
+#endif
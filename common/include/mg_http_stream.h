@@ -0,0 +1,100 @@
+#ifndef MG_HTTP_STREAM_H
+#define MG_HTTP_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mg_telemetry.h"
+
+/* Streaming HTTP/1.1 uploads, for draining a telemetry backlog over a
+ * kept-alive connection (mg_http_conn.h): a request body sent as
+ * Transfer-Encoding: chunked as it is produced, and a response reader that
+ * keeps what follows a response, so several requests can be pipelined and
+ * their responses read back in order.
+ */
+
+/* Room a chunk needs around it in the buffer handed to
+ * mg_http_send_chunked(): its size line in front, CRLF behind. Chunks are
+ * at most 0xffff bytes.
+ */
+#define MG_HTTP_CHUNK_HEAD 6
+#define MG_HTTP_CHUNK_TAIL 2
+
+/* Produces the next piece of a streamed body into @p buf. Returns the bytes
+ * written, at most @p len and possibly fewer, 0 at the end of the body, or
+ * a negative errno.
+ */
+typedef int (*mg_http_body_fn)(uint8_t *buf, size_t len, void *user);
+
+/* Sends the body pulled from @p produce as chunks of up to @p len bytes
+ * less the head and tail room, then the last chunk. Each chunk is produced
+ * in place in @p buf with its size line and CRLF around it, so it goes out
+ * in one send without a copy. Returns the body bytes sent or a negative
+ * errno.
+ */
+int mg_http_send_chunked(int sock, mg_http_body_fn produce, void *user,
+                         uint8_t *buf, size_t len);
+
+/* Reads responses from a connection one at a time. The head of a response
+ * has to fit in buf; bodies are skipped, whatever their length. Bytes read
+ * past a response are the start of the next pipelined one and are kept.
+ */
+struct mg_http_reader {
+  uint8_t *buf;
+  size_t len;
+  size_t fill;
+  /* Bytes of the current response received so far. While 0, the request
+   * may not have reached the server, so it is safe to send again.
+   */
+  size_t received;
+};
+
+void mg_http_reader_init(struct mg_http_reader *r, uint8_t *buf, size_t len);
+
+/* Forgets what was read ahead, for a new connection. */
+void mg_http_reader_reset(struct mg_http_reader *r);
+
+/* Reads the next response, waiting up to @p timeout_ms for each piece, and
+ * skips interim 1xx responses. Returns its status code and sets
+ * @p keep_alive as mg_http_response_keep_alive() does. Returns -EMSGSIZE if
+ * the head does not fit, -EPROTO if it is malformed or has a chunked body,
+ * -ECONNRESET if the server closed the connection, or a negative errno from
+ * the socket.
+ */
+int mg_http_read_response(struct mg_http_reader *r, int sock, int timeout_ms,
+                          bool *keep_alive);
+
+/* A body producer for mg_http_send_chunked() that encodes readings as one
+ * SenML-CBOR pack while pulling them from @p next, which returns 1 and
+ * fills in the next reading, 0 when there are no more, or a negative
+ * errno. The pack is an indefinite-length array of every reading's
+ * records, each reading with its own base time, so it is never held whole
+ * and the count need not be known up front. Base times are given as for a
+ * pack sent at the @p now passed to mg_http_senml_body_init().
+ */
+struct mg_http_senml_body {
+  int (*next)(sensor_data_t *data, int64_t *timestamp, void *user);
+  void *user;
+  /* Readings encoded so far. */
+  size_t count;
+  /* A reading pulled that did not fit in the last chunk. */
+  bool pending;
+  /* Array head written, next() returned 0 and the break written. */
+  bool started;
+  bool ended;
+  bool done;
+  sensor_data_t data;
+  int64_t timestamp;
+  int64_t now;
+};
+
+void mg_http_senml_body_init(struct mg_http_senml_body *body,
+                             int (*next)(sensor_data_t *data,
+                                         int64_t *timestamp, void *user),
+                             void *user, int64_t now);
+
+/* An mg_http_body_fn; @p user is the struct mg_http_senml_body. */
+int mg_http_senml_body_produce(uint8_t *buf, size_t len, void *user);
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef MG_INFLIGHT_H
+#define MG_INFLIGHT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest window: free entries are tracked in one 64-bit bitmap. */
+#define MG_INFLIGHT_MAX 64
+
+/* Window of outstanding MQTT QoS 1 and 2 publishes, so the next message can
+ * be sent without waiting for the previous one to be acknowledged. Each
+ * entry tracks where its handshake stands and when to retransmit; the
+ * caller owns the message buffers and does the actual sending.
+ *
+ * The window also allocates the message IDs, per connection and without
+ * randomness: entry i hands out i + 1, then i + 1 + capacity and so on, so
+ * an ID can never collide with one still in flight and an acknowledgement
+ * finds its entry by index. Since every entry uses the same retransmit
+ * interval, entries are kept in a list ordered by deadline, and adding,
+ * acknowledging and finding the next expired entry are all O(1).
+ */
+enum mg_inflight_state {
+  MG_INFLIGHT_FREE,
+  /* QoS 1 PUBLISH sent. */
+  MG_INFLIGHT_WAIT_PUBACK,
+  /* QoS 2 PUBLISH sent. */
+  MG_INFLIGHT_WAIT_PUBREC,
+  /* QoS 2 PUBREL sent. */
+  MG_INFLIGHT_WAIT_PUBCOMP,
+};
+
+enum mg_inflight_ack {
+  MG_INFLIGHT_PUBACK,
+  MG_INFLIGHT_PUBREC,
+  MG_INFLIGHT_PUBCOMP,
+};
+
+struct mg_inflight_msg {
+  uint16_t id;
+  uint8_t state;
+  /* Retransmissions so far of the packet now awaiting acknowledgement. */
+  uint8_t retries;
+  /* Neighbours in the deadline list, as entry indices. */
+  uint8_t prev;
+  uint8_t next;
+  int64_t deadline;
+  /* Set by the caller: the payload to retransmit. */
+  const void *payload;
+  size_t len;
+};
+
+struct mg_inflight {
+  struct mg_inflight_msg *msgs;
+  size_t capacity;
+  size_t count;
+  int64_t retry_ms;
+  /* Bit i set while entry i is free. */
+  uint64_t free;
+  /* Deadline list, earliest first. */
+  uint8_t head;
+  uint8_t tail;
+};
+
+/* @p storage holds @p capacity entries, at most MG_INFLIGHT_MAX, and sets
+ * the window size. Unacknowledged packets are retransmitted every
+ * @p retry_ms milliseconds. Call again on every new connection.
+ */
+void mg_inflight_init(struct mg_inflight *win, struct mg_inflight_msg *storage,
+                      size_t capacity, int64_t retry_ms);
+
+static inline bool mg_inflight_full(const struct mg_inflight *win) {
+  return win->count >= win->capacity;
+}
+
+static inline size_t mg_inflight_room(const struct mg_inflight *win) {
+  return win->capacity - win->count;
+}
+
+/* Allocates a message ID for a QoS 1 or 2 PUBLISH sent at @p now and
+ * starts tracking it. Returns the entry, with the ID in msg->id, or NULL
+ * if the window is full.
+ */
+struct mg_inflight_msg *mg_inflight_add(struct mg_inflight *win, int qos,
+                                        int64_t now);
+
+struct mg_inflight_msg *mg_inflight_find(struct mg_inflight *win, uint16_t id);
+
+/* Frees an entry and its message ID, e.g. when sending the PUBLISH failed
+ * or a blocking caller got its acknowledgement.
+ */
+void mg_inflight_release(struct mg_inflight *win, struct mg_inflight_msg *msg);
+
+/* Applies an acknowledgement received at @p now. PUBACK and PUBCOMP free
+ * the entry; PUBREC moves it on to waiting for PUBCOMP, and the caller
+ * sends the PUBREL. Returns the entry, still readable until the next
+ * mg_inflight_add(), or NULL if no message is waiting for this ack.
+ */
+struct mg_inflight_msg *mg_inflight_ack(struct mg_inflight *win,
+                                        enum mg_inflight_ack ack, uint16_t id,
+                                        int64_t now);
+
+/* Returns an entry whose retransmit time has passed at @p now, with its
+ * retry count bumped and timer restarted, or NULL. The caller resends the
+ * PUBLISH with DUP set, or the PUBREL once waiting for PUBCOMP.
+ */
+struct mg_inflight_msg *mg_inflight_expired(struct mg_inflight *win,
+                                            int64_t now);
+
+/* Earliest retransmit time, or INT64_MAX with nothing in flight. */
+int64_t mg_inflight_next_deadline(const struct mg_inflight *win);
+
+/* Frees every entry. Message IDs carry on where they were. */
+void mg_inflight_reset(struct mg_inflight *win);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef MG_NET_H
+#define MG_NET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mg_platform.h"
+
+/* Byte and call counters for everything sent or received through
+ * mg_net_send() and mg_net_recv(), so bytes on the wire per message can be
+ * measured the same way on every target.
+ */
+struct mg_net_stats {
+  uint64_t tx_bytes;
+  uint64_t rx_bytes;
+  uint32_t tx_calls;
+  uint32_t rx_calls;
+};
+
+extern struct mg_net_stats mg_net_stats;
+
+/* Fills @p addr for @p server (a literal address, or a host name where the
+ * port has a resolver, through the mg_dns.h cache) and opens a socket of
+ * @p type for it.
+ */
+int mg_net_setup_socket(sa_family_t family, const char *server, int port,
+                        int type, int *sock, struct sockaddr *addr,
+                        socklen_t addr_len);
+
+/* As mg_net_setup_socket(), then connects. On failure the socket is closed
+ * and *sock is set to -1.
+ */
+int mg_net_connect_socket(sa_family_t family, const char *server, int port,
+                          int type, int *sock, struct sockaddr *addr,
+                          socklen_t addr_len);
+
+/* Sends all of @p buf. Returns @p len or a negative errno. */
+ssize_t mg_net_send(int sock, const void *buf, size_t len);
+
+/* Waits up to @p timeout_ms for data and receives at most @p len bytes.
+ * Returns the byte count, 0 on orderly shutdown, -ETIMEDOUT or -errno.
+ */
+ssize_t mg_net_recv(int sock, void *buf, size_t len, int timeout_ms);
+
+/* Receives exactly @p len bytes. Returns 0 or a negative errno. */
+int mg_net_recv_all(int sock, void *buf, size_t len, int timeout_ms);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef MG_PLATFORM_H
+#define MG_PLATFORM_H
+
+#include <stdint.h>
+
+/* Platform abstraction layer for the common telemetry code.
+ *
+ * Every port provides mg_port.h on the include path, which maps the socket
+ * calls (mg_sock_*), the log macros (MG_LOG_*) and the log module
+ * declarations onto the native APIs, and implements the functions below.
+ */
+#include "mg_port.h"
+
+/* Monotonic time since boot. */
+int64_t mg_uptime_ms(void);
+uint64_t mg_uptime_us(void);
+
+/* Wall-clock (Unix) time at boot in milliseconds, so uptime t was Unix time
+ * mg_boot_epoch_ms() + t. Returns 0 while the port does not know the time
+ * of day; once known, it only changes if the clock is set again.
+ */
+int64_t mg_boot_epoch_ms(void);
+
+/* Non-cryptographic random numbers for tokens, IDs and jitter. */
+uint32_t mg_rand32(void);
+
+void mg_sleep_ms(uint32_t ms);
+
+/* Runs @p fn(@p arg) off the calling thread, for work that may block for
+ * seconds such as a DNS lookup. Returns -ENOTSUP where the port has no
+ * thread to run it on, or another negative errno.
+ */
+int mg_run_background(void (*fn)(void *), void *arg);
+
+#endif
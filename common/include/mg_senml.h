@@ -0,0 +1,39 @@
+#ifndef MG_SENML_H
+#define MG_SENML_H
+
+#include <stdint.h>
+
+/* SenML (RFC 8428) media types. */
+#define MG_SENML_JSON_CONTENT_TYPE "application/senml+json"
+#define MG_SENML_CBOR_CONTENT_TYPE "application/senml+cbor"
+#define MG_SENML_JSON_CONTENT_FORMAT 110
+#define MG_SENML_CBOR_CONTENT_FORMAT 112
+
+/* CBOR map labels, RFC 8428 section 6, table 6. */
+enum mg_senml_label {
+  MG_SENML_BASE_VERSION = -1,
+  MG_SENML_BASE_NAME = -2,
+  MG_SENML_BASE_TIME = -3,
+  MG_SENML_BASE_UNIT = -4,
+  MG_SENML_BASE_VALUE = -5,
+  MG_SENML_BASE_SUM = -6,
+  MG_SENML_NAME = 0,
+  MG_SENML_UNIT = 1,
+  MG_SENML_VALUE = 2,
+  MG_SENML_STRING_VALUE = 3,
+  MG_SENML_BOOL_VALUE = 4,
+  MG_SENML_SUM = 5,
+  MG_SENML_TIME = 6,
+  MG_SENML_UPDATE_TIME = 7,
+  MG_SENML_DATA_VALUE = 8,
+};
+
+/* SenML time in seconds of uptime @p timestamp (milliseconds) in a pack sent
+ * at uptime @p now. Where the port knows the time of day it is absolute Unix
+ * time. Otherwise it is negative, relative to when the pack is received, as
+ * RFC 8428 section 4.5.3 reads values below 2^28; uptime itself would be
+ * taken for a date in 1970.
+ */
+double mg_senml_time(int64_t timestamp, int64_t now);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef MG_STORE_H
+#define MG_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Store-and-forward queue for messages that could not be sent while the
+ * connection was down. Entries are opaque payloads kept in FIFO order; when
+ * the store is full the oldest entries are dropped to make room, so append
+ * never blocks and never fails for lack of space. The Zephyr port keeps
+ * them in a Flash Circular Buffer on the storage partition, which survives
+ * a reboot; the POSIX port in a fixed RAM ring. Neither is thread safe.
+ */
+struct mg_store_stats {
+  /* Entries waiting to be replayed. */
+  uint32_t depth;
+  uint32_t appended;
+  uint32_t replayed;
+  /* Entries discarded unsent, oldest first, to make room. */
+  uint32_t dropped;
+};
+
+extern struct mg_store_stats mg_store_stats;
+
+/* Called by mg_store_drain() for each queued entry. Returns 0 once the
+ * entry is handed to the transport, or a negative errno to stop draining.
+ */
+typedef int (*mg_store_send_fn)(const uint8_t *data, size_t len, void *user);
+
+/* Opens the store and counts the entries left from before a restart. */
+int mg_store_init(void);
+
+/* Queues @p data, dropping the oldest entries if it does not fit. Returns
+ * 0, -E2BIG if the entry can never fit, or a negative errno from the
+ * backing store.
+ */
+int mg_store_append(const void *data, size_t len);
+
+/* Copies the oldest entry into @p buf without removing it. Returns its
+ * length, -ENODATA if the store is empty or -E2BIG if @p len is too small.
+ */
+int mg_store_peek(void *buf, size_t len);
+
+/* Removes the entry returned by the last mg_store_peek(). */
+void mg_store_pop(void);
+
+/* Replays up to @p max queued entries through @p send, using @p buf as
+ * scratch for one entry. Entries are removed once sent; one that does not
+ * fit @p buf is dropped. Returns the number replayed, or the first error
+ * from @p send, in which case the entry stays queued.
+ */
+int mg_store_drain(mg_store_send_fn send, void *user, uint8_t *buf, size_t len,
+                   size_t max);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef MG_TELEMETRY_H
+#define MG_TELEMETRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  double temperature;
+  double humidity;
+  int battery_level;
+  bool led_state;
+} sensor_data_t;
+
+/* Encodes one reading as the JSON object the targets have always sent.
+ * Returns the encoded length, or -E2BIG if @p len is too small.
+ */
+int mg_telemetry_json_encode(const sensor_data_t *data, int64_t timestamp,
+                             char *buf, size_t len);
+
+/* Encodes one reading as a SenML-JSON pack (application/senml+json) with
+ * the records and base time of mg_telemetry_senml_cbor_encode(). Returns
+ * the encoded length, or -E2BIG if @p len is too small.
+ */
+int mg_telemetry_senml_json_encode(const sensor_data_t *data,
+                                   int64_t timestamp, int64_t now, char *buf,
+                                   size_t len);
+
+/* Encodes one reading as a SenML-CBOR pack (Content-Format 112), one record
+ * per field with the base time in the first. @p timestamp is in
+ * milliseconds, as for the JSON encoder, and @p now is when the pack is
+ * sent, which the base time is relative to where the port does not know the
+ * time of day (mg_senml_time()). Writes straight into @p buf, so it can
+ * point into a transport's transmit buffer. Returns the encoded length, or
+ * -E2BIG if @p len is too small.
+ */
+int mg_telemetry_senml_cbor_encode(const sensor_data_t *data,
+                                   int64_t timestamp, int64_t now,
+                                   uint8_t *buf, size_t len);
+
+#endif
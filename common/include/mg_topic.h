@@ -0,0 +1,22 @@
+#ifndef MG_TOPIC_H
+#define MG_TOPIC_H
+
+#include <stddef.h>
+
+/* Compile-time variants for targets whose IDs are string literal macros.
+ * They expand to string literals, so the length is a constant as well.
+ */
+#define MG_TOPIC(domain_id, channel_id) "m/" domain_id "/c/" channel_id
+#define MG_LEGACY_TOPIC(channel_id) "channels/" channel_id "/messages"
+#define MG_STRLEN(literal) (sizeof(literal) - 1)
+
+/* Writes the Magistrala message topic m/{domain_id}/c/{channel_id} into
+ * @p buf. Returns the topic length, or -ENOMEM if it does not fit.
+ */
+int mg_topic_format(char *buf, size_t len, const char *domain_id,
+                    const char *channel_id);
+
+/* Writes the legacy Mainflux topic channels/{channel_id}/messages. */
+int mg_legacy_topic_format(char *buf, size_t len, const char *channel_id);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef MG_WS_H
+#define MG_WS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Client-to-server WebSocket frames (RFC 6455), built in place. The payload
+ * is encoded MG_WS_HEADROOM bytes into the transmit buffer; once its length
+ * is known, the header and masking key are written right in front of it and
+ * the payload is masked where it lies, so the frame goes out in one send
+ * without copying the payload.
+ */
+
+/* Largest client frame header: 2 bytes, a 64-bit length and the key. */
+#define MG_WS_HEADROOM 14
+
+#define MG_WS_OPCODE_CONTINUATION 0x0
+#define MG_WS_OPCODE_TEXT 0x1
+#define MG_WS_OPCODE_BINARY 0x2
+#define MG_WS_OPCODE_CLOSE 0x8
+#define MG_WS_OPCODE_PING 0x9
+#define MG_WS_OPCODE_PONG 0xa
+
+/* Control frames carry at most this much payload. */
+#define MG_WS_MAX_CONTROL_LEN 125
+
+/* XORs @p len bytes of @p data with @p key; applied twice, it unmasks. */
+void mg_ws_mask(uint8_t *data, size_t len, const uint8_t key[4]);
+
+/* Writes the header of a final frame of @p opcode in front of the @p len
+ * payload bytes at @p payload, which has MG_WS_HEADROOM bytes before it,
+ * and masks the payload with @p mask. Returns where the frame starts and
+ * sets *frame_len.
+ */
+uint8_t *mg_ws_frame(uint8_t *payload, size_t len, uint8_t opcode,
+                     uint32_t mask, size_t *frame_len);
+
+/* Frames the payload as mg_ws_frame() does, with a random key, and sends
+ * it. The payload is left masked. Returns 0 or a negative errno.
+ */
+int mg_ws_send(int sock, uint8_t opcode, uint8_t *payload, size_t len);
+
+/* Ping/pong liveness of an open connection. A ping goes out after
+ * interval_ms without a frame from the server, and the connection is given
+ * up if no frame at all arrives within timeout_ms of it. The pings also keep
+ * NAT and proxy mappings open on a connection that only carries telemetry
+ * upstream.
+ *
+ * Times are passed in by the caller.
+ */
+struct mg_ws_keepalive {
+  uint32_t interval_ms;
+  uint32_t timeout_ms;
+  int64_t last_rx;
+  /* When the outstanding ping went out, or -1. */
+  int64_t ping_sent;
+  uint32_t pings;
+  uint32_t pongs;
+  /* Round trip of the last ping answered. */
+  uint32_t rtt_ms;
+};
+
+/* A connection opened at @p now. An @p interval_ms of 0 never pings. */
+void mg_ws_keepalive_init(struct mg_ws_keepalive *ka, uint32_t interval_ms,
+                          uint32_t timeout_ms, int64_t now);
+
+/* Records a frame of @p opcode received at @p now. */
+void mg_ws_keepalive_rx(struct mg_ws_keepalive *ka, uint8_t opcode,
+                        int64_t now);
+
+/* Returns 1 if a ping is due at @p now, which is then counted as sent,
+ * -ETIMEDOUT if the server stopped answering, or 0.
+ */
+int mg_ws_keepalive_check(struct mg_ws_keepalive *ka, int64_t now);
+
+/* When mg_ws_keepalive_check() next has something to do, or INT64_MAX. */
+int64_t mg_ws_keepalive_deadline(const struct mg_ws_keepalive *ka);
+
+#endif
@@ -0,0 +1,72 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "mg_platform.h"
+
+int64_t mg_uptime_ms(void) { return esp_timer_get_time() / 1000; }
+
+uint64_t mg_uptime_us(void) { return esp_timer_get_time(); }
+
+/* The clock starts at 1970 and is only right once SNTP (or the application)
+ * has set it, so anything before 2020 counts as unknown.
+ */
+#define EPOCH_VALID_SEC 1577836800
+
+int64_t mg_boot_epoch_ms(void) {
+  static int64_t boot_epoch;
+  struct timeval tv;
+
+  if (boot_epoch == 0) {
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec >= EPOCH_VALID_SEC) {
+      boot_epoch = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 -
+                   mg_uptime_ms();
+    }
+  }
+
+  return boot_epoch;
+}
+
+uint32_t mg_rand32(void) { return esp_random(); }
+
+void mg_sleep_ms(uint32_t ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+
+#define BACKGROUND_STACK_SIZE 4096
+
+struct background_call {
+  void (*fn)(void *);
+  void *arg;
+};
+
+static void background_task(void *arg) {
+  struct background_call call = *(struct background_call *)arg;
+
+  free(arg);
+  call.fn(call.arg);
+  vTaskDelete(NULL);
+}
+
+int mg_run_background(void (*fn)(void *), void *arg) {
+  struct background_call *call = malloc(sizeof(*call));
+
+  if (call == NULL) {
+    return -ENOMEM;
+  }
+
+  call->fn = fn;
+  call->arg = arg;
+
+  if (xTaskCreate(background_task, "mg_bg", BACKGROUND_STACK_SIZE, call,
+                  tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+    free(call);
+    return -ENOMEM;
+  }
+
+  return 0;
+}
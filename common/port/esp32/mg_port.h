@@ -0,0 +1,38 @@
+#ifndef MG_PORT_H
+#define MG_PORT_H
+
+#include "esp_log.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include <sys/poll.h>
+
+/* ESP-IDF port: lwIP BSD sockets and esp_log. */
+
+#define mg_sock_socket socket
+#define mg_sock_connect connect
+#define mg_sock_close close
+#define mg_sock_send send
+#define mg_sock_recv recv
+#define mg_sock_poll poll
+#define mg_sock_inet_pton inet_pton
+#define mg_sock_getaddrinfo getaddrinfo
+#define mg_sock_freeaddrinfo freeaddrinfo
+#define mg_pollfd pollfd
+#define mg_addrinfo addrinfo
+#define MG_POLLIN POLLIN
+#define MG_POLLOUT POLLOUT
+#define MG_POLLERR POLLERR
+#define MG_POLLHUP POLLHUP
+#define MG_SEND_FLAGS 0
+#define MG_HAVE_GETADDRINFO 1
+
+#define MG_LOG_MODULE_REGISTER(name)                                           \
+  static const char *const mg_log_tag = #name
+#define MG_LOG_MODULE_DECLARE(name) MG_LOG_MODULE_REGISTER(name)
+
+#define MG_LOG_ERR(...) ESP_LOGE(mg_log_tag, __VA_ARGS__)
+#define MG_LOG_WRN(...) ESP_LOGW(mg_log_tag, __VA_ARGS__)
+#define MG_LOG_INF(...) ESP_LOGI(mg_log_tag, __VA_ARGS__)
+#define MG_LOG_DBG(...) ESP_LOGD(mg_log_tag, __VA_ARGS__)
+
+#endif
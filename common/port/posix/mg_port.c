@@ -0,0 +1,91 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mg_platform.h"
+
+int mg_log_level = MG_LOG_LEVEL_INF;
+
+int64_t mg_uptime_ms(void) { return mg_uptime_us() / 1000; }
+
+uint64_t mg_uptime_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+/* Taken once, so every pack encoded against it gets the same times. */
+int64_t mg_boot_epoch_ms(void) {
+  static int64_t boot_epoch;
+  struct timespec ts;
+
+  if (boot_epoch == 0) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    boot_epoch = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 -
+                 mg_uptime_ms();
+  }
+
+  return boot_epoch;
+}
+
+uint32_t mg_rand32(void) {
+  static int seeded;
+
+  if (!seeded) {
+    srandom(time(NULL) ^ getpid());
+    seeded = 1;
+  }
+
+  return ((uint32_t)random() << 16) ^ (uint32_t)random();
+}
+
+void mg_sleep_ms(uint32_t ms) {
+  struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L};
+
+  while (nanosleep(&ts, &ts) != 0) {
+  }
+}
+
+struct background_call {
+  void (*fn)(void *);
+  void *arg;
+};
+
+static void *background_main(void *arg) {
+  struct background_call call = *(struct background_call *)arg;
+
+  free(arg);
+  call.fn(call.arg);
+
+  return NULL;
+}
+
+int mg_run_background(void (*fn)(void *), void *arg) {
+  struct background_call *call = malloc(sizeof(*call));
+  pthread_attr_t attr;
+  pthread_t thread;
+  int ret;
+
+  if (call == NULL) {
+    return -ENOMEM;
+  }
+
+  call->fn = fn;
+  call->arg = arg;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  ret = pthread_create(&thread, &attr, background_main, call);
+  pthread_attr_destroy(&attr);
+
+  if (ret != 0) {
+    free(call);
+    return -ret;
+  }
+
+  return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef MG_PORT_H
+#define MG_PORT_H
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* POSIX port, used by the Linux host target. */
+
+#define mg_sock_socket socket
+#define mg_sock_connect connect
+#define mg_sock_close close
+#define mg_sock_send send
+#define mg_sock_recv recv
+#define mg_sock_poll poll
+#define mg_sock_inet_pton inet_pton
+#define mg_sock_getaddrinfo getaddrinfo
+#define mg_sock_freeaddrinfo freeaddrinfo
+#define mg_pollfd pollfd
+#define mg_addrinfo addrinfo
+#define MG_POLLIN POLLIN
+#define MG_POLLOUT POLLOUT
+#define MG_POLLERR POLLERR
+#define MG_POLLHUP POLLHUP
+#define MG_SEND_FLAGS MSG_NOSIGNAL
+#define MG_HAVE_GETADDRINFO 1
+
+enum mg_log_level {
+  MG_LOG_LEVEL_ERR = 1,
+  MG_LOG_LEVEL_WRN,
+  MG_LOG_LEVEL_INF,
+  MG_LOG_LEVEL_DBG,
+};
+
+extern int mg_log_level;
+
+#define MG_LOG_MODULE_REGISTER(name)
+#define MG_LOG_MODULE_DECLARE(name)
+
+#define MG_LOG_AT(level, tag, fmt, ...)                                        \
+  do {                                                                         \
+    if (mg_log_level >= (level)) {                                             \
+      fprintf(stderr, "<" tag "> " fmt "\n", ##__VA_ARGS__);                   \
+    }                                                                          \
+  } while (0)
+
+#define MG_LOG_ERR(fmt, ...)                                                   \
+  MG_LOG_AT(MG_LOG_LEVEL_ERR, "err", fmt, ##__VA_ARGS__)
+#define MG_LOG_WRN(fmt, ...)                                                   \
+  MG_LOG_AT(MG_LOG_LEVEL_WRN, "wrn", fmt, ##__VA_ARGS__)
+#define MG_LOG_INF(fmt, ...)                                                   \
+  MG_LOG_AT(MG_LOG_LEVEL_INF, "inf", fmt, ##__VA_ARGS__)
+#define MG_LOG_DBG(fmt, ...)                                                   \
+  MG_LOG_AT(MG_LOG_LEVEL_DBG, "dbg", fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,100 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mg_store.h"
+
+/* RAM ring standing in for flash on the host: each entry is a 16-bit
+ * length followed by the payload, wrapping at the end of the buffer.
+ */
+#define STORE_SIZE (64 * 1024)
+#define ENTRY_HEADER 2
+
+static uint8_t ring[STORE_SIZE];
+static size_t head;
+static size_t used;
+static size_t peeked;
+
+static void ring_read(size_t pos, void *buf, size_t len) {
+  size_t first = len < STORE_SIZE - pos ? len : STORE_SIZE - pos;
+
+  memcpy(buf, ring + pos, first);
+  memcpy((uint8_t *)buf + first, ring, len - first);
+}
+
+static void ring_write(size_t pos, const void *buf, size_t len) {
+  size_t first = len < STORE_SIZE - pos ? len : STORE_SIZE - pos;
+
+  memcpy(ring + pos, buf, first);
+  memcpy(ring, (const uint8_t *)buf + first, len - first);
+}
+
+static size_t entry_len(void) {
+  uint8_t hdr[ENTRY_HEADER];
+
+  ring_read(head, hdr, sizeof(hdr));
+
+  return ENTRY_HEADER + ((hdr[0] << 8) | hdr[1]);
+}
+
+static void remove_oldest(void) {
+  size_t len = entry_len();
+
+  head = (head + len) % STORE_SIZE;
+  used -= len;
+  peeked = 0;
+  mg_store_stats.depth--;
+}
+
+int mg_store_init(void) {
+  head = 0;
+  used = 0;
+  peeked = 0;
+  mg_store_stats.depth = 0;
+
+  return 0;
+}
+
+int mg_store_append(const void *data, size_t len) {
+  uint8_t hdr[ENTRY_HEADER] = {len >> 8, len & 0xFF};
+
+  if (len > UINT16_MAX || ENTRY_HEADER + len > STORE_SIZE) {
+    return -E2BIG;
+  }
+
+  while (STORE_SIZE - used < ENTRY_HEADER + len) {
+    remove_oldest();
+    mg_store_stats.dropped++;
+  }
+
+  ring_write((head + used) % STORE_SIZE, hdr, sizeof(hdr));
+  ring_write((head + used + ENTRY_HEADER) % STORE_SIZE, data, len);
+  used += ENTRY_HEADER + len;
+  mg_store_stats.depth++;
+  mg_store_stats.appended++;
+
+  return 0;
+}
+
+int mg_store_peek(void *buf, size_t len) {
+  size_t data_len;
+
+  if (used == 0) {
+    return -ENODATA;
+  }
+
+  peeked = entry_len();
+  data_len = peeked - ENTRY_HEADER;
+  if (data_len > len) {
+    return -E2BIG;
+  }
+
+  ring_read((head + ENTRY_HEADER) % STORE_SIZE, buf, data_len);
+
+  return data_len;
+}
+
+void mg_store_pop(void) {
+  if (peeked > 0) {
+    remove_oldest();
+  }
+}
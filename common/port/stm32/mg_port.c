@@ -0,0 +1,43 @@
+#include <errno.h>
+
+#include "cmsis_os.h"
+#include "stm32f4xx_hal.h"
+
+#include "mg_platform.h"
+
+int64_t mg_uptime_ms(void) { return HAL_GetTick(); }
+
+uint64_t mg_uptime_us(void) { return (uint64_t)HAL_GetTick() * 1000u; }
+
+/* The RTC is not set up, so the time of day is unknown. */
+int64_t mg_boot_epoch_ms(void) { return 0; }
+
+/* xorshift32 seeded from the device UID and the tick counter. Good enough for
+ * message IDs, tokens and jitter; not for key material.
+ */
+uint32_t mg_rand32(void) {
+  static uint32_t state;
+
+  if (state == 0) {
+    state = HAL_GetUIDw0() ^ HAL_GetUIDw1() ^ HAL_GetUIDw2() ^ HAL_GetTick();
+    if (state == 0) {
+      state = 0x9E3779B9u;
+    }
+  }
+
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+
+  return state;
+}
+
+void mg_sleep_ms(uint32_t ms) { osDelay(ms); }
+
+/* No thread set aside for it: callers do the work inline instead. */
+int mg_run_background(void (*fn)(void *), void *arg) {
+  (void)fn;
+  (void)arg;
+
+  return -ENOTSUP;
+}
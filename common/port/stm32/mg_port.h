@@ -0,0 +1,45 @@
+#ifndef MG_PORT_H
+#define MG_PORT_H
+
+#include <stdio.h>
+
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+
+/* STM32Cube port: lwIP sockets (LWIP_SOCKET and LWIP_SOCKET_POLL enabled),
+ * CMSIS-RTOS delays and printf logging.
+ */
+
+#define mg_sock_socket lwip_socket
+#define mg_sock_connect lwip_connect
+#define mg_sock_close lwip_close
+#define mg_sock_send lwip_send
+#define mg_sock_recv lwip_recv
+#define mg_sock_poll lwip_poll
+#define mg_sock_inet_pton lwip_inet_pton
+#define mg_sock_getaddrinfo lwip_getaddrinfo
+#define mg_sock_freeaddrinfo lwip_freeaddrinfo
+#define mg_pollfd pollfd
+#define mg_addrinfo addrinfo
+#define MG_POLLIN POLLIN
+#define MG_POLLOUT POLLOUT
+#define MG_POLLERR POLLERR
+#define MG_POLLHUP POLLHUP
+#define MG_SEND_FLAGS 0
+#define MG_HAVE_GETADDRINFO LWIP_DNS
+
+#define MG_LOG_MODULE_REGISTER(name)                                           \
+  static const char *const mg_log_tag = #name
+#define MG_LOG_MODULE_DECLARE(name) MG_LOG_MODULE_REGISTER(name)
+
+#define MG_LOG_AT(tag, fmt, ...)                                               \
+  printf("%s <" tag "> " fmt "\n", mg_log_tag, ##__VA_ARGS__)
+
+#define MG_LOG_ERR(fmt, ...) MG_LOG_AT("err", fmt, ##__VA_ARGS__)
+#define MG_LOG_WRN(fmt, ...) MG_LOG_AT("wrn", fmt, ##__VA_ARGS__)
+#define MG_LOG_INF(fmt, ...) MG_LOG_AT("inf", fmt, ##__VA_ARGS__)
+#define MG_LOG_DBG(fmt, ...)                                                   \
+  do {                                                                         \
+  } while (0)
+
+#endif
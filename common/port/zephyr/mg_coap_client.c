@@ -0,0 +1,576 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "mg_coap_client.h"
+#include "mg_platform.h"
+
+MG_LOG_MODULE_DECLARE(mg_common);
+
+#define MAX_PENDING CONFIG_MG_COAP_MAX_PENDING
+
+/* Block1 / Block2 option value: NUM, M and SZX (RFC 7959 section 2.2). */
+#define BLOCK_NUM(v) ((uint32_t)(v) >> 4)
+#define BLOCK_MORE(v) (((v) & 0x08) != 0)
+#define BLOCK_SZX(v) ((enum coap_block_size)((v) & 0x07))
+
+/* Block1 and Size1 options and the payload marker, at most. */
+#define BLOCK1_OVERHEAD 10
+
+static int request_index(const struct mg_coap_client *client,
+                         const struct coap_packet *request) {
+  for (size_t i = 0; i < MAX_PENDING; i++) {
+    if (request->data == client->requests[i].buf) {
+      return i;
+    }
+  }
+
+  return -EINVAL;
+}
+
+/* Only used to match: the request is completed once
+ * coap_response_received() has returned, so the done callback may start a
+ * new request in the same entry.
+ */
+static int reply_matched(const struct coap_packet *response,
+                         struct coap_reply *reply,
+                         const struct sockaddr *from) {
+  ARG_UNUSED(response);
+  ARG_UNUSED(reply);
+  ARG_UNUSED(from);
+
+  return 0;
+}
+
+static int send_packet(struct mg_coap_client *client, const uint8_t *data,
+                       size_t len) {
+  if (zsock_sendto(client->sock, data, len, 0,
+                   (struct sockaddr *)&client->peer, client->peer_len) < 0) {
+    return -errno;
+  }
+
+  return 0;
+}
+
+static void release(struct mg_coap_client *client, size_t i) {
+  coap_pending_clear(&client->pending[i]);
+  coap_reply_clear(&client->replies[i]);
+  client->requests[i].busy = false;
+}
+
+static void complete(struct mg_coap_client *client, size_t i, int result,
+                     const struct coap_packet *response) {
+  struct mg_coap_request *req = &client->requests[i];
+  mg_coap_done_t done = req->done;
+  void *user = req->user;
+
+  release(client, i);
+  mg_coap_pacer_done(&client->pacer, result, k_uptime_get());
+
+  if (result == 0) {
+    client->stats.completed++;
+  } else if (result == -ETIMEDOUT) {
+    client->stats.timeouts++;
+  } else if (result == -ECONNRESET) {
+    client->stats.resets++;
+  }
+
+  if (done != NULL) {
+    done(result, response, user);
+  }
+}
+
+void mg_coap_client_init(struct mg_coap_client *client, int sock,
+                         const struct sockaddr *peer, socklen_t peer_len) {
+  memset(client, 0, sizeof(*client));
+  client->sock = sock;
+  memcpy(&client->peer, peer, MIN(peer_len, sizeof(client->peer)));
+  client->peer_len = peer_len;
+  mg_coap_pacer_init(&client->pacer, CONFIG_MG_COAP_PROBING_RATE,
+                     k_uptime_get());
+}
+
+int mg_coap_client_init_request(struct mg_coap_client *client,
+                                struct coap_packet *request, uint8_t type,
+                                uint8_t method) {
+  for (size_t i = 0; i < MAX_PENDING; i++) {
+    struct mg_coap_request *req = &client->requests[i];
+    int ret;
+
+    if (req->busy) {
+      continue;
+    }
+
+    ret = coap_packet_init(request, req->buf, sizeof(req->buf),
+                           COAP_VERSION_1, type, COAP_TOKEN_MAX_LEN,
+                           coap_next_token(), method, coap_next_id());
+    if (ret < 0) {
+      return ret;
+    }
+
+    req->busy = true;
+    req->done = NULL;
+    req->user = NULL;
+    req->cls = NULL;
+    req->expires = INT64_MAX;
+
+    return 0;
+  }
+
+  return -EBUSY;
+}
+
+int mg_coap_client_init_class_request(struct mg_coap_client *client,
+                                      struct coap_packet *request,
+                                      struct mg_coap_class *cls,
+                                      uint8_t method) {
+  int64_t now = k_uptime_get();
+  bool con = mg_coap_pacer_confirmable(&client->pacer, cls, now);
+  int ret;
+
+  if (!con && mg_coap_pacer_wait_ms(&client->pacer, now) > 0) {
+    return -EAGAIN;
+  }
+
+  ret = mg_coap_client_init_request(
+      client, request, con ? COAP_TYPE_CON : COAP_TYPE_NON_CON, method);
+  if (ret == 0) {
+    client->requests[request_index(client, request)].cls = cls;
+  }
+
+  return ret;
+}
+
+int mg_coap_client_send(struct mg_coap_client *client,
+                        struct coap_packet *request, mg_coap_done_t done,
+                        void *user) {
+  int i = request_index(client, request);
+  struct mg_coap_request *req;
+  int ret;
+
+  if (i < 0) {
+    return i;
+  }
+
+  req = &client->requests[i];
+
+  if (coap_header_get_type(request) != COAP_TYPE_CON) {
+    ret = send_packet(client, request->data, request->offset);
+    if (ret == 0) {
+      client->stats.sent++;
+      mg_coap_pacer_sent(&client->pacer, req->cls, false, request->offset,
+                         k_uptime_get());
+    }
+    release(client, i);
+    return ret;
+  }
+
+  ret = coap_pending_init(&client->pending[i], request,
+                          (struct sockaddr *)&client->peer, NULL);
+  if (ret < 0) {
+    release(client, i);
+    return ret;
+  }
+
+  /* Sets the first, randomised, ACK timeout. */
+  coap_pending_cycle(&client->pending[i]);
+
+  coap_reply_init(&client->replies[i], request);
+  client->replies[i].reply = reply_matched;
+
+  req->done = done;
+  req->user = user;
+
+  ret = send_packet(client, request->data, request->offset);
+  if (ret < 0) {
+    release(client, i);
+    return ret;
+  }
+
+  client->stats.sent++;
+  mg_coap_pacer_sent(&client->pacer, req->cls, true, request->offset,
+                     k_uptime_get());
+
+  return 0;
+}
+
+void mg_coap_client_drop(struct mg_coap_client *client,
+                         struct coap_packet *request) {
+  int i = request_index(client, request);
+
+  if (i >= 0) {
+    release(client, i);
+  }
+}
+
+int64_t mg_coap_client_next_deadline(struct mg_coap_client *client) {
+  int64_t next = INT64_MAX;
+
+  for (size_t i = 0; i < MAX_PENDING; i++) {
+    const struct coap_pending *pending = &client->pending[i];
+    int64_t deadline;
+
+    if (!client->requests[i].busy) {
+      continue;
+    }
+
+    deadline = pending->data != NULL ? pending->t0 + pending->timeout
+                                     : client->requests[i].expires;
+    next = MIN(next, deadline);
+  }
+
+  return next;
+}
+
+static void send_empty_ack(struct mg_coap_client *client,
+                           const struct coap_packet *response) {
+  uint8_t buf[4];
+  struct coap_packet ack;
+
+  if (coap_packet_init(&ack, buf, sizeof(buf), COAP_VERSION_1,
+                       COAP_TYPE_ACK, 0, NULL, COAP_CODE_EMPTY,
+                       coap_header_get_id(response)) == 0) {
+    (void)send_packet(client, ack.data, ack.offset);
+  }
+}
+
+static void handle_datagram(struct mg_coap_client *client, size_t len,
+                            const struct sockaddr *from) {
+  struct coap_packet response;
+  struct coap_pending *pending;
+  struct coap_reply *reply;
+  uint8_t type;
+
+  if (coap_packet_parse(&response, client->rx_buf, len, NULL, 0) < 0) {
+    return;
+  }
+
+  type = coap_header_get_type(&response);
+
+  /* An ACK or Reset ends retransmission of the request with its message
+   * ID. An empty ACK leaves the response to come separately.
+   */
+  if (type == COAP_TYPE_ACK || type == COAP_TYPE_RESET) {
+    pending = coap_pending_received(&response, client->pending, MAX_PENDING);
+    if (pending != NULL) {
+      coap_pending_clear(pending);
+      client->requests[pending - client->pending].expires =
+          k_uptime_get() + CONFIG_MG_COAP_EXCHANGE_TIMEOUT_MS;
+    }
+  }
+
+  /* Acknowledge every separate response, even one for a request given up
+   * on, so the server stops retransmitting it.
+   */
+  if (type == COAP_TYPE_CON) {
+    send_empty_ack(client, &response);
+  }
+
+  reply = coap_response_received(&response, from, client->replies,
+                                 MAX_PENDING);
+  if (reply == NULL) {
+    return;
+  }
+
+  if (type == COAP_TYPE_RESET) {
+    MG_LOG_WRN("CoAP request reset by peer");
+    complete(client, reply - client->replies, -ECONNRESET, NULL);
+  } else {
+    complete(client, reply - client->replies, 0, &response);
+  }
+}
+
+static int handle_timeouts(struct mg_coap_client *client) {
+  int64_t now = k_uptime_get();
+
+  for (size_t i = 0; i < MAX_PENDING; i++) {
+    struct coap_pending *pending = &client->pending[i];
+    int ret;
+
+    if (!client->requests[i].busy) {
+      continue;
+    }
+
+    if (pending->data == NULL) {
+      if (now >= client->requests[i].expires) {
+        MG_LOG_WRN("CoAP separate response timeout");
+        complete(client, i, -ETIMEDOUT, NULL);
+      }
+      continue;
+    }
+
+    if (now < pending->t0 + pending->timeout) {
+      continue;
+    }
+
+    if (!coap_pending_cycle(pending)) {
+      MG_LOG_WRN("CoAP request %u not acknowledged", pending->id);
+      complete(client, i, -ETIMEDOUT, NULL);
+      continue;
+    }
+
+    ret = send_packet(client, pending->data, pending->len);
+    if (ret < 0) {
+      return ret;
+    }
+
+    client->stats.retransmits++;
+  }
+
+  return 0;
+}
+
+int mg_coap_client_process(struct mg_coap_client *client) {
+  for (;;) {
+    struct sockaddr_storage from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len;
+
+    len = zsock_recvfrom(client->sock, client->rx_buf, sizeof(client->rx_buf),
+                         ZSOCK_MSG_DONTWAIT, (struct sockaddr *)&from,
+                         &from_len);
+    if (len < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return -errno;
+    }
+
+    handle_datagram(client, len, (struct sockaddr *)&from);
+  }
+
+  return handle_timeouts(client);
+}
+
+static enum coap_block_size block_size_for(size_t bytes) {
+  enum coap_block_size size = COAP_BLOCK_16;
+
+  while (size < COAP_BLOCK_1024 &&
+         coap_block_size_to_bytes(size + 1) <= bytes) {
+    size++;
+  }
+
+  return size;
+}
+
+static void block_done(int result, const struct coap_packet *response,
+                       void *user);
+
+/* Appends Block1, Size1 on the first block, and the block's payload. The
+ * block size is lowered until a block fits the request buffer.
+ */
+static int append_upload_block(struct mg_coap_transfer *t,
+                               struct coap_packet *request) {
+  size_t room = request->max_len - request->offset;
+  int ret;
+
+  room = room > BLOCK1_OVERHEAD ? room - BLOCK1_OVERHEAD : 0;
+  while (coap_block_size_to_bytes(t->block.block_size) > room &&
+         t->block.block_size > COAP_BLOCK_16) {
+    t->block.block_size--;
+  }
+
+  t->block_len = MIN(coap_block_size_to_bytes(t->block.block_size),
+                     t->block.total_size - t->block.current);
+  if (t->block_len > room) {
+    return -E2BIG;
+  }
+
+  ret = coap_append_block1_option(request, &t->block);
+  if (ret == 0 && t->block.current == 0) {
+    ret = coap_append_size1_option(request, &t->block);
+  }
+  if (ret == 0) {
+    ret = coap_packet_append_payload_marker(request);
+  }
+  if (ret < 0) {
+    return ret;
+  }
+
+  ret = t->produce(t->block.current, request->data + request->offset,
+                   t->block_len, t->user);
+  if (ret < 0) {
+    return ret;
+  }
+  if ((size_t)ret != t->block_len) {
+    return -EIO;
+  }
+
+  request->offset += t->block_len;
+
+  return 0;
+}
+
+static int send_block(struct mg_coap_transfer *t) {
+  struct coap_packet request;
+  int ret;
+
+  ret = mg_coap_client_init_request(t->client, &request, COAP_TYPE_CON,
+                                    t->method);
+  if (ret < 0) {
+    return ret;
+  }
+
+  ret = t->options != NULL ? t->options(&request, t->user) : 0;
+  if (ret == 0) {
+    ret = t->produce != NULL ? append_upload_block(t, &request)
+                             : coap_append_block2_option(&request, &t->block);
+  }
+  if (ret < 0) {
+    mg_coap_client_drop(t->client, &request);
+    return ret;
+  }
+
+  return mg_coap_client_send(t->client, &request, block_done, t);
+}
+
+/* Returns 1 once @p response is the final one, 0 with the next block sent,
+ * or a negative errno.
+ */
+static int next_upload_block(struct mg_coap_transfer *t,
+                             const struct coap_packet *response) {
+  uint8_t code = coap_header_get_code(response);
+  int block1 = coap_get_option_int(response, COAP_OPTION_BLOCK1);
+
+  /* Rejected with the block size the server takes: start over with it. */
+  if (code == COAP_RESPONSE_CODE_REQUEST_TOO_LARGE && block1 >= 0 &&
+      t->block.current == 0 && BLOCK_SZX(block1) < t->block.block_size) {
+    t->block.block_size = BLOCK_SZX(block1);
+    return send_block(t);
+  }
+
+  if (code != COAP_RESPONSE_CODE_CONTINUE) {
+    return 1;
+  }
+
+  /* 2.31 Continue may ask for smaller blocks from here on. */
+  if (block1 >= 0 && BLOCK_SZX(block1) < t->block.block_size) {
+    t->block.block_size = BLOCK_SZX(block1);
+  }
+
+  t->block.current += t->block_len;
+  if (t->block.current >= t->block.total_size) {
+    return -EPROTO;
+  }
+
+  return send_block(t);
+}
+
+static int next_download_block(struct mg_coap_transfer *t,
+                               const struct coap_packet *response) {
+  int block2 = coap_get_option_int(response, COAP_OPTION_BLOCK2);
+  const uint8_t *payload;
+  uint16_t len;
+  size_t offset;
+  bool more;
+  int ret;
+
+  if (COAP_RESPONSE_CODE_CLASS(coap_header_get_code(response)) != 2) {
+    return 1;
+  }
+
+  payload = coap_packet_get_payload(response, &len);
+
+  /* The server sent the whole body at once. */
+  if (block2 < 0) {
+    ret = t->consume(0, payload, len, true, t->user);
+    return ret < 0 ? ret : 1;
+  }
+
+  offset = (size_t)BLOCK_NUM(block2) << (BLOCK_SZX(block2) + 4);
+  more = BLOCK_MORE(block2);
+  if (offset != t->block.current) {
+    return -EPROTO;
+  }
+
+  ret = t->consume(offset, payload, len, !more, t->user);
+  if (ret < 0) {
+    return ret;
+  }
+  if (!more) {
+    return 1;
+  }
+
+  t->block.block_size = MIN(t->block.block_size, BLOCK_SZX(block2));
+  t->block.current += len;
+
+  return send_block(t);
+}
+
+static void block_done(int result, const struct coap_packet *response,
+                       void *user) {
+  struct mg_coap_transfer *t = user;
+  int ret = result;
+
+  if (ret == 0) {
+    t->client->stats.blocks++;
+    ret = t->produce != NULL ? next_upload_block(t, response)
+                             : next_download_block(t, response);
+    if (ret == 0) {
+      return;
+    }
+  }
+
+  t->client = NULL;
+  if (t->done != NULL) {
+    t->done(ret < 0 ? ret : 0, ret < 0 ? NULL : response, t->user);
+  }
+}
+
+static int start_transfer(struct mg_coap_client *client,
+                          struct mg_coap_transfer *t, size_t total) {
+  int ret;
+
+  ret = coap_block_transfer_init(
+      &t->block, block_size_for(CONFIG_MG_COAP_BLOCK_SIZE), total);
+  if (ret < 0) {
+    return ret;
+  }
+
+  t->client = client;
+  t->block_len = 0;
+
+  ret = send_block(t);
+  if (ret < 0) {
+    t->client = NULL;
+  }
+
+  return ret;
+}
+
+int mg_coap_client_upload(struct mg_coap_client *client,
+                          struct mg_coap_transfer *transfer) {
+  if (transfer->produce == NULL || transfer->total == 0) {
+    return -EINVAL;
+  }
+
+  return start_transfer(client, transfer, transfer->total);
+}
+
+int mg_coap_client_download(struct mg_coap_client *client,
+                            struct mg_coap_transfer *transfer) {
+  if (transfer->consume == NULL || transfer->produce != NULL) {
+    return -EINVAL;
+  }
+
+  return start_transfer(client, transfer, 0);
+}
+
+size_t mg_coap_client_in_flight(const struct mg_coap_client *client) {
+  size_t count = 0;
+
+  for (size_t i = 0; i < MAX_PENDING; i++) {
+    count += client->requests[i].busy;
+  }
+
+  return count;
+}
+
+void mg_coap_client_cancel(struct mg_coap_client *client) {
+  for (size_t i = 0; i < MAX_PENDING; i++) {
+    if (client->requests[i].busy) {
+      complete(client, i, -ECANCELED, NULL);
+    }
+  }
+}
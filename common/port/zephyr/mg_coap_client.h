@@ -0,0 +1,156 @@
+#ifndef MG_COAP_CLIENT_H
+#define MG_COAP_CLIENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <zephyr/net/coap.h>
+#include <zephyr/net/socket.h>
+
+#include "mg_coap_pacer.h"
+
+/* Called once per CON request: @p result is 0 with the @p response, or
+ * with @p response NULL -ETIMEDOUT when retransmissions ran out or no
+ * separate response came, -ECONNRESET on a Reset and -ECANCELED from
+ * mg_coap_client_cancel(). The response is only valid during the call. New
+ * requests may be sent from the callback.
+ */
+typedef void (*mg_coap_done_t)(int result, const struct coap_packet *response,
+                               void *user);
+
+struct mg_coap_client_stats {
+  uint32_t sent;
+  uint32_t retransmits;
+  uint32_t completed;
+  uint32_t timeouts;
+  uint32_t resets;
+  /* Blocks of block-wise transfers, counted once each. */
+  uint32_t blocks;
+};
+
+/* Block-wise transfer (RFC 7959) of a body too large for one message:
+ * Block1 uploads it from @p produce, Block2 downloads it to @p consume, one
+ * CON block exchange at a time. The block size starts at
+ * CONFIG_MG_COAP_BLOCK_SIZE, or smaller if a block would not fit in
+ * CONFIG_MG_COAP_MSG_LEN, and follows the server down when it asks for
+ * smaller blocks. The transfer must stay valid until @p done is called
+ * with the final response or the error that ended it.
+ */
+struct mg_coap_transfer {
+  uint8_t method;
+  /* Appends the options every block request carries, up to Uri-Query. */
+  int (*options)(struct coap_packet *request, void *user);
+  /* Upload: writes @p len bytes of the @p total byte body from @p offset
+   * into @p buf and returns @p len, or a negative errno to abort.
+   */
+  size_t total;
+  int (*produce)(size_t offset, uint8_t *buf, size_t len, void *user);
+  /* Download: takes the piece of the body at @p offset; @p last is set on
+   * the final block. A negative errno aborts.
+   */
+  int (*consume)(size_t offset, const uint8_t *data, size_t len, bool last,
+                 void *user);
+  mg_coap_done_t done;
+  void *user;
+
+  /* Owned by the client while the transfer runs. */
+  struct mg_coap_client *client;
+  struct coap_block_context block;
+  size_t block_len;
+};
+
+struct mg_coap_request {
+  uint8_t buf[CONFIG_MG_COAP_MSG_LEN];
+  mg_coap_done_t done;
+  void *user;
+  struct mg_coap_class *cls;
+  bool busy;
+  /* Deadline for a separate response once the request is acknowledged. */
+  int64_t expires;
+};
+
+/* Non-blocking CoAP client for one server. Up to CONFIG_MG_COAP_MAX_PENDING
+ * CON requests are in flight at once, matched to their responses by token
+ * (coap_reply) and retransmitted with the RFC 7252 exponential backoff of
+ * Zephyr's coap_pending, set by CONFIG_COAP_INIT_ACK_TIMEOUT_MS and
+ * CONFIG_COAP_MAX_RETRANSMIT.
+ *
+ * Requests started with mg_coap_client_init_class_request() go as NON with
+ * CON checkpoints and PROBING_RATE, as set by their class (mg_coap_pacer.h
+ * with CONFIG_MG_COAP_PROBING_RATE).
+ *
+ * The caller owns the event loop: it polls the socket with the timeout
+ * from mg_coap_client_next_deadline() and calls mg_coap_client_process()
+ * whenever the socket is readable or the deadline has passed.
+ */
+struct mg_coap_client {
+  int sock;
+  struct sockaddr_storage peer;
+  socklen_t peer_len;
+  struct coap_pending pending[CONFIG_MG_COAP_MAX_PENDING];
+  struct coap_reply replies[CONFIG_MG_COAP_MAX_PENDING];
+  struct mg_coap_request requests[CONFIG_MG_COAP_MAX_PENDING];
+  uint8_t rx_buf[CONFIG_MG_COAP_MSG_LEN];
+  struct mg_coap_pacer pacer;
+  struct mg_coap_client_stats stats;
+};
+
+/* Sends to @p peer over the UDP socket @p sock, which the caller opens and
+ * closes.
+ */
+void mg_coap_client_init(struct mg_coap_client *client, int sock,
+                         const struct sockaddr *peer, socklen_t peer_len);
+
+/* Starts a request of @p type and @p method with a fresh token and message
+ * ID in a free request buffer, for the caller to append options and
+ * payload to. Returns -EBUSY while every request is in flight. Hand the
+ * packet to mg_coap_client_send(), or to mg_coap_client_drop() if building
+ * it fails.
+ */
+int mg_coap_client_init_request(struct mg_coap_client *client,
+                                struct coap_packet *request, uint8_t type,
+                                uint8_t method);
+
+/* Like mg_coap_client_init_request(), with CON or NON picked for @p cls.
+ * Returns -EAGAIN while the server is not responding and PROBING_RATE holds
+ * NON requests back.
+ */
+int mg_coap_client_init_class_request(struct mg_coap_client *client,
+                                      struct coap_packet *request,
+                                      struct mg_coap_class *cls,
+                                      uint8_t method);
+
+/* Sends @p request. CON requests stay in flight until @p done is called;
+ * NON requests are done once sent and @p done is not called.
+ */
+int mg_coap_client_send(struct mg_coap_client *client,
+                        struct coap_packet *request, mg_coap_done_t done,
+                        void *user);
+
+void mg_coap_client_drop(struct mg_coap_client *client,
+                         struct coap_packet *request);
+
+/* Uptime (ms) at which the next retransmission or timeout is due, or
+ * INT64_MAX with nothing in flight.
+ */
+int64_t mg_coap_client_next_deadline(struct mg_coap_client *client);
+
+/* Reads every datagram waiting on the socket without blocking, completes
+ * the requests they answer, and retransmits or times out the overdue ones.
+ */
+int mg_coap_client_process(struct mg_coap_client *client);
+
+/* Start a block-wise transfer; its first block goes out at once, each
+ * next one when the previous is acknowledged.
+ */
+int mg_coap_client_upload(struct mg_coap_client *client,
+                          struct mg_coap_transfer *transfer);
+int mg_coap_client_download(struct mg_coap_client *client,
+                            struct mg_coap_transfer *transfer);
+
+size_t mg_coap_client_in_flight(const struct mg_coap_client *client);
+
+/* Fails every request in flight with -ECANCELED. */
+void mg_coap_client_cancel(struct mg_coap_client *client);
+
+#endif
@@ -0,0 +1,66 @@
+#include <zephyr/kernel.h>
+#include <zephyr/net/net_if.h>
+#include <zephyr/net/net_ip.h>
+#include <zephyr/net/net_mgmt.h>
+
+#include "mg_net_if.h"
+#include "mg_platform.h"
+
+MG_LOG_MODULE_DECLARE(mg_common);
+
+static struct net_mgmt_event_callback mgmt_cb;
+static K_SEM_DEFINE(dhcp_sem, 0, 1);
+
+static void net_mgmt_event_handler(struct net_mgmt_event_callback *cb,
+                                   uint64_t mgmt_event, struct net_if *iface) {
+  if (mgmt_event == NET_EVENT_IPV4_DHCP_BOUND) {
+    MG_LOG_INF("DHCP bound - got IP address");
+    k_sem_give(&dhcp_sem);
+  }
+}
+
+void mg_net_if_init(void) {
+  net_mgmt_init_event_callback(&mgmt_cb, net_mgmt_event_handler,
+                               NET_EVENT_IPV4_DHCP_BOUND);
+  net_mgmt_add_event_callback(&mgmt_cb);
+}
+
+static bool log_ipv4_address(struct net_if *iface, const char *what) {
+  struct net_if_addr *if_addr;
+  char addr_str[NET_IPV4_ADDR_LEN];
+
+  if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
+  if (!if_addr) {
+    return false;
+  }
+
+  net_addr_ntop(AF_INET, &if_addr->address.in_addr, addr_str,
+                sizeof(addr_str));
+  MG_LOG_INF("%s IP address: %s", what, addr_str);
+
+  return true;
+}
+
+int mg_wait_for_ip_address(struct net_if *iface) {
+  const int max_timeout = 30; // 30 seconds max wait
+
+  /* Check if we already have an IP */
+  if (log_ipv4_address(iface, "Already have")) {
+    return 0;
+  }
+
+  MG_LOG_INF("Waiting for IP address via DHCP...");
+
+  /* Wait for DHCP with timeout */
+  if (k_sem_take(&dhcp_sem, K_SECONDS(max_timeout)) != 0) {
+    MG_LOG_ERR("Timeout waiting for DHCP - checking if we have IP anyway");
+  }
+
+  /* Verify we have a valid IP */
+  if (log_ipv4_address(iface, "Got")) {
+    return 0;
+  }
+
+  MG_LOG_ERR("No IP address available");
+  return -ETIMEDOUT;
+}
@@ -0,0 +1,16 @@
+#ifndef MG_NET_IF_H
+#define MG_NET_IF_H
+
+#include <zephyr/net/net_if.h>
+
+/* Registers the DHCP event callback used by mg_wait_for_ip_address(). Call
+ * before bringing the interface up.
+ */
+void mg_net_if_init(void);
+
+/* Blocks until @p iface has a preferred IPv4 address, waiting up to 30 s for
+ * a DHCP lease.
+ */
+int mg_wait_for_ip_address(struct net_if *iface);
+
+#endif
@@ -0,0 +1,100 @@
+#include <errno.h>
+
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/random/random.h>
+#if defined(CONFIG_POSIX_CLOCK)
+#include <zephyr/posix/time.h>
+#endif
+
+#include "mg_platform.h"
+
+MG_LOG_MODULE_REGISTER(mg_common);
+
+int64_t mg_uptime_ms(void) { return k_uptime_get(); }
+
+uint64_t mg_uptime_us(void) { return k_ticks_to_us_floor64(k_uptime_ticks()); }
+
+/* CLOCK_REALTIME starts at 1970 and is only right once SNTP has set it, as
+ * the mqtts sample does, so anything before 2020 counts as unknown.
+ */
+#define EPOCH_VALID_SEC 1577836800
+
+int64_t mg_boot_epoch_ms(void) {
+#if defined(CONFIG_POSIX_CLOCK)
+  static int64_t boot_epoch;
+  struct timespec ts;
+
+  if (boot_epoch == 0 && clock_gettime(CLOCK_REALTIME, &ts) == 0 &&
+      ts.tv_sec >= EPOCH_VALID_SEC) {
+    boot_epoch = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 -
+                 mg_uptime_ms();
+  }
+
+  return boot_epoch;
+#else
+  return 0;
+#endif
+}
+
+uint32_t mg_rand32(void) { return sys_rand32_get(); }
+
+void mg_sleep_ms(uint32_t ms) { k_msleep(ms); }
+
+#if defined(CONFIG_MG_BACKGROUND_THREAD)
+#define BACKGROUND_CALLS 4
+
+struct background_call {
+  struct k_work work;
+  void (*fn)(void *);
+  void *arg;
+  atomic_t busy;
+};
+
+static K_THREAD_STACK_DEFINE(background_stack,
+                             CONFIG_MG_BACKGROUND_STACK_SIZE);
+static struct k_work_q background_q;
+static struct background_call background_calls[BACKGROUND_CALLS];
+
+static void background_handler(struct k_work *work) {
+  struct background_call *call =
+      CONTAINER_OF(work, struct background_call, work);
+
+  call->fn(call->arg);
+  atomic_clear(&call->busy);
+}
+
+int mg_run_background(void (*fn)(void *), void *arg) {
+  for (size_t i = 0; i < ARRAY_SIZE(background_calls); i++) {
+    struct background_call *call = &background_calls[i];
+
+    if (atomic_cas(&call->busy, 0, 1)) {
+      call->fn = fn;
+      call->arg = arg;
+      k_work_init(&call->work, background_handler);
+      k_work_submit_to_queue(&background_q, &call->work);
+      return 0;
+    }
+  }
+
+  return -EBUSY;
+}
+
+static int background_init(void) {
+  k_work_queue_start(&background_q, background_stack,
+                     K_THREAD_STACK_SIZEOF(background_stack),
+                     K_LOWEST_APPLICATION_THREAD_PRIO, NULL);
+  k_thread_name_set(&background_q.thread, "mg_background");
+
+  return 0;
+}
+
+SYS_INIT(background_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+#else
+int mg_run_background(void (*fn)(void *), void *arg) {
+  ARG_UNUSED(fn);
+  ARG_UNUSED(arg);
+
+  return -ENOTSUP;
+}
+#endif
@@ -0,0 +1,46 @@
+#ifndef MG_PORT_H
+#define MG_PORT_H
+
+#include <zephyr/logging/log.h>
+#include <zephyr/net/net_ip.h>
+#include <zephyr/net/socket.h>
+
+/* Zephyr port. Uses the zsock_* API so it works with or without
+ * CONFIG_POSIX_API.
+ */
+
+#define mg_sock_socket zsock_socket
+#define mg_sock_connect zsock_connect
+#define mg_sock_close zsock_close
+#define mg_sock_send zsock_send
+#define mg_sock_recv zsock_recv
+#define mg_sock_poll zsock_poll
+#define mg_sock_inet_pton zsock_inet_pton
+#define mg_sock_getaddrinfo zsock_getaddrinfo
+#define mg_sock_freeaddrinfo zsock_freeaddrinfo
+#define mg_pollfd zsock_pollfd
+#define mg_addrinfo zsock_addrinfo
+#define MG_POLLIN ZSOCK_POLLIN
+#define MG_POLLOUT ZSOCK_POLLOUT
+#define MG_POLLERR ZSOCK_POLLERR
+#define MG_POLLHUP ZSOCK_POLLHUP
+#define MG_SEND_FLAGS 0
+#define MG_HAVE_GETADDRINFO IS_ENABLED(CONFIG_DNS_RESOLVER)
+
+#if defined(CONFIG_MG_DNS_CACHE_SIZE)
+#define MG_DNS_CACHE_SIZE CONFIG_MG_DNS_CACHE_SIZE
+#define MG_DNS_TTL_MS ((int64_t)CONFIG_MG_DNS_TTL_SEC * 1000)
+#define MG_DNS_STALE_MS ((int64_t)CONFIG_MG_DNS_STALE_SEC * 1000)
+#endif
+
+#define MG_LOG_MODULE_REGISTER(name)                                           \
+  LOG_MODULE_REGISTER(name, CONFIG_MG_COMMON_LOG_LEVEL)
+#define MG_LOG_MODULE_DECLARE(name)                                            \
+  LOG_MODULE_DECLARE(name, CONFIG_MG_COMMON_LOG_LEVEL)
+
+#define MG_LOG_ERR LOG_ERR
+#define MG_LOG_WRN LOG_WRN
+#define MG_LOG_INF LOG_INF
+#define MG_LOG_DBG LOG_DBG
+
+#endif
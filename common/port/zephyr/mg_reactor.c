@@ -0,0 +1,185 @@
+#include <errno.h>
+#include <limits.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/zvfs/eventfd.h>
+
+#include "mg_platform.h"
+#include "mg_reactor.h"
+
+MG_LOG_MODULE_DECLARE(mg_common);
+
+#define SOCK_FD 0
+#define EVENT_FD 1
+
+static int client_sock(const struct mqtt_client *client) {
+#if defined(CONFIG_MQTT_LIB_TLS)
+  if (client->transport.type == MQTT_TRANSPORT_SECURE) {
+    return client->transport.tls.sock;
+  }
+#endif
+
+  return client->transport.tcp.sock;
+}
+
+#if defined(CONFIG_MG_REACTOR_STATS)
+#define STATS_INTERVAL_MS (60 * MSEC_PER_SEC)
+
+/* Logs the wakeups of the last minute and, with per-thread runtime stats,
+ * the share of it the CPU spent idle.
+ */
+static void log_stats(struct mg_reactor *reactor, int64_t now) {
+  static int64_t next_log;
+#if defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+  static k_thread_runtime_stats_t last;
+  k_thread_runtime_stats_t cur;
+  uint64_t cycles;
+  uint64_t idle;
+#endif
+  struct mg_reactor_stats *stats = &reactor->stats;
+
+  if (next_log == 0) {
+    next_log = now + STATS_INTERVAL_MS;
+  }
+
+  if (now < next_log) {
+    return;
+  }
+
+  next_log = now + STATS_INTERVAL_MS;
+
+#if defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+  k_thread_runtime_stats_all_get(&cur);
+  cycles = cur.execution_cycles - last.execution_cycles;
+  idle = cur.idle_cycles - last.idle_cycles;
+  last = cur;
+
+  MG_LOG_INF("Reactor: %u wakeups/min (%u input, %u posted, %u timer), "
+             "CPU idle %u%%",
+             stats->wakeups, stats->input, stats->posted, stats->timer,
+             cycles > 0 ? (unsigned int)(idle * 100 / cycles) : 0);
+#else
+  MG_LOG_INF("Reactor: %u wakeups/min (%u input, %u posted, %u timer)",
+             stats->wakeups, stats->input, stats->posted, stats->timer);
+#endif
+
+  *stats = (struct mg_reactor_stats){0};
+}
+#else
+static void log_stats(struct mg_reactor *reactor, int64_t now) {
+  ARG_UNUSED(reactor);
+  ARG_UNUSED(now);
+}
+#endif
+
+int mg_reactor_init(struct mg_reactor *reactor) {
+  int fd = zvfs_eventfd(0, ZVFS_EFD_NONBLOCK);
+
+  if (fd < 0) {
+    MG_LOG_ERR("Failed to create eventfd: %d", errno);
+    return -errno;
+  }
+
+  reactor->client = NULL;
+  reactor->fds[SOCK_FD].fd = -1;
+  reactor->fds[SOCK_FD].events = ZSOCK_POLLIN;
+  reactor->fds[EVENT_FD].fd = fd;
+  reactor->fds[EVENT_FD].events = ZSOCK_POLLIN;
+  atomic_clear(&reactor->events);
+  reactor->stats = (struct mg_reactor_stats){0};
+
+  return 0;
+}
+
+void mg_reactor_attach(struct mg_reactor *reactor, struct mqtt_client *client) {
+  reactor->client = client;
+  reactor->fds[SOCK_FD].fd = client_sock(client);
+}
+
+void mg_reactor_detach(struct mg_reactor *reactor) {
+  reactor->fds[SOCK_FD].fd = -1;
+}
+
+void mg_reactor_post(struct mg_reactor *reactor, uint32_t events) {
+  /* Only the first post since the last run needs to wake the reactor. */
+  if (atomic_or(&reactor->events, events) == 0) {
+    (void)zvfs_eventfd_write(reactor->fds[EVENT_FD].fd, 1);
+  }
+}
+
+/* Milliseconds to sleep: until the next keepalive ping or @p deadline,
+ * or no sleep at all with events already pending.
+ */
+static int poll_timeout(struct mg_reactor *reactor, int64_t deadline) {
+  int timeout = SYS_FOREVER_MS;
+  int64_t left;
+
+  if (atomic_get(&reactor->events) != 0) {
+    return 0;
+  }
+
+  if (reactor->fds[SOCK_FD].fd >= 0) {
+    timeout = mqtt_keepalive_time_left(reactor->client);
+  }
+
+  if (deadline != MG_REACTOR_FOREVER) {
+    left = CLAMP(deadline - k_uptime_get(), 0, INT_MAX);
+    if (timeout == SYS_FOREVER_MS || left < timeout) {
+      timeout = left;
+    }
+  }
+
+  return timeout;
+}
+
+int mg_reactor_run(struct mg_reactor *reactor, int64_t deadline) {
+  struct zsock_pollfd *sock = &reactor->fds[SOCK_FD];
+  zvfs_eventfd_t value;
+  int rc;
+
+  rc = zsock_poll(reactor->fds, ARRAY_SIZE(reactor->fds),
+                  poll_timeout(reactor, deadline));
+  if (rc < 0) {
+    MG_LOG_ERR("poll error: %d", errno);
+    return -errno;
+  }
+
+  reactor->stats.wakeups++;
+
+  if (reactor->fds[EVENT_FD].revents & ZSOCK_POLLIN) {
+    (void)zvfs_eventfd_read(reactor->fds[EVENT_FD].fd, &value);
+  }
+
+  if (sock->fd >= 0 && sock->revents != 0) {
+    reactor->stats.input++;
+
+    /* A hangup with data left is read first; mqtt_input() then sees EOF. */
+    if (!(sock->revents & ZSOCK_POLLIN)) {
+      MG_LOG_ERR("MQTT socket closed");
+      return -ENOTCONN;
+    }
+
+    rc = mqtt_input(reactor->client);
+    if (rc != 0) {
+      MG_LOG_ERR("mqtt_input failed: %d", rc);
+      return rc;
+    }
+  } else if (atomic_get(&reactor->events) != 0) {
+    reactor->stats.posted++;
+  } else {
+    reactor->stats.timer++;
+  }
+
+  /* mqtt_input() may have closed the connection. */
+  if (sock->fd >= 0) {
+    rc = mqtt_live(reactor->client);
+    if (rc != 0 && rc != -EAGAIN) {
+      MG_LOG_ERR("mqtt_live failed: %d", rc);
+      return rc;
+    }
+  }
+
+  log_stats(reactor, k_uptime_get());
+
+  return mg_reactor_take(reactor);
+}
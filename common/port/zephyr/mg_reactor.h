@@ -0,0 +1,65 @@
+#ifndef MG_REACTOR_H
+#define MG_REACTOR_H
+
+#include <stdint.h>
+
+#include <zephyr/net/mqtt.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/sys/atomic.h>
+
+/* No deadline of the caller's own: wait for input, a post or keepalive. */
+#define MG_REACTOR_FOREVER INT64_MAX
+
+struct mg_reactor_stats {
+  uint32_t wakeups;
+  /* Wakeups for socket input, posted events and deadlines. */
+  uint32_t input;
+  uint32_t posted;
+  uint32_t timer;
+};
+
+/* Event loop for one MQTT client. Sleeps in a single zsock_poll() on the
+ * client socket and an eventfd, with the timeout set by the keepalive and
+ * the caller's own deadline, so it only wakes up when there is something
+ * to do: input to read, a ping to send, a deadline reached or an event
+ * posted from another thread or from the MQTT event callback.
+ */
+struct mg_reactor {
+  struct mqtt_client *client;
+  struct zsock_pollfd fds[2];
+  atomic_t events;
+  struct mg_reactor_stats stats;
+};
+
+/* Creates the eventfd. Call once, before any connection. */
+int mg_reactor_init(struct mg_reactor *reactor);
+
+/* Starts polling @p client, once mqtt_connect() has opened its socket.
+ * Call mg_reactor_detach() from the client's MQTT_EVT_DISCONNECT handler.
+ */
+void mg_reactor_attach(struct mg_reactor *reactor, struct mqtt_client *client);
+
+/* Stops polling the socket, which the MQTT library has closed. Posted
+ * events still wake the reactor.
+ */
+void mg_reactor_detach(struct mg_reactor *reactor);
+
+/* ORs application-defined @p events, bits 0 to 30, into the pending set
+ * and wakes the reactor. Safe from any thread.
+ */
+void mg_reactor_post(struct mg_reactor *reactor, uint32_t events);
+
+/* Takes the pending events without waiting. */
+static inline uint32_t mg_reactor_take(struct mg_reactor *reactor) {
+  return atomic_clear(&reactor->events);
+}
+
+/* Waits until there is input, an event is posted, the keepalive is due or
+ * uptime reaches @p deadline (ms), whichever is first. Feeds input to
+ * mqtt_input(), keeps the connection alive and returns the posted events,
+ * including those posted by the callback during mqtt_input(), or a
+ * negative errno if the connection failed.
+ */
+int mg_reactor_run(struct mg_reactor *reactor, int64_t deadline);
+
+#endif
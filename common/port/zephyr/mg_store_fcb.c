@@ -0,0 +1,195 @@
+#include <errno.h>
+
+#include <zephyr/fs/fcb.h>
+#include <zephyr/storage/flash_map.h>
+
+#include "mg_platform.h"
+#include "mg_store.h"
+
+MG_LOG_MODULE_DECLARE(mg_common);
+
+/* Flash Circular Buffer on the storage partition. FCB appends in place and
+ * only erases whole sectors, so entries are consumed through a read cursor
+ * kept in RAM and a sector is erased once the cursor has left it. The
+ * cursor is not persisted: after a reboot every entry still in flash is
+ * replayed, including any consumed from a sector not yet erased.
+ */
+#define STORE_PARTITION_ID FIXED_PARTITION_ID(storage_partition)
+#define STORE_MAGIC 0x4D475346 /* "MGSF" */
+
+static struct flash_sector sectors[CONFIG_MG_STORE_MAX_SECTORS];
+static struct fcb fcb;
+
+/* Last consumed entry; fe_sector is NULL when nothing is consumed. */
+static struct fcb_entry read_loc;
+static struct fcb_entry peek_loc;
+
+struct count_ctx {
+  const struct flash_sector *sector;
+  uint32_t count;
+};
+
+static int count_entry(struct fcb_entry_ctx *entry_ctx, void *arg) {
+  struct count_ctx *ctx = arg;
+  const struct fcb_entry *loc = &entry_ctx->loc;
+
+  /* Entries at or before the read cursor are already consumed. */
+  if (loc->fe_sector != read_loc.fe_sector ||
+      loc->fe_elem_off > read_loc.fe_elem_off) {
+    ctx->count++;
+  }
+
+  return 0;
+}
+
+/* Erases the oldest sector, counting the unread entries it held. */
+static int drop_oldest_sector(void) {
+  struct count_ctx ctx = {.sector = fcb.f_oldest};
+  int ret;
+
+  (void)fcb_walk(&fcb, fcb.f_oldest, count_entry, &ctx);
+
+  ret = fcb_rotate(&fcb);
+  if (ret < 0) {
+    MG_LOG_ERR("Failed to erase store sector: %d", ret);
+    return ret;
+  }
+
+  if (read_loc.fe_sector == ctx.sector) {
+    read_loc.fe_sector = NULL;
+  }
+  peek_loc.fe_sector = NULL;
+
+  mg_store_stats.depth -= ctx.count;
+  mg_store_stats.dropped += ctx.count;
+
+  if (ctx.count > 0) {
+    MG_LOG_WRN("Store full, dropped %u queued messages", ctx.count);
+  }
+
+  return 0;
+}
+
+int mg_store_init(void) {
+  struct count_ctx ctx = {0};
+  uint32_t count = ARRAY_SIZE(sectors);
+  int ret;
+
+  ret = flash_area_get_sectors(STORE_PARTITION_ID, &count, sectors);
+  if (ret == -ENOMEM) {
+    /* Larger partition than the sector table: use its first sectors. */
+    count = ARRAY_SIZE(sectors);
+  } else if (ret < 0) {
+    MG_LOG_ERR("Failed to get store sectors: %d", ret);
+    return ret;
+  }
+
+  fcb.f_magic = STORE_MAGIC;
+  fcb.f_version = 1;
+  fcb.f_sectors = sectors;
+  fcb.f_sector_cnt = count;
+  fcb.f_scratch_cnt = 0;
+
+  ret = fcb_init(STORE_PARTITION_ID, &fcb);
+  if (ret < 0) {
+    MG_LOG_ERR("Failed to init store: %d", ret);
+    return ret;
+  }
+
+  read_loc.fe_sector = NULL;
+  peek_loc.fe_sector = NULL;
+
+  (void)fcb_walk(&fcb, NULL, count_entry, &ctx);
+  mg_store_stats.depth = ctx.count;
+
+  MG_LOG_INF("Store: %u sectors, %u queued messages", count, ctx.count);
+
+  return 0;
+}
+
+int mg_store_append(const void *data, size_t len) {
+  struct fcb_entry loc;
+  int ret;
+
+  if (len > FCB_MAX_LEN) {
+    return -E2BIG;
+  }
+
+  /* An entry larger than a sector never fits, however much is erased. */
+  for (int i = 0;; i++) {
+    ret = fcb_append(&fcb, len, &loc);
+    if (ret != -ENOSPC) {
+      break;
+    }
+
+    if (i == fcb.f_sector_cnt) {
+      return -E2BIG;
+    }
+
+    ret = drop_oldest_sector();
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  if (ret < 0) {
+    return ret;
+  }
+
+  ret = flash_area_write(fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), data, len);
+  if (ret < 0) {
+    MG_LOG_ERR("Failed to write store entry: %d", ret);
+    return ret;
+  }
+
+  ret = fcb_append_finish(&fcb, &loc);
+  if (ret < 0) {
+    return ret;
+  }
+
+  mg_store_stats.depth++;
+  mg_store_stats.appended++;
+
+  return 0;
+}
+
+int mg_store_peek(void *buf, size_t len) {
+  int ret;
+
+  peek_loc = read_loc;
+
+  ret = fcb_getnext(&fcb, &peek_loc);
+  if (ret < 0) {
+    peek_loc.fe_sector = NULL;
+    return -ENODATA;
+  }
+
+  if (peek_loc.fe_data_len > len) {
+    return -E2BIG;
+  }
+
+  ret = flash_area_read(fcb.fap, FCB_ENTRY_FA_DATA_OFF(peek_loc), buf,
+                        peek_loc.fe_data_len);
+  if (ret < 0) {
+    return ret;
+  }
+
+  return peek_loc.fe_data_len;
+}
+
+void mg_store_pop(void) {
+  if (peek_loc.fe_sector == NULL) {
+    return;
+  }
+
+  read_loc = peek_loc;
+  peek_loc.fe_sector = NULL;
+  mg_store_stats.depth--;
+
+  /* Sectors behind the cursor hold only consumed entries. */
+  while (fcb.f_oldest != read_loc.fe_sector) {
+    if (fcb_rotate(&fcb) < 0) {
+      break;
+    }
+  }
+}
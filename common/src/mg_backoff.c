@@ -0,0 +1,67 @@
+#include <string.h>
+
+#include "mg_backoff.h"
+#include "mg_platform.h"
+
+/* Uniform in [lo, hi]. */
+static uint32_t uniform(uint32_t lo, uint32_t hi) {
+  if (hi <= lo) {
+    return lo;
+  }
+
+  return lo + (uint32_t)((uint64_t)mg_rand32() * (hi - lo + 1ULL) >> 32);
+}
+
+static void reset(struct mg_backoff *bo) {
+  bo->prev_ms = 0;
+  bo->stats.failures = 0;
+}
+
+void mg_backoff_init(struct mg_backoff *bo,
+                     const struct mg_backoff_config *cfg) {
+  memset(bo, 0, sizeof(*bo));
+  bo->cfg = cfg;
+  bo->connected_at = -1;
+}
+
+uint32_t mg_backoff_next(struct mg_backoff *bo) {
+  const struct mg_backoff_config *cfg = bo->cfg;
+  uint32_t delay;
+
+  if (bo->prev_ms == 0) {
+    /* Fast first retry, jittered so a fleet does not retry as one. */
+    delay = uniform(0, cfg->first_ms < cfg->max_ms ? cfg->first_ms
+                                                   : cfg->max_ms);
+    bo->prev_ms = cfg->base_ms > 0 ? cfg->base_ms : 1;
+  } else {
+    uint64_t hi = (uint64_t)bo->prev_ms * 3;
+
+    delay = uniform(cfg->base_ms, hi < cfg->max_ms ? (uint32_t)hi
+                                                   : cfg->max_ms);
+    bo->prev_ms = delay > 0 ? delay : 1;
+  }
+
+  bo->stats.retries++;
+  bo->stats.failures++;
+  bo->stats.total_delay_ms += delay;
+  if (delay > bo->stats.max_delay_ms) {
+    bo->stats.max_delay_ms = delay;
+  }
+
+  return delay;
+}
+
+void mg_backoff_connected(struct mg_backoff *bo, int64_t now) {
+  bo->connected_at = now;
+  bo->stats.connects++;
+}
+
+void mg_backoff_disconnected(struct mg_backoff *bo, int64_t now) {
+  if (bo->connected_at >= 0 &&
+      now - bo->connected_at >= (int64_t)bo->cfg->stable_ms) {
+    reset(bo);
+    bo->stats.resets++;
+  }
+
+  bo->connected_at = -1;
+}
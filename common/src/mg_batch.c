@@ -0,0 +1,222 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mg_batch.h"
+#include "mg_cbor.h"
+#include "mg_senml.h"
+
+enum batch_field {
+  /* Unit-less fields go first, before any bu is in effect. */
+  FIELD_LED_STATE,
+  FIELD_TEMPERATURE,
+  FIELD_HUMIDITY,
+  FIELD_BATTERY,
+  FIELD_COUNT,
+};
+
+struct field_desc {
+  const char *name;
+  const char *unit;
+};
+
+static const struct field_desc fields[FIELD_COUNT] = {
+    [FIELD_LED_STATE] = {"led_state", NULL},
+    [FIELD_TEMPERATURE] = {"temperature", "Cel"},
+    [FIELD_HUMIDITY] = {"humidity", "%RH"},
+    [FIELD_BATTERY] = {"battery", "%EL"},
+};
+
+static void put_label(struct mg_cbor_writer *w, enum mg_senml_label label) {
+  mg_cbor_put_int(w, label);
+}
+
+static void put_string(struct mg_cbor_writer *w, const char *str) {
+  mg_cbor_put_text(w, str, strlen(str));
+}
+
+/* Writes the record for @p field of @p sample, the @p index-th reading of a
+ * pack sent at @p now. The first reading carries the base fields, the
+ * others a relative time. bt is always a double, so a record's size does not
+ * depend on when the pack is sent.
+ */
+static void put_record(struct mg_cbor_writer *w, const struct mg_batch *batch,
+                       enum batch_field field,
+                       const struct mg_batch_sample *sample, size_t index,
+                       int64_t base_time, int64_t now) {
+  const struct field_desc *desc = &fields[field];
+  const char *base_name = batch->config->base_name;
+  bool first_record = index == 0 && field == 0;
+  bool base_unit = index == 0 && desc->unit != NULL;
+  size_t pairs = 2;
+
+  if (first_record) {
+    pairs += base_name != NULL ? 2 : 1;
+  }
+  pairs += base_unit ? 1 : 0;
+  pairs += index > 0 ? 1 : 0;
+
+  mg_cbor_put_map(w, pairs);
+
+  if (first_record) {
+    if (base_name != NULL) {
+      put_label(w, MG_SENML_BASE_NAME);
+      put_string(w, base_name);
+    }
+    put_label(w, MG_SENML_BASE_TIME);
+    mg_cbor_put_double(w, mg_senml_time(base_time, now));
+  }
+
+  if (base_unit) {
+    put_label(w, MG_SENML_BASE_UNIT);
+    put_string(w, desc->unit);
+  }
+
+  put_label(w, MG_SENML_NAME);
+  put_string(w, desc->name);
+
+  if (index > 0) {
+    put_label(w, MG_SENML_TIME);
+    mg_cbor_put_number(w, (sample->timestamp - base_time) / 1000.0);
+  }
+
+  switch (field) {
+  case FIELD_LED_STATE:
+    put_label(w, MG_SENML_BOOL_VALUE);
+    mg_cbor_put_bool(w, sample->data.led_state);
+    break;
+  case FIELD_TEMPERATURE:
+    put_label(w, MG_SENML_VALUE);
+    mg_cbor_put_number(w, sample->data.temperature);
+    break;
+  case FIELD_HUMIDITY:
+    put_label(w, MG_SENML_VALUE);
+    mg_cbor_put_number(w, sample->data.humidity);
+    break;
+  default:
+    put_label(w, MG_SENML_VALUE);
+    mg_cbor_put_number(w, sample->data.battery_level);
+    break;
+  }
+}
+
+static size_t array_head_len(size_t count) {
+  struct mg_cbor_writer w;
+
+  mg_cbor_init_sizing(&w);
+  mg_cbor_put_array(&w, count);
+
+  return w.len;
+}
+
+static size_t pack_len(size_t count, size_t record_bytes) {
+  return array_head_len(count * FIELD_COUNT) + record_bytes;
+}
+
+void mg_batch_init(struct mg_batch *batch, const struct mg_batch_config *config,
+                   struct mg_batch_sample *storage, size_t capacity) {
+  batch->config = config;
+  batch->samples = storage;
+  batch->capacity = capacity;
+  mg_batch_reset(batch);
+}
+
+int mg_batch_add(struct mg_batch *batch, const sensor_data_t *data,
+                 int64_t timestamp) {
+  const struct mg_batch_config *config = batch->config;
+  struct mg_batch_sample sample = {.data = *data, .timestamp = timestamp};
+  int64_t base_time = batch->count > 0 ? batch->samples[0].timestamp
+                                       : timestamp;
+  struct mg_cbor_writer w;
+
+  if (batch->count >= batch->capacity ||
+      (config->max_count > 0 && batch->count >= config->max_count)) {
+    return -ENOSPC;
+  }
+
+  mg_cbor_init_sizing(&w);
+  for (int field = 0; field < FIELD_COUNT; field++) {
+    put_record(&w, batch, field, &sample, batch->count, base_time, 0);
+  }
+
+  if (config->max_bytes > 0 && batch->count > 0 &&
+      pack_len(batch->count + 1, batch->record_bytes + w.len) >
+          config->max_bytes) {
+    return -ENOSPC;
+  }
+
+  batch->samples[batch->count++] = sample;
+  batch->record_bytes += w.len;
+
+  return 0;
+}
+
+bool mg_batch_due(const struct mg_batch *batch, int64_t now) {
+  const struct mg_batch_config *config = batch->config;
+
+  if (batch->count == 0) {
+    return false;
+  }
+
+  if (batch->count >= batch->capacity ||
+      (config->max_count > 0 && batch->count >= config->max_count)) {
+    return true;
+  }
+
+  if (config->max_bytes > 0 &&
+      mg_batch_encoded_len(batch) >= config->max_bytes) {
+    return true;
+  }
+
+  return config->max_age_ms > 0 &&
+         now - batch->samples[0].timestamp >= config->max_age_ms;
+}
+
+size_t mg_batch_encoded_len(const struct mg_batch *batch) {
+  return batch->count > 0 ? pack_len(batch->count, batch->record_bytes) : 0;
+}
+
+static int encode_pack(const struct mg_batch *batch, int64_t now,
+                       struct mg_cbor_writer *w) {
+  int64_t base_time;
+
+  if (batch->count == 0) {
+    return -ENODATA;
+  }
+
+  base_time = batch->samples[0].timestamp;
+
+  mg_cbor_put_array(w, batch->count * FIELD_COUNT);
+
+  /* Past the end of the buffer (or window) nothing more is written. */
+  for (int field = 0; field < FIELD_COUNT && !w->overflow; field++) {
+    for (size_t i = 0; i < batch->count && !w->overflow; i++) {
+      put_record(w, batch, field, &batch->samples[i], i, base_time, now);
+    }
+  }
+
+  return mg_cbor_finish(w);
+}
+
+int mg_batch_encode_senml_cbor(const struct mg_batch *batch, int64_t now,
+                               uint8_t *buf, size_t len) {
+  struct mg_cbor_writer w;
+
+  mg_cbor_init(&w, buf, len);
+
+  return encode_pack(batch, now, &w);
+}
+
+int mg_batch_encode_senml_cbor_block(const struct mg_batch *batch,
+                                     int64_t now, size_t offset,
+                                     uint8_t *buf, size_t len) {
+  struct mg_cbor_writer w;
+
+  mg_cbor_init_window(&w, buf, len, offset);
+
+  return encode_pack(batch, now, &w);
+}
+
+void mg_batch_reset(struct mg_batch *batch) {
+  batch->count = 0;
+  batch->record_bytes = 0;
+}
@@ -0,0 +1,237 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mg_cbor.h"
+
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_NINT 1
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_SIMPLE 7
+
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_FLOAT16 0xF9
+#define CBOR_FLOAT32 0xFA
+#define CBOR_FLOAT64 0xFB
+
+/* Appends the part of @p len bytes that falls inside a window writer's
+ * window.
+ */
+static void emit(struct mg_cbor_writer *w, const uint8_t *data, size_t len) {
+  if (w->overflow) {
+    return;
+  }
+
+  if (w->skip > 0) {
+    size_t n = w->skip < len ? w->skip : len;
+
+    w->skip -= n;
+    data += n;
+    len -= n;
+  }
+
+  if (w->window_cap - w->window_len < len) {
+    w->overflow = true;
+    len = w->window_cap - w->window_len;
+  }
+
+  memcpy(w->buf + w->window_len, data, len);
+  w->window_len += len;
+}
+
+/* Copies out the part of the staged item inside the window. */
+static void flush(struct mg_cbor_writer *w) {
+  emit(w, w->stage, w->staged);
+  w->staged = 0;
+}
+
+/* Kept out of line so the in-place path of reserve() stays small enough to
+ * inline into every put.
+ */
+static __attribute__((noinline)) uint8_t *
+reserve_slow(struct mg_cbor_writer *w, size_t len) {
+  if (!w->window) {
+    w->overflow = true;
+    return NULL;
+  }
+
+  flush(w);
+  if (len > sizeof(w->stage)) {
+    return NULL;
+  }
+  w->staged = len;
+
+  return w->stage;
+}
+
+/* Returns where to write the next @p len bytes, or NULL to skip them. A
+ * window writer gets its stage.
+ */
+static uint8_t *reserve(struct mg_cbor_writer *w, size_t len) {
+  uint8_t *p;
+
+  if (w->overflow || w->cap - w->len < len) {
+    return reserve_slow(w, len);
+  }
+
+  p = w->buf != NULL ? w->buf + w->len : NULL;
+  w->len += len;
+
+  return p;
+}
+
+static void put_be(uint8_t *p, uint64_t value, size_t len) {
+  for (size_t i = len; i > 0; i--) {
+    p[i - 1] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+/* Inline, as the window writer's slow path would otherwise tip the
+ * compiler into calling it for every item.
+ */
+static inline void put_head(struct mg_cbor_writer *w, uint8_t major, uint64_t arg) {
+  size_t len;
+  uint8_t info;
+  uint8_t *p;
+
+  if (arg < 24) {
+    len = 0;
+    info = arg;
+  } else if (arg <= UINT8_MAX) {
+    len = 1;
+    info = 24;
+  } else if (arg <= UINT16_MAX) {
+    len = 2;
+    info = 25;
+  } else if (arg <= UINT32_MAX) {
+    len = 4;
+    info = 26;
+  } else {
+    len = 8;
+    info = 27;
+  }
+
+  p = reserve(w, 1 + len);
+  if (p == NULL) {
+    return;
+  }
+
+  p[0] = (major << 5) | info;
+  put_be(p + 1, arg, len);
+}
+
+static void put_float(struct mg_cbor_writer *w, uint8_t type, uint64_t bits,
+                      size_t len) {
+  uint8_t *p = reserve(w, 1 + len);
+
+  if (p == NULL) {
+    return;
+  }
+
+  p[0] = type;
+  put_be(p + 1, bits, len);
+}
+
+/* Returns true and the IEEE 754 half precision bits if @p f survives the
+ * conversion unchanged. Subnormal halves are left to single precision.
+ */
+static bool float_to_half(float f, uint16_t *half) {
+  uint32_t bits;
+  int exp;
+  uint32_t mant;
+
+  memcpy(&bits, &f, sizeof(bits));
+  exp = (int)((bits >> 23) & 0xFF) - 127;
+  mant = bits & 0x7FFFFF;
+
+  if (exp < -14 || exp > 15 || (mant & 0x1FFF) != 0) {
+    return false;
+  }
+
+  *half = ((bits >> 16) & 0x8000) | ((exp + 15) << 10) | (mant >> 13);
+
+  return true;
+}
+
+int mg_cbor_finish(struct mg_cbor_writer *w) {
+  if (w->window) {
+    flush(w);
+    return (int)w->window_len;
+  }
+
+  return w->overflow ? -E2BIG : (int)w->len;
+}
+
+void mg_cbor_put_array(struct mg_cbor_writer *w, size_t count) {
+  put_head(w, CBOR_MAJOR_ARRAY, count);
+}
+
+void mg_cbor_put_map(struct mg_cbor_writer *w, size_t pairs) {
+  put_head(w, CBOR_MAJOR_MAP, pairs);
+}
+
+void mg_cbor_put_int(struct mg_cbor_writer *w, int64_t value) {
+  if (value < 0) {
+    put_head(w, CBOR_MAJOR_NINT, (uint64_t)(-(value + 1)));
+  } else {
+    put_head(w, CBOR_MAJOR_UINT, value);
+  }
+}
+
+void mg_cbor_put_text(struct mg_cbor_writer *w, const char *str, size_t len) {
+  uint8_t *p;
+
+  put_head(w, CBOR_MAJOR_TEXT, len);
+
+  p = reserve(w, len);
+  if (p != NULL) {
+    memcpy(p, str, len);
+  } else if (w->window) {
+    /* Too long for the stage, which reserve() has flushed. */
+    emit(w, (const uint8_t *)str, len);
+  }
+}
+
+void mg_cbor_put_bool(struct mg_cbor_writer *w, bool value) {
+  uint8_t *p = reserve(w, 1);
+
+  if (p != NULL) {
+    p[0] = value ? CBOR_TRUE : CBOR_FALSE;
+  }
+}
+
+void mg_cbor_put_number(struct mg_cbor_writer *w, double value) {
+  float f = (float)value;
+  uint16_t half;
+  uint32_t bits32;
+
+  /* 2^53: beyond this not every integer is representable as a double. */
+  if (value >= -9007199254740992.0 && value <= 9007199254740992.0 &&
+      value == (double)(int64_t)value) {
+    mg_cbor_put_int(w, (int64_t)value);
+    return;
+  }
+
+  if ((double)f == value) {
+    if (float_to_half(f, &half)) {
+      put_float(w, CBOR_FLOAT16, half, 2);
+      return;
+    }
+
+    memcpy(&bits32, &f, sizeof(bits32));
+    put_float(w, CBOR_FLOAT32, bits32, 4);
+    return;
+  }
+
+  mg_cbor_put_double(w, value);
+}
+
+void mg_cbor_put_double(struct mg_cbor_writer *w, double value) {
+  uint64_t bits;
+
+  memcpy(&bits, &value, sizeof(bits));
+  put_float(w, CBOR_FLOAT64, bits, 8);
+}
@@ -0,0 +1,63 @@
+#include <string.h>
+
+#include "mg_coap_observe.h"
+
+/* Observe values are 24 bits (RFC 7641 section 4.4). */
+#define SEQ_HALF (1u << 23)
+#define SEQ_MASK 0xFFFFFFu
+#define REORDER_MS (128 * 1000)
+
+void mg_coap_observe_init(struct mg_coap_observe *obs, int64_t now) {
+  memset(obs, 0, sizeof(*obs));
+  obs->due = now;
+}
+
+bool mg_coap_observe_due(const struct mg_coap_observe *obs, int64_t now) {
+  return now >= obs->due;
+}
+
+uint32_t mg_coap_observe_wait_ms(const struct mg_coap_observe *obs,
+                                 int64_t now) {
+  return obs->due > now ? (uint32_t)(obs->due - now) : 0;
+}
+
+void mg_coap_observe_sent(struct mg_coap_observe *obs, int64_t now,
+                          uint32_t timeout_ms) {
+  if (obs->active) {
+    obs->stats.renewals++;
+  }
+
+  obs->stats.registrations++;
+  obs->pending = true;
+  obs->due = now + timeout_ms;
+}
+
+bool mg_coap_observe_notified(struct mg_coap_observe *obs, uint32_t seq,
+                              uint32_t max_age_s, int64_t now) {
+  uint32_t v1 = obs->seq, v2 = seq & SEQ_MASK;
+
+  /* The first reply to a registration is fresh whatever its value. */
+  if (obs->active && !obs->pending &&
+      !((v1 < v2 && v2 - v1 < SEQ_HALF) || (v1 > v2 && v1 - v2 > SEQ_HALF)) &&
+      now <= obs->received + REORDER_MS) {
+    obs->stats.stale++;
+    return false;
+  }
+
+  obs->pending = false;
+  obs->active = true;
+  obs->seq = v2;
+  obs->received = now;
+  obs->due = now + (int64_t)max_age_s * 1000 + MG_COAP_OBSERVE_GRACE_MS;
+  obs->stats.notifications++;
+
+  return true;
+}
+
+void mg_coap_observe_failed(struct mg_coap_observe *obs, int64_t now,
+                            uint32_t retry_ms) {
+  obs->pending = false;
+  obs->active = false;
+  obs->due = now + retry_ms;
+  obs->stats.failures++;
+}
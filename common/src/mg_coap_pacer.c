@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mg_coap_pacer.h"
+
+void mg_coap_pacer_init(struct mg_coap_pacer *pacer, uint32_t probing_rate,
+                        int64_t now) {
+  memset(pacer, 0, sizeof(*pacer));
+  pacer->probing_rate = probing_rate > 0 ? probing_rate : 1;
+  pacer->quiet_since = now;
+}
+
+void mg_coap_class_init(struct mg_coap_class *cls,
+                        const struct mg_coap_class_config *cfg) {
+  memset(cls, 0, sizeof(*cls));
+  cls->cfg = cfg;
+}
+
+bool mg_coap_pacer_confirmable(const struct mg_coap_pacer *pacer,
+                               const struct mg_coap_class *cls, int64_t now) {
+  const struct mg_coap_class_config *cfg = cls->cfg;
+
+  if (cfg->con_every == 1) {
+    return true;
+  }
+
+  if (pacer->outstanding > 0) {
+    return false;
+  }
+
+  if (!pacer->responding) {
+    return true;
+  }
+
+  return (cfg->con_every > 0 && cls->since_con + 1 >= cfg->con_every) ||
+         (cfg->con_interval_ms > 0 &&
+          now - cls->last_con >= (int64_t)cfg->con_interval_ms);
+}
+
+uint32_t mg_coap_pacer_wait_ms(const struct mg_coap_pacer *pacer,
+                               int64_t now) {
+  int64_t allowed;
+
+  if (pacer->responding) {
+    return 0;
+  }
+
+  /* The bytes sent so far, averaged from the start of the period, must
+   * stay within the rate before the next message goes.
+   */
+  allowed = pacer->quiet_since +
+            (int64_t)(pacer->quiet_bytes * 1000 / pacer->probing_rate);
+
+  return allowed > now ? (uint32_t)(allowed - now) : 0;
+}
+
+void mg_coap_pacer_sent(struct mg_coap_pacer *pacer, struct mg_coap_class *cls,
+                        bool con, size_t len, int64_t now) {
+  if (con) {
+    pacer->outstanding++;
+    pacer->stats.con++;
+  } else {
+    pacer->stats.non++;
+    if (!pacer->responding) {
+      pacer->stats.probing++;
+    }
+  }
+
+  if (!pacer->responding) {
+    pacer->quiet_bytes += len;
+  }
+
+  if (cls == NULL) {
+    return;
+  }
+
+  if (con) {
+    cls->since_con = 0;
+    cls->last_con = now;
+  } else {
+    cls->since_con++;
+  }
+}
+
+void mg_coap_pacer_done(struct mg_coap_pacer *pacer, int result, int64_t now) {
+  if (pacer->outstanding > 0) {
+    pacer->outstanding--;
+  }
+
+  if (result == -ECANCELED) {
+    return;
+  }
+
+  if (result != -ETIMEDOUT) {
+    pacer->responding = true;
+    pacer->stats.answered++;
+    return;
+  }
+
+  pacer->stats.lost++;
+
+  /* Probing starts afresh here, rather than averaging over the stream
+   * sent while the checkpoint was still being retransmitted.
+   */
+  if (pacer->responding) {
+    pacer->responding = false;
+    pacer->quiet_since = now;
+    pacer->quiet_bytes = 0;
+  }
+}
@@ -0,0 +1,259 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "mg_dns.h"
+
+MG_LOG_MODULE_DECLARE(mg_common);
+
+struct mg_dns_stats mg_dns_stats;
+
+#if MG_HAVE_GETADDRINFO
+
+/* Background refresh state, handed between threads with atomics. While a
+ * refresh runs, the worker owns the refresh_* fields and only reads the
+ * key, and the entry is not reused for another host.
+ */
+enum {
+  REFRESH_IDLE,
+  REFRESH_RUNNING,
+  REFRESH_DONE,
+};
+
+struct dns_entry {
+  char host[MG_DNS_HOST_MAX];
+  sa_family_t family;
+  int type;
+  bool valid;
+  /* Expired by mg_dns_expire(): look it up in the foreground next. */
+  bool forced;
+  int64_t expires;
+  int64_t last_used;
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+
+  int refresh;
+  int refresh_ret;
+  struct sockaddr_storage refresh_addr;
+  socklen_t refresh_len;
+};
+
+static struct dns_entry cache[MG_DNS_CACHE_SIZE];
+
+static int lookup(sa_family_t family, const char *host, int type,
+                  struct sockaddr_storage *addr, socklen_t *addr_len) {
+  struct mg_addrinfo hints = {.ai_family = family, .ai_socktype = type};
+  struct mg_addrinfo *ai = NULL;
+  int ret;
+
+  ret = mg_sock_getaddrinfo(host, NULL, &hints, &ai);
+  if (ret == 0 && ai != NULL && ai->ai_addrlen <= sizeof(*addr)) {
+    memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+    *addr_len = ai->ai_addrlen;
+    mg_sock_freeaddrinfo(ai);
+    return 0;
+  }
+
+  if (ai != NULL) {
+    mg_sock_freeaddrinfo(ai);
+  }
+
+  return -EHOSTUNREACH;
+}
+
+static void refresh(void *arg) {
+  struct dns_entry *e = arg;
+
+  e->refresh_ret =
+      lookup(e->family, e->host, e->type, &e->refresh_addr, &e->refresh_len);
+  __atomic_store_n(&e->refresh, REFRESH_DONE, __ATOMIC_RELEASE);
+}
+
+/* Takes in the result of a finished background refresh. */
+static void apply_refresh(struct dns_entry *e, int64_t now) {
+  if (__atomic_load_n(&e->refresh, __ATOMIC_ACQUIRE) != REFRESH_DONE) {
+    return;
+  }
+
+  mg_dns_stats.lookups++;
+
+  if (e->refresh_ret == 0) {
+    memcpy(&e->addr, &e->refresh_addr, e->refresh_len);
+    e->addr_len = e->refresh_len;
+    e->expires = now + MG_DNS_TTL_MS;
+  } else {
+    mg_dns_stats.failures++;
+    MG_LOG_WRN("DNS refresh of %s failed, keeping cached address", e->host);
+  }
+
+  __atomic_store_n(&e->refresh, REFRESH_IDLE, __ATOMIC_RELAXED);
+}
+
+/* Starts a background refresh unless one is running. Returns false if the
+ * port cannot run one.
+ */
+static bool start_refresh(struct dns_entry *e) {
+  if (__atomic_load_n(&e->refresh, __ATOMIC_ACQUIRE) == REFRESH_RUNNING) {
+    return true;
+  }
+
+  e->refresh = REFRESH_RUNNING;
+  if (mg_run_background(refresh, e) == 0) {
+    return true;
+  }
+
+  e->refresh = REFRESH_IDLE;
+
+  return false;
+}
+
+static struct dns_entry *find(sa_family_t family, const char *host) {
+  for (size_t i = 0; i < MG_DNS_CACHE_SIZE; i++) {
+    if (cache[i].valid && cache[i].family == family &&
+        strcmp(cache[i].host, host) == 0) {
+      return &cache[i];
+    }
+  }
+
+  return NULL;
+}
+
+/* An unused entry, or else the least recently used one not refreshing. */
+static struct dns_entry *victim(void) {
+  struct dns_entry *lru = NULL;
+
+  for (size_t i = 0; i < MG_DNS_CACHE_SIZE; i++) {
+    struct dns_entry *e = &cache[i];
+
+    if (!e->valid) {
+      return e;
+    }
+
+    if (__atomic_load_n(&e->refresh, __ATOMIC_ACQUIRE) == REFRESH_IDLE &&
+        (lru == NULL || e->last_used < lru->last_used)) {
+      lru = e;
+    }
+  }
+
+  return lru;
+}
+
+static int serve(struct dns_entry *e, bool stale, struct sockaddr *addr,
+                 socklen_t addr_len) {
+  if (e->addr_len > addr_len) {
+    return -EINVAL;
+  }
+
+  memcpy(addr, &e->addr, e->addr_len);
+  mg_dns_stats.hits++;
+  if (stale) {
+    mg_dns_stats.stale++;
+  }
+
+  return 0;
+}
+
+int mg_dns_resolve(sa_family_t family, const char *host, int type,
+                   struct sockaddr *addr, socklen_t addr_len) {
+  int64_t now = mg_uptime_ms();
+  struct dns_entry *e = find(family, host);
+  struct sockaddr_storage found;
+  socklen_t found_len;
+  int ret;
+
+  mg_dns_stats.resolutions++;
+
+  if (e != NULL) {
+    apply_refresh(e, now);
+    e->last_used = now;
+
+    if (!e->forced && now < e->expires) {
+      return serve(e, false, addr, addr_len);
+    }
+
+    if (!e->forced && now - e->expires < MG_DNS_STALE_MS &&
+        start_refresh(e)) {
+      return serve(e, true, addr, addr_len);
+    }
+  }
+
+  mg_dns_stats.lookups++;
+  ret = lookup(family, host, type, &found, &found_len);
+  if (ret < 0) {
+    mg_dns_stats.failures++;
+
+    /* Back to background refreshes while the resolver is unreachable. */
+    if (e != NULL) {
+      e->forced = false;
+    }
+
+    if (e != NULL && now - e->expires < MG_DNS_STALE_MS) {
+      MG_LOG_WRN("DNS lookup of %s failed, using cached address", host);
+      return serve(e, true, addr, addr_len);
+    }
+
+    return ret;
+  }
+
+  if (found_len > addr_len) {
+    return -EINVAL;
+  }
+
+  memcpy(addr, &found, found_len);
+
+  if (e == NULL && strlen(host) < MG_DNS_HOST_MAX) {
+    e = victim();
+    if (e != NULL) {
+      strcpy(e->host, host);
+      e->family = family;
+      e->type = type;
+      e->valid = true;
+      e->last_used = now;
+    }
+  }
+
+  if (e != NULL) {
+    e->forced = false;
+  }
+
+  /* A refresh still running for this entry only writes its refresh_*
+   * fields.
+   */
+  if (e != NULL) {
+    memcpy(&e->addr, &found, found_len);
+    e->addr_len = found_len;
+    e->expires = now + MG_DNS_TTL_MS;
+  }
+
+  return 0;
+}
+
+void mg_dns_expire(const char *host) {
+  int64_t now = mg_uptime_ms();
+
+  for (size_t i = 0; i < MG_DNS_CACHE_SIZE; i++) {
+    if (cache[i].valid && strcmp(cache[i].host, host) == 0) {
+      cache[i].forced = true;
+      if (cache[i].expires > now) {
+        cache[i].expires = now;
+      }
+    }
+  }
+}
+
+#else
+
+int mg_dns_resolve(sa_family_t family, const char *host, int type,
+                   struct sockaddr *addr, socklen_t addr_len) {
+  (void)family;
+  (void)host;
+  (void)type;
+  (void)addr;
+  (void)addr_len;
+
+  return -ENOTSUP;
+}
+
+void mg_dns_expire(const char *host) { (void)host; }
+
+#endif
@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mg_http_conn.h"
+#include "mg_net.h"
+#include "mg_platform.h"
+
+MG_LOG_MODULE_DECLARE(mg_common);
+
+static int lower(int c) { return c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c; }
+
+/* Case-insensitive comparison of @p len bytes of @p s with @p lit. */
+static bool equals(const char *s, size_t len, const char *lit) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    if (lit[i] == '\0' || lower(s[i]) != lit[i]) {
+      return false;
+    }
+  }
+
+  return lit[len] == '\0';
+}
+
+/* Whether the server has closed @p sock, or sent something unasked. */
+static bool closed_by_server(int sock) {
+  struct mg_pollfd pfd = {.fd = sock, .events = MG_POLLIN};
+
+  if (mg_sock_poll(&pfd, 1, 0) < 0) {
+    return true;
+  }
+
+  return (pfd.revents & (MG_POLLIN | MG_POLLHUP | MG_POLLERR)) != 0;
+}
+
+void mg_http_conn_init(struct mg_http_conn *conn, const char *host, int port,
+                       uint32_t idle_ms) {
+  memset(conn, 0, sizeof(*conn));
+  conn->host = host;
+  conn->port = port;
+  conn->idle_ms = idle_ms;
+  conn->sock = -1;
+}
+
+int mg_http_conn_acquire(struct mg_http_conn *conn, int64_t now) {
+  struct sockaddr_storage addr;
+  int ret;
+
+  if (conn->sock >= 0 && conn->pending == 0 &&
+      (closed_by_server(conn->sock) ||
+       (conn->idle_ms > 0 && now - conn->last_used >= conn->idle_ms))) {
+    MG_LOG_DBG("HTTP connection closed after %lld ms idle",
+               (long long)(now - conn->last_used));
+    conn->stats.stale++;
+    mg_http_conn_close(conn);
+  }
+
+  if (conn->sock >= 0) {
+    conn->reused = true;
+    conn->pending++;
+    conn->stats.reuses++;
+    return conn->sock;
+  }
+
+  ret = mg_net_connect_socket(AF_INET, conn->host, conn->port, SOCK_STREAM,
+                              &conn->sock, (struct sockaddr *)&addr,
+                              sizeof(addr));
+  if (ret < 0 || conn->sock < 0) {
+    conn->sock = -1;
+    return ret < 0 ? ret : -ECONNABORTED;
+  }
+
+  conn->reused = false;
+  conn->pending = 1;
+  conn->stats.connects++;
+
+  return conn->sock;
+}
+
+void mg_http_conn_release(struct mg_http_conn *conn, bool keep_alive,
+                          int64_t now) {
+  conn->last_used = now;
+  if (conn->pending > 0) {
+    conn->pending--;
+  }
+  if (!keep_alive) {
+    mg_http_conn_close(conn);
+  }
+}
+
+bool mg_http_conn_failed(struct mg_http_conn *conn) {
+  bool retry = conn->reused;
+
+  mg_http_conn_close(conn);
+  if (retry) {
+    conn->stats.retries++;
+  }
+
+  return retry;
+}
+
+void mg_http_conn_close(struct mg_http_conn *conn) {
+  if (conn->sock >= 0) {
+    mg_sock_close(conn->sock);
+    conn->sock = -1;
+  }
+  conn->reused = false;
+  conn->pending = 0;
+}
+
+const char *mg_http_header(const char *head, size_t len, const char *name,
+                           size_t *value_len) {
+  const char *end = head + len;
+  const char *line;
+
+  for (line = head; line < end;) {
+    const char *eol = memchr(line, '\n', end - line);
+    const char *colon;
+
+    if (eol == NULL) {
+      eol = end;
+    }
+    colon = memchr(line, ':', eol - line);
+    if (colon != NULL && equals(line, colon - line, name)) {
+      const char *value = colon + 1;
+      const char *value_end = eol;
+
+      while (value < value_end && (*value == ' ' || *value == '\t')) {
+        value++;
+      }
+      while (value_end > value &&
+             (value_end[-1] == '\r' || value_end[-1] == ' ' ||
+              value_end[-1] == '\t')) {
+        value_end--;
+      }
+      *value_len = value_end - value;
+      return value;
+    }
+    line = eol + 1;
+  }
+
+  return NULL;
+}
+
+bool mg_http_response_keep_alive(const char *head, size_t len) {
+  bool keep_alive = len < 8 || memcmp(head, "HTTP/1.0", 8) != 0;
+  size_t value_len;
+  const char *p = mg_http_header(head, len, "connection", &value_len);
+  const char *end;
+
+  if (p == NULL) {
+    return keep_alive;
+  }
+
+  /* A comma-separated list of options. */
+  for (end = p + value_len; p < end;) {
+    const char *tok;
+
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+      p++;
+    }
+    tok = p;
+    while (p < end && *p != ',' && *p != ' ' && *p != '\t') {
+      p++;
+    }
+    if (equals(tok, p - tok, "close")) {
+      return false;
+    } else if (equals(tok, p - tok, "keep-alive")) {
+      keep_alive = true;
+    }
+  }
+
+  return keep_alive;
+}
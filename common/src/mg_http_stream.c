@@ -0,0 +1,250 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mg_http_conn.h"
+#include "mg_http_stream.h"
+#include "mg_net.h"
+#include "mg_platform.h"
+
+MG_LOG_MODULE_DECLARE(mg_common);
+
+/* CBOR indefinite-length array head and its break. */
+#define CBOR_ARRAY_START 0x9f
+#define CBOR_BREAK 0xff
+
+int mg_http_send_chunked(int sock, mg_http_body_fn produce, void *user,
+                         uint8_t *buf, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  uint8_t *data = buf + MG_HTTP_CHUNK_HEAD;
+  size_t room;
+  int total = 0;
+  ssize_t sent;
+
+  if (len <= MG_HTTP_CHUNK_HEAD + MG_HTTP_CHUNK_TAIL) {
+    return -EINVAL;
+  }
+  room = len - MG_HTTP_CHUNK_HEAD - MG_HTTP_CHUNK_TAIL;
+  if (room > 0xffff) {
+    room = 0xffff;
+  }
+
+  for (;;) {
+    int ret = produce(data, room, user);
+    uint8_t *start = data;
+    size_t n;
+
+    if (ret < 0) {
+      return ret;
+    } else if (ret == 0) {
+      break;
+    } else if ((size_t)ret > room) {
+      return -EINVAL;
+    }
+
+    /* The size line goes right in front of the data, in hex. */
+    *--start = '\n';
+    *--start = '\r';
+    for (n = ret; n > 0; n >>= 4) {
+      *--start = hex[n & 0xf];
+    }
+    data[ret] = '\r';
+    data[ret + 1] = '\n';
+
+    sent = mg_net_send(sock, start, data + ret + MG_HTTP_CHUNK_TAIL - start);
+    if (sent < 0) {
+      return (int)sent;
+    }
+    total += ret;
+  }
+
+  sent = mg_net_send(sock, "0\r\n\r\n", 5);
+
+  return sent < 0 ? (int)sent : total;
+}
+
+void mg_http_reader_init(struct mg_http_reader *r, uint8_t *buf, size_t len) {
+  r->buf = buf;
+  r->len = len;
+  mg_http_reader_reset(r);
+}
+
+void mg_http_reader_reset(struct mg_http_reader *r) {
+  r->fill = 0;
+  r->received = 0;
+}
+
+/* Length of the head at the start of @p buf, up to and including the blank
+ * line, or 0 if it is not all there yet.
+ */
+static size_t head_len(const uint8_t *buf, size_t len) {
+  size_t i;
+
+  for (i = 3; i < len; i++) {
+    if (buf[i] == '\n' && buf[i - 1] == '\r' && buf[i - 2] == '\n' &&
+        buf[i - 3] == '\r') {
+      return i + 1;
+    }
+  }
+
+  return 0;
+}
+
+static int parse_status(const char *head, size_t len) {
+  int status = 0;
+  size_t i;
+
+  if (len < 12 || memcmp(head, "HTTP/1.", 7) != 0 || head[8] != ' ') {
+    return -EPROTO;
+  }
+  for (i = 9; i < 12; i++) {
+    if (head[i] < '0' || head[i] > '9') {
+      return -EPROTO;
+    }
+    status = status * 10 + head[i] - '0';
+  }
+
+  return status;
+}
+
+/* Drops the @p len bytes the current response takes, reading what is not
+ * in the buffer yet.
+ */
+static int consume(struct mg_http_reader *r, int sock, size_t len,
+                   int timeout_ms) {
+  if (len <= r->fill) {
+    memmove(r->buf, r->buf + len, r->fill - len);
+    r->fill -= len;
+    return 0;
+  }
+
+  len -= r->fill;
+  r->fill = 0;
+  while (len > 0) {
+    ssize_t ret = mg_net_recv(sock, r->buf, len < r->len ? len : r->len,
+                              timeout_ms);
+    if (ret <= 0) {
+      return ret < 0 ? (int)ret : -ECONNRESET;
+    }
+    len -= ret;
+  }
+
+  return 0;
+}
+
+int mg_http_read_response(struct mg_http_reader *r, int sock, int timeout_ms,
+                          bool *keep_alive) {
+  for (;;) {
+    const char *head = (const char *)r->buf;
+    const char *value;
+    size_t head_size, value_len, i;
+    size_t body_len = 0;
+    int status, ret;
+
+    /* What was read ahead is the start of this response. */
+    r->received = r->fill;
+    while ((head_size = head_len(r->buf, r->fill)) == 0) {
+      ssize_t n;
+
+      if (r->fill >= r->len) {
+        MG_LOG_ERR("HTTP response headers too large");
+        return -EMSGSIZE;
+      }
+      n = mg_net_recv(sock, r->buf + r->fill, r->len - r->fill, timeout_ms);
+      if (n <= 0) {
+        return n < 0 ? (int)n : -ECONNRESET;
+      }
+      r->fill += n;
+      r->received += n;
+    }
+
+    status = parse_status(head, head_size);
+    if (status < 0) {
+      MG_LOG_ERR("Malformed HTTP response");
+      return status;
+    }
+
+    value = mg_http_header(head, head_size, "transfer-encoding", &value_len);
+    if (value != NULL &&
+        !(value_len == 8 && memcmp(value, "identity", 8) == 0)) {
+      MG_LOG_ERR("Chunked HTTP responses are not supported");
+      return -EPROTO;
+    }
+
+    value = mg_http_header(head, head_size, "content-length", &value_len);
+    for (i = 0; value != NULL && i < value_len; i++) {
+      if (value[i] < '0' || value[i] > '9') {
+        return -EPROTO;
+      }
+      body_len = body_len * 10 + value[i] - '0';
+    }
+
+    *keep_alive = mg_http_response_keep_alive(head, head_size);
+
+    ret = consume(r, sock, head_size + body_len, timeout_ms);
+    if (ret < 0) {
+      return ret;
+    }
+
+    if (status >= 200) {
+      return status;
+    }
+  }
+}
+
+void mg_http_senml_body_init(struct mg_http_senml_body *body,
+                             int (*next)(sensor_data_t *data,
+                                         int64_t *timestamp, void *user),
+                             void *user, int64_t now) {
+  memset(body, 0, sizeof(*body));
+  body->next = next;
+  body->user = user;
+  body->now = now;
+}
+
+int mg_http_senml_body_produce(uint8_t *buf, size_t len, void *user) {
+  struct mg_http_senml_body *body = user;
+  size_t pos = 0;
+
+  if (!body->started) {
+    if (len < 1) {
+      return -E2BIG;
+    }
+    buf[pos++] = CBOR_ARRAY_START;
+    body->started = true;
+  }
+
+  while (!body->ended) {
+    int ret;
+
+    if (!body->pending) {
+      ret = body->next(&body->data, &body->timestamp, body->user);
+      if (ret < 0) {
+        return ret;
+      } else if (ret == 0) {
+        body->ended = true;
+        break;
+      }
+      body->pending = true;
+    }
+
+    ret = mg_telemetry_senml_cbor_encode(&body->data, body->timestamp,
+                                         body->now, buf + pos, len - pos);
+    if (ret < 0) {
+      /* The next chunk starts with it. */
+      return pos > 0 ? (int)pos : -E2BIG;
+    }
+
+    /* Drop the reading's own array head: its records join the stream. */
+    memmove(buf + pos, buf + pos + 1, ret - 1);
+    pos += ret - 1;
+    body->pending = false;
+    body->count++;
+  }
+
+  if (!body->done && pos < len) {
+    buf[pos++] = CBOR_BREAK;
+    body->done = true;
+  }
+
+  return pos;
+}
@@ -0,0 +1,179 @@
+#include "mg_inflight.h"
+
+#define NONE UINT8_MAX
+
+static size_t index_of(const struct mg_inflight *win,
+                       const struct mg_inflight_msg *msg) {
+  return msg - win->msgs;
+}
+
+static void unlink_msg(struct mg_inflight *win, struct mg_inflight_msg *msg) {
+  if (msg->prev != NONE) {
+    win->msgs[msg->prev].next = msg->next;
+  } else {
+    win->head = msg->next;
+  }
+
+  if (msg->next != NONE) {
+    win->msgs[msg->next].prev = msg->prev;
+  } else {
+    win->tail = msg->prev;
+  }
+}
+
+/* Restarts the retransmit timer. With one interval for every entry, the new
+ * deadline is the latest, so the entry goes to the back of the list.
+ */
+static void arm(struct mg_inflight *win, struct mg_inflight_msg *msg,
+                int64_t now) {
+  uint8_t idx = index_of(win, msg);
+
+  msg->deadline = now + win->retry_ms;
+  msg->prev = win->tail;
+  msg->next = NONE;
+
+  if (win->tail != NONE) {
+    win->msgs[win->tail].next = idx;
+  } else {
+    win->head = idx;
+  }
+  win->tail = idx;
+}
+
+void mg_inflight_init(struct mg_inflight *win, struct mg_inflight_msg *storage,
+                      size_t capacity, int64_t retry_ms) {
+  if (capacity > MG_INFLIGHT_MAX) {
+    capacity = MG_INFLIGHT_MAX;
+  }
+
+  win->msgs = storage;
+  win->capacity = capacity;
+  win->retry_ms = retry_ms;
+
+  for (size_t i = 0; i < capacity; i++) {
+    storage[i].id = 0;
+  }
+
+  mg_inflight_reset(win);
+}
+
+struct mg_inflight_msg *mg_inflight_add(struct mg_inflight *win, int qos,
+                                        int64_t now) {
+  struct mg_inflight_msg *msg;
+  size_t idx;
+  uint32_t id;
+
+  if (win->free == 0) {
+    return NULL;
+  }
+
+  idx = __builtin_ctzll(win->free);
+  win->free &= ~(1ULL << idx);
+  win->count++;
+
+  /* Next ID of this entry's sequence; 0 is not a valid message ID. */
+  msg = &win->msgs[idx];
+  id = msg->id != 0 ? msg->id + win->capacity : idx + 1;
+  msg->id = id <= UINT16_MAX ? id : idx + 1;
+
+  msg->state = qos == 2 ? MG_INFLIGHT_WAIT_PUBREC : MG_INFLIGHT_WAIT_PUBACK;
+  msg->retries = 0;
+  msg->payload = NULL;
+  msg->len = 0;
+  arm(win, msg, now);
+
+  return msg;
+}
+
+struct mg_inflight_msg *mg_inflight_find(struct mg_inflight *win,
+                                         uint16_t id) {
+  struct mg_inflight_msg *msg;
+
+  if (id == 0 || win->capacity == 0) {
+    return NULL;
+  }
+
+  msg = &win->msgs[(id - 1) % win->capacity];
+
+  return msg->state != MG_INFLIGHT_FREE && msg->id == id ? msg : NULL;
+}
+
+void mg_inflight_release(struct mg_inflight *win, struct mg_inflight_msg *msg) {
+  if (msg->state == MG_INFLIGHT_FREE) {
+    return;
+  }
+
+  unlink_msg(win, msg);
+  msg->state = MG_INFLIGHT_FREE;
+  win->free |= 1ULL << index_of(win, msg);
+  win->count--;
+}
+
+struct mg_inflight_msg *mg_inflight_ack(struct mg_inflight *win,
+                                        enum mg_inflight_ack ack, uint16_t id,
+                                        int64_t now) {
+  struct mg_inflight_msg *msg = mg_inflight_find(win, id);
+
+  if (msg == NULL) {
+    return NULL;
+  }
+
+  switch (ack) {
+  case MG_INFLIGHT_PUBACK:
+    if (msg->state != MG_INFLIGHT_WAIT_PUBACK) {
+      return NULL;
+    }
+    mg_inflight_release(win, msg);
+    break;
+  case MG_INFLIGHT_PUBREC:
+    /* A repeated PUBREC means our PUBREL was lost: send it again. */
+    if (msg->state != MG_INFLIGHT_WAIT_PUBREC &&
+        msg->state != MG_INFLIGHT_WAIT_PUBCOMP) {
+      return NULL;
+    }
+    msg->state = MG_INFLIGHT_WAIT_PUBCOMP;
+    msg->retries = 0;
+    unlink_msg(win, msg);
+    arm(win, msg, now);
+    break;
+  case MG_INFLIGHT_PUBCOMP:
+    if (msg->state != MG_INFLIGHT_WAIT_PUBCOMP) {
+      return NULL;
+    }
+    mg_inflight_release(win, msg);
+    break;
+  }
+
+  return msg;
+}
+
+struct mg_inflight_msg *mg_inflight_expired(struct mg_inflight *win,
+                                            int64_t now) {
+  struct mg_inflight_msg *msg;
+
+  if (win->head == NONE || win->msgs[win->head].deadline > now) {
+    return NULL;
+  }
+
+  msg = &win->msgs[win->head];
+  msg->retries++;
+  unlink_msg(win, msg);
+  arm(win, msg, now);
+
+  return msg;
+}
+
+int64_t mg_inflight_next_deadline(const struct mg_inflight *win) {
+  return win->head != NONE ? win->msgs[win->head].deadline : INT64_MAX;
+}
+
+void mg_inflight_reset(struct mg_inflight *win) {
+  for (size_t i = 0; i < win->capacity; i++) {
+    win->msgs[i].state = MG_INFLIGHT_FREE;
+  }
+
+  win->free = win->capacity < 64 ? (1ULL << win->capacity) - 1 : UINT64_MAX;
+  win->count = 0;
+  win->head = NONE;
+  win->tail = NONE;
+}
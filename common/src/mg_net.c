@@ -0,0 +1,147 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mg_dns.h"
+#include "mg_net.h"
+
+MG_LOG_MODULE_DECLARE(mg_common);
+
+struct mg_net_stats mg_net_stats;
+
+static int resolve(sa_family_t family, const char *server, int type,
+                   struct sockaddr *addr, socklen_t addr_len) {
+  void *sin_addr = family == AF_INET
+                       ? (void *)&((struct sockaddr_in *)addr)->sin_addr
+                       : (void *)&((struct sockaddr_in6 *)addr)->sin6_addr;
+
+  if (mg_sock_inet_pton(family, server, sin_addr) == 1) {
+    return 0;
+  }
+
+#if MG_HAVE_GETADDRINFO
+  if (mg_dns_resolve(family, server, type, addr, addr_len) == 0) {
+    return 0;
+  }
+#else
+  (void)type;
+  (void)addr_len;
+#endif
+
+  return -EINVAL;
+}
+
+int mg_net_setup_socket(sa_family_t family, const char *server, int port,
+                        int type, int *sock, struct sockaddr *addr,
+                        socklen_t addr_len) {
+  const char *family_str = family == AF_INET ? "IPv4" : "IPv6";
+
+  memset(addr, 0, addr_len);
+  *sock = -1;
+
+  if (resolve(family, server, type, addr, addr_len) < 0) {
+    MG_LOG_ERR("Cannot resolve %s %s address", server, family_str);
+    return -EINVAL;
+  }
+
+  if (family == AF_INET) {
+    ((struct sockaddr_in *)addr)->sin_family = AF_INET;
+    ((struct sockaddr_in *)addr)->sin_port = htons(port);
+  } else {
+    ((struct sockaddr_in6 *)addr)->sin6_family = AF_INET6;
+    ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+  }
+
+  *sock = mg_sock_socket(family, type, 0);
+  if (*sock < 0) {
+    MG_LOG_ERR("Failed to create %s socket (%d)", family_str, -errno);
+    return -errno;
+  }
+
+  return 0;
+}
+
+int mg_net_connect_socket(sa_family_t family, const char *server, int port,
+                          int type, int *sock, struct sockaddr *addr,
+                          socklen_t addr_len) {
+  int ret;
+
+  ret = mg_net_setup_socket(family, server, port, type, sock, addr, addr_len);
+  if (ret < 0 || *sock < 0) {
+    return ret < 0 ? ret : -EINVAL;
+  }
+
+  ret = mg_sock_connect(*sock, addr, addr_len);
+  if (ret < 0) {
+    ret = -errno;
+    MG_LOG_ERR("Cannot connect to %s remote (%d)",
+               family == AF_INET ? "IPv4" : "IPv6", ret);
+    mg_sock_close(*sock);
+    *sock = -1;
+    /* The host may have moved: look it up again next time. */
+    mg_dns_expire(server);
+  }
+
+  return ret;
+}
+
+ssize_t mg_net_send(int sock, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+  size_t sent = 0;
+
+  while (sent < len) {
+    ssize_t ret = mg_sock_send(sock, p + sent, len - sent, MG_SEND_FLAGS);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+
+    mg_net_stats.tx_calls++;
+    sent += ret;
+  }
+
+  mg_net_stats.tx_bytes += sent;
+
+  return sent;
+}
+
+ssize_t mg_net_recv(int sock, void *buf, size_t len, int timeout_ms) {
+  struct mg_pollfd pfd = {.fd = sock, .events = MG_POLLIN};
+  ssize_t ret;
+
+  ret = mg_sock_poll(&pfd, 1, timeout_ms);
+  if (ret < 0) {
+    return -errno;
+  } else if (ret == 0) {
+    return -ETIMEDOUT;
+  }
+
+  ret = mg_sock_recv(sock, buf, len, 0);
+  if (ret < 0) {
+    return -errno;
+  }
+
+  mg_net_stats.rx_calls++;
+  mg_net_stats.rx_bytes += ret;
+
+  return ret;
+}
+
+int mg_net_recv_all(int sock, void *buf, size_t len, int timeout_ms) {
+  uint8_t *p = buf;
+  size_t got = 0;
+
+  while (got < len) {
+    ssize_t ret = mg_net_recv(sock, p + got, len - got, timeout_ms);
+    if (ret < 0) {
+      return ret;
+    } else if (ret == 0) {
+      return -ECONNRESET;
+    }
+
+    got += ret;
+  }
+
+  return 0;
+}
@@ -0,0 +1,12 @@
+#include "mg_platform.h"
+#include "mg_senml.h"
+
+double mg_senml_time(int64_t timestamp, int64_t now) {
+  int64_t boot_epoch = mg_boot_epoch_ms();
+
+  if (boot_epoch != 0) {
+    return (boot_epoch + timestamp) / 1000.0;
+  }
+
+  return (timestamp - now) / 1000.0;
+}
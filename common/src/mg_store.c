@@ -0,0 +1,48 @@
+#include <errno.h>
+
+#include "mg_platform.h"
+#include "mg_store.h"
+
+MG_LOG_MODULE_DECLARE(mg_common);
+
+struct mg_store_stats mg_store_stats;
+
+int mg_store_drain(mg_store_send_fn send, void *user, uint8_t *buf, size_t len,
+                   size_t max) {
+  size_t replayed = 0;
+  int ret;
+
+  while (replayed < max) {
+    ret = mg_store_peek(buf, len);
+    if (ret == -ENODATA) {
+      break;
+    }
+
+    if (ret == -E2BIG) {
+      MG_LOG_WRN("Queued message larger than %zu B, dropped", len);
+      mg_store_pop();
+      mg_store_stats.dropped++;
+      continue;
+    }
+
+    if (ret < 0) {
+      return ret;
+    }
+
+    ret = send(buf, ret, user);
+    if (ret < 0) {
+      return ret;
+    }
+
+    mg_store_pop();
+    mg_store_stats.replayed++;
+    replayed++;
+  }
+
+  if (replayed > 0) {
+    MG_LOG_DBG("Replayed %zu queued messages, %u left", replayed,
+               (unsigned int)mg_store_stats.depth);
+  }
+
+  return replayed;
+}
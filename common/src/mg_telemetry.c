@@ -0,0 +1,50 @@
+#include <errno.h>
+#include <stdio.h>
+
+#include "mg_senml.h"
+#include "mg_telemetry.h"
+
+int mg_telemetry_json_encode(const sensor_data_t *data, int64_t timestamp,
+                             char *buf, size_t len) {
+  int ret;
+
+  ret = snprintf(buf, len,
+                 "{"
+                 "\"temperature\":%.1f,"
+                 "\"humidity\":%.1f,"
+                 "\"battery\":%d,"
+                 "\"led_state\":%s,"
+                 "\"timestamp\":%lld"
+                 "}",
+                 data->temperature, data->humidity, data->battery_level,
+                 data->led_state ? "true" : "false", (long long)timestamp);
+
+  if (ret < 0 || (size_t)ret >= len) {
+    return -E2BIG;
+  }
+
+  return ret;
+}
+
+int mg_telemetry_senml_json_encode(const sensor_data_t *data,
+                                   int64_t timestamp, int64_t now, char *buf,
+                                   size_t len) {
+  int ret;
+
+  ret = snprintf(buf, len,
+                 "["
+                 "{\"bt\":%.3f,\"n\":\"temperature\",\"u\":\"Cel\",\"v\":%.1f},"
+                 "{\"n\":\"humidity\",\"u\":\"%%RH\",\"v\":%.1f},"
+                 "{\"n\":\"battery\",\"u\":\"%%EL\",\"v\":%d},"
+                 "{\"n\":\"led_state\",\"vb\":%s}"
+                 "]",
+                 mg_senml_time(timestamp, now), data->temperature,
+                 data->humidity, data->battery_level,
+                 data->led_state ? "true" : "false");
+
+  if (ret < 0 || (size_t)ret >= len) {
+    return -E2BIG;
+  }
+
+  return ret;
+}
@@ -0,0 +1,51 @@
+#include "mg_cbor.h"
+#include "mg_senml.h"
+#include "mg_telemetry.h"
+
+#define LITERAL(str) str, sizeof(str) - 1
+
+static void put_label(struct mg_cbor_writer *w, enum mg_senml_label label) {
+  mg_cbor_put_int(w, label);
+}
+
+static void put_record(struct mg_cbor_writer *w, const char *name,
+                       size_t name_len, const char *unit, size_t unit_len,
+                       double value) {
+  mg_cbor_put_map(w, 3);
+  put_label(w, MG_SENML_NAME);
+  mg_cbor_put_text(w, name, name_len);
+  put_label(w, MG_SENML_UNIT);
+  mg_cbor_put_text(w, unit, unit_len);
+  put_label(w, MG_SENML_VALUE);
+  mg_cbor_put_number(w, value);
+}
+
+int mg_telemetry_senml_cbor_encode(const sensor_data_t *data,
+                                   int64_t timestamp, int64_t now,
+                                   uint8_t *buf, size_t len) {
+  struct mg_cbor_writer w;
+
+  mg_cbor_init(&w, buf, len);
+  mg_cbor_put_array(&w, 4);
+
+  mg_cbor_put_map(&w, 4);
+  put_label(&w, MG_SENML_BASE_TIME);
+  mg_cbor_put_number(&w, mg_senml_time(timestamp, now));
+  put_label(&w, MG_SENML_NAME);
+  mg_cbor_put_text(&w, LITERAL("temperature"));
+  put_label(&w, MG_SENML_UNIT);
+  mg_cbor_put_text(&w, LITERAL("Cel"));
+  put_label(&w, MG_SENML_VALUE);
+  mg_cbor_put_number(&w, data->temperature);
+
+  put_record(&w, LITERAL("humidity"), LITERAL("%RH"), data->humidity);
+  put_record(&w, LITERAL("battery"), LITERAL("%EL"), data->battery_level);
+
+  mg_cbor_put_map(&w, 2);
+  put_label(&w, MG_SENML_NAME);
+  mg_cbor_put_text(&w, LITERAL("led_state"));
+  put_label(&w, MG_SENML_BOOL_VALUE);
+  mg_cbor_put_bool(&w, data->led_state);
+
+  return mg_cbor_finish(&w);
+}
@@ -0,0 +1,37 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mg_topic.h"
+
+static int topic_join(char *buf, size_t len, const char *const parts[],
+                      size_t count) {
+  size_t pos = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    size_t part_len = strlen(parts[i]);
+
+    if (pos + part_len >= len) {
+      return -ENOMEM;
+    }
+
+    memcpy(buf + pos, parts[i], part_len);
+    pos += part_len;
+  }
+
+  buf[pos] = '\0';
+
+  return pos;
+}
+
+int mg_topic_format(char *buf, size_t len, const char *domain_id,
+                    const char *channel_id) {
+  const char *const parts[] = {"m/", domain_id, "/c/", channel_id};
+
+  return topic_join(buf, len, parts, sizeof(parts) / sizeof(parts[0]));
+}
+
+int mg_legacy_topic_format(char *buf, size_t len, const char *channel_id) {
+  const char *const parts[] = {"channels/", channel_id, "/messages"};
+
+  return topic_join(buf, len, parts, sizeof(parts) / sizeof(parts[0]));
+}
@@ -0,0 +1,113 @@
+#include <errno.h>
+#include <string.h>
+
+#include "mg_net.h"
+#include "mg_platform.h"
+#include "mg_ws.h"
+
+MG_LOG_MODULE_DECLARE(mg_common);
+
+#define WS_FIN 0x80
+#define WS_MASK 0x80
+
+void mg_ws_mask(uint8_t *data, size_t len, const uint8_t key[4]) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    data[i] ^= key[i & 3];
+  }
+}
+
+uint8_t *mg_ws_frame(uint8_t *payload, size_t len, uint8_t opcode,
+                     uint32_t mask, size_t *frame_len) {
+  uint8_t *key = payload - 4;
+  uint8_t *p;
+
+  if (len < 126) {
+    p = key - 2;
+    p[1] = WS_MASK | len;
+  } else if (len <= 0xffff) {
+    p = key - 4;
+    p[1] = WS_MASK | 126;
+    p[2] = len >> 8;
+    p[3] = len & 0xff;
+  } else {
+    uint64_t n = len;
+    int i;
+
+    p = key - 10;
+    p[1] = WS_MASK | 127;
+    for (i = 9; i >= 2; i--) {
+      p[i] = n & 0xff;
+      n >>= 8;
+    }
+  }
+  p[0] = WS_FIN | opcode;
+
+  memcpy(key, &mask, 4);
+  mg_ws_mask(payload, len, key);
+
+  *frame_len = payload + len - p;
+
+  return p;
+}
+
+int mg_ws_send(int sock, uint8_t opcode, uint8_t *payload, size_t len) {
+  size_t frame_len;
+  uint8_t *frame = mg_ws_frame(payload, len, opcode, mg_rand32(), &frame_len);
+  ssize_t ret = mg_net_send(sock, frame, frame_len);
+
+  return ret < 0 ? (int)ret : 0;
+}
+
+void mg_ws_keepalive_init(struct mg_ws_keepalive *ka, uint32_t interval_ms,
+                          uint32_t timeout_ms, int64_t now) {
+  memset(ka, 0, sizeof(*ka));
+  ka->interval_ms = interval_ms;
+  ka->timeout_ms = timeout_ms;
+  ka->last_rx = now;
+  ka->ping_sent = -1;
+}
+
+void mg_ws_keepalive_rx(struct mg_ws_keepalive *ka, uint8_t opcode,
+                        int64_t now) {
+  ka->last_rx = now;
+  if (opcode == MG_WS_OPCODE_PONG && ka->ping_sent >= 0) {
+    ka->rtt_ms = now - ka->ping_sent;
+    ka->pongs++;
+  }
+  /* Any frame shows the server is there. */
+  ka->ping_sent = -1;
+}
+
+int mg_ws_keepalive_check(struct mg_ws_keepalive *ka, int64_t now) {
+  if (ka->interval_ms == 0) {
+    return 0;
+  }
+
+  if (ka->ping_sent >= 0) {
+    if (now - ka->ping_sent < ka->timeout_ms) {
+      return 0;
+    }
+    MG_LOG_WRN("No WebSocket pong in %u ms", ka->timeout_ms);
+    return -ETIMEDOUT;
+  }
+
+  if (now - ka->last_rx < ka->interval_ms) {
+    return 0;
+  }
+
+  ka->ping_sent = now;
+  ka->pings++;
+
+  return 1;
+}
+
+int64_t mg_ws_keepalive_deadline(const struct mg_ws_keepalive *ka) {
+  if (ka->interval_ms == 0) {
+    return INT64_MAX;
+  }
+
+  return ka->ping_sent >= 0 ? ka->ping_sent + ka->timeout_ms
+                            : ka->last_rx + ka->interval_ms;
+}
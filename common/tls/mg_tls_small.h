@@ -0,0 +1,100 @@
+#ifndef MG_TLS_SMALL_H
+#define MG_TLS_SMALL_H
+
+/* Reduced-footprint mbedTLS profile for the MQTTS clients, included at the
+ * end of the platform's mbedTLS configuration (MBEDTLS_USER_CONFIG_FILE).
+ * It trades the 16 KB records and the full suite list for what a client
+ * with small MQTT buffers talking to one known broker needs:
+ *
+ * - Maximum Fragment Length (RFC 6066): the client asks the broker for
+ *   records of at most MG_TLS_FRAGMENT_LEN bytes, so both record buffers
+ *   can shrink to that. Zephyr's TLS sockets ask for the length matching
+ *   the content length; other clients pass MG_TLS_MFL_CODE to
+ *   mbedtls_ssl_conf_max_frag_len(). The broker's Certificate message
+ *   must still fit one buffer, so keep its chain short.
+ * - Variable buffers: after the handshake mbedTLS resizes the buffers to
+ *   the negotiated length.
+ * - ECDHE-ECDSA with AES-128-GCM on P-256 only (MG_TLS_CIPHERSUITES), so
+ *   the broker needs an ECDSA certificate. The other key exchanges, ciphers
+ *   and curves are compiled out. RSA stays, for CAs that sign with it.
+ *
+ * record_size_limit (RFC 8449) would do the same as MFL, but mbedTLS only
+ * has it for TLS 1.3.
+ */
+#define MG_TLS_PROFILE_SMALL
+
+#define MG_TLS_FRAGMENT_LEN 2048
+#define MG_TLS_MFL_CODE MBEDTLS_SSL_MAX_FRAG_LEN_2048
+/* Suites for mbedtls_ssl_conf_ciphersuites() or the socket cipher list;
+ * needs mbedtls/ssl_ciphersuites.h.
+ */
+#define MG_TLS_CIPHERSUITES MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256
+
+#ifndef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+#define MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+#endif
+#ifndef MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH
+#define MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH
+#endif
+
+#undef MBEDTLS_SSL_MAX_CONTENT_LEN
+#define MBEDTLS_SSL_MAX_CONTENT_LEN MG_TLS_FRAGMENT_LEN
+#undef MBEDTLS_SSL_IN_CONTENT_LEN
+#define MBEDTLS_SSL_IN_CONTENT_LEN MG_TLS_FRAGMENT_LEN
+#undef MBEDTLS_SSL_OUT_CONTENT_LEN
+#define MBEDTLS_SSL_OUT_CONTENT_LEN MG_TLS_FRAGMENT_LEN
+
+/* What ECDHE-ECDSA with AES-128-GCM needs. */
+#ifndef MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA_ENABLED
+#define MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA_ENABLED
+#endif
+#ifndef MBEDTLS_ECDH_C
+#define MBEDTLS_ECDH_C
+#endif
+#ifndef MBEDTLS_ECDSA_C
+#define MBEDTLS_ECDSA_C
+#endif
+#ifndef MBEDTLS_ECP_C
+#define MBEDTLS_ECP_C
+#endif
+#ifndef MBEDTLS_ECP_DP_SECP256R1_ENABLED
+#define MBEDTLS_ECP_DP_SECP256R1_ENABLED
+#endif
+#ifndef MBEDTLS_GCM_C
+#define MBEDTLS_GCM_C
+#endif
+
+#undef MBEDTLS_KEY_EXCHANGE_RSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_DHE_RSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDHE_RSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDH_RSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDH_ECDSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_PSK_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_DHE_PSK_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDHE_PSK_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_RSA_PSK_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECJPAKE_ENABLED
+#undef MBEDTLS_DHM_C
+
+#undef MBEDTLS_ARIA_C
+#undef MBEDTLS_CAMELLIA_C
+#undef MBEDTLS_CHACHAPOLY_C
+#undef MBEDTLS_CHACHA20_C
+#undef MBEDTLS_POLY1305_C
+
+#undef MBEDTLS_ECP_DP_SECP192R1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP224R1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP384R1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP521R1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP192K1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP224K1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP256K1_ENABLED
+#undef MBEDTLS_ECP_DP_BP256R1_ENABLED
+#undef MBEDTLS_ECP_DP_BP384R1_ENABLED
+#undef MBEDTLS_ECP_DP_BP512R1_ENABLED
+#undef MBEDTLS_ECP_DP_CURVE25519_ENABLED
+#undef MBEDTLS_ECP_DP_CURVE448_ENABLED
+
+#undef MBEDTLS_SSL_RENEGOTIATION
+
+#endif
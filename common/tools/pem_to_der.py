@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Converts PEM credentials to DER arrays for the firmware to embed.
+
+    pem_to_der.py <out.c> <out.h> <name>=<file.pem> [<name>=<file.pem> ...]
+
+Each <name> becomes `const unsigned char <name>[]` holding the DER of the
+first PEM block in <file.pem>, and `const size_t <name>_len`. mbedTLS parses
+DER without its PEM and base64 code, and can parse certificates in place
+(mbedtls_x509_crt_parse_der_nocopy()) since the arrays stay in flash.
+
+DER holds a single certificate, so a PEM file with a chain is refused: give
+each certificate a name of its own.
+"""
+
+import base64
+import os
+import re
+import sys
+
+PEM_BLOCK = re.compile(
+    rb"-----BEGIN ([A-Z0-9 ]+)-----\s*(.*?)\s*-----END \1-----", re.S)
+
+
+def der_of(path):
+    with open(path, "rb") as f:
+        blocks = PEM_BLOCK.findall(f.read())
+    if not blocks:
+        sys.exit("%s: no PEM block" % path)
+    if len(blocks) > 1 and blocks[0][0].endswith(b"CERTIFICATE"):
+        sys.exit("%s: %d certificates, give each its own name" %
+                 (path, len(blocks)))
+    # EC keys may be preceded by an EC PARAMETERS block; the key follows.
+    label, body = next((b for b in blocks if b[0].endswith(b"KEY")),
+                       blocks[0])
+    return base64.b64decode(b"".join(body.split()))
+
+
+def c_array(name, der):
+    lines = ["const unsigned char %s[] = {" % name]
+    for i in range(0, len(der), 12):
+        lines.append("  " + " ".join("0x%02x," % b for b in der[i:i + 12]))
+    lines.append("};")
+    lines.append("const size_t %s_len = sizeof(%s);" % (name, name))
+    return "\n".join(lines)
+
+
+def main():
+    if len(sys.argv) < 4:
+        sys.exit(__doc__)
+    out_c, out_h = sys.argv[1:3]
+    creds = []
+    for arg in sys.argv[3:]:
+        name, sep, path = arg.partition("=")
+        if not sep or not re.fullmatch(r"[A-Za-z_]\w*", name):
+            sys.exit("expected <name>=<file.pem>, got %s" % arg)
+        creds.append((name, der_of(path)))
+
+    guard = re.sub(r"\W", "_", os.path.basename(out_h)).upper()
+    with open(out_h, "w") as f:
+        f.write("/* Generated by pem_to_der.py. */\n")
+        f.write("#ifndef %s\n#define %s\n\n#include <stddef.h>\n\n" %
+                (guard, guard))
+        for name, _ in creds:
+            f.write("extern const unsigned char %s[];\n" % name)
+            f.write("extern const size_t %s_len;\n" % name)
+        f.write("\n#endif\n")
+
+    with open(out_c, "w") as f:
+        f.write("/* Generated by pem_to_der.py. */\n")
+        f.write('#include "%s"\n' % os.path.basename(out_h))
+        for name, der in creds:
+            f.write("\n" + c_array(name, der) + "\n")
+
+
+if __name__ == "__main__":
+    main()
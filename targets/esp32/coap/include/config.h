@@ -10,4 +10,8 @@ char mfTopic[150];
 
 const char *server = " ";
 
+// Delay before registering again after the Observe registration failed or
+// the server answered without observing
+#define COAP_OBSERVE_RETRY_SEC 30
+
 #endif
\ No newline at end of file
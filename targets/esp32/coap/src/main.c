@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -14,25 +15,56 @@
 // #include "protocol_examples_common.h"
 #include "coap3/coap.h"
 #include "config.h"
+#include "mg_coap_observe.h"
+#include "mg_platform.h"
+#include "mg_topic.h"
 #include "cnetwork.h"
 
 const static char *TAG = CLIENTID;
 
-static int resp_wait = 1;
 static coap_optlist_t *optlist = NULL;
-static int wait_ms;
+
+static struct mg_coap_observe observe;
+// Token of the Observe registration, kept to renew it and to match its
+// notifications
+static uint8_t observe_token[8];
+static size_t observe_token_len;
+// Message ID of the registration in flight, if any
+static coap_mid_t observe_mid = COAP_INVALID_MID;
 
 
 void format_mainflux_message_topic(void)
 {
-    const char *_preId = "channels/";
-    const char *_postId = "/messages";
-    strcpy(mfTopic, _preId);
-    strcat(mfTopic, mfChannelId);
-    strcat(mfTopic, _postId);
+    int len = mg_legacy_topic_format(mfTopic, sizeof(mfTopic), mfChannelId);
+
+    // Encode the Uri-Path options once, every request reuses the list
+    if (len > 0 && optlist == NULL)
+    {
+        coap_path_into_optlist((const uint8_t *)mfTopic, len, COAP_OPTION_URI_PATH, &optlist);
+    }
 }
 
 
+static bool is_observe_token(coap_bin_const_t token)
+{
+    return observe_token_len > 0 && token.length == observe_token_len &&
+           memcmp(token.s, observe_token, observe_token_len) == 0;
+}
+
+static uint32_t get_option_uint(const coap_pdu_t *pdu, coap_option_num_t num, uint32_t absent)
+{
+    coap_opt_iterator_t opt_iter;
+    coap_opt_t *option = coap_check_option(pdu, num, &opt_iter);
+
+    if (option == NULL)
+    {
+        return absent;
+    }
+    return coap_decode_var_bytes(coap_opt_value(option), coap_opt_length(option));
+}
+
+// Commands arrive as notifications of the Observe registration: the first
+// one answers the registration, later ones are pushed by the server
 static coap_response_t message_handler(coap_session_t *session,
                                        const coap_pdu_t *sent,
                                        const coap_pdu_t *received,
@@ -43,9 +75,33 @@ static coap_response_t message_handler(coap_session_t *session,
     size_t offset;
     size_t total;
     coap_pdu_code_t rcvd_code = coap_pdu_get_code(received);
+    int64_t now = mg_uptime_ms();
+
+    if (!is_observe_token(coap_pdu_get_token(received)))
+    {
+        return COAP_RESPONSE_OK;
+    }
+    observe_mid = COAP_INVALID_MID;
 
     if (COAP_RESPONSE_CLASS(rcvd_code) == 2)
     {
+        uint32_t seq = get_option_uint(received, COAP_OPTION_OBSERVE, UINT32_MAX);
+
+        if (seq == UINT32_MAX)
+        {
+            // Answered, but not registered: poll again after the retry time
+            ESP_LOGW(TAG, "Server does not observe %s", mfTopic);
+            mg_coap_observe_failed(&observe, now, COAP_OBSERVE_RETRY_SEC * 1000);
+        }
+        else if (!mg_coap_observe_notified(&observe, seq,
+                                           get_option_uint(received, COAP_OPTION_MAXAGE,
+                                                           MG_COAP_OBSERVE_MAX_AGE_S),
+                                           now))
+        {
+            // Overtaken by a newer notification
+            return COAP_RESPONSE_OK;
+        }
+
         if (coap_get_data_large(received, &data_len, &data, &offset, &total))
         {
             if (data_len != total)
@@ -53,7 +109,6 @@ static coap_response_t message_handler(coap_session_t *session,
                 printf("Unexpected partial data received offset %u, length %u\n", offset, data_len);
             }
             printf("Received:\n%.*s\n", (int)data_len, data);
-            resp_wait = 0;
         }
         return COAP_RESPONSE_OK;
     }
@@ -68,10 +123,49 @@ static coap_response_t message_handler(coap_session_t *session,
         }
     }
     printf("\n");
-    resp_wait = 0;
+    mg_coap_observe_failed(&observe, now, COAP_OBSERVE_RETRY_SEC * 1000);
     return COAP_RESPONSE_OK;
 }
 
+// libcoap gave up on the registration, or the server reset it
+static void nack_handler(coap_session_t *session,
+                         const coap_pdu_t *sent,
+                         const coap_nack_reason_t reason,
+                         const coap_mid_t mid)
+{
+    if (mid != observe_mid)
+    {
+        return;
+    }
+
+    observe_mid = COAP_INVALID_MID;
+    mg_coap_observe_failed(&observe, mg_uptime_ms(), COAP_OBSERVE_RETRY_SEC * 1000);
+}
+
+// GET with Observe 0 on the channel topic. The first registration takes a
+// fresh token, renewals reuse it so the server updates the same one.
+static coap_mid_t send_observe(coap_session_t *session, coap_pdu_type_t type)
+{
+    coap_pdu_t *request = coap_new_pdu(type, COAP_REQUEST_CODE_GET, session);
+    unsigned char buf[4];
+
+    if (!request)
+    {
+        ESP_LOGE(TAG, "coap_new_pdu() failed");
+        return COAP_INVALID_MID;
+    }
+    if (observe_token_len == 0)
+    {
+        coap_session_new_token(session, &observe_token_len, observe_token);
+    }
+    coap_add_token(request, observe_token_len, observe_token);
+    coap_add_option(request, COAP_OPTION_OBSERVE,
+                    coap_encode_var_safe(buf, sizeof(buf), COAP_OBSERVE_ESTABLISH), buf);
+    coap_add_optlist_pdu(request, &optlist);
+
+    return coap_send(session, request);
+}
+
 static void coap_log_handler(coap_log_t level, const char *message)
 {
     uint32_t esp_level = ESP_LOG_INFO;
@@ -96,9 +190,6 @@ static void coap_client(void *p)
     const char *server_uri = server;
     coap_context_t *ctx = NULL;
     coap_session_t *session = NULL;
-    coap_pdu_t *request = NULL;
-    unsigned char token[8];
-    size_t tokenlength;
     coap_addr_info_t *info_list = NULL;
     coap_proto_t proto;
     char tmpbuf[INET6_ADDRSTRLEN];
@@ -118,6 +209,7 @@ static void coap_client(void *p)
                                 COAP_BLOCK_USE_LIBCOAP | COAP_BLOCK_SINGLE_BODY);
 
     coap_register_response_handler(ctx, message_handler);
+    coap_register_nack_handler(ctx, nack_handler);
 
     if (coap_split_uri((const uint8_t *)server_uri, strlen(server_uri), &uri) == -1)
     {
@@ -146,46 +238,35 @@ static void coap_client(void *p)
         clean_up();
     }
 
-    while (true)
-    {
-        request = coap_new_pdu(coap_is_mcast(&dst_addr) ? COAP_MESSAGE_NON : COAP_MESSAGE_CON,
-                               COAP_REQUEST_CODE_GET, session);
-        if (!request)
-        {
-            ESP_LOGE(TAG, "coap_new_pdu() failed");
-            goto clean_up;
-        }
-        coap_session_new_token(session, &tokenlength, token);
-        coap_add_token(request, tokenlength, token);
-        coap_add_optlist_pdu(request, &optlist);
+    format_mainflux_message_topic();
 
-        resp_wait = 1;
-        coap_send(session, request);
+    mg_coap_observe_init(&observe, mg_uptime_ms());
 
-        wait_ms = COAP_DEFAULT_TIME_SEC * MS_COUNT;
+    // Commands are pushed as notifications, so the loop only wakes to
+    // register, and to renew the registration when Max-Age runs out
+    while (true)
+    {
+        int64_t now = mg_uptime_ms();
+        uint32_t wait;
 
-        while (resp_wait)
+        if (mg_coap_observe_due(&observe, now))
         {
-            int result = coap_io_process(ctx, wait_ms > 1000 ? 1000 : wait_ms);
-            if (result >= 0)
+            observe_mid = send_observe(session, coap_is_mcast(&dst_addr) ? COAP_MESSAGE_NON
+                                                                         : COAP_MESSAGE_CON);
+            if (observe_mid == COAP_INVALID_MID)
             {
-                if (result >= wait_ms)
-                {
-                    ESP_LOGE(TAG, "No response from server");
-                    break;
-                }
-                else
-                {
-                    wait_ms -= result;
-                }
+                ESP_LOGE(TAG, "coap_send() failed");
+                mg_coap_observe_failed(&observe, now, COAP_OBSERVE_RETRY_SEC * 1000);
+            }
+            else
+            {
+                ESP_LOGI(TAG, "Observing %s", mfTopic);
+                mg_coap_observe_sent(&observe, now, COAP_DEFAULT_TIME_SEC * MS_COUNT);
             }
         }
-        for (int countdown = 10; countdown >= 0; countdown--)
-        {
-            ESP_LOGI(TAG, "%d... ", countdown);
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-        }
-        ESP_LOGI(TAG, "Starting again!");
+
+        wait = mg_coap_observe_wait_ms(&observe, mg_uptime_ms());
+        coap_io_process(ctx, wait > 0 ? wait : COAP_IO_NO_WAIT);
     }
 }
 void clean_up()
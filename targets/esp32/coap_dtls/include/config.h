@@ -10,4 +10,37 @@ char mfTopic[150];
 
 const char *server = " ";
 
+// DTLS credentials, picked at build time with -DDTLS_MODE: PKI sends the
+// certificates in certs/, RPK (RFC 7250) only the public key of client.key
+// and PSK the pre-shared key below, which makes the smallest handshake.
+// RPK does not build with libcoap's mbedTLS backend, which ESP-IDF uses.
+#define DTLS_MODE_PKI 0
+#define DTLS_MODE_RPK 1
+#define DTLS_MODE_PSK 2
+#ifndef DTLS_MODE
+#define DTLS_MODE DTLS_MODE_PKI
+#endif
+
+#if DTLS_MODE == DTLS_MODE_PSK
+#define DTLS_MODE_NAME "PSK"
+#elif DTLS_MODE == DTLS_MODE_RPK
+#define DTLS_MODE_NAME "RPK"
+#else
+#define DTLS_MODE_NAME "PKI"
+#endif
+
+const char *pskIdentity = " ";
+const char *pskKey = " ";
+
+// Delay before registering again after the Observe registration failed or
+// the server answered without observing
+#define COAP_OBSERVE_RETRY_SEC 30
+
+// Delays before a new DTLS session once the old one closed or failed
+// (mg_backoff.h)
+#define DTLS_BACKOFF_FIRST_MS 1000
+#define DTLS_BACKOFF_BASE_MS 2000
+#define DTLS_BACKOFF_MAX_MS 300000
+#define DTLS_BACKOFF_STABLE_MS 60000
+
 #endif
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "esp_log.h"
+#include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "nvs_flash.h"
@@ -14,24 +15,89 @@
 #include "protocol_examples_common.h"
 #include "coap3/coap.h"
 #include "config.h"
+#include "mg_backoff.h"
+#include "mg_coap_observe.h"
+#include "mg_platform.h"
+#include "mg_topic.h"
 #include "cnetwork.h"
 
+// libcoap only has raw public keys with its TinyDTLS and GnuTLS backends.
+// ESP-IDF builds it on mbedTLS, where an RPK session would fail at run time.
+#if DTLS_MODE == DTLS_MODE_RPK && !defined(COAP_WITH_LIBTINYDTLS) && \
+    !defined(COAP_WITH_LIBGNUTLS)
+#error "DTLS_MODE_RPK needs a libcoap DTLS backend with RFC 7250 raw public keys"
+#endif
+
 const static char *TAG = CLIENTID;
 
-static int resp_wait = 1;
 static coap_optlist_t *optlist = NULL;
-static int wait_ms;
+
+static struct mg_coap_observe observe;
+// Token of the Observe registration, kept to renew it and to match its
+// notifications
+static uint8_t observe_token[8];
+static size_t observe_token_len;
+// Message ID of the registration in flight, if any
+static coap_mid_t observe_mid = COAP_INVALID_MID;
+
+// Full handshakes since boot. With a Connection ID the session outlives NAT
+// rebinding, so this only grows when the session closed or failed.
+static unsigned int handshakes;
+// Set from the event handler, for the loop to set up a new session
+static bool session_lost;
+// Free heap when the handshake started, to log what it took at its peak
+static uint32_t heap_before_handshake;
+
+static const struct mg_backoff_config backoff_config = {
+    .first_ms = DTLS_BACKOFF_FIRST_MS,
+    .base_ms = DTLS_BACKOFF_BASE_MS,
+    .max_ms = DTLS_BACKOFF_MAX_MS,
+    .stable_ms = DTLS_BACKOFF_STABLE_MS,
+};
+static struct mg_backoff backoff;
 
 
 void format_mainflux_message_topic(void)
 {
-    const char *_preId = "channels/";
-    const char *_postId = "/messages";
-    strcpy(mfTopic, _preId);
-    strcat(mfTopic, mfChannelId);
-    strcat(mfTopic, _postId);
+    int len = mg_legacy_topic_format(mfTopic, sizeof(mfTopic), mfChannelId);
+
+    // Encode the Uri-Path options once, every request reuses the list
+    if (len > 0 && optlist == NULL)
+    {
+        coap_path_into_optlist((const uint8_t *)mfTopic, len, COAP_OPTION_URI_PATH, &optlist);
+    }
+}
+
+static void set_client_sni(char *client_sni, size_t len, const coap_uri_t *uri)
+{
+    memset(client_sni, 0, len);
+    if (uri->host.length) {
+        memcpy(client_sni, uri->host.s, MIN(uri->host.length, len - 1));
+    } else {
+        memcpy(client_sni, "localhost", 9);
+    }
 }
 
+#if DTLS_MODE == DTLS_MODE_PSK
+static coap_session_t *
+coap_start_psk_session(coap_context_t *ctx, coap_address_t *dst_addr, coap_uri_t *uri, coap_proto_t proto)
+{
+    static coap_dtls_cpsk_t dtls_psk;
+    static char client_sni[256];
+
+    memset(&dtls_psk, 0, sizeof(dtls_psk));
+    dtls_psk.version = COAP_DTLS_CPSK_SETUP_VERSION;
+    set_client_sni(client_sni, sizeof(client_sni), uri);
+    dtls_psk.client_sni = client_sni;
+    dtls_psk.use_cid = 1;
+    dtls_psk.psk_info.identity.s = (const uint8_t *)pskIdentity;
+    dtls_psk.psk_info.identity.length = strlen(pskIdentity);
+    dtls_psk.psk_info.key.s = (const uint8_t *)pskKey;
+    dtls_psk.psk_info.key.length = strlen(pskKey);
+
+    return coap_new_client_session_psk2(ctx, NULL, dst_addr, proto, &dtls_psk);
+}
+#else
 static coap_session_t *
 coap_start_pki_session(coap_context_t *ctx, coap_address_t *dst_addr, coap_uri_t *uri, coap_proto_t proto)
 {
@@ -59,17 +125,25 @@ coap_start_pki_session(coap_context_t *ctx, coap_address_t *dst_addr, coap_uri_t
         dtls_pki.cn_call_back_arg        = NULL;
         dtls_pki.validate_sni_call_back  = NULL;
         dtls_pki.sni_call_back_arg       = NULL;
-        memset(client_sni, 0, sizeof(client_sni));
-        if (uri->host.length) {
-            memcpy(client_sni, uri->host.s, MIN(uri->host.length, sizeof(client_sni)));
-        } else {
-            memcpy(client_sni, "localhost", 9);
-        }
+        set_client_sni(client_sni, sizeof(client_sni), uri);
         dtls_pki.client_sni = client_sni;
     }
+    // RFC 9146: the server finds the session by the CID in each record
+    // rather than by our address, so the session survives the NAT handing
+    // us a new port. libcoap's mbedTLS backend cannot resume a cached
+    // session, so without this every rebinding cost a full handshake.
+    dtls_pki.use_cid = 1;
     dtls_pki.pki_key.key_type = COAP_PKI_KEY_PEM_BUF;
+#if DTLS_MODE == DTLS_MODE_RPK
+    // RFC 7250: only the public key goes on the wire, derived from the
+    // private key, and the server checks it against the keys it knows
+    dtls_pki.is_rpk_not_cert = 1;
+    dtls_pki.pki_key.key.pem_buf.public_cert = client_key_start;
+    dtls_pki.pki_key.key.pem_buf.public_cert_len = client_key_bytes;
+#else
     dtls_pki.pki_key.key.pem_buf.public_cert = client_crt_start;
     dtls_pki.pki_key.key.pem_buf.public_cert_len = client_crt_bytes;
+#endif
     dtls_pki.pki_key.key.pem_buf.private_key = client_key_start;
     dtls_pki.pki_key.key.pem_buf.private_key_len = client_key_bytes;
     dtls_pki.pki_key.key.pem_buf.ca_cert = ca_pem_start;
@@ -78,7 +152,39 @@ coap_start_pki_session(coap_context_t *ctx, coap_address_t *dst_addr, coap_uri_t
     return coap_new_client_session_pki(ctx, NULL, dst_addr, proto,
                                        &dtls_pki);
 }
+#endif
+
+static coap_session_t *
+coap_start_session(coap_context_t *ctx, coap_address_t *dst_addr, coap_uri_t *uri, coap_proto_t proto)
+{
+    heap_before_handshake = esp_get_free_heap_size();
+#if DTLS_MODE == DTLS_MODE_PSK
+    return coap_start_psk_session(ctx, dst_addr, uri, proto);
+#else
+    return coap_start_pki_session(ctx, dst_addr, uri, proto);
+#endif
+}
+
+static bool is_observe_token(coap_bin_const_t token)
+{
+    return observe_token_len > 0 && token.length == observe_token_len &&
+           memcmp(token.s, observe_token, observe_token_len) == 0;
+}
+
+static uint32_t get_option_uint(const coap_pdu_t *pdu, coap_option_num_t num, uint32_t absent)
+{
+    coap_opt_iterator_t opt_iter;
+    coap_opt_t *option = coap_check_option(pdu, num, &opt_iter);
 
+    if (option == NULL)
+    {
+        return absent;
+    }
+    return coap_decode_var_bytes(coap_opt_value(option), coap_opt_length(option));
+}
+
+// Commands arrive as notifications of the Observe registration: the first
+// one answers the registration, later ones are pushed by the server
 static coap_response_t message_handler(coap_session_t *session,
                                        const coap_pdu_t *sent,
                                        const coap_pdu_t *received,
@@ -89,9 +195,33 @@ static coap_response_t message_handler(coap_session_t *session,
     size_t offset;
     size_t total;
     coap_pdu_code_t rcvd_code = coap_pdu_get_code(received);
+    int64_t now = mg_uptime_ms();
+
+    if (!is_observe_token(coap_pdu_get_token(received)))
+    {
+        return COAP_RESPONSE_OK;
+    }
+    observe_mid = COAP_INVALID_MID;
 
     if (COAP_RESPONSE_CLASS(rcvd_code) == 2)
     {
+        uint32_t seq = get_option_uint(received, COAP_OPTION_OBSERVE, UINT32_MAX);
+
+        if (seq == UINT32_MAX)
+        {
+            // Answered, but not registered: poll again after the retry time
+            ESP_LOGW(TAG, "Server does not observe %s", mfTopic);
+            mg_coap_observe_failed(&observe, now, COAP_OBSERVE_RETRY_SEC * 1000);
+        }
+        else if (!mg_coap_observe_notified(&observe, seq,
+                                           get_option_uint(received, COAP_OPTION_MAXAGE,
+                                                           MG_COAP_OBSERVE_MAX_AGE_S),
+                                           now))
+        {
+            // Overtaken by a newer notification
+            return COAP_RESPONSE_OK;
+        }
+
         if (coap_get_data_large(received, &data_len, &data, &offset, &total))
         {
             if (data_len != total)
@@ -99,7 +229,6 @@ static coap_response_t message_handler(coap_session_t *session,
                 printf("Unexpected partial data received offset %u, length %u\n", offset, data_len);
             }
             printf("Received:\n%.*s\n", (int)data_len, data);
-            resp_wait = 0;
         }
         return COAP_RESPONSE_OK;
     }
@@ -114,10 +243,80 @@ static coap_response_t message_handler(coap_session_t *session,
         }
     }
     printf("\n");
-    resp_wait = 0;
+    mg_coap_observe_failed(&observe, now, COAP_OBSERVE_RETRY_SEC * 1000);
     return COAP_RESPONSE_OK;
 }
 
+// libcoap gave up on the registration, or the server reset it
+static void nack_handler(coap_session_t *session,
+                         const coap_pdu_t *sent,
+                         const coap_nack_reason_t reason,
+                         const coap_mid_t mid)
+{
+    if (mid != observe_mid)
+    {
+        return;
+    }
+
+    observe_mid = COAP_INVALID_MID;
+    mg_coap_observe_failed(&observe, mg_uptime_ms(), COAP_OBSERVE_RETRY_SEC * 1000);
+}
+
+// GET with Observe 0 on the channel topic. The first registration takes a
+// fresh token, renewals reuse it so the server updates the same one.
+static coap_mid_t send_observe(coap_session_t *session, coap_pdu_type_t type)
+{
+    coap_pdu_t *request = coap_new_pdu(type, COAP_REQUEST_CODE_GET, session);
+    unsigned char buf[4];
+
+    if (!request)
+    {
+        ESP_LOGE(TAG, "coap_new_pdu() failed");
+        return COAP_INVALID_MID;
+    }
+    if (observe_token_len == 0)
+    {
+        coap_session_new_token(session, &observe_token_len, observe_token);
+    }
+    coap_add_token(request, observe_token_len, observe_token);
+    coap_add_option(request, COAP_OPTION_OBSERVE,
+                    coap_encode_var_safe(buf, sizeof(buf), COAP_OBSERVE_ESTABLISH), buf);
+    coap_add_optlist_pdu(request, &optlist);
+
+    return coap_send(session, request);
+}
+
+static int event_handler(coap_session_t *session, const coap_event_t event)
+{
+    int64_t now = mg_uptime_ms();
+
+    switch (event)
+    {
+    case COAP_EVENT_DTLS_CONNECTED:
+    {
+        // The low-water mark is since boot, so compare modes on the
+        // first handshake
+        uint32_t low = esp_get_minimum_free_heap_size();
+
+        handshakes++;
+        mg_backoff_connected(&backoff, now);
+        ESP_LOGI(TAG, "DTLS handshake %u since boot, %s, heap peak %lu B, low-water %lu B",
+                 handshakes, DTLS_MODE_NAME,
+                 (unsigned long)(heap_before_handshake > low ? heap_before_handshake - low : 0),
+                 (unsigned long)low);
+        break;
+    }
+    case COAP_EVENT_DTLS_CLOSED:
+    case COAP_EVENT_DTLS_ERROR:
+    case COAP_EVENT_SESSION_FAILED:
+        session_lost = true;
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
 static void coap_log_handler(coap_log_t level, const char *message)
 {
     uint32_t esp_level = ESP_LOG_INFO;
@@ -142,12 +341,10 @@ static void coap_client(void *p)
     const char *server_uri = server;
     coap_context_t *ctx = NULL;
     coap_session_t *session = NULL;
-    coap_pdu_t *request = NULL;
-    unsigned char token[8];
-    size_t tokenlength;
     coap_addr_info_t *info_list = NULL;
     coap_proto_t proto;
     char tmpbuf[INET6_ADDRSTRLEN];
+    int64_t reconnect_at = 0;
 
     coap_startup();
 
@@ -164,6 +361,25 @@ static void coap_client(void *p)
                                 COAP_BLOCK_USE_LIBCOAP | COAP_BLOCK_SINGLE_BODY);
 
     coap_register_response_handler(ctx, message_handler);
+    coap_register_nack_handler(ctx, nack_handler);
+    coap_register_event_handler(ctx, event_handler);
+
+#if DTLS_MODE == DTLS_MODE_PSK
+    if (!coap_dtls_psk_is_supported())
+#elif DTLS_MODE == DTLS_MODE_RPK
+    if (!coap_dtls_rpk_is_supported())
+#else
+    if (!coap_dtls_pki_is_supported())
+#endif
+    {
+        ESP_LOGE(TAG, "The DTLS library has no %s support", DTLS_MODE_NAME);
+        goto clean_up;
+    }
+    if (!coap_dtls_cid_is_supported())
+    {
+        ESP_LOGW(TAG, "No DTLS Connection ID support, NAT rebinding will cost a handshake");
+    }
+    mg_backoff_init(&backoff, &backoff_config);
 
     if (coap_split_uri((const uint8_t *)server_uri, strlen(server_uri), &uri) == -1)
     {
@@ -185,53 +401,71 @@ static void coap_client(void *p)
     proto = info_list->proto;
     memcpy(&dst_addr, &info_list->addr, sizeof(dst_addr));
     coap_free_address_info(info_list);
-    session = coap_start_pki_session(ctx, &dst_addr, &uri, proto);
+    session = coap_start_session(ctx, &dst_addr, &uri, proto);
     if (!session)
     {
         ESP_LOGE(TAG, "coap_new_client_session() failed");
         clean_up();
     }
 
+    format_mainflux_message_topic();
+
+    mg_coap_observe_init(&observe, mg_uptime_ms());
+
+    // Commands are pushed as notifications, so the loop only wakes to
+    // register, and to renew the registration when Max-Age runs out
     while (true)
     {
-        request = coap_new_pdu(coap_is_mcast(&dst_addr) ? COAP_MESSAGE_NON : COAP_MESSAGE_CON,
-                               COAP_REQUEST_CODE_GET, session);
-        if (!request)
+        int64_t now = mg_uptime_ms();
+        uint32_t wait;
+
+        if (session_lost)
         {
-            ESP_LOGE(TAG, "coap_new_pdu() failed");
-            goto clean_up;
+            session_lost = false;
+            coap_session_release(session);
+            session = NULL;
+            observe_mid = COAP_INVALID_MID;
+            mg_backoff_disconnected(&backoff, now);
+            reconnect_at = now + mg_backoff_next(&backoff);
+            ESP_LOGW(TAG, "DTLS session lost, new one in %lld ms", reconnect_at - now);
         }
-        coap_session_new_token(session, &tokenlength, token);
-        coap_add_token(request, tokenlength, token);
-        coap_add_optlist_pdu(request, &optlist);
 
-        resp_wait = 1;
-        coap_send(session, request);
-
-        wait_ms = COAP_DEFAULT_TIME_SEC * MS_COUNT;
-
-        while (resp_wait)
+        if (session == NULL)
         {
-            int result = coap_io_process(ctx, wait_ms > 1000 ? 1000 : wait_ms);
-            if (result >= 0)
+            if (now < reconnect_at)
             {
-                if (result >= wait_ms)
-                {
-                    ESP_LOGE(TAG, "No response from server");
-                    break;
-                }
-                else
-                {
-                    wait_ms -= result;
-                }
+                coap_io_process(ctx, (uint32_t)(reconnect_at - now));
+                continue;
             }
+            session = coap_start_session(ctx, &dst_addr, &uri, proto);
+            if (!session)
+            {
+                ESP_LOGE(TAG, "coap_new_client_session() failed");
+                reconnect_at = now + mg_backoff_next(&backoff);
+                continue;
+            }
+            // The registration went with the old session
+            mg_coap_observe_failed(&observe, now, 0);
         }
-        for (int countdown = 10; countdown >= 0; countdown--)
+
+        if (mg_coap_observe_due(&observe, now))
         {
-            ESP_LOGI(TAG, "%d... ", countdown);
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
+            observe_mid = send_observe(session, coap_is_mcast(&dst_addr) ? COAP_MESSAGE_NON
+                                                                         : COAP_MESSAGE_CON);
+            if (observe_mid == COAP_INVALID_MID)
+            {
+                ESP_LOGE(TAG, "coap_send() failed");
+                mg_coap_observe_failed(&observe, now, COAP_OBSERVE_RETRY_SEC * 1000);
+            }
+            else
+            {
+                ESP_LOGI(TAG, "Observing %s", mfTopic);
+                mg_coap_observe_sent(&observe, now, COAP_DEFAULT_TIME_SEC * MS_COUNT);
+            }
         }
-        ESP_LOGI(TAG, "Starting again!");
+
+        wait = mg_coap_observe_wait_ms(&observe, mg_uptime_ms());
+        coap_io_process(ctx, wait > 0 ? wait : COAP_IO_NO_WAIT);
     }
 }
 void clean_up()
@@ -21,6 +21,7 @@
 #include "mqtt_client.h"
 #include "cnetwork.h"
 #include "config.h"
+#include "mg_topic.h"
 
 #define CLIENT_ID "ESP32"
 
@@ -42,11 +43,7 @@ static void log_error_if_nonzero(const char *message, int error_code)
 }
 void create_mainflux_channel(void)
 {
-    const char *_preId = "channels/";
-    const char *_postId = "/messages";
-    strcpy(mfTopic, _preId);
-    strcat(mfTopic, mfChannelId);
-    strcat(mfTopic, _postId);
+    mg_legacy_topic_format(mfTopic, sizeof(mfTopic), mfChannelId);
 }
 
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
@@ -55,7 +52,6 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     esp_mqtt_event_handle_t event = event_data;
     esp_mqtt_client_handle_t client = event->client;
     int msg_id;
-    create_mainflux_channel();
     switch ((esp_mqtt_event_id_t)event_id)
     {
     case MQTT_EVENT_CONNECTED:
@@ -112,6 +108,9 @@ static void mqtt_app_start(void)
         .credentials.authentication.certificate = (const char*)client_cert_pem_start,
         .credentials.authentication.key = (const char*) client_key_pem_start,
     };
+    // Build the topic once, the event handler only references it
+    create_mainflux_channel();
+
     esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(client);
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Transfer time of block-wise (RFC 7959 Block1) SenML packs against the
+# block size, under datagram loss.
+#
+#   ./bench/coap_block.sh [build dir] [packs]
+#
+# Every pack holds READINGS readings (default 32, about 3 KB of SenML-CBOR)
+# and goes as one Block1 transfer, one CON block at a time. For every
+# block size the stand-in is started afresh, dropping LOSS of the datagrams
+# in each direction and holding replies back by DELAY ms (default 20).
+# Latency is the time to deliver a whole pack. Blocks stop at 256 bytes:
+# larger ones do not fit in the client's 512-byte requests.
+set -e
+
+build=${1:-build}
+packs=${2:-20}
+readings=${READINGS:-32}
+delay=${DELAY:-20}
+ack_timeout=${ACK_TIMEOUT:-100}
+standin="$(dirname "$0")/../tools/standin.py"
+port=5699
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+
+for loss in 0 0.05 0.2; do
+  for size in 16 32 64 128 256; do
+    python3 "$standin" --coap "$port" --mqtt 0 --http 0 --ws 0 \
+      --loss "$loss" --delay "$delay" >"$out" &
+    pid=$!
+    sleep 0.5
+    printf 'loss %-4s block %4s: ' "$loss" "$size"
+    stats=$("$build/mg_client" -H 127.0.0.1 -p "$port" \
+      -n $((packs * readings)) -f cbor -b "$readings" -z "$size" \
+      -a "$ack_timeout" coap 2>/dev/null || true)
+    sleep 0.2
+    kill "$pid"
+    wait "$pid" 2>/dev/null || true
+    echo "$stats" |
+      awk '
+        /^readings/ { sent = $2; failed = $4 }
+        /^latency/ { p50 = $6; p99 = $8 }
+        /^throughput/ { t = $2 }
+        /^wire bytes/ { tx = $4 }
+        /^coap:/ { rt = $6 }
+        /^blocks/ { blocks = $2; transfers = $10 }
+        END { if (blocks == "") { print "failed"; exit }
+              printf "p50 %7.1f ms, p99 %7.1f ms, %8s readings/s, " \
+                     "%4s blocks/pack, tx %7s B, %4s retransmissions, " \
+                     "%s readings failed\n",
+                     p50 / 1000, p99 / 1000, t, \
+                     int(blocks / transfers + 0.5), tx, rt, failed }'
+  done
+done
@@ -0,0 +1,49 @@
+#!/bin/sh
+# CoAP telemetry sent all CON, as NON with a CON checkpoint every N
+# messages, and all NON, under datagram loss.
+#
+#   ./bench/coap_checkpoint.sh [build dir] [messages]
+#
+# One message at a time, as a sensor sends them. For every mode the
+# stand-in is started afresh, dropping LOSS of the datagrams in each
+# direction and holding replies back by DELAY ms (default 20); on exit it
+# reports how many distinct requests it received, which is how many NON
+# messages were delivered. "listening" is the time a CON was awaiting its
+# response, during which a duty-cycled radio has to stay in receive.
+set -e
+
+build=${1:-build}
+count=${2:-1000}
+delay=${DELAY:-20}
+ack_timeout=${ACK_TIMEOUT:-100}
+standin="$(dirname "$0")/../tools/standin.py"
+port=5699
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+
+for loss in 0 0.05 0.2; do
+  for mode in "-c 1" "-c 4" "-c 16" "-c 64" "-q 0"; do
+    python3 "$standin" --coap "$port" --mqtt 0 --http 0 --ws 0 \
+      --loss "$loss" --delay "$delay" >"$out" &
+    pid=$!
+    sleep 0.5
+    printf 'loss %-4s %-5s: ' "$loss" "$mode"
+    # shellcheck disable=SC2086
+    stats=$("$build/mg_client" -H 127.0.0.1 -p "$port" -n "$count" \
+      -a "$ack_timeout" $mode coap 2>/dev/null || true)
+    sleep 0.2
+    kill "$pid"
+    wait "$pid" 2>/dev/null || true
+    received=$(awk '/^coap:/ { print $2 }' "$out")
+    echo "$stats" |
+      awk -v received="$received" -v count="$count" '
+        /^throughput/ { t = $5 }
+        /^wire bytes/ { tx = $4; rx = $6 }
+        /^coap:/ { con = $2; non = $4 }
+        /^listening/ { l = $2 }
+        END { if (con == "") { con = non = l = "-" }
+              printf "%9s msg/s, %5.1f %% delivered, tx %7s B, rx %6s B, " \
+                     "%4s CON %4s NON, listening %s s\n",
+                     t, 100 * received / count, tx, rx, con, non, l }'
+  done
+done
@@ -0,0 +1,51 @@
+#!/bin/sh
+# CoAP CON throughput and latency under datagram loss, for a range of
+# in-flight windows.
+#
+#   ./bench/coap_loss.sh [build dir] [messages]
+#
+# Starts the stand-in for every loss rate, dropping that share of the
+# datagrams in each direction and holding replies back by DELAY ms (default
+# 20) as a round trip would. ACK_TIMEOUT (default 100 ms) is the initial
+# retransmission timeout; RFC 7252's 2 s default is meant for unknown
+# links. To use another CoAP server that answers POST with 2.xx, set
+# SERVER=host:port; it then runs once with whatever loss the server injects.
+set -e
+
+build=${1:-build}
+count=${2:-500}
+delay=${DELAY:-20}
+ack_timeout=${ACK_TIMEOUT:-100}
+standin="$(dirname "$0")/../tools/standin.py"
+port=5699
+
+run() {
+  for window in 1 4 16 64; do
+    printf 'loss %-5s window %2d: ' "$1" "$window"
+    "$build/mg_client" -H "$host" -p "$port" -n "$count" -a "$ack_timeout" \
+      -w "$window" coap 2>/dev/null |
+      awk '/^throughput/ { t = $2 } /^latency/ { p50 = $6; p99 = $8 }
+           /^coap:/ { r = $6; f = $8 }
+           END { printf "%8s msg/s, p50 %7s us, p99 %8s us, " \
+                        "%4s retransmissions, %s timed out\n",
+                        t, p50, p99, r, f }'
+  done
+}
+
+if [ -n "$SERVER" ]; then
+  host=${SERVER%:*}
+  port=${SERVER##*:}
+  run "-"
+  exit 0
+fi
+
+host=127.0.0.1
+for loss in 0 0.01 0.05 0.1 0.2; do
+  python3 "$standin" --coap "$port" --mqtt 0 --http 0 --ws 0 \
+    --loss "$loss" --delay "$delay" >/dev/null &
+  pid=$!
+  sleep 0.5
+  run "$loss"
+  kill "$pid"
+  wait "$pid" 2>/dev/null || true
+done
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""DTLS 1.2 handshake cost of the ESP32 coap_dtls credential modes.
+
+  pki  X.509 certificates both ways, TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8
+  rpk  RFC 7250 raw public keys in place of the certificates, same suite
+  psk  a pre-shared key, TLS_PSK_WITH_AES_128_CCM_8
+
+These are the suites RFC 7252 makes mandatory for CoAP. Each mode is run
+--count times with `openssl s_client` against a local `openssl s_server`
+through the byte-counting relay of dtls_rebind.py. It reports the
+handshake bytes both ways, the flights and round trips, and the heap the
+client held at its peak above what it held before connecting. The heap is
+measured by preloading libmg_heap_peak.so from the build directory. It is
+OpenSSL's heap, not mbedTLS's; on the device, the firmware logs the heap
+peak of every handshake.
+
+OpenSSL 3.0 has no raw public keys, so the rpk row is the pki handshake
+with each Certificate message cut down to a SubjectPublicKeyInfo, and the
+certificate type extensions added to the hellos.
+"""
+
+import argparse
+import os
+import secrets
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+from dtls_rebind import Relay, make_credentials
+
+PKI_SUITE = "ECDHE-ECDSA-AES128-CCM8"
+PSK_SUITE = "PSK-AES128-CCM8"
+PSK_IDENTITY = "device"
+# Handshake message types.
+CLIENT_HELLO, CERTIFICATE = 1, 11
+# client_certificate_type and server_certificate_type in a ClientHello
+# list the types (6 bytes each), a ServerHello picks one (5 bytes each).
+RPK_CLIENT_EXT = 2 * 6
+RPK_SERVER_EXT = 2 * 5
+
+
+def free_port():
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()
+
+
+def measure(args, server_cmd, client_cmd):
+    address = free_port()
+    server = subprocess.Popen(server_cmd + ["-accept", str(address[1])],
+                              stdin=subprocess.PIPE,
+                              stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL)
+    time.sleep(0.5)
+    relay = Relay(address)
+    peak_file = os.path.join(args.tmp, "heap_peak")
+    env = dict(os.environ, LD_PRELOAD=args.shim, MG_HEAP_PEAK_FILE=peak_file)
+    runs = []
+    try:
+        for _ in range(args.count):
+            counts = relay.run(client_cmd + ["-connect",
+                                             "127.0.0.1:%d" % relay.port],
+                               env)[0]
+            with open(peak_file) as f:
+                counts["heap"] = int(f.read())
+            runs.append(counts)
+        return runs
+    finally:
+        server.kill()
+        server.wait()
+
+
+def spki_len(key):
+    return len(subprocess.run(["openssl", "pkey", "-in", key, "-pubout",
+                               "-outform", "DER"],
+                              check=True, capture_output=True).stdout)
+
+
+def as_rpk(run, creds):
+    """The pki run with raw public keys on the wire instead."""
+    run = dict(run)
+    messages = run["messages"]
+    for direction, name in (("tx", "client"), ("rx", "server")):
+        # The certificate list becomes one 3-byte length prefixed key.
+        cert = messages.get((direction, CERTIFICATE), [0])[0]
+        run[direction] -= cert - (3 + spki_len(creds[name][1]))
+    hellos = messages.get(("tx", CLIENT_HELLO), [0, 1])[1]
+    run["tx"] += RPK_CLIENT_EXT * hellos
+    run["rx"] += RPK_SERVER_EXT
+    run["heap"] = None
+    return run
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("build", nargs="?", default="build",
+                        help="build directory with libmg_heap_peak.so")
+    parser.add_argument("-n", "--count", type=int, default=5,
+                        help="handshakes of each mode to measure")
+    args = parser.parse_args()
+    args.shim = os.path.abspath(os.path.join(args.build, "libmg_heap_peak.so"))
+    if not os.path.exists(args.shim):
+        sys.exit("%s not found, build the Linux target first" % args.shim)
+
+    with tempfile.TemporaryDirectory() as tmp:
+        args.tmp = tmp
+        creds = make_credentials(tmp)
+        psk = secrets.token_hex(16)
+        server = ["openssl", "s_server", "-dtls1_2", "-quiet", "-no_ticket"]
+        client = ["openssl", "s_client", "-dtls1_2"]
+
+        pki = measure(args, server + ["-cert", creds["server"][0],
+                                "-key", creds["server"][1],
+                                "-CAfile", creds["ca"], "-Verify", "2",
+                                "-cipher", PKI_SUITE],
+                      client + ["-CAfile", creds["ca"],
+                                "-cert", creds["client"][0],
+                                "-key", creds["client"][1],
+                                "-cipher", PKI_SUITE])
+        modes = {
+            "pki": pki,
+            "rpk": [as_rpk(run, creds) for run in pki],
+            "psk": measure(args, server + ["-nocert", "-psk", psk,
+                                     "-psk_identity", PSK_IDENTITY,
+                                     "-cipher", PSK_SUITE],
+                           client + ["-psk", psk,
+                                     "-psk_identity", PSK_IDENTITY,
+                                     "-cipher", PSK_SUITE]),
+        }
+
+    print("%-5s %8s %8s %8s %8s %12s %12s" %
+          ("mode", "tx B", "rx B", "total B", "flights", "round trips",
+           "heap peak B"))
+    for name, runs in modes.items():
+        tx, rx, flights = (statistics.median(r[key] for r in runs)
+                           for key in ("tx", "rx", "flights"))
+        heap = ("-" if runs[0]["heap"] is None else
+                "%d" % statistics.median(r["heap"] for r in runs))
+        print("%-5s %8d %8d %8d %8d %12d %12s" %
+              (name, tx, rx, tx + rx, flights, flights // 2, heap))
+    print("\nrpk: computed from the pki handshakes")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,277 @@
+#!/usr/bin/env python3
+"""DTLS cost of NAT rebinding over a day, for the ESP32 coap_dtls client.
+
+A device behind a NAT gets a new public port now and then. A DTLS 1.2
+server finds sessions by the peer's address, so records from the new port
+belong to no session. The client only notices once its requests go
+unanswered, then it handshakes again. Three ways to recover are compared:
+
+  full     a full certificate handshake every time (the old firmware)
+  resumed  an abbreviated handshake resuming the cached session
+  cid      RFC 9146 Connection ID: the server finds the session by the CID
+           in every record, so a rebinding costs no handshake, only the
+           CID bytes in each record
+
+The handshakes are real: each kind is run --count times with
+`openssl s_client -dtls1_2` through a UDP relay that counts the handshake
+records both ways and the flights. By default the relay points at a local
+`openssl s_server` with throwaway ECDSA P-256 credentials, which resumes
+sessions from its session cache, or from session tickets with --tickets.
+Tickets hold the client certificate, so they make a resumed ClientHello
+larger than a full one. --server,
+--ca, --cert and --key point it at another DTLS server, such as the
+Magistrala CoAP adapter, with the device credentials. OpenSSL has no
+Connection ID support, so the CID cost is computed from its record format.
+
+The day itself runs on a virtual clock. The device sends one request every
+--interval seconds and gets one response. The NAT rebinds at random, on
+average every --rebind seconds, and always when the device was silent
+longer than --nat-timeout. Without a CID, the request after a rebinding is
+lost with all its CoAP retransmissions before the handshake.
+"""
+
+import argparse
+import os
+import random
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+DAY = 24 * 3600
+# CoAP MAX_RETRANSMIT: a lost request is sent this many more times.
+MAX_RETRANSMIT = 4
+# DTLS 1.2 record header.
+RECORD_HEADER = 13
+# Content types of handshake records.
+HANDSHAKE_TYPES = (20, 22)
+
+
+def openssl(*args):
+    subprocess.run(("openssl",) + args, check=True,
+                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
+def make_credentials(path):
+    """Throwaway CA, server and client certificates on P-256."""
+    ec = ("-newkey", "ec", "-pkeyopt", "ec_paramgen_curve:P-256", "-nodes")
+    creds = {}
+    openssl("req", "-x509", *ec, "-keyout", path + "/ca.key",
+            "-out", path + "/ca.crt", "-subj", "/CN=ca", "-days", "1")
+    for name in ("server", "client"):
+        key, csr, crt = (path + "/" + name + ext
+                         for ext in (".key", ".csr", ".crt"))
+        openssl("req", *ec, "-keyout", key, "-out", csr,
+                "-subj", "/CN=" + name)
+        openssl("x509", "-req", "-in", csr, "-CA", path + "/ca.crt",
+                "-CAkey", path + "/ca.key", "-CAcreateserial",
+                "-out", crt, "-days", "1")
+        creds[name] = (crt, key)
+    creds["ca"] = path + "/ca.crt"
+    return creds
+
+
+class Relay:
+    """Forwards one client's datagrams to the server from a fresh port, as
+    a NAT after rebinding would, and counts the handshake bytes. Plaintext
+    handshake messages are also counted by type and direction, as bytes and
+    fragments."""
+
+    def __init__(self, server):
+        self.server = server
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(("127.0.0.1", 0))
+        self.port = self.sock.getsockname()[1]
+
+    def run(self, client_cmd, env=None):
+        upstream = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        upstream.connect(self.server)
+        counts = {"tx": 0, "rx": 0, "flights": 0, "messages": {}}
+        last = [None]
+        peer = [None]
+        done = threading.Event()
+
+        def count(data, direction):
+            pos = 0
+            while pos + RECORD_HEADER <= len(data):
+                length = int.from_bytes(data[pos + 11:pos + 13], "big")
+                if data[pos] in HANDSHAKE_TYPES:
+                    counts[direction] += RECORD_HEADER + length
+                    if last[0] != direction:
+                        counts["flights"] += 1
+                        last[0] = direction
+                epoch = int.from_bytes(data[pos + 3:pos + 5], "big")
+                if data[pos] == 22 and epoch == 0:
+                    # One fragment: type, length, sequence, offset, length.
+                    key = (direction, data[pos + RECORD_HEADER])
+                    frag = data[pos + RECORD_HEADER + 9:pos + RECORD_HEADER + 12]
+                    msg = counts["messages"].setdefault(key, [0, 0])
+                    msg[0] += int.from_bytes(frag, "big")
+                    msg[1] += 1
+                pos += RECORD_HEADER + length
+
+        def pump(src, direction):
+            src.settimeout(0.1)
+            while not done.is_set():
+                try:
+                    data, addr = src.recvfrom(4096)
+                except socket.timeout:
+                    continue
+                except OSError:
+                    return
+                count(data, direction)
+                if direction == "tx":
+                    peer[0] = addr
+                    upstream.send(data)
+                elif peer[0]:
+                    self.sock.sendto(data, peer[0])
+
+        threads = [threading.Thread(target=pump, args=(self.sock, "tx")),
+                   threading.Thread(target=pump, args=(upstream, "rx"))]
+        for t in threads:
+            t.start()
+        try:
+            out = subprocess.run(client_cmd, stdin=subprocess.DEVNULL,
+                                 capture_output=True, text=True,
+                                 timeout=10, env=env).stdout
+        finally:
+            done.set()
+            for t in threads:
+                t.join()
+            upstream.close()
+        return counts, "Reused," in out
+
+
+def handshakes(args, creds, relay, count):
+    sess = os.path.join(args.tmp, "session.pem")
+    client = ["openssl", "s_client", "-dtls1_2",
+              "-connect", "127.0.0.1:%d" % relay.port,
+              "-CAfile", creds["ca"], "-cert", creds["client"][0],
+              "-key", creds["client"][1]]
+    results = {}
+
+    for kind in ("full", "resumed"):
+        runs = []
+        for _ in range(count):
+            extra = ["-sess_out", sess]
+            if kind == "resumed":
+                extra = ["-sess_in", sess] + extra
+            counts, reused = relay.run(client + extra)
+            if reused != (kind == "resumed"):
+                sys.exit("%s handshake %s the session" %
+                         (kind, "resumed" if reused else "did not resume"))
+            runs.append(counts)
+        results[kind] = {key: statistics.median(r[key] for r in runs)
+                         for key in ("tx", "rx", "flights")}
+
+    return results
+
+
+def simulate(args, cost):
+    """Counts a day of rebindings; returns handshakes and bytes per mode."""
+    rng = random.Random(args.seed)
+    rebinds = 0
+    t = 0.0
+    next_rebind = rng.expovariate(1 / args.rebind)
+
+    while t + args.interval < DAY:
+        t += args.interval
+        rebound = args.interval > args.nat_timeout
+        while next_rebind <= t:
+            rebound = True
+            next_rebind += rng.expovariate(1 / args.rebind)
+        rebinds += rebound
+
+    messages = int(DAY // args.interval)
+    full = cost["full"]["tx"] + cost["full"]["rx"]
+    resumed = cost["resumed"]["tx"] + cost["resumed"]["rx"]
+    lost = rebinds * (1 + MAX_RETRANSMIT) * args.request_len
+    # Every request carries the server's CID and the inner content type;
+    # the handshake negotiates it in a ClientHello and a ServerHello
+    # extension.
+    cid = messages * (args.cid_len + 1)
+    cid_hello = 2 * 5 + args.cid_len
+
+    return rebinds, messages, {
+        "full": (1 + rebinds, full * (1 + rebinds), lost),
+        "resumed": (1 + rebinds, full + resumed * rebinds, lost),
+        "cid": (1, full + cid_hello, cid),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--server", help="host:port of a DTLS server "
+                        "(default: a local openssl s_server)")
+    parser.add_argument("--ca", help="CA to verify the server with")
+    parser.add_argument("--cert", help="client certificate")
+    parser.add_argument("--key", help="client private key")
+    parser.add_argument("--tickets", action="store_true",
+                        help="let the local server issue session tickets")
+    parser.add_argument("-n", "--count", type=int, default=5,
+                        help="handshakes of each kind to measure")
+    parser.add_argument("--interval", type=float, default=30,
+                        help="seconds between requests")
+    parser.add_argument("--rebind", type=float, default=3600,
+                        help="mean seconds between NAT rebindings")
+    parser.add_argument("--nat-timeout", type=float, default=120,
+                        help="idle seconds after which the NAT rebinds")
+    parser.add_argument("--request-len", type=int, default=120,
+                        help="bytes of a protected CoAP request")
+    parser.add_argument("--cid-len", type=int, default=8,
+                        help="bytes of the server's Connection ID")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        args.tmp = tmp
+        server = None
+        if args.server:
+            host, _, port = args.server.rpartition(":")
+            address = (socket.gethostbyname(host), int(port))
+            creds = {"ca": args.ca, "client": (args.cert, args.key)}
+        else:
+            creds = make_credentials(tmp)
+            with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+                s.bind(("127.0.0.1", 0))
+                address = s.getsockname()
+            server = subprocess.Popen(
+                ["openssl", "s_server", "-dtls1_2", "-quiet",
+                 "-accept", str(address[1]), "-cert", creds["server"][0],
+                 "-key", creds["server"][1], "-CAfile", creds["ca"],
+                 "-Verify", "2"] + ([] if args.tickets else ["-no_ticket"]),
+                stdin=subprocess.PIPE, stdout=subprocess.DEVNULL,
+                stderr=subprocess.DEVNULL)
+            time.sleep(0.5)
+
+        try:
+            cost = handshakes(args, creds, Relay(address), args.count)
+        finally:
+            if server:
+                server.kill()
+                server.wait()
+
+    for kind in ("full", "resumed"):
+        c = cost[kind]
+        print("%-8s handshake: tx %5d B, rx %5d B, %d flights" %
+              (kind, c["tx"], c["rx"], c["flights"]))
+
+    rebinds, messages, modes = simulate(args, cost)
+    print("\n24 h, a request every %g s (%d), %d NAT rebindings\n" %
+          (args.interval, messages, rebinds))
+    print("%-8s %10s %14s %14s %12s" %
+          ("mode", "handshakes", "handshake B", "overhead B", "total B"))
+    for name, (count, hs_bytes, overhead) in modes.items():
+        print("%-8s %10d %14d %14d %12d" %
+              (name, count, hs_bytes, overhead, hs_bytes + overhead))
+    print("\noverhead: requests lost to a rebinding with their "
+          "retransmissions, or the CID bytes of every request")
+
+
+if __name__ == "__main__":
+    main()
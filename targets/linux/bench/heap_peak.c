@@ -0,0 +1,103 @@
+/* LD_PRELOAD shim that measures the heap a connection takes at its peak,
+ * for bench/dtls_modes.py:
+ *
+ *   MG_HEAP_PEAK_FILE=peak LD_PRELOAD=./build/libmg_heap_peak.so <command>
+ *
+ * Live heap bytes are tracked through malloc and friends. The first
+ * connect() takes the live bytes as the baseline, so start-up, such as
+ * loading certificates, does not count. At exit, the peak above that
+ * baseline is written to MG_HEAP_PEAK_FILE.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *ptr);
+
+/* Signed, as memory from before the shim was loaded may be freed. */
+static long live;
+static long baseline;
+static long peak;
+static int started;
+
+static void *track(void *ptr) {
+  if (ptr != NULL) {
+    live += (long)malloc_usable_size(ptr);
+    if (started && live - baseline > peak) {
+      peak = live - baseline;
+    }
+  }
+  return ptr;
+}
+
+static void untrack(void *ptr) {
+  if (ptr != NULL) {
+    live -= (long)malloc_usable_size(ptr);
+  }
+}
+
+void *malloc(size_t size) { return track(__libc_malloc(size)); }
+
+void *calloc(size_t n, size_t size) { return track(__libc_calloc(n, size)); }
+
+void *realloc(void *ptr, size_t size) {
+  size_t old = ptr != NULL ? malloc_usable_size(ptr) : 0;
+  void *p = __libc_realloc(ptr, size);
+
+  if (p == NULL) {
+    return size == 0 ? NULL : p;
+  }
+  live -= (long)old;
+  return track(p);
+}
+
+void *memalign(size_t align, size_t size) {
+  return track(__libc_memalign(align, size));
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+  return memalign(align, size);
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size) {
+  *ptr = memalign(align, size);
+  return *ptr != NULL ? 0 : ENOMEM;
+}
+
+void free(void *ptr) {
+  untrack(ptr);
+  __libc_free(ptr);
+}
+
+int connect(int fd, const struct sockaddr *addr, socklen_t len) {
+  static int (*next)(int, const struct sockaddr *, socklen_t);
+
+  if (next == NULL) {
+    next = (int (*)(int, const struct sockaddr *, socklen_t))dlsym(RTLD_NEXT,
+                                                                   "connect");
+  }
+  if (!started) {
+    started = 1;
+    baseline = live;
+  }
+  return next(fd, addr, len);
+}
+
+__attribute__((destructor)) static void report(void) {
+  const char *path = getenv("MG_HEAP_PEAK_FILE");
+  FILE *f;
+
+  if (path == NULL || (f = fopen(path, "w")) == NULL) {
+    return;
+  }
+  fprintf(f, "%ld\n", peak);
+  fclose(f);
+}
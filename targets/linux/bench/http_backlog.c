@@ -0,0 +1,267 @@
+/* Drains a backlog of readings over HTTP three ways, as a device would
+ * after hours offline: one POST per reading, POSTs pipelined on the
+ * kept-alive connection, and one POST streaming the whole backlog as a
+ * chunked SenML-CBOR pack.
+ *
+ *   ./build/mg_bench_backlog [-H host] [-p port] [-n readings]
+ *                            [-w pipelined] [-c chunk bytes]
+ *
+ * Run it against the stand-in, with --delay for a WAN round trip:
+ *
+ *   python3 tools/standin.py --delay 20
+ *
+ * The default backlog is a day of readings taken every 30 s. Readings are
+ * encoded as they go out, from a cursor over the backlog, so no way holds
+ * more than a request, or a chunk, at a time.
+ */
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mg_http_conn.h"
+#include "mg_http_stream.h"
+#include "mg_net.h"
+#include "mg_platform.h"
+#include "mg_senml.h"
+#include "mg_topic.h"
+
+#define DEFAULT_READINGS (24 * 3600 / 30)
+#define DEFAULT_PIPELINED 8
+#define DEFAULT_CHUNK 512
+#define MAX_PIPELINED 64
+#define INTERVAL_MS 30000
+#define TIMEOUT_MS 5000
+
+#define REQUEST_HEAD                                                           \
+  "POST /" MG_TOPIC(DOMAIN_ID, CHANNEL_ID) " HTTP/1.1\r\n"                      \
+  "Host: %s\r\n"                                                               \
+  "Content-Type: " MG_SENML_CBOR_CONTENT_TYPE "\r\n"                           \
+  "Authorization: Client " CLIENT_SECRET "\r\n"
+
+static const sensor_data_t reading = {.temperature = 23.5,
+                                      .humidity = 65.0,
+                                      .battery_level = 85,
+                                      .led_state = false};
+
+static const char *host = MAGISTRALA_IP;
+static struct mg_http_conn conn;
+static uint8_t recv_buf[512];
+static struct mg_http_reader reader;
+
+/* The backlog: reading i was taken at i * INTERVAL_MS. */
+struct cursor {
+  size_t next;
+  size_t count;
+};
+
+static int next_reading(sensor_data_t *data, int64_t *timestamp, void *user) {
+  struct cursor *c = user;
+
+  if (c->next == c->count) {
+    return 0;
+  }
+  *data = reading;
+  *timestamp = (int64_t)c->next++ * INTERVAL_MS;
+
+  return 1;
+}
+
+static int acquire(void) {
+  int sock = mg_http_conn_acquire(&conn, mg_uptime_ms());
+
+  if (sock >= 0 && !conn.reused) {
+    int one = 1;
+
+    (void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    mg_http_reader_reset(&reader);
+  }
+
+  return sock;
+}
+
+static int read_response(int sock) {
+  bool keep_alive = false;
+  int status = mg_http_read_response(&reader, sock, TIMEOUT_MS, &keep_alive);
+
+  if (status < 0) {
+    mg_http_conn_close(&conn);
+    return status;
+  }
+  mg_http_conn_release(&conn, keep_alive, mg_uptime_ms());
+
+  return status >= 200 && status < 300 ? 0 : -EPROTO;
+}
+
+/* Sends the POST of one reading; the head and body go out in one send. */
+static int send_reading(int sock, struct cursor *c) {
+  uint8_t req[512];
+  sensor_data_t data;
+  int64_t timestamp;
+  int head, body;
+
+  if (next_reading(&data, &timestamp, c) == 0) {
+    return -ENODATA;
+  }
+  body = mg_telemetry_senml_cbor_encode(&data, timestamp, mg_uptime_ms(),
+                                        req + 256, sizeof(req) - 256);
+  head = snprintf((char *)req, 256, REQUEST_HEAD "Content-Length: %d\r\n\r\n",
+                  host, body);
+  if (body < 0 || head < 0 || head >= 256) {
+    return -E2BIG;
+  }
+  memmove(req + head, req + 256, body);
+
+  return mg_net_send(sock, req, head + body) < 0 ? -EIO : 0;
+}
+
+/* Up to @p depth POSTs in flight; 1 waits for every response. */
+static int drain_posts(size_t readings, size_t depth, size_t *requests) {
+  struct cursor c = {.count = readings};
+  size_t in_flight = 0;
+  int sock = -1;
+  int ret;
+
+  while (c.next < c.count || in_flight > 0) {
+    if (c.next < c.count && in_flight < depth) {
+      sock = acquire();
+      if (sock < 0) {
+        return sock;
+      }
+      ret = send_reading(sock, &c);
+      if (ret < 0) {
+        return ret;
+      }
+      in_flight++;
+      (*requests)++;
+      continue;
+    }
+
+    ret = read_response(sock);
+    if (ret < 0) {
+      return ret;
+    }
+    in_flight--;
+    if (conn.sock < 0 && in_flight > 0) {
+      /* Closed by the server with POSTs pipelined behind. */
+      return -ECONNRESET;
+    }
+  }
+
+  return 0;
+}
+
+/* One POST with the whole backlog as a chunked body. */
+static int drain_chunked(size_t readings, size_t chunk, size_t *requests) {
+  struct cursor c = {.count = readings};
+  struct mg_http_senml_body body;
+  uint8_t *buf;
+  char head[256];
+  int sock, len, ret;
+
+  buf = malloc(chunk + MG_HTTP_CHUNK_HEAD + MG_HTTP_CHUNK_TAIL);
+  if (buf == NULL) {
+    return -ENOMEM;
+  }
+
+  sock = acquire();
+  if (sock < 0) {
+    free(buf);
+    return sock;
+  }
+
+  len = snprintf(head, sizeof(head),
+                 REQUEST_HEAD "Transfer-Encoding: chunked\r\n\r\n", host);
+  mg_http_senml_body_init(&body, next_reading, &c, mg_uptime_ms());
+  ret = mg_net_send(sock, head, len) < 0 ? -EIO : 0;
+  if (ret == 0) {
+    ret = mg_http_send_chunked(sock, mg_http_senml_body_produce, &body, buf,
+                               chunk + MG_HTTP_CHUNK_HEAD +
+                                   MG_HTTP_CHUNK_TAIL);
+  }
+  if (ret >= 0) {
+    ret = read_response(sock);
+  }
+  free(buf);
+  (*requests)++;
+
+  return ret < 0 ? ret : 0;
+}
+
+int main(int argc, char **argv) {
+  static const char *const modes[] = {"post", "pipelined", "chunked"};
+  size_t readings = DEFAULT_READINGS;
+  size_t depth = DEFAULT_PIPELINED;
+  size_t chunk = DEFAULT_CHUNK;
+  int port = MAGISTRALA_HTTP_PORT;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "H:p:n:w:c:")) != -1) {
+    switch (opt) {
+    case 'H':
+      host = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'n':
+      readings = strtoul(optarg, NULL, 10);
+      break;
+    case 'w':
+      depth = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      chunk = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      readings = 0;
+      break;
+    }
+  }
+
+  if (readings == 0 || depth < 1 || depth > MAX_PIPELINED || chunk < 128) {
+    fprintf(stderr,
+            "Usage: %s [-H host] [-p port] [-n readings] [-w pipelined] "
+            "[-c chunk bytes]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  mg_http_reader_init(&reader, recv_buf, sizeof(recv_buf));
+  printf("%zu readings, %zu pipelined, %zu B chunks\n\n", readings, depth,
+         chunk);
+  printf("%-10s %9s %10s %12s %12s %8s\n", "mode", "requests", "time s",
+         "readings/s", "tx B", "tx B/rd");
+
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    size_t requests = 0;
+    uint64_t start_us, elapsed_us;
+    int ret;
+
+    mg_http_conn_init(&conn, host, port, 0);
+    memset(&mg_net_stats, 0, sizeof(mg_net_stats));
+    start_us = mg_uptime_us();
+    if (m == 2) {
+      ret = drain_chunked(readings, chunk, &requests);
+    } else {
+      ret = drain_posts(readings, m == 0 ? 1 : depth, &requests);
+    }
+    elapsed_us = mg_uptime_us() - start_us;
+    mg_http_conn_close(&conn);
+
+    if (ret < 0) {
+      printf("%-10s failed: %s\n", modes[m], strerror(-ret));
+      continue;
+    }
+    printf("%-10s %9zu %10.3f %12.1f %12llu %8.1f\n", modes[m], requests,
+           elapsed_us / 1e6, readings / (elapsed_us / 1e6),
+           (unsigned long long)mg_net_stats.tx_bytes,
+           (double)mg_net_stats.tx_bytes / readings);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,44 @@
+#!/bin/sh
+# HTTP telemetry POSTs on one kept-alive connection against a new
+# connection for every POST, as the device firmware used to open.
+#
+#   ./bench/http_keepalive.sh [build dir] [messages]
+#
+# One POST at a time. The stand-in holds every response back by DELAY ms
+# (0 and 20 by default, one round trip) and a new connection's first one
+# by twice that, for its TCP handshake. A second run limits connections to
+# MAX_REQUESTS requests (default 100, as nginx does), so the client has to
+# notice the server closing them and connect again.
+set -e
+
+build=${1:-build}
+count=${2:-1000}
+max_requests=${MAX_REQUESTS:-100}
+standin="$(dirname "$0")/../tools/standin.py"
+port=8099
+
+for delay in ${DELAY:-0 20}; do
+  for limit in 0 "$max_requests"; do
+    for mode in keep-alive per-post; do
+      python3 "$standin" --http "$port" --mqtt 0 --coap 0 --ws 0 \
+        --delay "$delay" --http-max-requests "$limit" >/dev/null &
+      pid=$!
+      sleep 0.5
+      printf 'delay %-3s max %-4s %-10s: ' "$delay" "$limit" "$mode"
+      # shellcheck disable=SC2086
+      stats=$("$build/mg_client" -H 127.0.0.1 -p "$port" -n "$count" \
+        $([ "$mode" = per-post ] && echo -r) http 2>/dev/null || true)
+      kill "$pid"
+      wait "$pid" 2>/dev/null || true
+      echo "$stats" |
+        awk '
+          /^throughput/ { t = $5 }
+          /^latency/ { p50 = $6; p99 = $8 }
+          /^readings/ { failed = $4 }
+          /^http:/ { conns = $2; found = $10 }
+          END { printf "%9s posts/s, p50 %6.2f ms, p99 %6.2f ms, " \
+                       "%4s connections, %3s found closed, %s failed\n",
+                       t, p50 / 1000, p99 / 1000, conns, found, failed }'
+    done
+  done
+done
@@ -0,0 +1,22 @@
+#!/bin/sh
+# MQTT throughput against a local broker for a range of in-flight windows.
+#
+#   ./bench/mqtt_window.sh [build dir] [host] [messages]
+#
+# Without a real link in between, start the stand-in with a reply delay to
+# stand in for the round trip: python3 tools/standin.py --delay 20
+set -e
+
+build=${1:-build}
+host=${2:-127.0.0.1}
+count=${3:-2000}
+
+for qos in 1 2; do
+  for window in 1 2 4 8 16 32 64; do
+    printf 'qos %d window %2d: ' "$qos" "$window"
+    "$build/mg_client" -H "$host" -n "$count" -q "$qos" -w "$window" mqtt \
+      2>/dev/null |
+      awk '/^throughput/ { t = $2 } /^latency/ { l = $6 }
+           END { printf "%8s msg/s, p50 ack %s us\n", t, l }'
+  done
+done
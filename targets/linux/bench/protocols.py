@@ -0,0 +1,344 @@
+#!/usr/bin/env python3
+"""The same telemetry workload over MQTT, CoAP, HTTP and WebSocket, as JSON.
+
+Each transport sends the same readings with mg_client, one run at a time,
+to a fresh stand-in on loopback. By default every message is acknowledged:
+MQTT QoS 1, CoAP CON, an HTTP response, and the stand-in echoing every
+WebSocket frame. --unacked runs MQTT QoS 0, CoAP NON and WebSocket frames
+without echo instead; HTTP has no such mode and still waits for responses.
+
+Per transport it reports:
+
+  throughput  readings and messages per second
+  latency     p50, p99 and max of the time send() took, in microseconds
+  payload     the bytes mg_client handed to and got from its sockets
+  wire        the packets and bytes loopback carried both ways during the
+              run, so TCP and UDP headers, handshakes, ACKs and FINs are in.
+              Frame bytes include loopback's 14-byte Ethernet header.
+  tls         the wire bytes with TLS records around every send and every
+              response, computed from the record format: TLS 1.2 and
+              DTLS 1.2 with the suites the targets use add 29 bytes a record.
+              Pass --tls-handshake and --dtls-handshake, as measured by
+              tls_resume.py and dtls_modes.py, to count one handshake too.
+  wakeups     voluntary context switches, the times mg_client blocked
+  ram         the heap peak above the heap before connecting, taken by
+              preloading libmg_heap_peak.so, the peak RSS, and the data and
+              bss of the transport's own code
+  rom         text and data of the transport's object file and of the
+              common modules it uses that main.c does not
+
+The sizes are x86-64 ones, which rank the transports but are not what a
+device build takes. --elf adds the sizes of a Zephyr build, such as
+native_sim or a board, of the matching sample:
+
+    python3 bench/protocols.py build --elf mqtt=../zephyr/mqtt/build/zephyr/zephyr.elf
+
+The wire counters are loopback's own, so nothing else should use loopback
+during a run.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import re
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+PROTOCOLS = ("mqtt", "coap", "http", "websocket")
+STANDIN_FLAG = {"mqtt": "--mqtt", "coap": "--coap", "http": "--http",
+                "websocket": "--ws"}
+# Record header, explicit nonce and tag: TLS 1.2 AES-128-GCM as in
+# common/tls/mg_tls_small.h, DTLS 1.2 AES-128-CCM-8 as in the ESP32
+# coap_dtls client.
+TLS_RECORD = 5 + 8 + 16
+DTLS_RECORD = 13 + 8 + 8
+ETH_HEADER = 14
+LOOPBACK = "/sys/class/net/lo/statistics/"
+COMMON = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                      "..", "..", "..", "common")
+
+
+def free_port(kind):
+    with socket.socket(socket.AF_INET, kind) as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def loopback():
+    counts = {}
+    for name in ("tx_packets", "tx_bytes"):
+        with open(LOOPBACK + name) as f:
+            counts[name] = int(f.read())
+    return counts
+
+
+def parse_client(out):
+    """Picks the figures out of mg_client's report."""
+    patterns = {
+        "readings": (r"^readings:\s+(\d+) sent, (\d+) failed in ([\d.]+) s "
+                     r"\((\d+) messages\)"),
+        "throughput": r"^throughput:\s+([\d.]+) readings/s in ([\d.]+) msg/s",
+        "latency": r"^latency us:\s+avg (\d+) p50 (\d+) p99 (\d+) max (\d+)",
+        "wire": r"^wire bytes:\s+tx (\d+) rx (\d+) \(.*, (\d+) sends\)",
+        "payload": r"^payload:\s+(\S+), last (\d+) B",
+    }
+    found = {}
+    for key, pattern in patterns.items():
+        m = re.search(pattern, out, re.MULTILINE)
+        if m is None:
+            return None
+        found[key] = m.groups()
+
+    sent, failed, elapsed, messages = found["readings"]
+    readings_s, msg_s = found["throughput"]
+    avg, p50, p99, top = found["latency"]
+    tx, rx, sends = found["wire"]
+    return {
+        "format": found["payload"][0],
+        "payload_len": int(found["payload"][1]),
+        "readings": int(sent),
+        "failed": int(failed),
+        "messages": int(messages),
+        "elapsed_s": float(elapsed),
+        "readings_per_s": float(readings_s),
+        "msg_per_s": float(msg_s),
+        "latency_us": {"avg": int(avg), "p50": int(p50), "p99": int(p99),
+                       "max": int(top)},
+        "payload_bytes": {"tx": int(tx), "rx": int(rx)},
+        "sends": int(sends),
+    }
+
+
+def size(path):
+    """text, data and bss of an object or ELF file."""
+    out = subprocess.run(["size", path], check=True, capture_output=True,
+                         text=True).stdout.splitlines()
+    text, data, bss = (int(v) for v in out[1].split()[:3])
+    return {"text": text, "data": data, "bss": bss}
+
+
+def includes(path):
+    with open(path) as f:
+        return set(re.findall(r'#include "(mg_\w+)\.h"', f.read()))
+
+
+def footprint(build, protocol):
+    """Sizes of the transport's object and the common modules only it uses."""
+    src = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..",
+                       "src")
+    objects = {protocol: os.path.join(build, "CMakeFiles", "mg_client.dir",
+                                      "src", protocol + ".c.o")}
+    shared = includes(os.path.join(src, "main.c"))
+    for module in sorted(includes(os.path.join(src, protocol + ".c")) -
+                         shared):
+        obj = os.path.join(build, "mg_common", "CMakeFiles", "mg_common.dir",
+                           "src", module + ".c.o")
+        if os.path.exists(obj):
+            objects[module] = obj
+
+    sizes = {name: size(path) for name, path in objects.items()}
+    return {
+        "rom": sum(s["text"] + s["data"] for s in sizes.values()),
+        "static_ram": sum(s["data"] + s["bss"] for s in sizes.values()),
+        "objects": sizes,
+    }
+
+
+def run(args, protocol):
+    port = free_port(socket.SOCK_DGRAM if protocol == "coap"
+                     else socket.SOCK_STREAM)
+    standin = [sys.executable, args.standin, "--host", "127.0.0.1",
+               "--delay", str(args.delay)]
+    # The stand-in serves every protocol; give the others ports of their own.
+    for name, flag in STANDIN_FLAG.items():
+        standin += [flag, str(port if name == protocol else 0)]
+    acked = not args.unacked or protocol == "http"
+    if protocol == "websocket" and acked:
+        standin.append("--echo")
+
+    client = [args.client, "-H", "127.0.0.1", "-p", str(port),
+              "-n", str(args.count), "-f", args.format,
+              "-b", str(args.batch), "-i", str(args.interval)]
+    if protocol in ("mqtt", "coap"):
+        client += ["-q", "0" if args.unacked else "1"]
+    if protocol == "websocket":
+        client += ["-e"] if acked else []
+    client.append(protocol)
+
+    peak_file = os.path.join(args.tmp, "heap_peak")
+    if os.path.exists(peak_file):
+        os.unlink(peak_file)
+    env = dict(os.environ, LD_PRELOAD=args.shim, MG_HEAP_PEAK_FILE=peak_file)
+
+    server = subprocess.Popen(standin, stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL)
+    try:
+        time.sleep(0.5)
+        before = loopback()
+        with tempfile.TemporaryFile("w+") as out:
+            proc = subprocess.Popen(client, stdout=out,
+                                    stderr=subprocess.DEVNULL, env=env)
+            _, status, usage = os.wait4(proc.pid, 0)
+            proc.returncode = os.waitstatus_to_exitcode(status)
+            # Let the closing handshake and the last ACKs go through.
+            time.sleep(0.2)
+            after = loopback()
+            out.seek(0)
+            report = out.read()
+    finally:
+        server.kill()
+        server.wait()
+
+    result = {"protocol": protocol, "acknowledged": acked,
+              "ok": proc.returncode == 0}
+    figures = parse_client(report)
+    if figures is None:
+        result["ok"] = False
+        return result
+    result.update(figures)
+
+    packets = after["tx_packets"] - before["tx_packets"]
+    frame_bytes = after["tx_bytes"] - before["tx_bytes"]
+    ip_bytes = frame_bytes - ETH_HEADER * packets
+    payload = figures["payload_bytes"]["tx"] + figures["payload_bytes"]["rx"]
+    result["wire"] = {
+        "packets": packets,
+        "frame_bytes": frame_bytes,
+        "ip_bytes": ip_bytes,
+        "overhead_bytes": ip_bytes - payload,
+        "ip_bytes_per_reading": (round(ip_bytes / figures["readings"], 1)
+                                 if figures["readings"] else None),
+    }
+
+    # One record per send, and one per response when there are any.
+    records = figures["sends"] + (figures["messages"] if acked else 0)
+    record_len = DTLS_RECORD if protocol == "coap" else TLS_RECORD
+    handshake = (args.dtls_handshake if protocol == "coap"
+                 else args.tls_handshake)
+    result["tls"] = {
+        "version": "DTLS 1.2" if protocol == "coap" else "TLS 1.2",
+        "records": records,
+        "record_bytes": records * record_len,
+        "handshake_bytes": handshake,
+        "ip_bytes": ip_bytes + records * record_len + handshake,
+    }
+
+    result["wakeups"] = {
+        "voluntary": usage.ru_nvcsw,
+        "involuntary": usage.ru_nivcsw,
+        "per_message": (round(usage.ru_nvcsw / figures["messages"], 2)
+                        if figures["messages"] else None),
+    }
+
+    sizes = footprint(args.build, protocol)
+    heap = None
+    if os.path.exists(peak_file):
+        with open(peak_file) as f:
+            heap = int(f.read())
+    result["ram"] = {"heap_peak": heap, "max_rss_kb": usage.ru_maxrss,
+                     "static": sizes["static_ram"]}
+    result["rom"] = {"transport": sizes["rom"], "objects": sizes["objects"]}
+    if protocol in args.elf:
+        elf = size(args.elf[protocol])
+        result["device"] = {"elf": args.elf[protocol],
+                            "rom": elf["text"] + elf["data"],
+                            "static_ram": elf["data"] + elf["bss"]}
+
+    return result
+
+
+def git_revision():
+    try:
+        return subprocess.run(["git", "-C", COMMON, "rev-parse", "HEAD"],
+                              check=True, capture_output=True,
+                              text=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("build", nargs="?", default="build",
+                        help="build directory with mg_client and "
+                        "libmg_heap_peak.so")
+    parser.add_argument("-n", "--count", type=int, default=2000,
+                        help="readings to send over each transport")
+    parser.add_argument("-f", "--format", choices=("json", "cbor"),
+                        default="cbor")
+    parser.add_argument("-b", "--batch", type=int, default=1,
+                        help="cbor: readings per SenML pack")
+    parser.add_argument("-i", "--interval", type=int, default=0,
+                        help="milliseconds between messages, the duty cycle")
+    parser.add_argument("--delay", type=float, default=0.0,
+                        help="stand-in reply delay in milliseconds")
+    parser.add_argument("--unacked", action="store_true",
+                        help="MQTT QoS 0, CoAP NON, WebSocket without echo")
+    parser.add_argument("--tls-handshake", type=int, default=0,
+                        help="bytes of a TLS handshake to add to the TCP "
+                        "transports")
+    parser.add_argument("--dtls-handshake", type=int, default=0,
+                        help="bytes of a DTLS handshake to add to CoAP")
+    parser.add_argument("--elf", action="append", default=[],
+                        metavar="PROTOCOL=PATH",
+                        help="Zephyr build of a transport to size")
+    parser.add_argument("-p", "--protocol", action="append",
+                        choices=PROTOCOLS, help="transports to run "
+                        "(default all)")
+    parser.add_argument("-o", "--output", help="write the JSON here")
+    args = parser.parse_args()
+
+    args.build = os.path.abspath(args.build)
+    args.client = os.path.join(args.build, "mg_client")
+    args.shim = os.path.join(args.build, "libmg_heap_peak.so")
+    args.standin = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                "..", "tools", "standin.py")
+    for path in (args.client, args.shim):
+        if not os.path.exists(path):
+            sys.exit("%s not found, build the Linux target first" % path)
+    if not os.path.exists(LOOPBACK):
+        sys.exit("no loopback statistics in %s" % LOOPBACK)
+    elf = {}
+    for spec in args.elf:
+        name, _, path = spec.partition("=")
+        if name not in PROTOCOLS or not path:
+            sys.exit("--elf wants PROTOCOL=PATH, got %s" % spec)
+        elf[name] = path
+    args.elf = elf
+
+    with tempfile.TemporaryDirectory() as tmp:
+        args.tmp = tmp
+        results = [run(args, p) for p in args.protocol or PROTOCOLS]
+
+    doc = {
+        "suite": "protocols",
+        "version": 1,
+        "date": datetime.datetime.now(datetime.timezone.utc).isoformat(
+            timespec="seconds"),
+        "revision": git_revision(),
+        "host": {"system": platform.system(), "release": platform.release(),
+                 "machine": platform.machine()},
+        "workload": {"readings": args.count, "format": args.format,
+                     "batch": args.batch, "interval_ms": args.interval,
+                     "delay_ms": args.delay,
+                     "acknowledged": not args.unacked},
+        "results": results,
+    }
+    text = json.dumps(doc, indent=2) + "\n"
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
+
+    return 0 if all(r["ok"] for r in results) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,293 @@
+/* Simulates a fleet reconnecting after a broker restart, on a virtual clock,
+ * with the retry policy of the old mqtts firmware, plain exponential
+ * backoff and the mg_backoff.h scheduler.
+ *
+ *   ./build/mg_bench_reconnect [-n clients] [-d down s] [-c accepts/s]
+ *                              [-t]
+ *
+ * Every client loses its connection at once (each notices within 100 ms)
+ * and the broker is down for a while. Once it is back it accepts a limited
+ * number of connections per second, standing in for the TLS handshakes it
+ * can afford, and refuses the rest, which retry. The summary shows the
+ * attempts per connection, the busiest second once the broker is back and
+ * when the clients got connected. -t prints the connection attempts of
+ * every second instead.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mg_backoff.h"
+#include "mg_platform.h"
+
+#define DEFAULT_CLIENTS 10000
+#define DEFAULT_DOWN_S 10
+#define DEFAULT_CAPACITY 500
+
+/* Give up on a run that has not reconnected everyone by then. */
+#define HORIZON_S 3600
+#define DETECT_MS 100
+
+/* The mqtts settings, in src/config.h of that target. */
+#define CONST_FIRST_MS 1000
+#define CONST_MS 5000
+static const struct mg_backoff_config backoff_config = {
+    .first_ms = 1000,
+    .base_ms = 1000,
+    .max_ms = 60000,
+    .stable_ms = 60000,
+};
+
+enum policy {
+  POLICY_CONSTANT,
+  POLICY_EXPONENTIAL,
+  POLICY_DECORRELATED,
+  POLICY_COUNT,
+};
+
+static const char *const policy_names[] = {
+    "constant 5 s",
+    "exponential",
+    "decorrelated jitter",
+};
+
+struct client {
+  struct mg_backoff backoff;
+  uint32_t failures;
+};
+
+struct event {
+  int64_t at;
+  uint32_t client;
+};
+
+/* Binary min-heap of pending connection attempts. */
+static struct event *heap;
+static size_t heap_len;
+
+static void heap_push(int64_t at, uint32_t client) {
+  size_t i = heap_len++;
+
+  while (i > 0 && heap[(i - 1) / 2].at > at) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+
+  heap[i] = (struct event){.at = at, .client = client};
+}
+
+static struct event heap_pop(void) {
+  struct event top = heap[0];
+  struct event last = heap[--heap_len];
+  size_t i = 0;
+
+  for (;;) {
+    size_t child = 2 * i + 1;
+
+    if (child >= heap_len) {
+      break;
+    }
+    if (child + 1 < heap_len && heap[child + 1].at < heap[child].at) {
+      child++;
+    }
+    if (heap[child].at >= last.at) {
+      break;
+    }
+
+    heap[i] = heap[child];
+    i = child;
+  }
+
+  if (heap_len > 0) {
+    heap[i] = last;
+  }
+
+  return top;
+}
+
+static uint32_t uniform_ms(uint32_t max) {
+  return (uint32_t)((uint64_t)mg_rand32() * (max + 1ULL) >> 32);
+}
+
+/* Delay before the client's next attempt, after losing the connection
+ * (failures 0) or failing to connect.
+ */
+static uint32_t next_delay(enum policy policy, struct client *c) {
+  switch (policy) {
+  case POLICY_CONSTANT:
+    /* The main loop's 1 s sleep, then the constant retry delay. */
+    return c->failures == 0 ? CONST_FIRST_MS : CONST_MS;
+  case POLICY_EXPONENTIAL: {
+    uint64_t delay =
+        c->failures == 0 ? 0 : (uint64_t)backoff_config.base_ms
+                                   << (c->failures < 16 ? c->failures - 1 : 15);
+
+    return delay < backoff_config.max_ms ? delay : backoff_config.max_ms;
+  }
+  default:
+    return mg_backoff_next(&c->backoff);
+  }
+}
+
+static int compare_ms(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+struct result {
+  uint64_t attempts;
+  /* Most attempts in a second once the broker is back. */
+  uint32_t peak;
+  int64_t p50_ms;
+  int64_t p99_ms;
+  int64_t last_ms;
+  uint32_t connected;
+};
+
+/* Runs one policy; fills @p per_second with the attempts of every second. */
+static void simulate(enum policy policy, uint32_t clients, int64_t down_ms,
+                     uint32_t capacity, uint32_t *per_second,
+                     struct result *res) {
+  struct client *fleet = calloc(clients, sizeof(*fleet));
+  int64_t *connect_ms = malloc(clients * sizeof(*connect_ms));
+  int64_t second = -1;
+  uint32_t accepted = 0;
+
+  memset(res, 0, sizeof(*res));
+  heap_len = 0;
+
+  for (uint32_t i = 0; i < clients; i++) {
+    struct client *c = &fleet[i];
+    int64_t lost = uniform_ms(DETECT_MS);
+
+    /* Connected for long enough that the first retry is a fast one. */
+    mg_backoff_init(&c->backoff, &backoff_config);
+    mg_backoff_connected(&c->backoff, -(int64_t)backoff_config.stable_ms);
+    mg_backoff_disconnected(&c->backoff, lost);
+
+    heap_push(lost + next_delay(policy, c), i);
+  }
+
+  while (heap_len > 0) {
+    struct event ev = heap_pop();
+    struct client *c = &fleet[ev.client];
+
+    if (ev.at >= (int64_t)HORIZON_S * 1000) {
+      break;
+    }
+
+    if (ev.at / 1000 != second) {
+      second = ev.at / 1000;
+      accepted = 0;
+    }
+
+    res->attempts++;
+    if (++per_second[second] > res->peak && ev.at >= down_ms) {
+      res->peak = per_second[second];
+    }
+
+    if (ev.at >= down_ms && accepted < capacity) {
+      accepted++;
+      connect_ms[res->connected++] = ev.at;
+      mg_backoff_connected(&c->backoff, ev.at);
+      continue;
+    }
+
+    c->failures++;
+    heap_push(ev.at + next_delay(policy, c), ev.client);
+  }
+
+  if (res->connected > 0) {
+    qsort(connect_ms, res->connected, sizeof(*connect_ms), compare_ms);
+    res->p50_ms = connect_ms[res->connected / 2];
+    res->p99_ms = connect_ms[(uint64_t)res->connected * 99 / 100];
+    res->last_ms = connect_ms[res->connected - 1];
+  }
+
+  free(connect_ms);
+  free(fleet);
+}
+
+int main(int argc, char **argv) {
+  uint32_t clients = DEFAULT_CLIENTS;
+  uint32_t capacity = DEFAULT_CAPACITY;
+  int64_t down_ms = DEFAULT_DOWN_S * 1000;
+  uint32_t *per_second[POLICY_COUNT];
+  struct result res[POLICY_COUNT];
+  int timeline = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:d:c:t")) != -1) {
+    switch (opt) {
+    case 'n':
+      clients = strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      down_ms = strtoll(optarg, NULL, 10) * 1000;
+      break;
+    case 'c':
+      capacity = strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      timeline = 1;
+      break;
+    default:
+      clients = 0;
+      break;
+    }
+  }
+
+  if (clients == 0 || capacity == 0 || down_ms < 0) {
+    fprintf(stderr,
+            "Usage: %s [-n clients] [-d down s] [-c accepts/s] [-t]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  heap = malloc(clients * sizeof(*heap));
+
+  for (int p = 0; p < POLICY_COUNT; p++) {
+    per_second[p] = calloc(HORIZON_S, sizeof(*per_second[p]));
+    simulate(p, clients, down_ms, capacity, per_second[p], &res[p]);
+  }
+
+  if (timeline) {
+    int64_t end = 0;
+
+    for (int p = 0; p < POLICY_COUNT; p++) {
+      end = res[p].last_ms > end ? res[p].last_ms : end;
+    }
+
+    printf("second,constant,exponential,decorrelated\n");
+    for (int64_t s = 0; s <= end / 1000 && s < HORIZON_S; s++) {
+      printf("%lld,%u,%u,%u\n", (long long)s, per_second[0][s],
+             per_second[1][s], per_second[2][s]);
+    }
+  } else {
+    printf("%u clients, broker down %lld s, then %u accepts/s\n\n", clients,
+           (long long)(down_ms / 1000), capacity);
+    printf("%-20s %10s %9s %9s %9s %9s %9s\n", "policy", "attempts",
+           "per conn", "peak/s", "p50 s", "p99 s", "all s");
+    for (int p = 0; p < POLICY_COUNT; p++) {
+      printf("%-20s %10llu %9.1f %9u %9.1f %9.1f ", policy_names[p],
+             (unsigned long long)res[p].attempts,
+             res[p].connected ? (double)res[p].attempts / res[p].connected
+                              : 0.0,
+             res[p].peak, res[p].p50_ms / 1e3, res[p].p99_ms / 1e3);
+      if (res[p].connected == clients) {
+        printf("%9.1f\n", res[p].last_ms / 1e3);
+      } else {
+        printf("%9s (%u left)\n", "-", clients - res[p].connected);
+      }
+    }
+  }
+
+  for (int p = 0; p < POLICY_COUNT; p++) {
+    free(per_second[p]);
+  }
+  free(heap);
+
+  return EXIT_SUCCESS;
+}
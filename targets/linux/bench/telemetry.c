@@ -0,0 +1,92 @@
+/* Compares the telemetry encoders: bytes per reading and encode cost.
+ *
+ *   ./build/mg_bench_telemetry [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mg_platform.h"
+#include "mg_telemetry.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#define DEFAULT_ITERATIONS 1000000
+
+static sensor_data_t current_data = {.temperature = 23.5,
+                                     .humidity = 65.0,
+                                     .battery_level = 85,
+                                     .led_state = false};
+
+static int encode_json(int64_t ts, uint8_t *buf, size_t len) {
+  return mg_telemetry_json_encode(&current_data, ts, (char *)buf, len);
+}
+
+static int encode_cbor(int64_t ts, uint8_t *buf, size_t len) {
+  return mg_telemetry_senml_cbor_encode(&current_data, ts, ts, buf, len);
+}
+
+static const struct {
+  const char *name;
+  int (*encode)(int64_t ts, uint8_t *buf, size_t len);
+} encoders[] = {
+    {"json", encode_json},
+    {"senml+cbor", encode_cbor},
+};
+
+static uint64_t cycles(void) {
+#if HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+int main(int argc, char **argv) {
+  unsigned long iterations = DEFAULT_ITERATIONS;
+  uint8_t buf[256];
+
+  if (argc > 1) {
+    iterations = strtoul(argv[1], NULL, 10);
+  }
+
+  if (iterations == 0) {
+    fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%-12s %8s %10s %12s\n", "format", "bytes", "ns/enc",
+         HAVE_TSC ? "cycles/enc" : "");
+
+  for (size_t e = 0; e < sizeof(encoders) / sizeof(encoders[0]); e++) {
+    uint64_t t0, c0, elapsed_us, elapsed_cycles;
+    int64_t ts = mg_uptime_ms();
+    int len = 0;
+
+    t0 = mg_uptime_us();
+    c0 = cycles();
+    for (unsigned long i = 0; i < iterations; i++) {
+      /* A changing timestamp keeps the encoder from being hoisted. */
+      len = encoders[e].encode(ts + i, buf, sizeof(buf));
+      if (len < 0) {
+        fprintf(stderr, "%s: encode failed %d\n", encoders[e].name, len);
+        return EXIT_FAILURE;
+      }
+    }
+    elapsed_cycles = cycles() - c0;
+    elapsed_us = mg_uptime_us() - t0;
+
+    printf("%-12s %8d %10.1f", encoders[e].name, len,
+           elapsed_us * 1000.0 / iterations);
+    if (HAVE_TSC) {
+      printf(" %12.1f", (double)elapsed_cycles / iterations);
+    }
+    printf("\n");
+  }
+
+  return EXIT_SUCCESS;
+}
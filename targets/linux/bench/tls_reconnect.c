@@ -0,0 +1,433 @@
+/* Reconnect cost of the STM32 mqtts client's TLS setup, with the host's
+ * mbedTLS 2.28, three ways:
+ *
+ *   pem each connect  the original client: everything torn down, and the
+ *                     DRBG seeded and the PEM root parsed and copied again
+ *   der each connect  the same with the DER root parsed in place
+ *   der once          netInit() at boot, then per connect only a session
+ *                     reset, the TCP connect and the handshake
+ *
+ * For each it prints the p50 time of the setup before the TCP connect, the
+ * p50 and max time from the start of the setup to the end of the handshake,
+ * the heap peak of a connect above the heap before it, and what the heap
+ * holds after the last one. mbedTLS is loaded at run time, so the bench
+ * builds without its headers.
+ *
+ *   ./build/mg_bench_tls_reconnect -c ca.pem -d ca.der -p port [-n connects]
+ *
+ * bench/tls_reconnect.sh makes a P-256 CA and server certificate and runs
+ * it against `openssl s_server`.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mg_platform.h"
+
+#define DEFAULT_CONNECTS 50
+#define MAX_CONNECTS 1000
+#define HOSTNAME "localhost"
+
+/* mbedTLS 2.28 constants. */
+#define SSL_IS_CLIENT 0
+#define SSL_TRANSPORT_STREAM 0
+#define SSL_PRESET_DEFAULT 0
+#define SSL_VERIFY_REQUIRED 2
+#define ERR_SSL_WANT_READ -0x6900
+#define ERR_SSL_WANT_WRITE -0x6880
+
+typedef int (*send_fn)(void *, const unsigned char *, size_t);
+typedef int (*recv_fn)(void *, unsigned char *, size_t);
+typedef int (*rng_fn)(void *, unsigned char *, size_t);
+
+/* The contexts are only handed to mbedTLS, so room is all they need. Their
+ * sizes depend on how the library was configured: give them plenty.
+ */
+#define CONTEXT_SIZE 65536
+
+static _Alignas(64) unsigned char ssl[CONTEXT_SIZE];
+static _Alignas(64) unsigned char conf[CONTEXT_SIZE];
+static _Alignas(64) unsigned char cacert[CONTEXT_SIZE];
+static _Alignas(64) unsigned char entropy[CONTEXT_SIZE];
+static _Alignas(64) unsigned char ctr_drbg[CONTEXT_SIZE];
+
+static struct {
+  void (*ssl_init)(void *);
+  void (*ssl_free)(void *);
+  int (*ssl_setup)(void *, const void *);
+  int (*ssl_set_hostname)(void *, const char *);
+  void (*ssl_set_bio)(void *, void *, send_fn, recv_fn, void *);
+  int (*ssl_handshake)(void *);
+  int (*ssl_close_notify)(void *);
+  int (*ssl_session_reset)(void *);
+  void (*config_init)(void *);
+  void (*config_free)(void *);
+  int (*config_defaults)(void *, int, int, int);
+  void (*conf_authmode)(void *, int);
+  void (*conf_ca_chain)(void *, void *, void *);
+  void (*conf_rng)(void *, rng_fn, void *);
+  void (*crt_init)(void *);
+  void (*crt_free)(void *);
+  int (*crt_parse)(void *, const unsigned char *, size_t);
+  int (*crt_parse_der_nocopy)(void *, const unsigned char *, size_t);
+  void (*entropy_init)(void *);
+  void (*entropy_free)(void *);
+  int (*entropy_func)(void *, unsigned char *, size_t);
+  void (*drbg_init)(void *);
+  void (*drbg_free)(void *);
+  int (*drbg_seed)(void *, int (*)(void *, unsigned char *, size_t), void *,
+                   const unsigned char *, size_t);
+  int (*drbg_random)(void *, unsigned char *, size_t);
+} tls;
+
+/* Live heap bytes and their peak, tracked through malloc and friends. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static long live;
+static long peak;
+
+static void *track(void *ptr) {
+  if (ptr != NULL) {
+    live += malloc_usable_size(ptr);
+    if (live > peak) {
+      peak = live;
+    }
+  }
+  return ptr;
+}
+
+void *malloc(size_t size) { return track(__libc_malloc(size)); }
+
+void *calloc(size_t n, size_t size) { return track(__libc_calloc(n, size)); }
+
+void *realloc(void *ptr, size_t size) {
+  if (ptr != NULL) {
+    live -= malloc_usable_size(ptr);
+  }
+  return track(__libc_realloc(ptr, size));
+}
+
+void free(void *ptr) {
+  if (ptr != NULL) {
+    live -= malloc_usable_size(ptr);
+  }
+  __libc_free(ptr);
+}
+
+enum mode { PEM_EACH, DER_EACH, DER_ONCE };
+
+static unsigned char *ca_pem, *ca_der;
+static size_t ca_pem_len, ca_der_len;
+static int port;
+static int sock = -1;
+
+static int load_tls(void) {
+  static const char *const libs[] = {"libmbedcrypto.so.7", "libmbedx509.so.1",
+                                     "libmbedtls.so.14"};
+  void *h[3];
+  size_t i;
+
+  for (i = 0; i < 3; i++) {
+    h[i] = dlopen(libs[i], RTLD_NOW | RTLD_GLOBAL);
+    if (h[i] == NULL) {
+      fprintf(stderr, "%s\n", dlerror());
+      return -ENOENT;
+    }
+  }
+
+#define SYM(field, lib, name)                                                  \
+  if ((*(void **)&tls.field = dlsym(h[lib], name)) == NULL) {                  \
+    fprintf(stderr, "%s not found\n", name);                                   \
+    return -ENOENT;                                                            \
+  }
+  SYM(ssl_init, 2, "mbedtls_ssl_init");
+  SYM(ssl_free, 2, "mbedtls_ssl_free");
+  SYM(ssl_setup, 2, "mbedtls_ssl_setup");
+  SYM(ssl_set_hostname, 2, "mbedtls_ssl_set_hostname");
+  SYM(ssl_set_bio, 2, "mbedtls_ssl_set_bio");
+  SYM(ssl_handshake, 2, "mbedtls_ssl_handshake");
+  SYM(ssl_close_notify, 2, "mbedtls_ssl_close_notify");
+  SYM(ssl_session_reset, 2, "mbedtls_ssl_session_reset");
+  SYM(config_init, 2, "mbedtls_ssl_config_init");
+  SYM(config_free, 2, "mbedtls_ssl_config_free");
+  SYM(config_defaults, 2, "mbedtls_ssl_config_defaults");
+  SYM(conf_authmode, 2, "mbedtls_ssl_conf_authmode");
+  SYM(conf_ca_chain, 2, "mbedtls_ssl_conf_ca_chain");
+  SYM(conf_rng, 2, "mbedtls_ssl_conf_rng");
+  SYM(crt_init, 1, "mbedtls_x509_crt_init");
+  SYM(crt_free, 1, "mbedtls_x509_crt_free");
+  SYM(crt_parse, 1, "mbedtls_x509_crt_parse");
+  SYM(crt_parse_der_nocopy, 1, "mbedtls_x509_crt_parse_der_nocopy");
+  SYM(entropy_init, 0, "mbedtls_entropy_init");
+  SYM(entropy_free, 0, "mbedtls_entropy_free");
+  SYM(entropy_func, 0, "mbedtls_entropy_func");
+  SYM(drbg_init, 0, "mbedtls_ctr_drbg_init");
+  SYM(drbg_free, 0, "mbedtls_ctr_drbg_free");
+  SYM(drbg_seed, 0, "mbedtls_ctr_drbg_seed");
+  SYM(drbg_random, 0, "mbedtls_ctr_drbg_random");
+#undef SYM
+
+  return 0;
+}
+
+static unsigned char *read_file(const char *path, size_t *len, int nul) {
+  FILE *f = fopen(path, "rb");
+  unsigned char *buf;
+  long n;
+
+  if (f == NULL) {
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  n = ftell(f);
+  rewind(f);
+  buf = malloc(n + 1);
+  if (buf != NULL && fread(buf, 1, n, f) != (size_t)n) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  if (buf != NULL) {
+    buf[n] = '\0';
+    /* mbedtls_x509_crt_parse() wants the PEM terminator counted. */
+    *len = n + (nul ? 1 : 0);
+  }
+
+  return buf;
+}
+
+static int net_send(void *ctx, const unsigned char *buf, size_t len) {
+  ssize_t ret = send(*(int *)ctx, buf, len, 0);
+
+  return ret < 0 ? -1 : (int)ret;
+}
+
+static int net_recv(void *ctx, unsigned char *buf, size_t len) {
+  ssize_t ret = recv(*(int *)ctx, buf, len, 0);
+
+  return ret < 0 ? -1 : (int)ret;
+}
+
+/* netInit(): contexts, DRBG, root certificate, configuration and SSL
+ * context.
+ */
+static int tls_init(enum mode mode) {
+  static const char pers[] = "mbedtls";
+  int ret;
+
+  tls.ssl_init(ssl);
+  tls.config_init(conf);
+  tls.crt_init(cacert);
+  tls.drbg_init(ctr_drbg);
+  tls.entropy_init(entropy);
+  if (tls.drbg_seed(ctr_drbg, tls.entropy_func, entropy,
+                    (const unsigned char *)pers, strlen(pers)) != 0) {
+    return -EIO;
+  }
+
+  if (mode == PEM_EACH) {
+    ret = tls.crt_parse(cacert, ca_pem, ca_pem_len);
+  } else {
+    ret = tls.crt_parse_der_nocopy(cacert, ca_der, ca_der_len);
+  }
+  if (ret < 0) {
+    fprintf(stderr, "root certificate: -0x%04x\n", -ret);
+    return -EINVAL;
+  }
+
+  if (tls.config_defaults(conf, SSL_IS_CLIENT, SSL_TRANSPORT_STREAM,
+                          SSL_PRESET_DEFAULT) != 0) {
+    return -EIO;
+  }
+  tls.conf_authmode(conf, SSL_VERIFY_REQUIRED);
+  tls.conf_ca_chain(conf, cacert, NULL);
+  tls.conf_rng(conf, tls.drbg_random, ctr_drbg);
+
+  if (tls.ssl_setup(ssl, conf) != 0 ||
+      tls.ssl_set_hostname(ssl, HOSTNAME) != 0) {
+    return -EIO;
+  }
+
+  return 0;
+}
+
+/* netClear(). */
+static void tls_clear(void) {
+  tls.crt_free(cacert);
+  tls.ssl_free(ssl);
+  tls.config_free(conf);
+  tls.drbg_free(ctr_drbg);
+  tls.entropy_free(entropy);
+}
+
+/* netConnect(). */
+static int tls_connect(void) {
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(port),
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  int ret;
+
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    return -errno;
+  }
+
+  tls.ssl_set_bio(ssl, &sock, net_send, net_recv, NULL);
+  while ((ret = tls.ssl_handshake(ssl)) != 0) {
+    if (ret != ERR_SSL_WANT_READ && ret != ERR_SSL_WANT_WRITE) {
+      fprintf(stderr, "handshake: -0x%04x\n", -ret);
+      return -ECONNREFUSED;
+    }
+  }
+
+  return 0;
+}
+
+/* netDisconnect(). */
+static void tls_disconnect(void) {
+  int ret;
+
+  do {
+    ret = tls.ssl_close_notify(ssl);
+  } while (ret == ERR_SSL_WANT_WRITE);
+  tls.ssl_session_reset(ssl);
+  if (sock >= 0) {
+    close(sock);
+    sock = -1;
+  }
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static int run(enum mode mode, size_t connects, uint64_t *setup_us,
+               uint64_t *connect_us, long *heap_peak, long *heap_after) {
+  long base = live;
+  size_t i;
+  int ret;
+
+  *heap_peak = 0;
+  if (mode == DER_ONCE && (ret = tls_init(mode)) < 0) {
+    return ret;
+  }
+
+  for (i = 0; i < connects; i++) {
+    uint64_t start = mg_uptime_us();
+    long before = live;
+
+    peak = live;
+    if (mode != DER_ONCE) {
+      /* mqttConnectBroker() before the fix: clear, then initialise again. */
+      if (i > 0) {
+        tls_clear();
+      }
+      ret = tls_init(mode);
+      if (ret < 0) {
+        return ret;
+      }
+    }
+    setup_us[i] = mg_uptime_us() - start;
+    ret = tls_connect();
+    if (ret < 0) {
+      return ret;
+    }
+    connect_us[i] = mg_uptime_us() - start;
+    if (peak - before > *heap_peak) {
+      *heap_peak = peak - before;
+    }
+    tls_disconnect();
+  }
+
+  *heap_after = live - base;
+  tls_clear();
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  static const char *const modes[] = {"pem each connect", "der each connect",
+                                      "der once"};
+  const char *pem_path = NULL, *der_path = NULL;
+  size_t connects = DEFAULT_CONNECTS;
+  uint64_t *setup_us, *connect_us;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:d:p:n:")) != -1) {
+    switch (opt) {
+    case 'c':
+      pem_path = optarg;
+      break;
+    case 'd':
+      der_path = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'n':
+      connects = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      connects = 0;
+      break;
+    }
+  }
+
+  if (pem_path == NULL || der_path == NULL || port <= 0 || connects < 2 ||
+      connects > MAX_CONNECTS) {
+    fprintf(stderr,
+            "Usage: %s -c ca.pem -d ca.der -p port [-n connects]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  ca_pem = read_file(pem_path, &ca_pem_len, 1);
+  ca_der = read_file(der_path, &ca_der_len, 0);
+  setup_us = calloc(connects, sizeof(*setup_us));
+  connect_us = calloc(connects, sizeof(*connect_us));
+  if (ca_pem == NULL || ca_der == NULL || setup_us == NULL ||
+      connect_us == NULL ||
+      load_tls() < 0) {
+    return EXIT_FAILURE;
+  }
+
+  printf("%zu connects, root certificate %zu B PEM, %zu B DER\n\n", connects,
+         ca_pem_len - 1, ca_der_len);
+  printf("%-17s %10s %10s %10s %13s %13s\n", "setup", "setup ms",
+         "p50 ms", "max ms", "heap peak B", "heap after B");
+
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    long heap_peak, heap_after;
+    int ret = run(m, connects, setup_us, connect_us, &heap_peak, &heap_after);
+
+    if (ret < 0) {
+      printf("%-17s failed: %s\n", modes[m], strerror(-ret));
+      continue;
+    }
+    qsort(setup_us, connects, sizeof(*setup_us), compare_u64);
+    qsort(connect_us, connects, sizeof(*connect_us), compare_u64);
+    printf("%-17s %10.3f %10.2f %10.2f %13ld %13ld\n", modes[m],
+           setup_us[connects / 2] / 1e3, connect_us[connects / 2] / 1e3,
+           connect_us[connects - 1] / 1e3, heap_peak, heap_after);
+  }
+
+  free(setup_us);
+  free(connect_us);
+
+  return EXIT_SUCCESS;
+}
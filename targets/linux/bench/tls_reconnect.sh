@@ -0,0 +1,36 @@
+#!/bin/sh
+# Reconnect cost of the STM32 mqtts client's TLS setup, against a local
+# `openssl s_server` with a throwaway P-256 CA and server certificate.
+#
+#   ./bench/tls_reconnect.sh [build dir] [connects]
+#
+# The root certificate goes in as PEM and as DER, the two forms the client
+# has embedded. See mg_bench_tls_reconnect for what is measured.
+set -e
+
+build=${1:-build}
+count=${2:-50}
+port=8443
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+openssl ecparam -name prime256v1 -genkey -noout -out "$dir/ca.key"
+openssl req -new -x509 -key "$dir/ca.key" -subj /CN=ca -days 1 \
+  -out "$dir/ca.pem" 2>/dev/null
+openssl x509 -in "$dir/ca.pem" -outform DER -out "$dir/ca.der"
+openssl ecparam -name prime256v1 -genkey -noout -out "$dir/server.key"
+openssl req -new -key "$dir/server.key" -subj /CN=localhost \
+  -out "$dir/server.csr" 2>/dev/null
+openssl x509 -req -in "$dir/server.csr" -CA "$dir/ca.pem" \
+  -CAkey "$dir/ca.key" -CAcreateserial -days 1 -out "$dir/server.pem" \
+  2>/dev/null
+
+openssl s_server -quiet -accept "$port" -cert "$dir/server.pem" \
+  -key "$dir/server.key" -cipher ECDHE-ECDSA-AES128-GCM-SHA256 \
+  -no_ticket </dev/null >/dev/null 2>&1 &
+pid=$!
+sleep 0.5
+"$build/mg_bench_tls_reconnect" -c "$dir/ca.pem" -d "$dir/ca.der" \
+  -p "$port" -n "$count" || true
+kill "$pid"
+wait "$pid" 2>/dev/null || true
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""TLS handshake cost against a TLS broker: full handshakes versus ones
+resuming the previous session, as the Zephyr mqtts client does on reconnect.
+
+Prints the handshake time (from the TCP connection being up to the TLS
+handshake completing) and the TLS bytes each side sent, up to the point
+the session is resumable, so a TLS 1.3 session ticket is counted too.
+
+Point it at the broker's TLS listener with the device credentials, e.g. a
+local Mosquitto with `listener 8883`, `cafile`, `certfile`, `keyfile` and
+`require_certificate true`:
+
+    python3 bench/tls_resume.py --ca ca.pem --cert device.crt \\
+        --key device.key --host 127.0.0.1 --port 8883
+"""
+
+import argparse
+import socket
+import ssl
+import statistics
+import time
+
+# Seconds to wait for a TLS 1.3 ticket after the handshake.
+TICKET_WAIT = 0.5
+
+
+def pump(sock, incoming, outgoing, counts):
+    """Flushes what TLS wants to send, then feeds it one read of input."""
+    data = outgoing.read()
+    if data:
+        sock.sendall(data)
+        counts[0] += len(data)
+    chunk = sock.recv(16384)
+    if not chunk:
+        raise ConnectionError("connection closed during handshake")
+    incoming.write(chunk)
+    counts[1] += len(chunk)
+
+
+def handshake(args, ctx, session):
+    sock = socket.create_connection((args.host, args.port))
+    incoming, outgoing = ssl.MemoryBIO(), ssl.MemoryBIO()
+    tls = ctx.wrap_bio(incoming, outgoing, server_hostname=args.servername,
+                       session=session)
+    counts = [0, 0]
+
+    try:
+        start = time.perf_counter()
+        while True:
+            try:
+                tls.do_handshake()
+                break
+            except ssl.SSLWantReadError:
+                pump(sock, incoming, outgoing, counts)
+        elapsed = time.perf_counter() - start
+
+        data = outgoing.read()
+        if data:
+            sock.sendall(data)
+            counts[0] += len(data)
+
+        # TLS 1.3 sends the ticket after the handshake.
+        sock.settimeout(TICKET_WAIT)
+        while tls.version() == "TLSv1.3" and not tls.session.has_ticket:
+            try:
+                tls.read()
+            except ssl.SSLWantReadError:
+                try:
+                    pump(sock, incoming, outgoing, counts)
+                except socket.timeout:
+                    break
+
+        return elapsed, counts[0], counts[1], tls.session, tls.session_reused
+    finally:
+        sock.close()
+
+
+def report(name, results):
+    ms = [r[0] * 1000 for r in results]
+    print("%-8s avg %7.2f ms  p50 %7.2f ms  tx %5d B  rx %5d B" %
+          (name + ":", statistics.mean(ms), statistics.median(ms),
+           statistics.mean(r[1] for r in results),
+           statistics.mean(r[2] for r in results)), end="")
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8883)
+    parser.add_argument("--servername",
+                        help="SNI and certificate host name (default: --host)")
+    parser.add_argument("--ca", help="CA to verify the broker with")
+    parser.add_argument("--cert", help="client certificate")
+    parser.add_argument("--key", help="client private key")
+    parser.add_argument("--tls", choices=("1.2", "1.3"), default="1.2")
+    parser.add_argument("-n", "--count", type=int, default=20,
+                        help="handshakes of each kind")
+    args = parser.parse_args()
+    args.servername = args.servername or args.host
+
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    version = ssl.TLSVersion.TLSv1_3 if args.tls == "1.3" else \
+        ssl.TLSVersion.TLSv1_2
+    ctx.minimum_version = ctx.maximum_version = version
+    if args.ca:
+        ctx.load_verify_locations(args.ca)
+    else:
+        ctx.check_hostname = False
+        ctx.verify_mode = ssl.CERT_NONE
+    if args.cert:
+        ctx.load_cert_chain(args.cert, args.key)
+
+    print("TLS %s to %s:%d, %d handshakes each" %
+          (args.tls, args.host, args.port, args.count))
+
+    full = [handshake(args, ctx, None) for _ in range(args.count)]
+    report("full", full)
+    print()
+
+    resumed = []
+    session = full[-1][3]
+    for _ in range(args.count):
+        result = handshake(args, ctx, session)
+        resumed.append(result)
+        session = result[3]
+    report("resumed", resumed)
+    print("  (%d/%d resumed)" % (sum(r[4] for r in resumed), args.count))
+
+
+if __name__ == "__main__":
+    main()
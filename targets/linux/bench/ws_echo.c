@@ -0,0 +1,304 @@
+/* Echo round trips of a WebSocket client that waits for the echo two ways:
+ * the old Zephyr sample's, which tries a non-blocking read and sleeps
+ * 50 ms whenever nothing has arrived, and a poll() on the socket, as
+ * ws_rx.c in the Zephyr websocket sample now does. Both assemble the echo
+ * incrementally, across TCP segments and WebSocket fragments, with pings
+ * arriving in between answered.
+ *
+ *   ./build/mg_bench_ws_echo [-H host] [-p port] [-n echoes] [-s max bytes]
+ *
+ * Run it against the stand-in, which can delay its echoes and split them
+ * into fragments:
+ *
+ *   python3 tools/standin.py --echo --delay 20 --ws-fragment 64
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mg_net.h"
+#include "mg_platform.h"
+#include "mg_ws.h"
+
+#define DEFAULT_ECHOES 200
+#define DEFAULT_SIZE 512
+#define MAX_SIZE 4096
+#define SLEEP_MS 50
+#define TIMEOUT_MS 5000
+
+enum wait_mode { WAIT_SLEEP, WAIT_POLL };
+
+static const char *host = MAGISTRALA_IP;
+static int port = MAGISTRALA_WS_PORT;
+
+/* Bytes read off the socket and not yet parsed. */
+static uint8_t rx_buf[MAX_SIZE + 64];
+static size_t rx_fill;
+/* The echo being assembled from its fragments. */
+static uint8_t msg[MAX_SIZE];
+static size_t msg_len;
+static uint8_t tx_buf[MG_WS_HEADROOM + MAX_SIZE];
+static uint8_t pong_buf[MG_WS_HEADROOM + MG_WS_MAX_CONTROL_LEN];
+static unsigned long wakeups;
+
+static int ws_open(void) {
+  struct sockaddr_storage addr;
+  char req[256];
+  char head[512];
+  size_t len = 0;
+  int sock, n;
+
+  if (mg_net_connect_socket(AF_INET, host, port, SOCK_STREAM, &sock,
+                            (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      sock < 0) {
+    return -ECONNREFUSED;
+  }
+
+  n = snprintf(req, sizeof(req),
+               "GET / HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\n"
+               "Connection: Upgrade\r\n"
+               "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+               "Sec-WebSocket-Version: 13\r\n\r\n",
+               host);
+  if (mg_net_send(sock, req, n) < 0) {
+    close(sock);
+    return -EIO;
+  }
+
+  /* One byte at a time, so no frame after the response is consumed. */
+  while (len < sizeof(head) - 1) {
+    if (mg_net_recv_all(sock, head + len, 1, TIMEOUT_MS) < 0) {
+      close(sock);
+      return -EIO;
+    }
+    len++;
+    if (len >= 4 && memcmp(head + len - 4, "\r\n\r\n", 4) == 0) {
+      break;
+    }
+  }
+  if (len < 12 || memcmp(head, "HTTP/1.1 101", 12) != 0) {
+    close(sock);
+    return -ECONNREFUSED;
+  }
+
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+  return sock;
+}
+
+/* Takes the frames complete in rx_buf. Returns 1 once the echo is whole. */
+static int parse_frames(int sock) {
+  for (;;) {
+    size_t hdr = 2;
+    uint64_t len;
+    uint8_t opcode;
+    bool fin;
+
+    if (rx_fill < 2) {
+      return 0;
+    }
+    fin = rx_buf[0] & 0x80;
+    opcode = rx_buf[0] & 0x0f;
+    len = rx_buf[1] & 0x7f;
+    if (len == 126) {
+      if (rx_fill < 4) {
+        return 0;
+      }
+      len = (uint64_t)rx_buf[2] << 8 | rx_buf[3];
+      hdr = 4;
+    } else if (len == 127) {
+      return -EMSGSIZE;
+    }
+    if (len > MAX_SIZE) {
+      return -EMSGSIZE;
+    }
+    if (rx_fill < hdr + len) {
+      return 0;
+    }
+
+    if (opcode == MG_WS_OPCODE_PING) {
+      memcpy(pong_buf + MG_WS_HEADROOM, rx_buf + hdr, len);
+      if (mg_ws_send(sock, MG_WS_OPCODE_PONG, pong_buf + MG_WS_HEADROOM,
+                     len) < 0) {
+        return -EIO;
+      }
+    } else if (opcode == MG_WS_OPCODE_CLOSE) {
+      return -ECONNRESET;
+    } else if (opcode != MG_WS_OPCODE_PONG) {
+      if (msg_len + len > sizeof(msg)) {
+        return -EMSGSIZE;
+      }
+      memcpy(msg + msg_len, rx_buf + hdr, len);
+      msg_len += len;
+    }
+
+    memmove(rx_buf, rx_buf + hdr + len, rx_fill - hdr - len);
+    rx_fill -= hdr + len;
+    if (fin && opcode <= MG_WS_OPCODE_BINARY) {
+      return 1;
+    }
+  }
+}
+
+/* Waits for the whole echo, reading whatever has arrived and then either
+ * sleeping or polling until more comes.
+ */
+static int recv_echo(int sock, enum wait_mode mode) {
+  uint64_t deadline = mg_uptime_ms() + TIMEOUT_MS;
+  int ret;
+
+  msg_len = 0;
+  for (;;) {
+    ssize_t n = recv(sock, rx_buf + rx_fill, sizeof(rx_buf) - rx_fill, 0);
+
+    if (n == 0) {
+      return -ECONNRESET;
+    } else if (n > 0) {
+      rx_fill += n;
+      ret = parse_frames(sock);
+      if (ret != 0) {
+        return ret < 0 ? ret : 0;
+      }
+      continue;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      return -errno;
+    }
+
+    if ((uint64_t)mg_uptime_ms() >= deadline) {
+      return -ETIMEDOUT;
+    }
+
+    if (mode == WAIT_SLEEP) {
+      usleep(SLEEP_MS * 1000);
+    } else {
+      struct pollfd pfd = {.fd = sock, .events = POLLIN};
+
+      if (poll(&pfd, 1, deadline - mg_uptime_ms()) < 0) {
+        return -errno;
+      }
+    }
+    wakeups++;
+  }
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static int run(enum wait_mode mode, size_t echoes, size_t max_size,
+               uint64_t *rtt_us) {
+  int sock = ws_open();
+  size_t i;
+
+  if (sock < 0) {
+    return sock;
+  }
+
+  rx_fill = 0;
+  wakeups = 0;
+  for (i = 0; i < echoes; i++) {
+    size_t len = 1 + mg_rand32() % max_size;
+    uint8_t *payload = tx_buf + MG_WS_HEADROOM;
+    uint64_t start;
+    size_t j;
+    int ret;
+
+    for (j = 0; j < len; j++) {
+      payload[j] = 'a' + (i + j) % 26;
+    }
+
+    start = mg_uptime_us();
+    ret = mg_ws_send(sock, MG_WS_OPCODE_TEXT, payload, len);
+    if (ret == 0) {
+      ret = recv_echo(sock, mode);
+    }
+    if (ret < 0) {
+      close(sock);
+      return ret;
+    }
+    rtt_us[i] = mg_uptime_us() - start;
+
+    /* mg_ws_send() left the payload masked. */
+    mg_ws_mask(payload, len, payload - 4);
+    if (msg_len != len || memcmp(msg, payload, len) != 0) {
+      fprintf(stderr, "echo mismatch: %zu of %zu bytes\n", msg_len, len);
+      close(sock);
+      return -EBADMSG;
+    }
+  }
+
+  close(sock);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  static const char *const modes[] = {"sleep 50ms", "poll"};
+  size_t echoes = DEFAULT_ECHOES;
+  size_t max_size = DEFAULT_SIZE;
+  uint64_t *rtt_us;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "H:p:n:s:")) != -1) {
+    switch (opt) {
+    case 'H':
+      host = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'n':
+      echoes = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      max_size = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      echoes = 0;
+      break;
+    }
+  }
+
+  if (echoes == 0 || max_size < 1 || max_size > MAX_SIZE) {
+    fprintf(stderr,
+            "Usage: %s [-H host] [-p port] [-n echoes] [-s max bytes]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  rtt_us = calloc(echoes, sizeof(*rtt_us));
+  if (rtt_us == NULL) {
+    return EXIT_FAILURE;
+  }
+
+  printf("%zu echoes of 1 to %zu bytes\n\n", echoes, max_size);
+  printf("%-11s %9s %9s %9s %9s %13s\n", "wait", "p50 ms", "p90 ms", "p99 ms",
+         "max ms", "wakeups/echo");
+
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    int ret = run(m, echoes, max_size, rtt_us);
+
+    if (ret < 0) {
+      printf("%-11s failed: %s\n", modes[m], strerror(-ret));
+      continue;
+    }
+    qsort(rtt_us, echoes, sizeof(*rtt_us), compare_u64);
+    printf("%-11s %9.2f %9.2f %9.2f %9.2f %13.2f\n", modes[m],
+           rtt_us[echoes / 2] / 1e3, rtt_us[echoes * 9 / 10] / 1e3,
+           rtt_us[echoes * 99 / 100] / 1e3, rtt_us[echoes - 1] / 1e3,
+           (double)wakeups / echoes);
+  }
+
+  free(rtt_us);
+
+  return EXIT_SUCCESS;
+}
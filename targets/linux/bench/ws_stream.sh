@@ -0,0 +1,52 @@
+#!/bin/sh
+# WebSocket telemetry streamed as frames built in place, one reading per
+# frame as JSON text and SenML-CBOR binary, and as SenML-CBOR packs.
+#
+#   ./bench/ws_stream.sh [build dir] [readings]
+#
+# Nothing is echoed, so the client only waits for the socket. The stand-in
+# counts the data frames that reached it, which shows every frame was
+# delivered and not just written. The last rows wait for the echo of every
+# frame instead, like websocketd cat, on a tenth of the readings.
+set -e
+
+build=${1:-build}
+count=${2:-100000}
+standin="$(dirname "$0")/../tools/standin.py"
+port=8099
+log=$(mktemp)
+trap 'rm -f "$log"' EXIT
+
+run() {
+  label=$1
+  echo_flag=$2
+  shift 2
+  python3 "$standin" --ws "$port" --mqtt 0 --coap 0 --http 0 \
+    $echo_flag >"$log" &
+  pid=$!
+  sleep 0.5
+  printf '%-17s: ' "$label"
+  stats=$("$build/mg_client" -H 127.0.0.1 -p "$port" -n "$count" "$@" \
+    websocket 2>/dev/null || true)
+  # Let the stand-in read what is still buffered before it reports.
+  sleep 2
+  kill "$pid"
+  wait "$pid" 2>/dev/null || true
+  { echo "$stats"; cat "$log"; } |
+    awk '
+      /^throughput/ { t = $2; m = $5 }
+      /^latency/ { p50 = $6 }
+      /^wire bytes/ { b = $7; sub(/\(/, "", b) }
+      /^ws:/ { frames = $2 }
+      END { printf "%10s readings/s, %9s frames/s, %5s tx B/reading, " \
+                   "p50 %4s us, %s frames received\n",
+                   t, m, b, p50, frames }'
+}
+
+run "json" "" -f json
+run "cbor" "" -f cbor
+run "cbor pack 10" "" -f cbor -b 10
+run "cbor pack 40" "" -f cbor -b 40
+count=$((count / 10))
+run "json echo" --echo -f json -e
+run "cbor pack 10 echo" --echo -f cbor -b 10 -e
@@ -0,0 +1,26 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/* Magistrala Configuration */
+#define MAGISTRALA_IP "127.0.0.1" // Replace with your Magistrala instance IP
+#define MAGISTRALA_MQTT_PORT 1883
+#define MAGISTRALA_COAP_PORT 5683
+#define MAGISTRALA_HTTP_PORT 8008
+#define MAGISTRALA_WS_PORT 8186
+#define DOMAIN_ID "DOMAIN_ID"         // Replace with your Domain ID
+#define CLIENT_ID "CLIENT_ID"         // Replace with your Client ID
+#define CLIENT_SECRET "CLIENT_SECRET" // Replace with your Client secret
+#define CHANNEL_ID "CHANNEL_ID"       // Replace with your Channel ID
+#define MQTT_CLIENTID "MQTT_CLIENTID" // Replace with your actual client ID
+
+/* HTTP: a kept-alive connection idle this long is opened again rather than
+ * risk the server closing it as a POST goes out.
+ */
+#define HTTP_IDLE_TIMEOUT_MS 60000
+
+/* WebSocket: ping after this long without a frame from the server, which
+ * keeps NAT mappings open and notices a dead server; -g overrides it.
+ */
+#define WS_PING_INTERVAL_MS 20000
+
+#endif
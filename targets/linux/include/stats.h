@@ -0,0 +1,19 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct latency_stats {
+  uint32_t *samples_us;
+  size_t count;
+  size_t cap;
+  uint64_t total_us;
+};
+
+int latency_stats_init(struct latency_stats *st, size_t cap);
+void latency_stats_add(struct latency_stats *st, uint32_t sample_us);
+uint32_t latency_stats_percentile(struct latency_stats *st, unsigned int pct);
+void latency_stats_free(struct latency_stats *st);
+
+#endif
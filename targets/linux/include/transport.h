@@ -0,0 +1,81 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum payload_format {
+  PAYLOAD_JSON,
+  PAYLOAD_SENML_CBOR,
+};
+
+struct transport_ctx {
+  const char *host;
+  int port;
+  int sock;
+  /* MQTT QoS level; for CoAP 0 selects NON and anything else CON. */
+  int qos;
+  /* WebSocket only: wait for the server to echo every frame back. */
+  bool echo;
+  /* WebSocket only: ping after this long without a frame from the server
+   * and give up on it if the ping goes unanswered for timeout_ms; 0 never
+   * pings.
+   */
+  int ping_interval_ms;
+  /* HTTP only: open a new connection for every POST instead of keeping one
+   * alive.
+   */
+  bool no_keep_alive;
+  int timeout_ms;
+  /* CoAP CON: initial retransmission timeout (RFC 7252 ACK_TIMEOUT). */
+  int ack_timeout_ms;
+  /* CoAP CON: every con_every-th message, and one at least every
+   * con_interval_ms, is a CON checkpoint and the rest go as NON. 1 sends
+   * every message as CON; 0 disables either trigger.
+   */
+  int con_every;
+  int con_interval_ms;
+  /* CoAP CON: payloads larger than this go block-wise (RFC 7959 Block1),
+   * in blocks of the largest power of two that fits; 0 never does.
+   */
+  int block_size;
+  /* Selects the Content-Format / Content-Type and WebSocket opcode. */
+  enum payload_format format;
+  /* MQTT QoS 1/2: messages sent before waiting for acknowledgements. With
+   * more than one, send() returns as soon as the message is in flight and
+   * each round trip is reported through acked() instead.
+   */
+  int window;
+  void (*acked)(uint64_t latency_us);
+  /* Pipelined messages given up on after send() returned. */
+  void (*failed)(int err);
+};
+
+/* One protocol path. send() returns once the message is delivered to the
+ * level the protocol promises (written for QoS 0 / NON, acknowledged
+ * otherwise), so the time spent inside it is the per-message latency.
+ */
+struct transport {
+  const char *name;
+  int default_port;
+  int (*connect)(struct transport_ctx *ctx);
+  /* Returns where send() wants the payload in its transmit buffer and how
+   * much room there is, so it can be encoded in place. send() skips the
+   * copy when handed this pointer.
+   */
+  uint8_t *(*payload_buf)(struct transport_ctx *ctx, size_t *cap);
+  int (*send)(struct transport_ctx *ctx, const uint8_t *payload, size_t len);
+  /* Optional: waits until every message in flight is acknowledged. */
+  int (*flush)(struct transport_ctx *ctx);
+  void (*disconnect)(struct transport_ctx *ctx);
+  /* Optional: prints protocol statistics after the run. */
+  void (*report)(struct transport_ctx *ctx);
+};
+
+extern const struct transport mqtt_transport;
+extern const struct transport coap_transport;
+extern const struct transport http_transport;
+extern const struct transport websocket_transport;
+
+#endif
@@ -0,0 +1,811 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mg_coap_pacer.h"
+#include "mg_net.h"
+#include "mg_platform.h"
+#include "mg_senml.h"
+#include "mg_topic.h"
+#include "transport.h"
+
+#define MAX_COAP_MSG_LEN 512
+
+#define COAP_VERSION_1 1
+#define COAP_TYPE_CON 0
+#define COAP_TYPE_NON 1
+#define COAP_TYPE_ACK 2
+#define COAP_TYPE_RST 3
+#define COAP_METHOD_POST 0x02
+#define COAP_TOKEN_LEN 8
+
+#define COAP_OPTION_URI_PATH 11
+#define COAP_OPTION_CONTENT_FORMAT 12
+#define COAP_OPTION_URI_QUERY 15
+#define COAP_OPTION_BLOCK1 27
+#define COAP_OPTION_SIZE1 60
+#define COAP_CONTENT_FORMAT_APP_JSON 50
+
+#define COAP_CODE_CONTINUE ((2 << 5) | 31)
+#define COAP_CODE_REQUEST_TOO_LARGE ((4 << 5) | 13)
+
+/* Block1 and Size1 options, at most. */
+#define COAP_BLOCK_OPTIONS_LEN 10
+/* Room for a SenML pack of every reading -b takes, sent block-wise. */
+#define COAP_MAX_BODY 4096
+
+/* RFC 7252 section 4.8 transmission parameters; ACK_TIMEOUT is
+ * ctx->ack_timeout_ms.
+ */
+#define COAP_ACK_RANDOM_FACTOR_PCT 150
+#define COAP_MAX_RETRANSMIT 4
+/* RFC 7252 section 4.7: bytes/s to a server that does not respond. */
+#define COAP_PROBING_RATE 1
+
+#define COAP_MAX_WINDOW 64
+
+/* One CON request awaiting its response, kept for retransmission. */
+struct coap_exchange {
+  bool busy;
+  /* Empty ACK received: retransmissions stop and the separate response
+   * is awaited until the deadline.
+   */
+  bool acked;
+  uint8_t retries;
+  uint16_t mid;
+  uint8_t token[COAP_TOKEN_LEN];
+  uint32_t timeout_ms;
+  int64_t deadline;
+  uint64_t sent_us;
+  int result;
+  /* Response code and Block1 value (-1 if absent) of the response. */
+  uint8_t code;
+  int32_t block1;
+  size_t len;
+  uint8_t buf[MAX_COAP_MSG_LEN];
+};
+
+static struct sockaddr_storage magistrala_addr;
+static uint16_t message_id;
+
+static struct coap_exchange exchanges[COAP_MAX_WINDOW];
+static size_t window_size;
+static size_t in_flight;
+
+static struct {
+  unsigned long retransmits;
+  unsigned long timeouts;
+  unsigned long blocks;
+  unsigned long transfers;
+  /* Time with a response outstanding, which a duty-cycled radio spends
+   * listening.
+   */
+  uint64_t awaiting_us;
+} coap_stats;
+static uint64_t awaiting_since_us;
+
+static struct mg_coap_pacer pacer;
+static struct mg_coap_class_config telemetry_config;
+static struct mg_coap_class telemetry_class;
+
+/* Uri-Path, Content-Format and Uri-Query never change, so they are encoded
+ * once on init and copied into every request.
+ */
+static uint8_t request_options[MAX_COAP_MSG_LEN / 2];
+static size_t request_options_len;
+
+static uint8_t request_buf[MAX_COAP_MSG_LEN];
+
+/* Block-wise payloads are encoded here rather than in request_buf. */
+static uint8_t body_buf[COAP_MAX_BODY];
+/* SZX of the blocks: 2^(szx + 4) bytes. */
+static uint8_t block_szx;
+
+struct coap_writer {
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+  uint16_t last_option;
+};
+
+static int coap_append_option(struct coap_writer *w, uint16_t num,
+                              const void *value, size_t len) {
+  uint16_t delta = num - w->last_option;
+  uint8_t ext[4];
+  size_t ext_len = 0;
+  uint8_t d, l;
+
+  if (delta < 13) {
+    d = delta;
+  } else if (delta < 269) {
+    d = 13;
+    ext[ext_len++] = delta - 13;
+  } else {
+    d = 14;
+    ext[ext_len++] = (delta - 269) >> 8;
+    ext[ext_len++] = (delta - 269) & 0xFF;
+  }
+
+  if (len < 13) {
+    l = len;
+  } else if (len < 269) {
+    l = 13;
+    ext[ext_len++] = len - 13;
+  } else {
+    l = 14;
+    ext[ext_len++] = (len - 269) >> 8;
+    ext[ext_len++] = (len - 269) & 0xFF;
+  }
+
+  if (w->len + 1 + ext_len + len > w->cap) {
+    return -E2BIG;
+  }
+
+  w->buf[w->len++] = (d << 4) | l;
+  memcpy(w->buf + w->len, ext, ext_len);
+  w->len += ext_len;
+  memcpy(w->buf + w->len, value, len);
+  w->len += len;
+  w->last_option = num;
+
+  return 0;
+}
+
+static int coap_append_option_uint(struct coap_writer *w, uint16_t num,
+                                   uint32_t value) {
+  uint8_t buf[4];
+  size_t len = 0;
+
+  /* Minimal big-endian encoding; zero is the empty value. */
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    if (len > 0 || (value >> shift) != 0) {
+      buf[len++] = value >> shift;
+    }
+  }
+
+  return coap_append_option(w, num, buf, len);
+}
+
+/* Reads an extended option delta or length of nibble @p v at @p pos. */
+static int coap_option_ext(uint8_t v, const uint8_t *buf, size_t len,
+                           size_t *pos) {
+  if (v < 13) {
+    return v;
+  }
+  if (v == 13 && *pos < len) {
+    return 13 + buf[(*pos)++];
+  }
+  if (v == 14 && *pos + 1 < len) {
+    *pos += 2;
+    return 269 + ((buf[*pos - 2] << 8) | buf[*pos - 1]);
+  }
+
+  return -1;
+}
+
+/* Returns the value of uint option @p num in a message with a @p tkl byte
+ * token, or -1 if it has none.
+ */
+static int32_t coap_get_option_uint(const uint8_t *buf, size_t len,
+                                    size_t tkl, uint16_t num) {
+  size_t pos = 4 + tkl;
+  uint32_t option = 0;
+
+  while (pos < len && buf[pos] != 0xFF) {
+    uint8_t head = buf[pos++];
+    int delta = coap_option_ext(head >> 4, buf, len, &pos);
+    int olen = coap_option_ext(head & 0x0F, buf, len, &pos);
+    int32_t value = 0;
+
+    if (delta < 0 || olen < 0 || pos + olen > len) {
+      return -1;
+    }
+
+    option += delta;
+    if (option > num) {
+      return -1;
+    }
+    if (option == num) {
+      for (int i = 0; i < olen && i < 3; i++) {
+        value = (value << 8) | buf[pos + i];
+      }
+      return value;
+    }
+
+    pos += olen;
+  }
+
+  return -1;
+}
+
+static int encode_request_options(struct transport_ctx *ctx) {
+  const char *segments[] = {"m", DOMAIN_ID, "c", CHANNEL_ID};
+  static const char auth_query[] = "auth=" CLIENT_SECRET;
+  struct coap_writer w = {.buf = request_options,
+                          .cap = sizeof(request_options)};
+  uint8_t content_format = ctx->format == PAYLOAD_SENML_CBOR
+                               ? MG_SENML_CBOR_CONTENT_FORMAT
+                               : COAP_CONTENT_FORMAT_APP_JSON;
+  int ret;
+
+  /* Construct URI path: m/{domain_id}/c/{channel_id} */
+  for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
+    ret = coap_append_option(&w, COAP_OPTION_URI_PATH, segments[i],
+                             strlen(segments[i]));
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  ret = coap_append_option(&w, COAP_OPTION_CONTENT_FORMAT, &content_format,
+                           sizeof(content_format));
+  if (ret < 0) {
+    return ret;
+  }
+
+  /* Add authorization query with Client secret */
+  ret = coap_append_option(&w, COAP_OPTION_URI_QUERY, auth_query,
+                           MG_STRLEN(auth_query));
+  if (ret < 0) {
+    return ret;
+  }
+
+  request_options_len = w.len;
+
+  return 0;
+}
+
+static int coap_client_init(struct transport_ctx *ctx) {
+  int ret;
+
+  ret = encode_request_options(ctx);
+  if (ret < 0) {
+    MG_LOG_ERR("CoAP request options too large");
+    return ret;
+  }
+
+  ret = mg_net_setup_socket(AF_INET, ctx->host, ctx->port, SOCK_DGRAM,
+                            &ctx->sock, (struct sockaddr *)&magistrala_addr,
+                            sizeof(magistrala_addr));
+  if (ret < 0) {
+    return ret;
+  }
+
+  /* Connected UDP socket: the kernel filters datagrams from other peers. */
+  ret = connect(ctx->sock, (struct sockaddr *)&magistrala_addr,
+                sizeof(struct sockaddr_in));
+  if (ret < 0) {
+    ret = -errno;
+    MG_LOG_ERR("Failed to connect CoAP socket: %d", ret);
+    close(ctx->sock);
+    ctx->sock = -1;
+    return ret;
+  }
+
+  /* Blocks are sent one exchange at a time, each acknowledged. */
+  if (ctx->block_size > 0 && (ctx->qos == 0 || ctx->window > 1)) {
+    MG_LOG_ERR("CoAP block-wise transfer needs CON and a window of 1");
+    close(ctx->sock);
+    ctx->sock = -1;
+    return -EINVAL;
+  }
+
+  /* The largest block up to block_size that fits in a request. */
+  block_szx = 6;
+  while (block_szx > 0 &&
+         ((1u << (block_szx + 4)) > (size_t)ctx->block_size ||
+          (1u << (block_szx + 4)) > sizeof(request_buf) - 4 - COAP_TOKEN_LEN -
+                                        request_options_len -
+                                        COAP_BLOCK_OPTIONS_LEN - 1)) {
+    block_szx--;
+  }
+
+  message_id = mg_rand32();
+
+  window_size = ctx->window < COAP_MAX_WINDOW ? ctx->window : COAP_MAX_WINDOW;
+  memset(exchanges, 0, sizeof(exchanges));
+  in_flight = 0;
+
+  telemetry_config.con_every = ctx->con_every;
+  telemetry_config.con_interval_ms = ctx->con_interval_ms;
+  mg_coap_class_init(&telemetry_class, &telemetry_config);
+  mg_coap_pacer_init(&pacer, COAP_PROBING_RATE, mg_uptime_ms());
+
+  MG_LOG_INF("Magistrala CoAP client initialized - IP: %s:%d", ctx->host,
+          ctx->port);
+
+  return 0;
+}
+
+/* Payload goes after the header, token, options and payload marker, or in
+ * body_buf with block-wise transfers.
+ */
+static uint8_t *coap_payload_buf(struct transport_ctx *ctx, size_t *cap) {
+  size_t offset = 4 + COAP_TOKEN_LEN + request_options_len + 1;
+
+  if (ctx->block_size > 0) {
+    *cap = sizeof(body_buf);
+    return body_buf;
+  }
+
+  *cap = sizeof(request_buf) - offset;
+
+  return request_buf + offset;
+}
+
+static void complete(struct transport_ctx *ctx, struct coap_exchange *ex,
+                     int result) {
+  ex->busy = false;
+  ex->result = result;
+  if (--in_flight == 0) {
+    coap_stats.awaiting_us += mg_uptime_us() - awaiting_since_us;
+  }
+
+  mg_coap_pacer_done(&pacer, result, mg_uptime_ms());
+
+  if (window_size == 1) {
+    return;
+  }
+
+  if (result == 0 && ctx->acked != NULL) {
+    ctx->acked(mg_uptime_us() - ex->sent_us);
+  } else if (result < 0 && ctx->failed != NULL) {
+    ctx->failed(result);
+  }
+}
+
+static struct coap_exchange *find_by_mid(uint16_t mid) {
+  for (size_t i = 0; i < window_size; i++) {
+    if (exchanges[i].busy && exchanges[i].mid == mid) {
+      return &exchanges[i];
+    }
+  }
+
+  return NULL;
+}
+
+static struct coap_exchange *find_by_token(const uint8_t *token, size_t tkl) {
+  if (tkl != COAP_TOKEN_LEN) {
+    return NULL;
+  }
+
+  for (size_t i = 0; i < window_size; i++) {
+    if (exchanges[i].busy &&
+        memcmp(exchanges[i].token, token, COAP_TOKEN_LEN) == 0) {
+      return &exchanges[i];
+    }
+  }
+
+  return NULL;
+}
+
+/* Matches one datagram against the exchanges in flight. */
+static void handle_datagram(struct transport_ctx *ctx, const uint8_t *buf,
+                            size_t len) {
+  struct coap_exchange *ex;
+  uint8_t rtype, tkl;
+  uint16_t rmid;
+
+  if (len < 4 || (buf[0] >> 6) != COAP_VERSION_1) {
+    return;
+  }
+
+  rtype = (buf[0] >> 4) & 0x03;
+  tkl = buf[0] & 0x0F;
+  rmid = (buf[2] << 8) | buf[3];
+
+  if (rtype == COAP_TYPE_RST) {
+    ex = find_by_mid(rmid);
+    if (ex != NULL && !ex->acked) {
+      MG_LOG_ERR("CoAP request reset by peer");
+      complete(ctx, ex, -ECONNRESET);
+    }
+    return;
+  }
+
+  if (rtype == COAP_TYPE_ACK && buf[1] == 0) {
+    ex = find_by_mid(rmid);
+    if (ex != NULL && !ex->acked) {
+      MG_LOG_DBG("CoAP empty ACK, waiting for separate response");
+      ex->acked = true;
+      ex->deadline = mg_uptime_ms() + ctx->timeout_ms;
+    }
+    return;
+  }
+
+  if (len < 4u + tkl) {
+    return;
+  }
+
+  /* Acknowledge every separate response, even one for an exchange given
+   * up on, so the server stops retransmitting it.
+   */
+  if (rtype == COAP_TYPE_CON) {
+    uint8_t ack[4] = {(COAP_VERSION_1 << 6) | (COAP_TYPE_ACK << 4), 0, buf[2],
+                      buf[3]};
+
+    (void)mg_net_send(ctx->sock, ack, sizeof(ack));
+  }
+
+  ex = find_by_token(buf + 4, tkl);
+  if (ex == NULL || (rtype == COAP_TYPE_ACK && rmid != ex->mid)) {
+    return;
+  }
+
+  MG_LOG_DBG("CoAP response code: %d.%02d", buf[1] >> 5, buf[1] & 0x1F);
+
+  ex->code = buf[1];
+  ex->block1 = coap_get_option_uint(buf, len, tkl, COAP_OPTION_BLOCK1);
+  complete(ctx, ex, (buf[1] >> 5) == 2 ? 0 : -EPROTO);
+}
+
+/* Retransmits overdue requests with the timeout doubled, and gives up on
+ * those out of retransmissions or still without a separate response.
+ */
+static int retransmit_expired(struct transport_ctx *ctx) {
+  int64_t now = mg_uptime_ms();
+
+  for (size_t i = 0; i < window_size; i++) {
+    struct coap_exchange *ex = &exchanges[i];
+
+    if (!ex->busy || ex->deadline > now) {
+      continue;
+    }
+
+    if (ex->acked || ex->retries >= COAP_MAX_RETRANSMIT) {
+      MG_LOG_WRN("CoAP response timeout");
+      coap_stats.timeouts++;
+      complete(ctx, ex, -ETIMEDOUT);
+      continue;
+    }
+
+    ex->retries++;
+    ex->timeout_ms *= 2;
+    ex->deadline = now + ex->timeout_ms;
+    coap_stats.retransmits++;
+    MG_LOG_DBG("CoAP retransmitting message %u", ex->mid);
+
+    if (mg_net_send(ctx->sock, ex->buf, ex->len) < 0) {
+      return -errno;
+    }
+  }
+
+  return 0;
+}
+
+/* Takes in one datagram if it arrives within @p timeout_ms, then handles
+ * whatever is overdue. Returns 1 if a datagram was read, 0 if not, or a
+ * negative errno.
+ */
+static int service_exchanges(struct transport_ctx *ctx, int timeout_ms) {
+  static uint8_t response_buf[MAX_COAP_MSG_LEN];
+  int64_t now = mg_uptime_ms();
+  int handled = 0;
+  int ret;
+
+  for (size_t i = 0; i < window_size; i++) {
+    if (exchanges[i].busy && exchanges[i].deadline - now < timeout_ms) {
+      timeout_ms = exchanges[i].deadline > now ? exchanges[i].deadline - now
+                                               : 0;
+    }
+  }
+
+  ret = mg_net_recv(ctx->sock, response_buf, sizeof(response_buf),
+                    timeout_ms);
+  if (ret >= 0) {
+    handle_datagram(ctx, response_buf, ret);
+    handled = 1;
+  } else if (ret != -ETIMEDOUT) {
+    return ret;
+  }
+
+  ret = retransmit_expired(ctx);
+
+  return ret < 0 ? ret : handled;
+}
+
+/* Takes a free exchange, first waiting for room if the window is full. */
+static int reserve_exchange(struct transport_ctx *ctx,
+                            struct coap_exchange **ex) {
+  int ret;
+
+  while (in_flight >= window_size) {
+    ret = service_exchanges(ctx, ctx->timeout_ms);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  for (size_t i = 0; i < window_size; i++) {
+    if (!exchanges[i].busy) {
+      *ex = &exchanges[i];
+      return 0;
+    }
+  }
+
+  return -ENOBUFS;
+}
+
+/* Picks CON or NON for the next message, handling responses while
+ * PROBING_RATE holds NON messages back.
+ */
+static int pick_type(struct transport_ctx *ctx, uint8_t *type) {
+  for (;;) {
+    int64_t now = mg_uptime_ms();
+    uint32_t wait_ms;
+    int ret;
+
+    if (mg_coap_pacer_confirmable(&pacer, &telemetry_class, now)) {
+      *type = COAP_TYPE_CON;
+      return 0;
+    }
+
+    wait_ms = mg_coap_pacer_wait_ms(&pacer, now);
+    if (wait_ms == 0) {
+      *type = COAP_TYPE_NON;
+      return 0;
+    }
+
+    ret = service_exchanges(ctx, wait_ms);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+}
+
+/* Sends a request with the fixed options, @p extra options numbered above
+ * them and @p payload. A CON request is tracked in @p ex from then on.
+ */
+static int transmit(struct transport_ctx *ctx, uint8_t type,
+                    struct coap_exchange *ex, const uint8_t *extra,
+                    size_t extra_len, const uint8_t *payload,
+                    size_t payload_len) {
+  uint8_t token[COAP_TOKEN_LEN];
+  size_t len = 4 + sizeof(token);
+  uint16_t mid;
+
+  if (len + request_options_len + extra_len + 1 + payload_len >
+      sizeof(request_buf)) {
+    MG_LOG_ERR("CoAP payload too large");
+    return -E2BIG;
+  }
+
+  mid = ++message_id;
+  for (size_t i = 0; i < sizeof(token); i += 4) {
+    uint32_t r = mg_rand32();
+
+    memcpy(token + i, &r, 4);
+  }
+
+  request_buf[0] = (COAP_VERSION_1 << 6) | (type << 4) | sizeof(token);
+  request_buf[1] = COAP_METHOD_POST;
+  request_buf[2] = mid >> 8;
+  request_buf[3] = mid & 0xFF;
+  memcpy(request_buf + 4, token, sizeof(token));
+  memcpy(request_buf + len, request_options, request_options_len);
+  len += request_options_len;
+  memcpy(request_buf + len, extra, extra_len);
+  len += extra_len;
+
+  if (payload_len > 0) {
+    request_buf[len++] = 0xFF;
+    if (payload != request_buf + len) {
+      memcpy(request_buf + len, payload, payload_len);
+    }
+    len += payload_len;
+  }
+
+  if (mg_net_send(ctx->sock, request_buf, len) < 0) {
+    MG_LOG_ERR("Failed to send CoAP request: %d", errno);
+    return -errno;
+  }
+
+  if (ctx->qos > 0) {
+    mg_coap_pacer_sent(&pacer, &telemetry_class, ex != NULL, len,
+                       mg_uptime_ms());
+  }
+
+  if (ex == NULL) {
+    return 0;
+  }
+
+  /* Initial timeout random between ACK_TIMEOUT and ACK_TIMEOUT times
+   * ACK_RANDOM_FACTOR, so clients that lost the same datagram do not
+   * retransmit in step.
+   */
+  ex->busy = true;
+  ex->acked = false;
+  ex->retries = 0;
+  ex->mid = mid;
+  ex->code = 0;
+  ex->block1 = -1;
+  memcpy(ex->token, token, sizeof(token));
+  ex->timeout_ms = ctx->ack_timeout_ms +
+                   mg_rand32() % (ctx->ack_timeout_ms *
+                                      (COAP_ACK_RANDOM_FACTOR_PCT - 100) / 100 +
+                                  1);
+  ex->deadline = mg_uptime_ms() + ex->timeout_ms;
+  ex->sent_us = mg_uptime_us();
+  memcpy(ex->buf, request_buf, len);
+  ex->len = len;
+  if (in_flight++ == 0) {
+    awaiting_since_us = ex->sent_us;
+  }
+
+  return 0;
+}
+
+static int await_exchange(struct transport_ctx *ctx,
+                          struct coap_exchange *ex) {
+  int ret;
+
+  while (ex->busy) {
+    ret = service_exchanges(ctx, ctx->timeout_ms);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  return ex->result;
+}
+
+/* Block1 upload (RFC 7959) of a payload larger than ctx->block_size, one
+ * CON block at a time. The server may ask for smaller blocks in its 2.31
+ * Continue, or by rejecting the first block with 4.13.
+ */
+static int send_blocks(struct transport_ctx *ctx, const uint8_t *payload,
+                       size_t payload_len) {
+  uint8_t szx = block_szx;
+  size_t offset = 0;
+  int ret;
+
+  coap_stats.transfers++;
+
+  for (;;) {
+    size_t block_len = payload_len - offset;
+    uint8_t options[COAP_BLOCK_OPTIONS_LEN];
+    struct coap_writer w = {.buf = options,
+                            .cap = sizeof(options),
+                            .last_option = COAP_OPTION_URI_QUERY};
+    struct coap_exchange *ex = NULL;
+    bool more;
+
+    if (block_len > (1u << (szx + 4))) {
+      block_len = 1u << (szx + 4);
+    }
+    more = offset + block_len < payload_len;
+
+    ret = coap_append_option_uint(&w, COAP_OPTION_BLOCK1,
+                                  (offset >> (szx + 4)) << 4 | more << 3 |
+                                      szx);
+    if (ret == 0 && offset == 0) {
+      ret = coap_append_option_uint(&w, COAP_OPTION_SIZE1, payload_len);
+    }
+    if (ret == 0) {
+      ret = reserve_exchange(ctx, &ex);
+    }
+    if (ret == 0) {
+      ret = transmit(ctx, COAP_TYPE_CON, ex, options, w.len, payload + offset,
+                     block_len);
+    }
+    if (ret < 0) {
+      return ret;
+    }
+
+    coap_stats.blocks++;
+    ret = await_exchange(ctx, ex);
+
+    /* Rejected with the block size the server takes: start over with it. */
+    if (ex->code == COAP_CODE_REQUEST_TOO_LARGE && offset == 0 &&
+        ex->block1 >= 0 && (ex->block1 & 0x07) < szx) {
+      szx = ex->block1 & 0x07;
+      continue;
+    }
+
+    if (ret < 0 || ex->code != COAP_CODE_CONTINUE) {
+      return ret;
+    }
+
+    if (ex->block1 >= 0 && (ex->block1 & 0x07) < szx) {
+      szx = ex->block1 & 0x07;
+    }
+
+    offset += block_len;
+    if (offset >= payload_len) {
+      return -EPROTO;
+    }
+  }
+}
+
+static int send_coap_message(struct transport_ctx *ctx, const uint8_t *payload,
+                             size_t payload_len) {
+  uint8_t type = COAP_TYPE_NON;
+  struct coap_exchange *ex = NULL;
+  int ret;
+
+  if (ctx->block_size > 0 && payload_len > (1u << (block_szx + 4))) {
+    return send_blocks(ctx, payload, payload_len);
+  }
+
+  if (ctx->qos > 0) {
+    ret = pick_type(ctx, &type);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  if (type == COAP_TYPE_CON) {
+    ret = reserve_exchange(ctx, &ex);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  ret = transmit(ctx, type, ex, NULL, 0, payload, payload_len);
+  if (ret < 0 || ex == NULL) {
+    return ret;
+  }
+
+  if (window_size > 1) {
+    /* Take in whatever responses have already arrived. */
+    do {
+      ret = service_exchanges(ctx, 0);
+    } while (ret > 0 && in_flight > 0);
+
+    return ret < 0 ? ret : 0;
+  }
+
+  return await_exchange(ctx, ex);
+}
+
+static int coap_flush(struct transport_ctx *ctx) {
+  int ret;
+
+  while (in_flight > 0) {
+    ret = service_exchanges(ctx, ctx->timeout_ms);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  return 0;
+}
+
+static void coap_report(struct transport_ctx *ctx) {
+  if (ctx->qos > 0) {
+    printf("coap:        %u CON, %u NON, %lu retransmissions, "
+           "%lu exchanges timed out\n",
+           pacer.stats.con, pacer.stats.non, coap_stats.retransmits,
+           coap_stats.timeouts);
+    printf("listening:   %.3f s awaiting responses, %u NON sent while "
+           "probing\n",
+           coap_stats.awaiting_us / 1e6, pacer.stats.probing);
+  }
+
+  if (ctx->block_size > 0) {
+    printf("blocks:      %lu blocks of up to %u bytes in %lu transfers\n",
+           coap_stats.blocks, 1u << (block_szx + 4), coap_stats.transfers);
+  }
+}
+
+static void coap_client_close(struct transport_ctx *ctx) {
+  if (ctx->sock >= 0) {
+    close(ctx->sock);
+    ctx->sock = -1;
+  }
+}
+
+const struct transport coap_transport = {
+    .name = "coap",
+    .default_port = MAGISTRALA_COAP_PORT,
+    .connect = coap_client_init,
+    .payload_buf = coap_payload_buf,
+    .send = send_coap_message,
+    .flush = coap_flush,
+    .disconnect = coap_client_close,
+    .report = coap_report,
+};
@@ -0,0 +1,285 @@
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "config.h"
+#include "mg_http_conn.h"
+#include "mg_http_stream.h"
+#include "mg_net.h"
+#include "mg_platform.h"
+#include "mg_senml.h"
+#include "mg_topic.h"
+#include "transport.h"
+
+#define MAX_RECV_BUF_LEN 512
+#define MAX_HEADER_LEN 512
+#define MAX_BODY_LEN 512
+#define HTTP_MAX_WINDOW 64
+
+static uint8_t recv_buf_ipv4[MAX_RECV_BUF_LEN];
+static struct mg_http_reader reader;
+
+/* Everything up to Content-Length is the same for every request, so it is
+ * formatted once on connect and only the length is appended per POST.
+ */
+static char header[MAX_HEADER_LEN];
+static size_t header_prefix_len;
+
+static uint8_t body[MAX_BODY_LEN];
+
+/* As on the device target, one connection is kept alive across POSTs and
+ * opened again only when the server closes it. With ctx->no_keep_alive every
+ * POST opens its own, and the connect is part of the measured latency.
+ */
+static struct mg_http_conn conn;
+
+/* With a window, POSTs are pipelined: up to ctx->window are sent before
+ * their responses are read, in order. These are the send times of those
+ * awaiting a response, oldest first.
+ */
+static uint64_t pipeline_sent_us[HTTP_MAX_WINDOW];
+static size_t pipeline_head;
+static size_t pipeline_count;
+
+static int http_connect(struct transport_ctx *ctx) {
+  int ret;
+
+  ctx->sock = -1;
+  mg_http_conn_init(&conn, ctx->host, ctx->port, HTTP_IDLE_TIMEOUT_MS);
+  mg_http_reader_init(&reader, recv_buf_ipv4, sizeof(recv_buf_ipv4));
+  pipeline_head = 0;
+  pipeline_count = 0;
+
+  ret = snprintf(header, sizeof(header),
+                 "POST /" MG_TOPIC(DOMAIN_ID, CHANNEL_ID) " HTTP/1.1\r\n"
+                 "Host: %s\r\n"
+                 "Content-Type: %s\r\n"
+                 "Authorization: Client " CLIENT_SECRET "\r\n",
+                 ctx->host,
+                 ctx->format == PAYLOAD_SENML_CBOR
+                     ? MG_SENML_CBOR_CONTENT_TYPE
+                     : MG_SENML_JSON_CONTENT_TYPE);
+  if (ret < 0 || (size_t)ret >= sizeof(header)) {
+    return -E2BIG;
+  }
+
+  header_prefix_len = ret;
+
+  return 0;
+}
+
+/* The body is sent from its own buffer right after the header. */
+static uint8_t *http_payload_buf(struct transport_ctx *ctx, size_t *cap) {
+  (void)ctx;
+  *cap = sizeof(body);
+
+  return body;
+}
+
+/* Reads the response to the oldest POST. Returns 0 for a 2xx, -EPROTO for
+ * another status, or the error that left the connection unusable.
+ */
+static int read_response(struct transport_ctx *ctx) {
+  bool keep_alive = false;
+  int status;
+
+  status = mg_http_read_response(&reader, ctx->sock, ctx->timeout_ms,
+                                 &keep_alive);
+  if (status < 0) {
+    return status;
+  }
+
+  MG_LOG_DBG("Response status %d", status);
+
+  /* A complete response, even an error status, leaves the connection
+   * usable.
+   */
+  mg_http_conn_release(&conn, keep_alive && !ctx->no_keep_alive,
+                       mg_uptime_ms());
+  if (conn.sock < 0) {
+    ctx->sock = -1;
+  }
+
+  return status >= 200 && status < 300 ? 0 : -EPROTO;
+}
+
+/* Sends the request on the kept-alive connection, or a new one. The header
+ * is already formatted, @p header_len bytes.
+ */
+static int send_request(struct transport_ctx *ctx, size_t header_len,
+                        const uint8_t *payload, size_t len) {
+  ctx->sock = mg_http_conn_acquire(&conn, mg_uptime_ms());
+  if (ctx->sock < 0) {
+    MG_LOG_ERR("Cannot create HTTP connection.");
+    return -ECONNABORTED;
+  }
+
+  if (!conn.reused) {
+    int one = 1;
+
+    /* The body is a second send(). On a kept-alive connection, Nagle would
+     * hold it until the header's delayed ACK, 40 ms later.
+     */
+    (void)setsockopt(ctx->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    mg_http_reader_reset(&reader);
+  }
+
+  if (mg_net_send(ctx->sock, header, header_len) < 0 ||
+      mg_net_send(ctx->sock, payload, len) < 0) {
+    return -EIO;
+  }
+
+  return 0;
+}
+
+/* Reads the response to the oldest pipelined POST and reports its round
+ * trip. On a lost connection, every POST still awaiting a response is
+ * reported as failed.
+ */
+static int pipeline_read(struct transport_ctx *ctx) {
+  uint64_t sent_us = pipeline_sent_us[pipeline_head];
+  int ret;
+
+  ret = read_response(ctx);
+  if (ret < 0 && ret != -EPROTO) {
+    for (; pipeline_count > 0; pipeline_count--) {
+      ctx->failed(ret);
+    }
+    pipeline_head = 0;
+    mg_http_conn_close(&conn);
+    ctx->sock = -1;
+    return ret;
+  }
+
+  pipeline_head = (pipeline_head + 1) % HTTP_MAX_WINDOW;
+  pipeline_count--;
+  if (ret == 0) {
+    ctx->acked(mg_uptime_us() - sent_us);
+  } else {
+    ctx->failed(ret);
+  }
+
+  /* The server closed the connection after that response: the POSTs
+   * pipelined behind it were not taken.
+   */
+  if (conn.sock < 0) {
+    for (; pipeline_count > 0; pipeline_count--) {
+      ctx->failed(-ECONNRESET);
+    }
+    pipeline_head = 0;
+  }
+
+  return 0;
+}
+
+static int pipeline_query(struct transport_ctx *ctx, size_t header_len,
+                          const uint8_t *payload, size_t len) {
+  size_t window =
+      ctx->window < HTTP_MAX_WINDOW ? ctx->window : HTTP_MAX_WINDOW;
+  int ret;
+
+  while (pipeline_count >= window) {
+    ret = pipeline_read(ctx);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  ret = send_request(ctx, header_len, payload, len);
+  if (ret < 0) {
+    mg_http_conn_close(&conn);
+    ctx->sock = -1;
+    return ret;
+  }
+
+  pipeline_sent_us[(pipeline_head + pipeline_count) % HTTP_MAX_WINDOW] =
+      mg_uptime_us();
+  pipeline_count++;
+
+  return 0;
+}
+
+static int run_query(struct transport_ctx *ctx, const uint8_t *payload,
+                     size_t len) {
+  size_t header_len;
+  int ret;
+
+  ret = snprintf(header + header_prefix_len,
+                 sizeof(header) - header_prefix_len,
+                 "Content-Length: %zu\r\n"
+                 "%s"
+                 "\r\n",
+                 len, ctx->no_keep_alive ? "Connection: close\r\n" : "");
+  if (ret < 0 || (size_t)ret >= sizeof(header) - header_prefix_len) {
+    return -E2BIG;
+  }
+  header_len = header_prefix_len + ret;
+
+  if (ctx->window > 1 && !ctx->no_keep_alive) {
+    return pipeline_query(ctx, header_len, payload, len);
+  }
+
+  ret = send_request(ctx, header_len, payload, len);
+  if (ret == 0) {
+    ret = read_response(ctx);
+  }
+
+  /* The server may close the kept-alive connection just as the POST goes
+   * out. Nothing came back, so it was not taken: send it again once. A
+   * timeout is not retried, as the server may only be slow.
+   */
+  if (ret < 0 && ret != -EPROTO && ret != -ETIMEDOUT &&
+      reader.received == 0 && mg_http_conn_failed(&conn)) {
+    MG_LOG_DBG("HTTP connection lost before the response, sending again");
+    ret = send_request(ctx, header_len, payload, len);
+    if (ret == 0) {
+      ret = read_response(ctx);
+    }
+  }
+
+  if (ret < 0 && ret != -EPROTO) {
+    mg_http_conn_close(&conn);
+  }
+  ctx->sock = conn.sock;
+
+  return ret;
+}
+
+static int http_flush(struct transport_ctx *ctx) {
+  int ret;
+
+  while (pipeline_count > 0) {
+    ret = pipeline_read(ctx);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  return 0;
+}
+
+static void http_report(struct transport_ctx *ctx) {
+  (void)ctx;
+  printf("http:        %u connections, %u POSTs on an open connection, "
+         "%u found closed, %u sent again\n",
+         conn.stats.connects, conn.stats.reuses, conn.stats.stale,
+         conn.stats.retries);
+}
+
+static void http_disconnect(struct transport_ctx *ctx) {
+  mg_http_conn_close(&conn);
+  ctx->sock = -1;
+}
+
+const struct transport http_transport = {
+    .name = "http",
+    .default_port = MAGISTRALA_HTTP_PORT,
+    .connect = http_connect,
+    .payload_buf = http_payload_buf,
+    .send = run_query,
+    .flush = http_flush,
+    .disconnect = http_disconnect,
+    .report = http_report,
+};
@@ -0,0 +1,480 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mg_batch.h"
+#include "mg_dns.h"
+#include "mg_net.h"
+#include "mg_platform.h"
+#include "mg_store.h"
+#include "mg_telemetry.h"
+#include "stats.h"
+#include "transport.h"
+
+#define DEFAULT_MESSAGES 1000
+#define DEFAULT_TIMEOUT_MS 5000
+#define DEFAULT_ACK_TIMEOUT_MS 2000
+#define MAX_BATCH 64
+#define MAX_WINDOW 64
+#define RECONNECT_MS 1000
+
+static sensor_data_t current_data = {.temperature = 23.5,
+                                     .humidity = 65.0,
+                                     .battery_level = 85,
+                                     .led_state = false};
+
+static struct mg_batch_config batch_config = {.base_name = CLIENT_ID ":"};
+static struct mg_batch_sample batch_storage[MAX_BATCH];
+static struct mg_batch batch;
+
+static struct latency_stats lat;
+static unsigned long lost;
+
+/* Largest payload the transport takes, and the buffer a message is queued
+ * from, sized for it.
+ */
+static size_t max_payload;
+static uint8_t *store_entry;
+
+/* Queued entries are the readings count followed by the payload. */
+struct replay {
+  const struct transport *tr;
+  struct transport_ctx *ctx;
+  unsigned long readings;
+  unsigned long messages;
+};
+
+static const struct transport *const transports[] = {
+    &mqtt_transport,
+    &coap_transport,
+    &http_transport,
+    &websocket_transport,
+};
+
+static int encode_telemetry(enum payload_format format, uint8_t *buf,
+                            size_t len) {
+  int64_t now = mg_uptime_ms();
+  int ret;
+
+  if (format == PAYLOAD_SENML_CBOR) {
+    ret = mg_telemetry_senml_cbor_encode(&current_data, now, now, buf, len);
+  } else {
+    ret = mg_telemetry_json_encode(&current_data, now, (char *)buf, len);
+  }
+
+  if (ret < 0) {
+    MG_LOG_ERR("Telemetry payload too large");
+  }
+
+  return ret;
+}
+
+static void record_ack(uint64_t latency_us) {
+  latency_stats_add(&lat, latency_us);
+}
+
+static void record_failure(int err) {
+  (void)err;
+  lost++;
+}
+
+static int send_stored(const uint8_t *data, size_t len, void *user) {
+  struct replay *replay = user;
+  int ret;
+
+  ret = replay->tr->send(replay->ctx, data + 1, len - 1);
+  if (ret < 0) {
+    return ret;
+  }
+
+  replay->readings += data[0];
+  replay->messages++;
+
+  return 0;
+}
+
+/* Returns 0 once the message is queued, or a negative errno. */
+static int store_message(const uint8_t *payload, size_t len,
+                         unsigned long readings) {
+  int ret;
+
+  if (len > max_payload) {
+    MG_LOG_ERR("Message of %zu B too large to queue", len);
+    return -E2BIG;
+  }
+
+  store_entry[0] = readings;
+  memcpy(store_entry + 1, payload, len);
+
+  ret = mg_store_append(store_entry, 1 + len);
+  if (ret < 0) {
+    MG_LOG_ERR("Failed to queue message: %d", ret);
+  }
+
+  return ret;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [options] <mqtt|coap|http|websocket>\n"
+          "  -H <host>      server address (default %s)\n"
+          "  -p <port>      server port (default: protocol port)\n"
+          "  -n <count>     messages to send (default %d)\n"
+          "  -i <ms>        interval between messages (default 0)\n"
+          "  -q <qos>       MQTT QoS, or CoAP 0=NON 1=CON (default 1)\n"
+          "  -t <ms>        response timeout (default %d)\n"
+          "  -a <ms>        CoAP CON: initial retransmission timeout "
+          "(default %d)\n"
+          "  -c <count>     CoAP CON: send every <count>th message as CON and "
+          "the\n"
+          "                 rest as NON (default 1, all CON)\n"
+          "  -k <ms>        CoAP CON: also send a CON at least this often\n"
+          "  -z <bytes>     CoAP CON: send larger payloads block-wise in blocks\n"
+          "                 of up to <bytes>\n"
+          "  -e             WebSocket: wait for echo of every frame\n"
+          "  -g <ms>        WebSocket: ping after <ms> without a frame from the\n"
+          "                 server, 0 never (default %d)\n"
+          "  -r             HTTP: open a new connection for every POST\n"
+          "  -f <format>    payload format: json or cbor (default json)\n"
+          "  -b <count>     cbor: readings per SenML pack, up to %d (default 1)\n"
+          "  -w <count>     MQTT QoS 1/2, CoAP CON or HTTP: messages in flight, "
+          "up to %d\n"
+          "                 (default 1)\n"
+          "  -s <rate>      queue messages while the server is down and replay\n"
+          "                 up to <rate> of them per message after reconnecting\n"
+          "  -v             verbose logging\n",
+          prog, MAGISTRALA_IP, DEFAULT_MESSAGES, DEFAULT_TIMEOUT_MS,
+          DEFAULT_ACK_TIMEOUT_MS, WS_PING_INTERVAL_MS, MAX_BATCH, MAX_WINDOW);
+}
+
+int main(int argc, char **argv) {
+  struct transport_ctx ctx = {.host = MAGISTRALA_IP,
+                              .sock = -1,
+                              .qos = 1,
+                              .timeout_ms = DEFAULT_TIMEOUT_MS,
+                              .ack_timeout_ms = DEFAULT_ACK_TIMEOUT_MS,
+                              .con_every = 1,
+                              .ping_interval_ms = WS_PING_INTERVAL_MS,
+                              .window = 1};
+  const struct transport *tr = NULL;
+  unsigned long count = DEFAULT_MESSAGES;
+  unsigned long interval_ms = 0;
+  unsigned long sent = 0, failed = 0, messages = 0;
+  unsigned long batch_count = 1;
+  unsigned long store_rate = 0, queued = 0, unqueued = 0;
+  struct replay replay = {.ctx = &ctx};
+  uint8_t *replay_buf;
+  bool online = true;
+  bool flush_failed = false;
+  int64_t next_connect = 0;
+  uint8_t payload[256];
+  int payload_len = 0;
+  uint64_t start_us, elapsed_us;
+  int opt, ret;
+
+  while ((opt = getopt(argc, argv, "H:p:n:i:q:t:a:c:k:z:eg:rf:b:w:s:v")) != -1) {
+    switch (opt) {
+    case 'H':
+      ctx.host = optarg;
+      break;
+    case 'p':
+      ctx.port = atoi(optarg);
+      break;
+    case 'n':
+      count = strtoul(optarg, NULL, 10);
+      break;
+    case 'i':
+      interval_ms = strtoul(optarg, NULL, 10);
+      break;
+    case 'q':
+      ctx.qos = atoi(optarg);
+      break;
+    case 't':
+      ctx.timeout_ms = atoi(optarg);
+      break;
+    case 'a':
+      ctx.ack_timeout_ms = atoi(optarg);
+      break;
+    case 'c':
+      ctx.con_every = atoi(optarg);
+      break;
+    case 'k':
+      ctx.con_interval_ms = atoi(optarg);
+      break;
+    case 'z':
+      ctx.block_size = atoi(optarg);
+      break;
+    case 'e':
+      ctx.echo = true;
+      break;
+    case 'g':
+      ctx.ping_interval_ms = atoi(optarg);
+      break;
+    case 'r':
+      ctx.no_keep_alive = true;
+      break;
+    case 'f':
+      if (strcmp(optarg, "cbor") == 0) {
+        ctx.format = PAYLOAD_SENML_CBOR;
+      } else if (strcmp(optarg, "json") == 0) {
+        ctx.format = PAYLOAD_JSON;
+      } else {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'b':
+      batch_count = strtoul(optarg, NULL, 10);
+      break;
+    case 'w':
+      ctx.window = atoi(optarg);
+      break;
+    case 's':
+      store_rate = strtoul(optarg, NULL, 10);
+      break;
+    case 'v':
+      mg_log_level = MG_LOG_LEVEL_DBG;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind >= argc) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  for (size_t i = 0; i < sizeof(transports) / sizeof(transports[0]); i++) {
+    if (strcmp(argv[optind], transports[i]->name) == 0) {
+      tr = transports[i];
+    }
+  }
+
+  if (tr == NULL || ctx.qos < 0 || ctx.qos > 2 || batch_count < 1 ||
+      batch_count > MAX_BATCH || ctx.window < 1 || ctx.window > MAX_WINDOW ||
+      ctx.ack_timeout_ms < 1 || ctx.con_every < 0 || ctx.con_interval_ms < 0 ||
+      ctx.block_size < 0 || ctx.ping_interval_ms < 0 ||
+      (ctx.window > 1 && tr->flush == NULL) ||
+      (ctx.window > 1 && ctx.no_keep_alive) ||
+      (batch_count > 1 && ctx.format != PAYLOAD_SENML_CBOR)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (ctx.port == 0) {
+    ctx.port = tr->default_port;
+  }
+
+  if (latency_stats_init(&lat, count) < 0) {
+    return EXIT_FAILURE;
+  }
+
+  /* Pipelined sends return early: time the acknowledgements instead. */
+  if (ctx.window > 1) {
+    ctx.acked = record_ack;
+    ctx.failed = record_failure;
+  }
+
+  replay.tr = tr;
+  mg_store_init();
+
+  MG_LOG_INF("Magistrala %s client starting - %s:%d", tr->name, ctx.host,
+             ctx.port);
+
+  ret = tr->connect(&ctx);
+  if (ret < 0) {
+    MG_LOG_ERR("Failed to connect: %d", ret);
+    latency_stats_free(&lat);
+    return EXIT_FAILURE;
+  }
+
+  max_payload = sizeof(payload);
+  if (tr->payload_buf != NULL) {
+    (void)tr->payload_buf(&ctx, &max_payload);
+  }
+
+  store_entry = malloc(2 * (1 + max_payload));
+  if (store_entry == NULL) {
+    tr->disconnect(&ctx);
+    latency_stats_free(&lat);
+    return EXIT_FAILURE;
+  }
+  replay_buf = store_entry + 1 + max_payload;
+
+  if (batch_count > 1) {
+    batch_config.max_count = batch_count;
+    batch_config.max_bytes = max_payload;
+    mg_batch_init(&batch, &batch_config, batch_storage, batch_count);
+  }
+
+  start_us = mg_uptime_us();
+
+  while (sent + failed + queued + unqueued < count) {
+    uint8_t *buf = payload;
+    size_t cap = sizeof(payload);
+    unsigned long readings = 1;
+    uint64_t t0;
+    int len;
+
+    if (!online && mg_uptime_ms() >= next_connect) {
+      if (tr->connect(&ctx) == 0) {
+        MG_LOG_INF("Reconnected, %u messages queued", mg_store_stats.depth);
+        online = true;
+      } else {
+        next_connect = mg_uptime_ms() + RECONNECT_MS;
+      }
+    }
+
+    if (online && mg_store_stats.depth > 0) {
+      ret = mg_store_drain(send_stored, &replay, replay_buf,
+                           1 + max_payload, store_rate);
+      if (ret < 0 && ret != -ETIMEDOUT) {
+        tr->disconnect(&ctx);
+        online = false;
+        next_connect = mg_uptime_ms() + RECONNECT_MS;
+      }
+    }
+
+    /* Encode straight into the transport's transmit buffer if it has one. */
+    if (tr->payload_buf != NULL) {
+      buf = tr->payload_buf(&ctx, &cap);
+    }
+
+    if (batch_count > 1) {
+      /* Sample until a pack is due, then send it as one message. */
+      while (sent + failed + queued + unqueued + batch.count < count &&
+             !mg_batch_due(&batch, mg_uptime_ms())) {
+        if (mg_batch_add(&batch, &current_data, mg_uptime_ms()) < 0) {
+          break;
+        }
+      }
+
+      readings = batch.count;
+      len = mg_batch_encode_senml_cbor(&batch, mg_uptime_ms(), buf, cap);
+      mg_batch_reset(&batch);
+    } else {
+      len = encode_telemetry(ctx.format, buf, cap);
+    }
+
+    if (len < 0) {
+      MG_LOG_ERR("Telemetry payload too large");
+      break;
+    }
+    payload_len = len;
+
+    if (!online) {
+      if (store_message(buf, len, readings) == 0) {
+        queued += readings;
+      } else {
+        unqueued += readings;
+      }
+      goto next;
+    }
+
+    t0 = mg_uptime_us();
+    ret = tr->send(&ctx, buf, len);
+    messages++;
+    if (ret < 0 && ret != -ETIMEDOUT && store_rate > 0) {
+      MG_LOG_WRN("Connection lost (%d), queueing messages", ret);
+      if (store_message(buf, len, readings) == 0) {
+        queued += readings;
+      } else {
+        unqueued += readings;
+      }
+      tr->disconnect(&ctx);
+      online = false;
+      next_connect = mg_uptime_ms() + RECONNECT_MS;
+    } else if (ret < 0) {
+      MG_LOG_ERR("Failed to send telemetry: %d", ret);
+      failed += readings;
+      if (ret != -ETIMEDOUT) {
+        break;
+      }
+    } else {
+      if (ctx.acked == NULL) {
+        latency_stats_add(&lat, mg_uptime_us() - t0);
+      }
+      sent += readings;
+    }
+
+  next:
+    if (interval_ms > 0) {
+      usleep(interval_ms * 1000);
+    }
+  }
+
+  /* Flush what is still queued at the full rate before reporting. */
+  while (online && mg_store_stats.depth > 0 &&
+         mg_store_drain(send_stored, &replay, replay_buf, 1 + max_payload,
+                        mg_store_stats.depth) > 0) {
+  }
+
+  if (online && tr->flush != NULL) {
+    ret = tr->flush(&ctx);
+    if (ret < 0) {
+      MG_LOG_ERR("Failed to flush messages in flight: %d", ret);
+      flush_failed = true;
+    }
+  }
+
+  elapsed_us = mg_uptime_us() - start_us;
+
+  sent += replay.readings;
+  messages += replay.messages;
+  queued -= replay.readings;
+
+  if (online) {
+    tr->disconnect(&ctx);
+  }
+
+  printf("transport:   %s (qos %d, window %d)\n", tr->name, ctx.qos,
+         ctx.window);
+  printf("payload:     %s, last %d B, %.1f readings/msg\n",
+         ctx.format == PAYLOAD_SENML_CBOR ? "senml+cbor" : "json", payload_len,
+         messages ? (double)(sent + failed) / messages : 0.0);
+  printf("readings:    %lu sent, %lu failed in %.3f s (%lu messages)\n", sent,
+         failed, elapsed_us / 1e6, messages);
+  if (lost > 0) {
+    printf("lost:        %lu pipelined messages never acknowledged\n", lost);
+  }
+  printf("throughput:  %.1f readings/s in %.1f msg/s\n",
+         elapsed_us ? sent * 1e6 / elapsed_us : 0.0,
+         elapsed_us ? messages * 1e6 / elapsed_us : 0.0);
+  if (store_rate > 0) {
+    printf("store:       %lu readings replayed, %lu undelivered, "
+           "%lu dropped unqueued (depth %u, %u dropped)\n",
+           replay.readings, queued, unqueued, mg_store_stats.depth,
+           mg_store_stats.dropped);
+  }
+  printf("latency us:  avg %llu p50 %u p99 %u max %u\n",
+         lat.count ? (unsigned long long)(lat.total_us / lat.count) : 0ULL,
+         latency_stats_percentile(&lat, 50), latency_stats_percentile(&lat, 99),
+         latency_stats_percentile(&lat, 100));
+  printf("wire bytes:  tx %llu rx %llu (%.1f tx B/reading, %u sends)\n",
+         (unsigned long long)mg_net_stats.tx_bytes,
+         (unsigned long long)mg_net_stats.rx_bytes,
+         sent ? (double)mg_net_stats.tx_bytes / sent : 0.0,
+         mg_net_stats.tx_calls);
+  if (tr->report != NULL) {
+    tr->report(&ctx);
+  }
+  if (mg_dns_stats.resolutions > 0) {
+    printf("dns:         %u of %u resolutions from cache (%u stale), "
+           "%u lookups, %u failed\n",
+           mg_dns_stats.hits, mg_dns_stats.resolutions, mg_dns_stats.stale,
+           mg_dns_stats.lookups, mg_dns_stats.failures);
+  }
+
+  latency_stats_free(&lat);
+  free(store_entry);
+
+  return failed || lost || queued || unqueued || flush_failed
+             ? EXIT_FAILURE
+             : EXIT_SUCCESS;
+}
@@ -0,0 +1,490 @@
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mg_inflight.h"
+#include "mg_net.h"
+#include "mg_platform.h"
+#include "mg_topic.h"
+#include "transport.h"
+
+#define APP_MQTT_BUFFER_SIZE 1024
+#define MQTT_KEEPALIVE_SEC 60
+#define MQTT_MAX_WINDOW MG_INFLIGHT_MAX
+#define MQTT_MAX_RETRIES 3
+
+#define MQTT_PKT_CONNECT 0x10
+#define MQTT_PKT_CONNACK 0x20
+#define MQTT_PKT_PUBLISH 0x30
+#define MQTT_PKT_PUBACK 0x40
+#define MQTT_PKT_PUBREC 0x50
+#define MQTT_PKT_PUBREL 0x62
+#define MQTT_PKT_PUBCOMP 0x70
+#define MQTT_PKT_PINGREQ 0xC0
+#define MQTT_PKT_PINGRESP 0xD0
+#define MQTT_PKT_DISCONNECT 0xE0
+#define MQTT_FLAG_DUP 0x08
+
+static uint8_t rx_buffer[APP_MQTT_BUFFER_SIZE];
+static uint8_t tx_buffer[APP_MQTT_BUFFER_SIZE];
+
+/* QoS 1/2 message IDs come from the window, one entry per publish in
+ * flight. Pipelined, each entry has a copy of its PUBLISH for
+ * retransmission and the time it was first sent, indexed alike.
+ */
+static struct mg_inflight window;
+static struct mg_inflight_msg window_msgs[MQTT_MAX_WINDOW];
+static uint8_t window_pkts[MQTT_MAX_WINDOW][APP_MQTT_BUFFER_SIZE];
+static uint64_t window_sent_us[MQTT_MAX_WINDOW];
+
+/* m/{domain_id}/c/{channel_id}, fixed at build time. */
+static const char mqtt_topic[] = MG_TOPIC(DOMAIN_ID, CHANNEL_ID);
+
+static size_t put_remaining_length(uint8_t *buf, size_t len) {
+  size_t pos = 0;
+
+  do {
+    uint8_t byte = len % 128;
+
+    len /= 128;
+    if (len > 0) {
+      byte |= 0x80;
+    }
+    buf[pos++] = byte;
+  } while (len > 0);
+
+  return pos;
+}
+
+static size_t put_utf8(uint8_t *buf, const char *str, size_t len) {
+  buf[0] = len >> 8;
+  buf[1] = len & 0xFF;
+  memcpy(buf + 2, str, len);
+
+  return len + 2;
+}
+
+/* Writes the fixed header in front of a variable header + payload that was
+ * built at tx_buffer + 5, and returns the start of the packet.
+ */
+static uint8_t *finish_packet(uint8_t type, size_t body_len, size_t *pkt_len) {
+  uint8_t hdr[5];
+  size_t hdr_len;
+
+  hdr[0] = type;
+  hdr_len = 1 + put_remaining_length(hdr + 1, body_len);
+
+  memcpy(tx_buffer + 5 - hdr_len, hdr, hdr_len);
+  *pkt_len = hdr_len + body_len;
+
+  return tx_buffer + 5 - hdr_len;
+}
+
+static int read_packet(struct transport_ctx *ctx, uint8_t *type,
+                       size_t *len) {
+  uint8_t byte;
+  size_t remaining = 0;
+  int shift = 0;
+  int rc;
+
+  rc = mg_net_recv_all(ctx->sock, type, 1, ctx->timeout_ms);
+  if (rc < 0) {
+    return rc;
+  }
+
+  do {
+    rc = mg_net_recv_all(ctx->sock, &byte, 1, ctx->timeout_ms);
+    if (rc < 0) {
+      return rc;
+    }
+    remaining |= (size_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while ((byte & 0x80) && shift < 28);
+
+  if (remaining > sizeof(rx_buffer)) {
+    MG_LOG_ERR("MQTT packet too large: %zu", remaining);
+    return -EMSGSIZE;
+  }
+
+  *len = remaining;
+
+  return remaining ? mg_net_recv_all(ctx->sock, rx_buffer, remaining,
+                                     ctx->timeout_ms)
+                   : 0;
+}
+
+static int send_ack(struct transport_ctx *ctx, uint8_t type, uint16_t id) {
+  uint8_t pkt[4] = {type, 2, id >> 8, id & 0xFF};
+
+  return mg_net_send(ctx->sock, pkt, sizeof(pkt)) < 0 ? -EIO : 0;
+}
+
+/* Acknowledges an incoming PUBLISH, which is otherwise dropped. */
+static void ack_publish(struct transport_ctx *ctx, uint8_t type, size_t len) {
+  int qos = (type >> 1) & 0x03;
+  size_t topic_len = (rx_buffer[0] << 8) | rx_buffer[1];
+
+  if (qos > 0 && len >= topic_len + 4) {
+    uint16_t pid = (rx_buffer[2 + topic_len] << 8) | rx_buffer[3 + topic_len];
+
+    send_ack(ctx, qos == 1 ? MQTT_PKT_PUBACK : MQTT_PKT_PUBREC, pid);
+  }
+}
+
+/* Reads packets until one of @p want with message ID @p id arrives. Incoming
+ * PUBLISH packets are acknowledged and dropped.
+ */
+static int wait_for(struct transport_ctx *ctx, uint8_t want, uint16_t id) {
+  uint8_t type;
+  size_t len;
+  int rc;
+
+  for (;;) {
+    rc = read_packet(ctx, &type, &len);
+    if (rc < 0) {
+      MG_LOG_ERR("MQTT read failed: %d", rc);
+      return rc;
+    }
+
+    if ((type & 0xF0) == MQTT_PKT_PUBLISH) {
+      ack_publish(ctx, type, len);
+      continue;
+    }
+
+    if (type == want &&
+        (want == MQTT_PKT_CONNACK || want == MQTT_PKT_PINGRESP ||
+         (len >= 2 && ((rx_buffer[0] << 8) | rx_buffer[1]) == id))) {
+      return 0;
+    }
+
+    MG_LOG_DBG("MQTT ignoring packet 0x%02x", type);
+  }
+}
+
+static int mqtt_connect(struct transport_ctx *ctx) {
+  struct sockaddr_storage broker_addr;
+  uint8_t *p = tx_buffer + 5;
+  uint8_t *pkt;
+  size_t pkt_len;
+  size_t window_size;
+  int rc;
+
+  rc = mg_net_connect_socket(AF_INET, ctx->host, ctx->port, SOCK_STREAM,
+                             &ctx->sock, (struct sockaddr *)&broker_addr,
+                             sizeof(broker_addr));
+  if (rc < 0) {
+    return rc;
+  }
+
+  /* Pipelined publishes must not wait for the previous one's TCP ACK. */
+  if (ctx->window > 1) {
+    int one = 1;
+
+    (void)setsockopt(ctx->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  p += put_utf8(p, "MQTT", 4);
+  *p++ = 4;    /* MQTT 3.1.1 */
+  *p++ = 0xC2; /* user name, password, clean session */
+  *p++ = MQTT_KEEPALIVE_SEC >> 8;
+  *p++ = MQTT_KEEPALIVE_SEC & 0xFF;
+  p += put_utf8(p, MQTT_CLIENTID, strlen(MQTT_CLIENTID));
+  p += put_utf8(p, CLIENT_ID, strlen(CLIENT_ID));
+  p += put_utf8(p, CLIENT_SECRET, strlen(CLIENT_SECRET));
+
+  pkt = finish_packet(MQTT_PKT_CONNECT, p - (tx_buffer + 5), &pkt_len);
+  if (mg_net_send(ctx->sock, pkt, pkt_len) < 0) {
+    goto fail;
+  }
+
+  rc = wait_for(ctx, MQTT_PKT_CONNACK, 0);
+  if (rc < 0 || rx_buffer[1] != 0) {
+    MG_LOG_ERR("MQTT connect failed %d", rc < 0 ? rc : rx_buffer[1]);
+    goto fail;
+  }
+
+  MG_LOG_INF("MQTT client connected!");
+
+  window_size = ctx->window < MQTT_MAX_WINDOW ? ctx->window : MQTT_MAX_WINDOW;
+  mg_inflight_init(&window, window_msgs, window_size, ctx->timeout_ms);
+
+  return 0;
+
+fail:
+  close(ctx->sock);
+  ctx->sock = -1;
+
+  return -ECONNREFUSED;
+}
+
+/* PUBLISH payloads start after the fixed header headroom, the topic and,
+ * for QoS > 0, the message ID.
+ */
+static uint8_t *publish_payload_buf(struct transport_ctx *ctx, size_t *cap) {
+  size_t offset = 5 + 2 + MG_STRLEN(mqtt_topic) + (ctx->qos > 0 ? 2 : 0);
+
+  *cap = sizeof(tx_buffer) - offset;
+
+  return tx_buffer + offset;
+}
+
+/* Matches one acknowledgement against the window. */
+static int handle_ack(struct transport_ctx *ctx, uint8_t type, size_t len) {
+  static const enum mg_inflight_ack acks[] = {
+      [MQTT_PKT_PUBACK >> 4] = MG_INFLIGHT_PUBACK,
+      [MQTT_PKT_PUBREC >> 4] = MG_INFLIGHT_PUBREC,
+      [MQTT_PKT_PUBCOMP >> 4] = MG_INFLIGHT_PUBCOMP,
+  };
+  struct mg_inflight_msg *msg;
+  uint16_t id;
+
+  if (len < 2) {
+    return -EPROTO;
+  }
+
+  id = (rx_buffer[0] << 8) | rx_buffer[1];
+  msg = mg_inflight_ack(&window, acks[type >> 4], id, mg_uptime_ms());
+  if (msg == NULL) {
+    MG_LOG_DBG("MQTT ack 0x%02x for unknown message %u", type, id);
+    return 0;
+  }
+
+  if (type == MQTT_PKT_PUBREC) {
+    return send_ack(ctx, MQTT_PKT_PUBREL, id);
+  }
+
+  if (ctx->acked != NULL) {
+    ctx->acked(mg_uptime_us() - window_sent_us[msg - window_msgs]);
+  }
+
+  return 0;
+}
+
+static int retransmit_expired(struct transport_ctx *ctx) {
+  struct mg_inflight_msg *msg;
+  uint8_t *pkt;
+
+  while ((msg = mg_inflight_expired(&window, mg_uptime_ms())) != NULL) {
+    if (msg->retries > MQTT_MAX_RETRIES) {
+      MG_LOG_ERR("MQTT message %u not acknowledged", msg->id);
+      return -ETIMEDOUT;
+    }
+
+    MG_LOG_WRN("MQTT retransmitting message %u", msg->id);
+
+    if (msg->state == MG_INFLIGHT_WAIT_PUBCOMP) {
+      if (send_ack(ctx, MQTT_PKT_PUBREL, msg->id) < 0) {
+        return -EIO;
+      }
+      continue;
+    }
+
+    pkt = window_pkts[msg - window_msgs];
+    pkt[0] |= MQTT_FLAG_DUP;
+    if (mg_net_send(ctx->sock, pkt, msg->len) < 0) {
+      return -EIO;
+    }
+  }
+
+  return 0;
+}
+
+/* Handles acknowledgements for up to @p timeout_ms, returning after the
+ * first packet, and retransmits whatever is overdue. Returns 1 if a packet
+ * was read, 0 if not, or a negative errno.
+ */
+static int service_window(struct transport_ctx *ctx, int timeout_ms) {
+  struct pollfd pfd = {.fd = ctx->sock, .events = POLLIN};
+  int64_t left = mg_inflight_next_deadline(&window) - mg_uptime_ms();
+  uint8_t type;
+  size_t len;
+  int handled;
+  int rc;
+
+  if (left < timeout_ms) {
+    timeout_ms = left > 0 ? left : 0;
+  }
+
+  rc = poll(&pfd, 1, timeout_ms);
+  if (rc < 0) {
+    return -errno;
+  }
+
+  if (rc > 0) {
+    rc = read_packet(ctx, &type, &len);
+    if (rc < 0) {
+      MG_LOG_ERR("MQTT read failed: %d", rc);
+      return rc;
+    }
+
+    if ((type & 0xF0) == MQTT_PKT_PUBLISH) {
+      ack_publish(ctx, type, len);
+    } else if (type == MQTT_PKT_PUBACK || type == MQTT_PKT_PUBREC ||
+               type == MQTT_PKT_PUBCOMP) {
+      rc = handle_ack(ctx, type, len);
+      if (rc < 0) {
+        return rc;
+      }
+    }
+    rc = 1;
+  }
+
+  handled = rc;
+  rc = retransmit_expired(ctx);
+
+  return rc < 0 ? rc : handled;
+}
+
+/* Takes a message ID from the window, first waiting for room if every
+ * entry is in flight.
+ */
+static int reserve_message(struct transport_ctx *ctx,
+                           struct mg_inflight_msg **msg) {
+  int rc;
+
+  while (mg_inflight_full(&window)) {
+    rc = service_window(ctx, ctx->timeout_ms);
+    if (rc < 0) {
+      return rc;
+    }
+  }
+
+  *msg = mg_inflight_add(&window, ctx->qos, mg_uptime_ms());
+
+  return 0;
+}
+
+/* Sends @p pkt without waiting for its acknowledgement, then takes in
+ * whatever acknowledgements have already arrived.
+ */
+static int publish_pipelined(struct transport_ctx *ctx,
+                             struct mg_inflight_msg *msg, uint8_t *pkt,
+                             size_t pkt_len) {
+  size_t idx = msg - window_msgs;
+  int rc;
+
+  memcpy(window_pkts[idx], pkt, pkt_len);
+  msg->payload = window_pkts[idx];
+  msg->len = pkt_len;
+  window_sent_us[idx] = mg_uptime_us();
+
+  if (mg_net_send(ctx->sock, pkt, pkt_len) < 0) {
+    mg_inflight_release(&window, msg);
+    return -EIO;
+  }
+
+  do {
+    rc = service_window(ctx, 0);
+  } while (rc > 0 && window.count > 0);
+
+  return rc < 0 ? rc : 0;
+}
+
+/* Sends @p pkt and waits for the whole QoS 1 or 2 handshake. */
+static int publish_blocking(struct transport_ctx *ctx, uint16_t message_id,
+                            const uint8_t *pkt, size_t pkt_len) {
+  int rc;
+
+  if (mg_net_send(ctx->sock, pkt, pkt_len) < 0) {
+    return -EIO;
+  }
+
+  if (ctx->qos == 1) {
+    return wait_for(ctx, MQTT_PKT_PUBACK, message_id);
+  }
+
+  rc = wait_for(ctx, MQTT_PKT_PUBREC, message_id);
+  if (rc < 0) {
+    return rc;
+  }
+
+  rc = send_ack(ctx, MQTT_PKT_PUBREL, message_id);
+  if (rc < 0) {
+    return rc;
+  }
+
+  return wait_for(ctx, MQTT_PKT_PUBCOMP, message_id);
+}
+
+static int publish_flush(struct transport_ctx *ctx) {
+  int rc;
+
+  while (window.count > 0) {
+    rc = service_window(ctx, ctx->timeout_ms);
+    if (rc < 0) {
+      return rc;
+    }
+  }
+
+  return 0;
+}
+
+static int publish(struct transport_ctx *ctx, const uint8_t *payload,
+                   size_t len) {
+  struct mg_inflight_msg *msg = NULL;
+  uint8_t *p = tx_buffer + 5;
+  uint8_t *pkt;
+  size_t pkt_len;
+  int rc;
+
+  if (MG_STRLEN(mqtt_topic) + len + 4 > sizeof(tx_buffer) - 5) {
+    return -EMSGSIZE;
+  }
+
+  if (ctx->qos > 0) {
+    rc = reserve_message(ctx, &msg);
+    if (rc < 0) {
+      return rc;
+    }
+  }
+
+  p += put_utf8(p, mqtt_topic, MG_STRLEN(mqtt_topic));
+  if (msg != NULL) {
+    *p++ = msg->id >> 8;
+    *p++ = msg->id & 0xFF;
+  }
+  if (payload != p) {
+    memcpy(p, payload, len);
+  }
+  p += len;
+
+  pkt = finish_packet(MQTT_PKT_PUBLISH | (ctx->qos << 1), p - (tx_buffer + 5),
+                      &pkt_len);
+  if (msg == NULL) {
+    return mg_net_send(ctx->sock, pkt, pkt_len) < 0 ? -EIO : 0;
+  }
+
+  if (window.capacity > 1) {
+    return publish_pipelined(ctx, msg, pkt, pkt_len);
+  }
+
+  rc = publish_blocking(ctx, msg->id, pkt, pkt_len);
+  mg_inflight_release(&window, msg);
+
+  return rc;
+}
+
+static void mqtt_disconnect(struct transport_ctx *ctx) {
+  const uint8_t pkt[2] = {MQTT_PKT_DISCONNECT, 0};
+
+  if (ctx->sock < 0) {
+    return;
+  }
+
+  (void)mg_net_send(ctx->sock, pkt, sizeof(pkt));
+  close(ctx->sock);
+  ctx->sock = -1;
+}
+
+const struct transport mqtt_transport = {
+    .name = "mqtt",
+    .default_port = MAGISTRALA_MQTT_PORT,
+    .connect = mqtt_connect,
+    .payload_buf = publish_payload_buf,
+    .send = publish,
+    .flush = publish_flush,
+    .disconnect = mqtt_disconnect,
+};
@@ -0,0 +1,56 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include "stats.h"
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+int latency_stats_init(struct latency_stats *st, size_t cap) {
+  st->samples_us = calloc(cap ? cap : 1, sizeof(uint32_t));
+  if (st->samples_us == NULL) {
+    return -ENOMEM;
+  }
+
+  st->count = 0;
+  st->cap = cap;
+  st->total_us = 0;
+
+  return 0;
+}
+
+void latency_stats_add(struct latency_stats *st, uint32_t sample_us) {
+  st->total_us += sample_us;
+
+  if (st->count < st->cap) {
+    st->samples_us[st->count++] = sample_us;
+  }
+}
+
+uint32_t latency_stats_percentile(struct latency_stats *st, unsigned int pct) {
+  size_t idx;
+
+  if (st->count == 0) {
+    return 0;
+  }
+
+  qsort(st->samples_us, st->count, sizeof(uint32_t), cmp_u32);
+
+  idx = (st->count * pct + 99) / 100;
+  if (idx > 0) {
+    idx--;
+  }
+
+  return st->samples_us[idx < st->count ? idx : st->count - 1];
+}
+
+void latency_stats_free(struct latency_stats *st) {
+  free(st->samples_us);
+  st->samples_us = NULL;
+  st->count = 0;
+  st->cap = 0;
+}
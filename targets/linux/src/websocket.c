@@ -0,0 +1,338 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mg_net.h"
+#include "mg_platform.h"
+#include "mg_topic.h"
+#include "mg_ws.h"
+#include "transport.h"
+
+#define MAX_RECV_BUF_LEN 1024
+
+static uint8_t recv_buf_ipv4[MAX_RECV_BUF_LEN];
+/* Payloads are encoded after the headroom, for mg_ws_frame(). */
+static uint8_t send_buf_ipv4[MG_WS_HEADROOM + MAX_RECV_BUF_LEN];
+/* Pongs are sent from here, so they do not clobber a payload being encoded
+ * in send_buf_ipv4.
+ */
+static uint8_t control_buf[MG_WS_HEADROOM + MG_WS_MAX_CONTROL_LEN];
+
+static struct mg_ws_keepalive keepalive;
+static uint32_t frames;
+
+static void base64_encode(char *out, const uint8_t *in, size_t len) {
+  static const char alphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t i;
+
+  for (i = 0; i + 2 < len; i += 3) {
+    *out++ = alphabet[in[i] >> 2];
+    *out++ = alphabet[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+    *out++ = alphabet[((in[i + 1] & 0x0F) << 2) | (in[i + 2] >> 6)];
+    *out++ = alphabet[in[i + 2] & 0x3F];
+  }
+
+  if (i < len) {
+    *out++ = alphabet[in[i] >> 2];
+    if (i + 1 < len) {
+      *out++ = alphabet[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+      *out++ = alphabet[(in[i + 1] & 0x0F) << 2];
+    } else {
+      *out++ = alphabet[(in[i] & 0x03) << 4];
+      *out++ = '=';
+    }
+    *out++ = '=';
+  }
+
+  *out = '\0';
+}
+
+static int websocket_connect(struct transport_ctx *ctx) {
+  struct sockaddr_storage addr4;
+  uint8_t nonce[16];
+  char key[25];
+  char req[512];
+  size_t len = 0;
+  int req_len;
+  int ret;
+
+  ret = mg_net_connect_socket(AF_INET, ctx->host, ctx->port, SOCK_STREAM,
+                              &ctx->sock, (struct sockaddr *)&addr4,
+                              sizeof(addr4));
+  if (ret < 0 || ctx->sock < 0) {
+    MG_LOG_ERR("Cannot create or connect IPv4 HTTP socket.");
+    return -ECONNABORTED;
+  }
+
+  for (size_t i = 0; i < sizeof(nonce); i += 4) {
+    uint32_t r = mg_rand32();
+
+    memcpy(nonce + i, &r, 4);
+  }
+  base64_encode(key, nonce, sizeof(nonce));
+
+  // URI path: m/{domain_id}/c/{channel_id}?authorization={client_secret}
+  req_len = snprintf(req, sizeof(req),
+                     "GET /" MG_TOPIC(DOMAIN_ID, CHANNEL_ID)
+                     "?authorization=" CLIENT_SECRET " HTTP/1.1\r\n"
+                     "Host: %s\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: %s\r\n"
+                     "Sec-WebSocket-Version: 13\r\n"
+                     "\r\n",
+                     ctx->host, key);
+  if (req_len < 0 || (size_t)req_len >= sizeof(req)) {
+    ret = -E2BIG;
+    goto fail;
+  }
+
+  if (mg_net_send(ctx->sock, req, req_len) < 0) {
+    ret = -EIO;
+    goto fail;
+  }
+
+  /* Read the handshake response one byte at a time so that no frame data
+   * that follows it is consumed here.
+   */
+  while (len < sizeof(recv_buf_ipv4) - 1) {
+    ret =
+        mg_net_recv_all(ctx->sock, recv_buf_ipv4 + len, 1, ctx->timeout_ms);
+    if (ret < 0) {
+      goto fail;
+    }
+
+    len++;
+    if (len >= 4 && memcmp(recv_buf_ipv4 + len - 4, "\r\n\r\n", 4) == 0) {
+      break;
+    }
+  }
+  recv_buf_ipv4[len] = '\0';
+
+  if (strncmp((char *)recv_buf_ipv4, "HTTP/1.1 101", 12) != 0) {
+    MG_LOG_ERR("Websocket upgrade refused: %.*s", 32, (char *)recv_buf_ipv4);
+    ret = -ECONNREFUSED;
+    goto fail;
+  }
+
+  MG_LOG_INF("Websocket %d for %s connected.", ctx->sock, ctx->host);
+  mg_ws_keepalive_init(&keepalive, ctx->ping_interval_ms, ctx->timeout_ms,
+                       mg_uptime_ms());
+
+  return 0;
+
+fail:
+  close(ctx->sock);
+  ctx->sock = -1;
+
+  return ret;
+}
+
+static int recv_frame(struct transport_ctx *ctx, uint8_t *opcode,
+                      size_t *len) {
+  uint8_t hdr[2];
+  uint64_t plen;
+  int ret;
+
+  ret = mg_net_recv_all(ctx->sock, hdr, sizeof(hdr), ctx->timeout_ms);
+  if (ret < 0) {
+    return ret;
+  }
+
+  *opcode = hdr[0] & 0x0F;
+  plen = hdr[1] & 0x7F;
+
+  if (plen == 126 || plen == 127) {
+    uint8_t ext[8];
+    size_t ext_len = plen == 126 ? 2 : 8;
+
+    ret = mg_net_recv_all(ctx->sock, ext, ext_len, ctx->timeout_ms);
+    if (ret < 0) {
+      return ret;
+    }
+
+    plen = 0;
+    for (size_t i = 0; i < ext_len; i++) {
+      plen = (plen << 8) | ext[i];
+    }
+  }
+
+  if (plen > sizeof(recv_buf_ipv4)) {
+    return -EMSGSIZE;
+  }
+
+  *len = plen;
+
+  return plen ? mg_net_recv_all(ctx->sock, recv_buf_ipv4, plen,
+                                ctx->timeout_ms)
+              : 0;
+}
+
+/* Frame payloads live at a fixed offset in send_buf_ipv4; the header is
+ * written into the headroom in front of them once the length is known.
+ */
+static uint8_t *ws_payload_buf(struct transport_ctx *ctx, size_t *cap) {
+  (void)ctx;
+  *cap = MAX_RECV_BUF_LEN;
+
+  return send_buf_ipv4 + MG_WS_HEADROOM;
+}
+
+static int send_frame(struct transport_ctx *ctx, uint8_t opcode,
+                      const uint8_t *payload, size_t len) {
+  uint8_t *data = send_buf_ipv4 + MG_WS_HEADROOM;
+  uint8_t *frame;
+  size_t frame_len;
+
+  if (len > MAX_RECV_BUF_LEN) {
+    return -EMSGSIZE;
+  }
+
+  if (len > 0 && payload != data) {
+    memcpy(data, payload, len);
+  }
+
+  frame = mg_ws_frame(data, len, opcode, mg_rand32(), &frame_len);
+  if (mg_net_send(ctx->sock, frame, frame_len) < 0) {
+    return -EIO;
+  }
+  frames++;
+
+  /* A payload encoded in place is compared against the echo, so undo the
+   * masking for it.
+   */
+  if (payload == data && ctx->echo) {
+    mg_ws_mask(data, len, data - 4);
+  }
+
+  return 0;
+}
+
+/* Answers a ping, or ends on a close. Returns 1 for a data frame. */
+static int handle_frame(struct transport_ctx *ctx, uint8_t opcode,
+                        size_t len) {
+  uint8_t *pong = control_buf + MG_WS_HEADROOM;
+
+  mg_ws_keepalive_rx(&keepalive, opcode, mg_uptime_ms());
+
+  switch (opcode) {
+  case MG_WS_OPCODE_PING:
+    if (len > MG_WS_MAX_CONTROL_LEN) {
+      return -EPROTO;
+    }
+    memcpy(pong, recv_buf_ipv4, len);
+    return mg_ws_send(ctx->sock, MG_WS_OPCODE_PONG, pong, len) < 0 ? -EIO
+                                                                    : 0;
+  case MG_WS_OPCODE_CLOSE:
+    return -ECONNRESET;
+  case MG_WS_OPCODE_PONG:
+    return 0;
+  default:
+    return 1;
+  }
+}
+
+/* Handles what the server sent while the client was busy sending, without
+ * waiting, and pings it when it has been quiet for the ping interval.
+ */
+static int service_connection(struct transport_ctx *ctx) {
+  struct mg_pollfd pfd = {.fd = ctx->sock, .events = MG_POLLIN};
+  uint8_t opcode;
+  size_t len;
+  int ret;
+
+  while (mg_sock_poll(&pfd, 1, 0) > 0) {
+    if (pfd.revents & (MG_POLLHUP | MG_POLLERR)) {
+      return -ECONNRESET;
+    }
+    ret = recv_frame(ctx, &opcode, &len);
+    if (ret < 0) {
+      return ret;
+    }
+    ret = handle_frame(ctx, opcode, len);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  ret = mg_ws_keepalive_check(&keepalive, mg_uptime_ms());
+  if (ret <= 0) {
+    return ret;
+  }
+
+  return mg_ws_send(ctx->sock, MG_WS_OPCODE_PING,
+                    control_buf + MG_WS_HEADROOM, 0) < 0
+             ? -EIO
+             : 0;
+}
+
+static int send_and_wait_msg(struct transport_ctx *ctx, const uint8_t *payload,
+                             size_t len) {
+  uint8_t opcode = ctx->format == PAYLOAD_SENML_CBOR ? MG_WS_OPCODE_BINARY
+                                                     : MG_WS_OPCODE_TEXT;
+  size_t rlen;
+  int ret;
+
+  if (!ctx->echo) {
+    ret = service_connection(ctx);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  ret = send_frame(ctx, opcode, payload, len);
+  if (ret < 0 || !ctx->echo) {
+    return ret;
+  }
+
+  for (;;) {
+    ret = recv_frame(ctx, &opcode, &rlen);
+    if (ret < 0) {
+      return ret;
+    }
+
+    ret = handle_frame(ctx, opcode, rlen);
+    if (ret < 0) {
+      return ret;
+    } else if (ret == 0) {
+      continue;
+    }
+
+    if (rlen != len || memcmp(recv_buf_ipv4, payload, len) != 0) {
+      MG_LOG_ERR("Websocket echo mismatch %zu/%zu bytes", rlen, len);
+      return -EBADMSG;
+    }
+    return 0;
+  }
+}
+
+static void websocket_disconnect(struct transport_ctx *ctx) {
+  if (ctx->sock < 0) {
+    return;
+  }
+
+  (void)send_frame(ctx, MG_WS_OPCODE_CLOSE, NULL, 0);
+  close(ctx->sock);
+  ctx->sock = -1;
+}
+
+static void websocket_report(struct transport_ctx *ctx) {
+  (void)ctx;
+
+  printf("websocket:   %u frames sent, %u pings, %u pongs (last %u ms)\n",
+         frames, keepalive.pings, keepalive.pongs, keepalive.rtt_ms);
+}
+
+const struct transport websocket_transport = {
+    .name = "websocket",
+    .default_port = MAGISTRALA_WS_PORT,
+    .connect = websocket_connect,
+    .payload_buf = ws_payload_buf,
+    .send = send_and_wait_msg,
+    .disconnect = websocket_disconnect,
+    .report = websocket_report,
+};
@@ -0,0 +1,286 @@
+/* Unit tests for mg_batch.h: the full encoding, the block-wise one and
+ * mg_batch_encoded_len() agree, and the pack decodes to the SenML records
+ * expected, with bn, bt and bu in the first ones and t offsets after.
+ *
+ *   ctest --test-dir build
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mg_batch.h"
+#include "mg_senml.h"
+
+#define READINGS 3
+#define FIELDS 4
+#define SEND_TIME 7000
+
+static int failures;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);               \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+static const int64_t timestamps[READINGS] = {1000, 3500, 6000};
+
+static const struct mg_batch_config config = {.base_name = "dev:"};
+static struct mg_batch_sample storage[READINGS];
+static struct mg_batch batch;
+
+static void fill(void) {
+  mg_batch_init(&batch, &config, storage, READINGS);
+
+  for (int i = 0; i < READINGS; i++) {
+    sensor_data_t data = {.temperature = 20.5 + i,
+                          .humidity = 40.0,
+                          .battery_level = 90 - i,
+                          .led_state = i == 1};
+
+    CHECK(mg_batch_add(&batch, &data, timestamps[i]) == 0);
+  }
+}
+
+/* Just enough of a CBOR (RFC 8949) reader for the pack: integers, text,
+ * arrays and maps of definite length, floats and booleans.
+ */
+struct reader {
+  const uint8_t *p;
+  const uint8_t *end;
+  bool error;
+};
+
+struct item {
+  int major;
+  uint64_t arg;
+  int64_t i;
+  double d;
+  const char *text;
+};
+
+static uint64_t take(struct reader *r, size_t len) {
+  uint64_t value = 0;
+
+  if ((size_t)(r->end - r->p) < len) {
+    r->error = true;
+    return 0;
+  }
+  while (len-- > 0) {
+    value = (value << 8) | *r->p++;
+  }
+
+  return value;
+}
+
+static double half_to_double(uint16_t half) {
+  int exp = (half >> 10) & 0x1F;
+  double mant = half & 0x3FF;
+  double value = exp == 0 ? ldexp(mant, -24) : ldexp(mant + 1024, exp - 25);
+
+  return half & 0x8000 ? -value : value;
+}
+
+static struct item next(struct reader *r) {
+  struct item it = {0};
+  uint8_t info;
+  uint32_t bits32;
+  uint64_t bits64;
+  float f;
+
+  if (r->p >= r->end) {
+    r->error = true;
+    return it;
+  }
+
+  it.major = *r->p >> 5;
+  info = *r->p++ & 0x1F;
+
+  if (it.major == 7) {
+    switch (info) {
+    case 20:
+    case 21:
+      it.i = info == 21;
+      break;
+    case 25:
+      it.d = half_to_double(take(r, 2));
+      break;
+    case 26:
+      bits32 = take(r, 4);
+      memcpy(&f, &bits32, sizeof(f));
+      it.d = f;
+      break;
+    case 27:
+      bits64 = take(r, 8);
+      memcpy(&it.d, &bits64, sizeof(it.d));
+      break;
+    default:
+      r->error = true;
+    }
+    return it;
+  }
+
+  it.arg = info < 24 ? info : take(r, (size_t)1 << (info - 24));
+  it.i = it.major == 1 ? -1 - (int64_t)it.arg : (int64_t)it.arg;
+  it.d = it.i;
+
+  if (it.major == 3) {
+    if ((size_t)(r->end - r->p) < it.arg) {
+      r->error = true;
+      return it;
+    }
+    it.text = (const char *)r->p;
+    r->p += it.arg;
+  }
+
+  return it;
+}
+
+static bool text_is(const struct item *it, const char *str) {
+  return it->major == 3 && it->arg == strlen(str) &&
+         memcmp(it->text, str, it->arg) == 0;
+}
+
+static void test_block_matches_full(void) {
+  static const size_t block_sizes[] = {1, 7, 13, 64, 300};
+  uint8_t full[512];
+  uint8_t blocks[1024];
+  int len;
+
+  fill();
+
+  len = mg_batch_encode_senml_cbor(&batch, SEND_TIME, full, sizeof(full));
+  CHECK(len > 0);
+  CHECK((size_t)len == mg_batch_encoded_len(&batch));
+
+  /* Too small a buffer is refused rather than cut short. */
+  CHECK(mg_batch_encode_senml_cbor(&batch, SEND_TIME, full, len - 1) ==
+        -E2BIG);
+
+  for (size_t s = 0; s < sizeof(block_sizes) / sizeof(block_sizes[0]); s++) {
+    size_t block = block_sizes[s];
+    size_t offset = 0;
+    int ret;
+
+    memset(blocks, 0, sizeof(blocks));
+    do {
+      ret = mg_batch_encode_senml_cbor_block(&batch, SEND_TIME, offset,
+                                             blocks + offset, block);
+      CHECK(ret >= 0);
+      offset += ret;
+    } while (ret == (int)block && offset < sizeof(blocks) - block);
+
+    CHECK(offset == (size_t)len);
+    CHECK(memcmp(blocks, full, len) == 0);
+  }
+
+  mg_batch_reset(&batch);
+  CHECK(mg_batch_encoded_len(&batch) == 0);
+  CHECK(mg_batch_encode_senml_cbor(&batch, SEND_TIME, full, sizeof(full)) ==
+        -ENODATA);
+}
+
+static void test_decode(void) {
+  static const char *const names[FIELDS] = {"led_state", "temperature",
+                                            "humidity", "battery"};
+  static const char *const units[FIELDS] = {NULL, "Cel", "%RH", "%EL"};
+  uint8_t buf[512];
+  struct reader r;
+  struct item it;
+  int len;
+
+  fill();
+  len = mg_batch_encode_senml_cbor(&batch, SEND_TIME, buf, sizeof(buf));
+  CHECK(len > 0);
+
+  r = (struct reader){.p = buf, .end = buf + (len > 0 ? len : 0)};
+  it = next(&r);
+  CHECK(it.major == 4 && it.arg == READINGS * FIELDS);
+
+  /* Records are grouped per field, each field's readings oldest first. */
+  for (int field = 0; field < FIELDS && !r.error; field++) {
+    for (int i = 0; i < READINGS && !r.error; i++) {
+      bool seen_bn = false, seen_bt = false, seen_bu = false;
+      bool seen_n = false, seen_t = false, seen_v = false;
+      uint64_t pairs;
+
+      it = next(&r);
+      CHECK(it.major == 5);
+      pairs = it.arg;
+
+      for (uint64_t p = 0; p < pairs && !r.error; p++) {
+        struct item key = next(&r);
+        struct item value = next(&r);
+
+        CHECK(key.major == 0 || key.major == 1);
+
+        switch (key.i) {
+        case MG_SENML_BASE_NAME:
+          seen_bn = true;
+          CHECK(text_is(&value, "dev:"));
+          break;
+        case MG_SENML_BASE_TIME:
+          seen_bt = true;
+          CHECK(value.major == 7);
+          CHECK(value.d == mg_senml_time(timestamps[0], SEND_TIME));
+          break;
+        case MG_SENML_BASE_UNIT:
+          seen_bu = true;
+          CHECK(units[field] != NULL && text_is(&value, units[field]));
+          break;
+        case MG_SENML_NAME:
+          seen_n = true;
+          CHECK(text_is(&value, names[field]));
+          break;
+        case MG_SENML_TIME:
+          seen_t = true;
+          CHECK(value.d == (timestamps[i] - timestamps[0]) / 1000.0);
+          break;
+        case MG_SENML_VALUE:
+          seen_v = true;
+          CHECK(field != 0);
+          if (field == 1) {
+            CHECK(value.d == 20.5 + i);
+          } else if (field == 3) {
+            CHECK(value.i == 90 - i);
+          }
+          break;
+        case MG_SENML_BOOL_VALUE:
+          seen_v = true;
+          CHECK(field == 0);
+          CHECK(value.major == 7 && value.i == (i == 1));
+          break;
+        default:
+          CHECK(!"unexpected label");
+        }
+      }
+
+      /* bn and bt once, in the first record; bu in a field's first. */
+      CHECK(seen_bn == (field == 0 && i == 0));
+      CHECK(seen_bt == (field == 0 && i == 0));
+      CHECK(seen_bu == (i == 0 && units[field] != NULL));
+      CHECK(seen_n);
+      CHECK(seen_t == (i > 0));
+      CHECK(seen_v);
+    }
+  }
+
+  CHECK(!r.error);
+  CHECK(r.p == r.end);
+}
+
+int main(void) {
+  test_block_matches_full();
+  test_decode();
+
+  if (failures > 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
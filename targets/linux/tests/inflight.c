@@ -0,0 +1,198 @@
+/* Unit tests for mg_inflight.h: ID allocation, acknowledgements, stale and
+ * out-of-state acknowledgements, 16-bit ID wrap and retransmit order.
+ *
+ *   ctest --test-dir build
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mg_inflight.h"
+
+#define RETRY_MS 1000
+
+static int failures;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);               \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+static struct mg_inflight_msg storage[MG_INFLIGHT_MAX];
+static struct mg_inflight win;
+
+static void test_alloc(void) {
+  struct mg_inflight_msg *msgs[4];
+
+  mg_inflight_init(&win, storage, 4, RETRY_MS);
+  CHECK(mg_inflight_room(&win) == 4);
+
+  /* Entry i hands out i + 1 first. */
+  for (int i = 0; i < 4; i++) {
+    msgs[i] = mg_inflight_add(&win, 1, 0);
+    CHECK(msgs[i] != NULL);
+    CHECK(msgs[i]->id == i + 1);
+    CHECK(msgs[i]->state == MG_INFLIGHT_WAIT_PUBACK);
+    CHECK(mg_inflight_find(&win, msgs[i]->id) == msgs[i]);
+  }
+  CHECK(mg_inflight_full(&win));
+  CHECK(mg_inflight_add(&win, 1, 0) == NULL);
+
+  /* A freed entry carries on with its sequence: 2, then 2 + 4. */
+  mg_inflight_release(&win, msgs[1]);
+  CHECK(mg_inflight_room(&win) == 1);
+  CHECK(mg_inflight_find(&win, 2) == NULL);
+  CHECK(mg_inflight_add(&win, 2, 0)->id == 6);
+  CHECK(mg_inflight_find(&win, 6)->state == MG_INFLIGHT_WAIT_PUBREC);
+
+  /* Message ID 0 is never valid. */
+  CHECK(mg_inflight_find(&win, 0) == NULL);
+
+  /* A reset frees everything but keeps the sequences going. */
+  mg_inflight_reset(&win);
+  CHECK(mg_inflight_room(&win) == 4);
+  CHECK(mg_inflight_next_deadline(&win) == INT64_MAX);
+  CHECK(mg_inflight_add(&win, 1, 0)->id == 5);
+}
+
+static void test_ack(void) {
+  struct mg_inflight_msg *q1, *q2;
+
+  mg_inflight_init(&win, storage, 4, RETRY_MS);
+  q1 = mg_inflight_add(&win, 1, 0);
+  q2 = mg_inflight_add(&win, 2, 0);
+
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBACK, q1->id, 10) == q1);
+  CHECK(q1->state == MG_INFLIGHT_FREE);
+  CHECK(win.count == 1);
+
+  /* PUBREC moves QoS 2 on to PUBCOMP and restarts its timer. */
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBREC, q2->id, 20) == q2);
+  CHECK(q2->state == MG_INFLIGHT_WAIT_PUBCOMP);
+  CHECK(q2->deadline == 20 + RETRY_MS);
+  /* A repeated PUBREC asks for the PUBREL again. */
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBREC, q2->id, 30) == q2);
+  CHECK(q2->deadline == 30 + RETRY_MS);
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBCOMP, q2->id, 40) == q2);
+  CHECK(win.count == 0);
+  CHECK(mg_inflight_next_deadline(&win) == INT64_MAX);
+}
+
+static void test_stale_ack(void) {
+  struct mg_inflight_msg *q1, *q2;
+  uint16_t old;
+
+  mg_inflight_init(&win, storage, 4, RETRY_MS);
+  q1 = mg_inflight_add(&win, 1, 0);
+  q2 = mg_inflight_add(&win, 2, 0);
+
+  /* Acknowledgements of the wrong kind for the state. */
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBCOMP, q1->id, 0) == NULL);
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBREC, q1->id, 0) == NULL);
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBACK, q2->id, 0) == NULL);
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBCOMP, q2->id, 0) == NULL);
+  CHECK(q1->state == MG_INFLIGHT_WAIT_PUBACK);
+  CHECK(q2->state == MG_INFLIGHT_WAIT_PUBREC);
+
+  /* A duplicate PUBACK after the entry was freed. */
+  old = q1->id;
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBACK, old, 0) == q1);
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBACK, old, 0) == NULL);
+
+  /* The entry's next message must not take the previous ID's ack. */
+  q1 = mg_inflight_add(&win, 1, 0);
+  CHECK(q1->id == old + 4);
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBACK, old, 0) == NULL);
+  CHECK(q1->state == MG_INFLIGHT_WAIT_PUBACK);
+
+  /* IDs nobody handed out. */
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBACK, 3, 0) == NULL);
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBACK, UINT16_MAX, 0) == NULL);
+  CHECK(win.count == 2);
+}
+
+static void test_wrap(void) {
+  /* A capacity that does not divide 65535, so the last ID of a sequence
+   * falls short of it.
+   */
+  const size_t capacity = 7;
+  struct mg_inflight_msg *msg;
+  uint16_t prev = 0;
+  unsigned long wraps = 0;
+
+  mg_inflight_init(&win, storage, capacity, RETRY_MS);
+  for (unsigned long i = 0; i < 2 * (UINT16_MAX / capacity) + 4; i++) {
+    msg = mg_inflight_add(&win, 1, 0);
+    CHECK(msg == &storage[0]);
+    CHECK(msg->id != 0);
+    CHECK((msg->id - 1) % capacity == 0);
+    if (prev != 0 && msg->id < prev) {
+      CHECK(msg->id == 1);
+      CHECK(prev + capacity > UINT16_MAX);
+      wraps++;
+    } else if (prev != 0) {
+      CHECK(msg->id == prev + capacity);
+    }
+    CHECK(mg_inflight_find(&win, msg->id) == msg);
+    prev = msg->id;
+    CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBACK, msg->id, 0) == msg);
+  }
+  CHECK(wraps == 2);
+}
+
+static void test_expiry_order(void) {
+  struct mg_inflight_msg *a, *b, *c;
+
+  mg_inflight_init(&win, storage, 4, RETRY_MS);
+  CHECK(mg_inflight_expired(&win, INT64_MAX) == NULL);
+
+  a = mg_inflight_add(&win, 1, 0);
+  b = mg_inflight_add(&win, 2, 100);
+  c = mg_inflight_add(&win, 1, 200);
+  CHECK(mg_inflight_next_deadline(&win) == RETRY_MS);
+
+  /* Nothing before the first deadline. */
+  CHECK(mg_inflight_expired(&win, RETRY_MS - 1) == NULL);
+
+  /* Earliest first; a retransmitted entry goes to the back. */
+  CHECK(mg_inflight_expired(&win, RETRY_MS) == a);
+  CHECK(a->retries == 1);
+  CHECK(a->deadline == 2 * RETRY_MS);
+  CHECK(mg_inflight_expired(&win, RETRY_MS) == NULL);
+  CHECK(mg_inflight_next_deadline(&win) == 100 + RETRY_MS);
+
+  /* Acknowledging the head hands the deadline to the next entry. */
+  CHECK(mg_inflight_ack(&win, MG_INFLIGHT_PUBREC, b->id, 150) == b);
+  CHECK(mg_inflight_next_deadline(&win) == 200 + RETRY_MS);
+
+  /* Order now: c (1200), a (2000), b (1150 + 1000). */
+  CHECK(mg_inflight_expired(&win, 3000) == c);
+  CHECK(mg_inflight_expired(&win, 3000) == a);
+  CHECK(mg_inflight_expired(&win, 3000) == b);
+  CHECK(b->state == MG_INFLIGHT_WAIT_PUBCOMP);
+  CHECK(b->retries == 1);
+  CHECK(mg_inflight_expired(&win, 3000) == NULL);
+
+  /* Releasing an entry in the middle keeps the list intact. */
+  mg_inflight_release(&win, a);
+  CHECK(mg_inflight_expired(&win, 4000) == c);
+  CHECK(mg_inflight_expired(&win, 4000) == b);
+  CHECK(mg_inflight_expired(&win, 4000) == NULL);
+}
+
+int main(void) {
+  test_alloc();
+  test_ack();
+  test_stale_ack();
+  test_wrap();
+  test_expiry_order();
+
+  if (failures > 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
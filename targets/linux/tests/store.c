@@ -0,0 +1,179 @@
+/* Unit tests for the POSIX mg_store.h ring: FIFO order across the wrap of
+ * the 64 KiB buffer, dropping the oldest entries when full, an empty store
+ * and draining within the per-call budget.
+ *
+ *   ctest --test-dir build
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mg_store.h"
+
+/* With its 2-byte length, 65 entries fill the 64 KiB ring and do not
+ * divide it, so one of them is split across the end.
+ */
+#define ENTRY_LEN 1000
+#define RING_ENTRIES 65
+
+static int failures;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);               \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+static void reset(void) {
+  memset(&mg_store_stats, 0, sizeof(mg_store_stats));
+  CHECK(mg_store_init() == 0);
+}
+
+/* Entry @p seq is ENTRY_LEN bytes counting up from @p seq. */
+static void append(unsigned int seq) {
+  uint8_t data[ENTRY_LEN];
+
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = (uint8_t)(seq + i);
+  }
+  CHECK(mg_store_append(data, sizeof(data)) == 0);
+}
+
+static void pop_expect(unsigned int seq) {
+  uint8_t data[ENTRY_LEN];
+  int ret = mg_store_peek(data, sizeof(data));
+  size_t i;
+
+  CHECK(ret == ENTRY_LEN);
+  for (i = 0; i < sizeof(data) && data[i] == (uint8_t)(seq + i); i++) {
+  }
+  CHECK(i == sizeof(data));
+  mg_store_pop();
+}
+
+static void test_wrap_order(void) {
+  reset();
+
+  for (unsigned int seq = 0; seq < 60; seq++) {
+    append(seq);
+  }
+  for (unsigned int seq = 0; seq < 30; seq++) {
+    pop_expect(seq);
+  }
+
+  /* These run past the end of the ring and on from its start. */
+  for (unsigned int seq = 60; seq < 90; seq++) {
+    append(seq);
+  }
+  CHECK(mg_store_stats.depth == 60);
+
+  for (unsigned int seq = 30; seq < 90; seq++) {
+    pop_expect(seq);
+  }
+  CHECK(mg_store_stats.depth == 0);
+  CHECK(mg_store_stats.dropped == 0);
+  CHECK(mg_store_stats.appended == 90);
+}
+
+static void test_drop_oldest(void) {
+  uint8_t big[64 * 1024];
+
+  reset();
+
+  for (unsigned int seq = 0; seq < RING_ENTRIES + 5; seq++) {
+    append(seq);
+  }
+  CHECK(mg_store_stats.depth == RING_ENTRIES);
+  CHECK(mg_store_stats.dropped == 5);
+  pop_expect(5);
+
+  /* An entry that can never fit is refused and drops nothing. */
+  CHECK(mg_store_append(big, sizeof(big)) == -E2BIG);
+  CHECK(mg_store_stats.depth == RING_ENTRIES - 1);
+  CHECK(mg_store_stats.dropped == 5);
+}
+
+static void test_empty(void) {
+  uint8_t data[ENTRY_LEN];
+
+  reset();
+
+  CHECK(mg_store_peek(data, sizeof(data)) == -ENODATA);
+  mg_store_pop();
+  CHECK(mg_store_stats.depth == 0);
+
+  /* Popping again after the last entry is a no-op too. */
+  append(1);
+  pop_expect(1);
+  mg_store_pop();
+  CHECK(mg_store_stats.depth == 0);
+  CHECK(mg_store_peek(data, sizeof(data)) == -ENODATA);
+}
+
+struct sender {
+  unsigned int sent;
+  unsigned int fail_at;
+  uint8_t first[4];
+};
+
+static int send_entry(const uint8_t *data, size_t len, void *user) {
+  struct sender *s = user;
+
+  if (s->sent == s->fail_at) {
+    return -EIO;
+  }
+
+  CHECK(len == ENTRY_LEN);
+  if (s->sent < sizeof(s->first)) {
+    s->first[s->sent] = data[0];
+  }
+  s->sent++;
+
+  return 0;
+}
+
+static void test_drain_budget(void) {
+  struct sender s = {.fail_at = UINT32_MAX};
+  uint8_t buf[ENTRY_LEN];
+
+  reset();
+  for (unsigned int seq = 0; seq < 10; seq++) {
+    append(seq);
+  }
+
+  CHECK(mg_store_drain(send_entry, &s, buf, sizeof(buf), 3) == 3);
+  CHECK(s.sent == 3);
+  CHECK(s.first[0] == 0 && s.first[1] == 1 && s.first[2] == 2);
+  CHECK(mg_store_stats.depth == 7);
+  CHECK(mg_store_stats.replayed == 3);
+
+  /* A send error stops the drain and leaves its entry queued. */
+  s.fail_at = 4;
+  CHECK(mg_store_drain(send_entry, &s, buf, sizeof(buf), 5) == -EIO);
+  CHECK(s.sent == 4);
+  CHECK(mg_store_stats.depth == 6);
+  pop_expect(4);
+
+  /* An entry too large for the scratch buffer is dropped, not replayed. */
+  s = (struct sender){.fail_at = UINT32_MAX};
+  CHECK(mg_store_drain(send_entry, &s, buf, ENTRY_LEN - 1, 2) == 0);
+  CHECK(mg_store_stats.depth == 0);
+  CHECK(mg_store_stats.dropped == 5);
+}
+
+int main(void) {
+  test_wrap_order();
+  test_drop_oldest();
+  test_empty();
+  test_drain_budget();
+
+  if (failures > 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
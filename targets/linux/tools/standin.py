@@ -0,0 +1,422 @@
+#!/usr/bin/env python3
+"""Minimal local stand-ins for the Magistrala MQTT, CoAP, HTTP and WebSocket
+adapters, for running the Linux client without a full Magistrala deployment.
+
+They acknowledge everything they receive and keep no state beyond a single
+connection, which is all the throughput and latency measurements need. Use a
+real Mosquitto, libcoap or websocketd instead when protocol conformance
+matters.
+"""
+
+import argparse
+import base64
+import hashlib
+import queue
+import random
+import socket
+import signal
+import socketserver
+import struct
+import sys
+import threading
+import time
+
+WS_GUID = b"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+# Tokens of the CoAP requests that got through, reported on SIGTERM so a
+# benchmark can tell how many NON messages were delivered.
+coap_tokens = set()
+
+
+def recv_exact(sock, n):
+    buf = b""
+    while len(buf) < n:
+        chunk = sock.recv(n - len(buf))
+        if not chunk:
+            raise ConnectionError
+        buf += chunk
+    return buf
+
+
+class MQTTHandler(socketserver.BaseRequestHandler):
+    # Seconds every reply is held back, as a WAN round trip would. Reading
+    # carries on meanwhile, so pipelined publishes are acked in parallel.
+    delay = 0.0
+
+    def setup(self):
+        self.lock = threading.Lock()
+
+    def reply(self, data):
+        def send():
+            with self.lock:
+                try:
+                    self.request.sendall(data)
+                except OSError:
+                    pass
+
+        if self.delay:
+            threading.Timer(self.delay, send).start()
+        else:
+            send()
+
+    def read_packet(self):
+        hdr = recv_exact(self.request, 1)[0]
+        length, shift = 0, 0
+        while True:
+            byte = recv_exact(self.request, 1)[0]
+            length |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        return hdr, recv_exact(self.request, length) if length else b""
+
+    def handle(self):
+        try:
+            while True:
+                hdr, body = self.read_packet()
+                kind = hdr & 0xF0
+                if kind == 0x10:  # CONNECT
+                    self.reply(b"\x20\x02\x00\x00")
+                elif kind == 0x30:  # PUBLISH
+                    qos = (hdr >> 1) & 0x03
+                    if qos:
+                        tlen = struct.unpack("!H", body[:2])[0]
+                        pid = body[2 + tlen:4 + tlen]
+                        ack = 0x40 if qos == 1 else 0x50
+                        self.reply(bytes([ack, 2]) + pid)
+                elif kind == 0x60:  # PUBREL
+                    self.reply(b"\x70\x02" + body[:2])
+                elif kind == 0x80:  # SUBSCRIBE
+                    self.reply(b"\x90\x03" + body[:2] + b"\x00")
+                elif kind == 0xC0:  # PINGREQ
+                    self.reply(b"\xd0\x00")
+                elif kind == 0xE0:  # DISCONNECT
+                    return
+        except (ConnectionError, OSError):
+            return
+
+
+class HTTPHandler(socketserver.BaseRequestHandler):
+    # Requests served on one connection before closing it, and seconds it
+    # may sit idle between requests, as a reverse proxy limits keep-alive
+    # connections; 0 for no limit.
+    max_requests = 0
+    idle = 0.0
+    # Seconds every reply is held back, as a WAN round trip would. The
+    # first reply on a connection waits twice as long: a TCP handshake on
+    # loopback takes no time, but over a WAN it is a round trip too.
+    # Reading carries on meanwhile, so pipelined requests are answered in
+    # parallel, in order.
+    delay = 0.0
+    connections = 0
+    requests = 0
+
+    def send_replies(self):
+        while True:
+            due, data = self.replies.get()
+            if data is None:
+                return
+            time.sleep(max(due - time.monotonic(), 0))
+            try:
+                self.request.sendall(data)
+            except OSError:
+                return
+
+    def handle(self):
+        self.replies = queue.Queue()
+        sender = threading.Thread(target=self.send_replies, daemon=True)
+        sender.start()
+        try:
+            self.serve()
+        finally:
+            self.replies.put((0, None))
+            sender.join()
+
+    def serve(self):
+        buf = b""
+        served = 0
+        HTTPHandler.connections += 1
+        try:
+            while True:
+                while b"\r\n\r\n" not in buf:
+                    # Idle until the first byte of the next request.
+                    self.request.settimeout(None if buf
+                                            else self.idle or None)
+                    chunk = self.request.recv(4096)
+                    if not chunk:
+                        return
+                    buf += chunk
+                self.request.settimeout(None)
+                head, buf = buf.split(b"\r\n\r\n", 1)
+                lines = head.decode(errors="replace").split("\r\n")
+                headers = {}
+                for line in lines[1:]:
+                    key, _, value = line.partition(":")
+                    headers[key.strip().lower()] = value.strip().lower()
+                if headers.get("transfer-encoding") == "chunked":
+                    buf = self.read_chunked(buf)
+                else:
+                    length = int(headers.get("content-length", "0"))
+                    while len(buf) < length:
+                        chunk = self.request.recv(4096)
+                        if not chunk:
+                            return
+                        buf += chunk
+                    buf = buf[length:]
+                served += 1
+                HTTPHandler.requests += 1
+                close = (headers.get("connection") == "close"
+                         or lines[0].endswith("HTTP/1.0")
+                         or served == self.max_requests)
+                self.replies.put((
+                    time.monotonic()
+                    + self.delay * (2 if served == 1 else 1),
+                    b"HTTP/1.1 202 Accepted\r\nContent-Length: 0\r\n"
+                    + (b"Connection: close\r\n" if close else b"")
+                    + b"\r\n"))
+                if close:
+                    return
+        except (ConnectionError, OSError, ValueError):
+            return
+
+    def read_chunked(self, buf):
+        while True:
+            while b"\r\n" not in buf:
+                chunk = self.request.recv(4096)
+                if not chunk:
+                    raise ConnectionError
+                buf += chunk
+            line, buf = buf.split(b"\r\n", 1)
+            size = int(line.split(b";")[0], 16)
+            while len(buf) < size + 2:
+                chunk = self.request.recv(4096)
+                if not chunk:
+                    raise ConnectionError
+                buf += chunk
+            buf = buf[size + 2:]
+            if size == 0:
+                return buf
+
+
+class WSHandler(socketserver.BaseRequestHandler):
+    echo = False
+    delay = 0.0
+    # Echoes are split into frames of at most this many bytes; 0 does not.
+    fragment = 0
+    # Data frames, their payload bytes and pings, over all connections.
+    frames = 0
+    payload_bytes = 0
+    pings = 0
+
+    def handle(self):
+        buf = b""
+        # Fragments go out as they are written, as from websocketd, whose
+        # Go sockets have Nagle off.
+        self.request.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        try:
+            while b"\r\n\r\n" not in buf:
+                chunk = self.request.recv(4096)
+                if not chunk:
+                    return
+                buf += chunk
+            head = buf.split(b"\r\n\r\n", 1)[0].decode(errors="replace")
+            key = ""
+            for line in head.split("\r\n")[1:]:
+                name, _, value = line.partition(":")
+                if name.strip().lower() == "sec-websocket-key":
+                    key = value.strip()
+            accept = base64.b64encode(
+                hashlib.sha1(key.encode() + WS_GUID).digest())
+            self.request.sendall(
+                b"HTTP/1.1 101 Switching Protocols\r\n"
+                b"Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                b"Sec-WebSocket-Accept: " + accept + b"\r\n\r\n")
+            while True:
+                hdr = recv_exact(self.request, 2)
+                opcode = hdr[0] & 0x0F
+                length = hdr[1] & 0x7F
+                if length == 126:
+                    length = struct.unpack("!H", recv_exact(self.request, 2))[0]
+                elif length == 127:
+                    length = struct.unpack("!Q", recv_exact(self.request, 8))[0]
+                mask = recv_exact(self.request, 4) if hdr[1] & 0x80 else None
+                data = recv_exact(self.request, length) if length else b""
+                if mask:
+                    data = bytes(b ^ mask[i % 4] for i, b in enumerate(data))
+                if opcode == 0x8:
+                    self.request.sendall(b"\x88\x00")
+                    return
+                if opcode == 0x9:
+                    WSHandler.pings += 1
+                    self.send_frame(0xA, data)
+                elif opcode in (0x0, 0x1, 0x2):
+                    WSHandler.frames += 1
+                    WSHandler.payload_bytes += length
+                    if self.echo:
+                        time.sleep(self.delay)
+                        self.send_message(opcode, data)
+        except (ConnectionError, OSError):
+            return
+
+    def send_message(self, opcode, data):
+        if not self.fragment or len(data) <= self.fragment:
+            self.send_frame(opcode, data)
+            return
+        # A text or binary frame, continuation frames, the last with FIN.
+        for i in range(0, len(data), self.fragment):
+            last = i + self.fragment >= len(data)
+            self.send_frame(opcode if i == 0 else 0x0,
+                            data[i:i + self.fragment], last)
+
+    def send_frame(self, opcode, data, fin=True):
+        first = (0x80 if fin else 0) | opcode
+        if len(data) < 126:
+            hdr = bytes([first, len(data)])
+        elif len(data) < 65536:
+            hdr = bytes([first, 126]) + struct.pack("!H", len(data))
+        else:
+            hdr = bytes([first, 127]) + struct.pack("!Q", len(data))
+        self.request.sendall(hdr + data)
+
+
+def coap_option(data, tkl, number):
+    """Returns the value of option @number of a CoAP message, or None."""
+    pos, option = 4 + tkl, 0
+    while pos < len(data) and data[pos] != 0xFF:
+        delta, length = data[pos] >> 4, data[pos] & 0x0F
+        pos += 1
+        ext = []
+        for nibble in (delta, length):
+            if nibble == 13:
+                ext.append(13 + data[pos])
+                pos += 1
+            elif nibble == 14:
+                ext.append(269 + struct.unpack("!H", data[pos:pos + 2])[0])
+                pos += 2
+            else:
+                ext.append(nibble)
+        option += ext[0]
+        if option == number:
+            return data[pos:pos + ext[1]]
+        pos += ext[1]
+    return None
+
+
+def uint_option(number, value, last):
+    """Encodes a uint option following option @last."""
+    body = value.to_bytes((value.bit_length() + 7) // 8, "big")
+    delta = number - last
+    if delta < 13:
+        return bytes([delta << 4 | len(body)]) + body
+    return bytes([13 << 4 | len(body), delta - 13]) + body
+
+
+def serve_coap(host, port, loss, delay, block_szx):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind((host, port))
+    while True:
+        data, peer = sock.recvfrom(2048)
+        if len(data) < 4 or data[0] >> 6 != 1:
+            continue
+        if loss and random.random() < loss:
+            continue
+        mtype = (data[0] >> 4) & 0x03
+        tkl = data[0] & 0x0F
+        code = data[1]
+        if code == 0 or mtype > 1:
+            continue
+        token = data[4:4 + tkl]
+        coap_tokens.add(token)
+        # Block1 (RFC 7959): 2.31 Continue until the last block, echoing
+        # the block with at most --block-size.
+        rcode, options = 0x44, b""
+        block1 = coap_option(data, tkl, 27)
+        if block1 is not None:
+            value = int.from_bytes(block1, "big")
+            more = value & 0x08
+            szx = min(value & 0x07, block_szx)
+            options = uint_option(27, value & ~0x07 | szx, 0)
+            if more:
+                rcode = 0x5F
+        if mtype == 0:  # CON: piggybacked 2.04 Changed
+            resp = bytes([0x60 | tkl, rcode]) + data[2:4] + token + options
+        else:  # NON: NON 2.04 Changed with a fresh message ID
+            mid = struct.pack("!H", random.getrandbits(16))
+            resp = bytes([0x50 | tkl, rcode]) + mid + token + options
+        if loss and random.random() < loss:
+            continue
+        if delay:
+            threading.Timer(delay, sock.sendto, (resp, peer)).start()
+        else:
+            sock.sendto(resp, peer)
+
+
+class Server(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def report(signum, frame):
+    print("coap: %d distinct requests received" % len(coap_tokens))
+    print("http: %d requests on %d connections" %
+          (HTTPHandler.requests, HTTPHandler.connections))
+    print("ws: %d data frames, %d payload bytes, %d pings" %
+          (WSHandler.frames, WSHandler.payload_bytes, WSHandler.pings),
+          flush=True)
+    sys.exit(0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--mqtt", type=int, default=1883)
+    parser.add_argument("--coap", type=int, default=5683)
+    parser.add_argument("--http", type=int, default=8008)
+    parser.add_argument("--ws", type=int, default=8186)
+    parser.add_argument("--loss", type=float, default=0.0,
+                        help="CoAP datagram drop probability per direction")
+    parser.add_argument("--delay", type=float, default=0.0,
+                        help="MQTT, CoAP and HTTP reply and WebSocket echo "
+                        "delay in milliseconds")
+    parser.add_argument("--block-size", type=int, default=1024,
+                        help="largest CoAP block accepted, as a power of two")
+    parser.add_argument("--http-max-requests", type=int, default=0,
+                        help="HTTP requests served per connection")
+    parser.add_argument("--http-idle", type=float, default=0.0,
+                        help="HTTP keep-alive idle timeout in milliseconds")
+    parser.add_argument("--echo", action="store_true",
+                        help="echo WebSocket data frames like websocketd cat")
+    parser.add_argument("--ws-fragment", type=int, default=0,
+                        help="split WebSocket echoes into frames of this size")
+    args = parser.parse_args()
+
+    WSHandler.echo = args.echo
+    WSHandler.delay = args.delay / 1000
+    WSHandler.fragment = args.ws_fragment
+    HTTPHandler.max_requests = args.http_max_requests
+    HTTPHandler.idle = args.http_idle / 1000
+    MQTTHandler.delay = args.delay / 1000
+    HTTPHandler.delay = args.delay / 1000
+    threads = [threading.Thread(target=serve_coap,
+                                args=(args.host, args.coap, args.loss,
+                                      args.delay / 1000,
+                                      max(args.block_size.bit_length() - 5,
+                                          0)),
+                                daemon=True)]
+    for port, handler in ((args.mqtt, MQTTHandler), (args.http, HTTPHandler),
+                          (args.ws, WSHandler)):
+        server = Server((args.host, port), handler)
+        threads.append(threading.Thread(target=server.serve_forever,
+                                        daemon=True))
+    signal.signal(signal.SIGTERM, report)
+    for t in threads:
+        t.start()
+    print("stand-ins listening: mqtt %d coap %d http %d ws %d" %
+          (args.mqtt, args.coap, args.http, args.ws), flush=True)
+    for t in threads:
+        t.join()
+
+
+if __name__ == "__main__":
+    main()
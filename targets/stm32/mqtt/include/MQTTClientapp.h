@@ -7,6 +7,7 @@
 #include "MQTTInterface.h"
 #include "cmsis_os.h"
 #include "config.h"
+#include "mg_topic.h"
 
 #define MQTT_PORT 1883
 #define MQTT_BUFSIZE 1024
@@ -6,11 +6,7 @@
 
 void createMainfluxChannel(void)
 {
-    const char *_preId = "channels/";
-    const char *_postId = "/messages";
-    strcpy(mfTopic, _preId);
-    strcat(mfTopic, mfChannelId);
-    strcat(mfTopic, _postId);
+    mg_legacy_topic_format(mfTopic, sizeof(mfTopic), mfChannelId);
 }
 
 void mqttClientSubTask(void const *argument)
@@ -33,16 +29,19 @@ void mqttClientSubTask(void const *argument)
 
 void mqttClientPubTask(void const *argument)
 {
-    const char *str = "{'message':'hello'}";
-    MQTTMessage message;
+    static const char str[] = "{'message':'hello'}";
+    MQTTMessage message = {0};
+
+    // The topic is built on connect and the payload is constant, so the
+    // publish loop does no string work of its own.
+    message.qos = QOS0;
+    message.payload = (void *)str;
+    message.payloadlen = sizeof(str) - 1;
 
     while (1)
     {
         if (mqttClient.isconnected)
         {
-            message.payload = (void *)str;
-            message.payloadlen = strlen(str);
-
             MQTTPublish(&mqttClient, mfTopic, &message);
         }
         osDelay(MESSAGE_DELAY);
@@ -0,0 +1,26 @@
+"""PlatformIO pre-build step: converts certs/ca.pem to DER and embeds it as
+root_ca (common/tools/pem_to_der.py), so the firmware carries no PEM
+parsing and netInit() parses the certificate in place once."""
+
+import os
+import subprocess
+
+Import("env")
+
+project = env.subst("$PROJECT_DIR")
+pem = os.path.join(project, "certs", "ca.pem")
+gen = os.path.join(env.subst("$BUILD_DIR"), "creds")
+
+if not os.path.exists(pem):
+    env.Exit("%s not found, see README.md" % pem)
+
+os.makedirs(gen, exist_ok=True)
+subprocess.run([env.subst("$PYTHONEXE"),
+                os.path.join(project, "..", "..", "..", "common", "tools",
+                             "pem_to_der.py"),
+                os.path.join(gen, "creds_der.c"),
+                os.path.join(gen, "creds_der.h"),
+                "root_ca=" + pem], check=True)
+
+env.Append(CPPPATH=[gen])
+env.BuildSources(os.path.join("$BUILD_DIR", "creds_der"), gen)
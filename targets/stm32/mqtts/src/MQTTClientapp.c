@@ -7,15 +7,19 @@
 
 void createMainfluxChannel(void)
 {
-    const char *_preId = "channels/";
-    const char *_postId = "/messages";
-    strcpy(mfTopic, _preId);
-    strcat(mfTopic, mfChannelId);
-    strcat(mfTopic, _postId);
+    mg_legacy_topic_format(mfTopic, sizeof(mfTopic), mfChannelId);
 }
 
 void mqttClientSubTask(void const *argument)
 {
+    // The credentials, configuration and SSL context are set up once here;
+    // reconnects only reopen the socket and handshake again.
+    if (netInit(&net) != 0)
+    {
+        printf("netInit failed.\n");
+        osThreadTerminate(osThreadGetId());
+    }
+
     while (1)
     {
         if (!mqttClient.isconnected)
@@ -34,16 +38,19 @@ void mqttClientSubTask(void const *argument)
 
 void mqttClientPubTask(void const *argument)
 {
-    const char *str = "{'message':'hello'}";
-    MQTTMessage message;
+    static const char str[] = "{'message':'hello'}";
+    MQTTMessage message = {0};
+
+    // The topic is built on connect and the payload is constant, so the
+    // publish loop does no string work of its own.
+    message.qos = QOS0;
+    message.payload = (void *)str;
+    message.payloadlen = sizeof(str) - 1;
 
     while (1)
     {
         if (mqttClient.isconnected)
         {
-            message.payload = (void *)str;
-            message.payloadlen = strlen(str);
-
             MQTTPublish(&mqttClient, mfTopic, &message);
         }
         osDelay(MESSAGE_DELAY);
@@ -54,18 +61,13 @@ int mqttConnectBroker()
 {
     int ret;
 
-    net_clear();
-    ret = net_init(&net);
-    if (ret != MQTT_SUCCESS)
-    {
-        printf("net_init failed.\n");
-        return ERR_CODE;
-    }
+    // Close what is left of the last connection and reset the SSL session.
+    netDisconnect(&net);
 
-    ret = net_connect(&net, server, MQTT_PORT);
+    ret = netConnect(&net, server, MQTT_PORT);
     if (ret != MQTT_SUCCESS)
     {
-        printf("net_connect failed.\n");
+        printf("netConnect failed.\n");
         return ERR_CODE;
     }
 
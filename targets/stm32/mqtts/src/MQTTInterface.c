@@ -20,20 +20,28 @@
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/error.h"
 #include "mbedtls/certs.h"
+#include "mbedtls/ssl_ciphersuites.h"
+
+#include "creds_der.h"
 
 #define SERVER_PORT "8883"
 #define DEBUG_LEVEL 1
 #define PROG_DELAY 1000
 
-const char mbedtls_root_certificate[] = ""; // Add root certificate.
-
-const size_t mbedtls_root_certificate_len = sizeof(mbedtls_root_certificate);
-
 #if defined(MBEDTLS_MEMORY_BUFFER_ALLOC_C)
+#if defined(MG_TLS_PROFILE_SMALL)
+// 2 KB records and one cipher suite, see mg_tls_small.h
+#define MEMORY_HEAP_SIZE 24576
+#else
 #define MEMORY_HEAP_SIZE 65536
+#endif
 uint8_t alloc_buf[MEMORY_HEAP_SIZE];
 #endif
 
+#if defined(MG_TLS_PROFILE_SMALL)
+static const int tls_ciphers[] = {MG_TLS_CIPHERSUITES, 0};
+#endif
+
 mbedtls_net_context server_fd;
 const char *pers = "mbedtls";
 
@@ -50,7 +58,7 @@ static void my_debug(void *ctx, int level, const char *file, int line, const cha
 	fflush((FILE *)ctx);
 }
 
-int net_init(Network *n)
+int netInit(Network *n)
 {
 	int ret;
 
@@ -76,35 +84,18 @@ int net_init(Network *n)
 		return ERR_CODE;
 	}
 
-	// Register functions
-	n->mqttread = netRead;
-	n->mqttwrite = netWrite;
-	n->disconnect = netDisconnect;
-
-	return 0;
-}
-
-int netConnect(Network *n, char *ip, int port)
-{
-	int ret;
-
-	// SSL/TLS connection process.
-	ret = mbedtls_x509_crt_parse(&cacert, (const unsigned char *)mbedtls_root_certificate,
-								 mbedtls_root_certificate_len);
-	if (ret < 0)
-	{
-		printf("mbedtls_x509_crt_parse failed.\n");
-		return ERR_CODE;
-	}
-
-	ret = mbedtls_net_connect(&server_fd, server, SERVER_PORT,
-							  MBEDTLS_NET_PROTO_TCP);
+	// Parsed once for every connect. root_ca is DER in flash (certs/ca.pem,
+	// converted at build time), so the certificate is referenced in place
+	// rather than decoded and copied to the heap.
+	ret = mbedtls_x509_crt_parse_der_nocopy(&cacert, root_ca, root_ca_len);
 	if (ret < 0)
 	{
-		printf("mbedtls_net_connect failed.\n");
+		printf("mbedtls_x509_crt_parse_der_nocopy failed.\n");
 		return ERR_CODE;
 	}
 
+	// The configuration and the SSL context are set up once as well: each
+	// connect reuses the context after netDisconnect() resets its session.
 	ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT,
 									  MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
 	if (ret < 0)
@@ -117,6 +108,16 @@ int netConnect(Network *n, char *ip, int port)
 	mbedtls_ssl_conf_ca_chain(&conf, &cacert, NULL);
 	mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &ctr_drbg);
 	mbedtls_ssl_conf_dbg(&conf, my_debug, stdout);
+#if defined(MG_TLS_PROFILE_SMALL)
+	mbedtls_ssl_conf_ciphersuites(&conf, tls_ciphers);
+	// Ask the broker for records that fit the smaller buffers
+	ret = mbedtls_ssl_conf_max_frag_len(&conf, MG_TLS_MFL_CODE);
+	if (ret < 0)
+	{
+		printf("mbedtls_ssl_conf_max_frag_len failed.\n");
+		return ERR_CODE;
+	}
+#endif
 
 	ret = mbedtls_ssl_setup(&ssl, &conf);
 	if (ret < 0)
@@ -132,6 +133,31 @@ int netConnect(Network *n, char *ip, int port)
 		return ERR_CODE;
 	}
 
+	// Register functions
+	n->mqttread = netRead;
+	n->mqttwrite = netWrite;
+	n->disconnect = netDisconnect;
+
+	return 0;
+}
+
+int netConnect(Network *n, char *ip, int port)
+{
+	int ret;
+	uint32_t start = HAL_GetTick();
+
+#if defined(MBEDTLS_MEMORY_DEBUG)
+	mbedtls_memory_buffer_alloc_max_reset();
+#endif
+
+	ret = mbedtls_net_connect(&server_fd, server, SERVER_PORT,
+							  MBEDTLS_NET_PROTO_TCP);
+	if (ret < 0)
+	{
+		printf("mbedtls_net_connect failed.\n");
+		return ERR_CODE;
+	}
+
 	mbedtls_ssl_set_bio(&ssl, &server_fd, mbedtls_net_send, mbedtls_net_recv,
 						NULL);
 
@@ -151,6 +177,17 @@ int netConnect(Network *n, char *ip, int port)
 		return ERR_CODE;
 	}
 
+#if defined(MBEDTLS_MEMORY_DEBUG)
+	size_t heap_peak, heap_blocks;
+
+	// Heap high-water of this connect alone
+	mbedtls_memory_buffer_alloc_max_get(&heap_peak, &heap_blocks);
+	printf("Connected in %lu ms, mbedTLS heap peak %u B in %u blocks.\n",
+		   (unsigned long)(HAL_GetTick() - start), (unsigned)heap_peak, (unsigned)heap_blocks);
+#else
+	printf("Connected in %lu ms.\n", (unsigned long)(HAL_GetTick() - start));
+#endif
+
 	return 0;
 }
 
@@ -14,4 +14,11 @@
 #define CLIENT_SECRET "CLIENT_SECRET" // Replace with your Client secret
 #define CHANNEL_ID "CHANNEL_ID"       // Replace with your Channel ID
 
+/* Telemetry goes as NON except for every TELEMETRY_CON_EVERY-th message and
+ * one at least every TELEMETRY_CON_INTERVAL_SEC, which are CON checkpoints.
+ * 1 sends every message as CON; 0 disables either trigger.
+ */
+#define TELEMETRY_CON_EVERY 1
+#define TELEMETRY_CON_INTERVAL_SEC 0
+
 #endif
@@ -1,4 +1,10 @@
 #include "config.h"
+#include "mg_batch.h"
+#include "mg_coap_client.h"
+#include "mg_net_if.h"
+#include "mg_senml.h"
+#include "mg_telemetry.h"
+#include "mg_topic.h"
 #include "wifi.h"
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
@@ -18,33 +24,50 @@ static struct net_if *sta_iface;
 /* CoAP client socket */
 static int coap_sock = -1;
 static struct sockaddr_in magistrala_addr;
+static struct mg_coap_client coap;
 
 #define MAX_COAP_MSG_LEN 512
 #define TELEMETRY_INTERVAL_SEC 30
 
-typedef struct {
-  double temperature;
-  double humidity;
-  int battery_level;
-  bool led_state;
-} sensor_data_t;
+/* Uri-Path m/{domain_id}/c/{channel_id} and Uri-Query auth={client_secret},
+ * fixed at build time.
+ */
+static const char coap_uri_path[] = MG_TOPIC(DOMAIN_ID, CHANNEL_ID);
+static const char coap_auth_query[] = "auth=" CLIENT_SECRET;
 
 static sensor_data_t current_data = {.temperature = 23.5,
                                      .humidity = 65.0,
                                      .battery_level = 85,
                                      .led_state = false};
 
-/* Network event callback */
-static struct net_mgmt_event_callback mgmt_cb;
-static K_SEM_DEFINE(dhcp_sem, 0, 1);
-
-static void net_mgmt_event_handler(struct net_mgmt_event_callback *cb,
-                                   uint32_t mgmt_event, struct net_if *iface) {
-  if (mgmt_event == NET_EVENT_IPV4_DHCP_BOUND) {
-    LOG_INF("DHCP bound - got IP address");
-    k_sem_give(&dhcp_sem);
-  }
-}
+/* Readings are sampled every TELEMETRY_INTERVAL_SEC and sent as one SenML
+ * pack whenever a batch threshold is reached. A pack larger than
+ * CONFIG_MG_COAP_BLOCK_SIZE goes block-wise, encoded a block at a time,
+ * while the next one fills the other batch.
+ */
+static const struct mg_batch_config batch_config = {
+    .base_name = CLIENT_ID ":",
+    .max_count = CONFIG_MG_TELEMETRY_BATCH_COUNT,
+    .max_bytes = CONFIG_MG_TELEMETRY_BATCH_MAX_BYTES,
+    .max_age_ms = CONFIG_MG_TELEMETRY_BATCH_MAX_AGE_MS,
+};
+static struct mg_batch_sample
+    batch_storage[2][CONFIG_MG_TELEMETRY_BATCH_COUNT];
+static struct mg_batch batches[2];
+static struct mg_batch *batch = &batches[0];
+
+/* The pack being uploaded block-wise, or NULL, and the time its blocks are
+ * encoded for, the same for all of them.
+ */
+static struct mg_batch *upload_batch;
+static int64_t upload_time;
+static struct mg_coap_transfer upload;
+
+static const struct mg_coap_class_config telemetry_config = {
+    .con_every = TELEMETRY_CON_EVERY,
+    .con_interval_ms = TELEMETRY_CON_INTERVAL_SEC * MSEC_PER_SEC,
+};
+static struct mg_coap_class telemetry_class;
 
 static int coap_client_init(void) {
   int ret;
@@ -67,197 +90,267 @@ static int coap_client_init(void) {
     return -EINVAL;
   }
 
+  mg_coap_client_init(&coap, coap_sock, (struct sockaddr *)&magistrala_addr,
+                      sizeof(magistrala_addr));
+  mg_coap_class_init(&telemetry_class, &telemetry_config);
+
   LOG_INF("Magistrala CoAP client initialized - IP: %s:%d", MAGISTRALA_IP,
           MAGISTRALA_COAP_PORT);
 
   return 0;
 }
 
-static int send_coap_message(const char *uri_path, const char *payload,
-                             size_t payload_len) {
-  static uint8_t request_buf[MAX_COAP_MSG_LEN];
-  static uint8_t response_buf[MAX_COAP_MSG_LEN];
-  struct coap_packet request, response;
-  int ret, recv_len;
-  struct sockaddr_in recv_addr;
-  socklen_t recv_addr_len = sizeof(recv_addr);
-
-  /* Initialize CoAP request */
-  ret = coap_packet_init(&request, request_buf, sizeof(request_buf),
-                         COAP_VERSION_1, COAP_TYPE_CON, COAP_TOKEN_MAX_LEN,
-                         coap_next_token(), COAP_METHOD_POST, coap_next_id());
+/* Encodes the queued readings (or, for JSON, the current one) straight into
+ * the request after the payload marker, so there is no intermediate payload
+ * buffer.
+ */
+static int append_telemetry(struct coap_packet *request) {
+  uint8_t *buf = request->data + request->offset;
+  size_t len = request->max_len - request->offset;
+  int64_t now = k_uptime_get();
+  int ret;
+
+  if (IS_ENABLED(CONFIG_MG_TELEMETRY_FORMAT_SENML_CBOR)) {
+    ret = mg_batch_encode_senml_cbor(batch, now, buf, len);
+  } else {
+    ret = mg_telemetry_json_encode(&current_data, now, (char *)buf, len);
+  }
+
   if (ret < 0) {
-    LOG_ERR("Failed to init CoAP request: %d", ret);
     return ret;
   }
 
+  request->offset += ret;
+
+  return ret;
+}
+
+/* Completion of a telemetry request, @p user being its reading count. */
+static void telemetry_done(int result, const struct coap_packet *response,
+                           void *user) {
+  size_t readings = (uintptr_t)user;
+  uint8_t code;
+
+  if (result < 0) {
+    LOG_ERR("Telemetry not delivered (%d), %zu readings lost", result,
+            readings);
+    return;
+  }
+
+  code = coap_header_get_code(response);
+  if (COAP_RESPONSE_CODE_CLASS(code) != 2) {
+    LOG_WRN("Telemetry rejected: %d.%02d", COAP_RESPONSE_CODE_CLASS(code),
+            COAP_RESPONSE_CODE_DETAIL(code));
+    return;
+  }
+
+  LOG_DBG("Telemetry acknowledged: %zu readings", readings);
+}
+
+static int append_telemetry_options(struct coap_packet *request,
+                                    void *user) {
+  int ret;
+
+  ARG_UNUSED(user);
+
   /* Add URI path */
-  ret = coap_packet_append_option(&request, COAP_OPTION_URI_PATH, uri_path,
-                                  strlen(uri_path));
+  ret = coap_packet_append_option(request, COAP_OPTION_URI_PATH,
+                                  coap_uri_path, MG_STRLEN(coap_uri_path));
   if (ret < 0) {
     LOG_ERR("Failed to add URI path: %d", ret);
     return ret;
   }
 
-  /* Add authorization header with Client secret */
-  char auth_query[128];
-  ret = snprintf(auth_query, sizeof(auth_query), "auth=%s", CLIENT_SECRET);
-  if (ret >= sizeof(auth_query)) {
-    LOG_ERR("URI path too large");
-    return -E2BIG;
+  /* Add content format for the telemetry encoding */
+  ret = coap_append_option_int(
+      request, COAP_OPTION_CONTENT_FORMAT,
+      IS_ENABLED(CONFIG_MG_TELEMETRY_FORMAT_SENML_CBOR)
+          ? MG_SENML_CBOR_CONTENT_FORMAT
+          : COAP_CONTENT_FORMAT_APP_JSON);
+  if (ret < 0) {
+    LOG_ERR("Failed to add content format: %d", ret);
+    return ret;
   }
 
-  ret = coap_packet_append_option(&request, COAP_OPTION_URI_QUERY, auth_query,
-                                  strlen(auth_query));
+  /* Add authorization header with Client secret */
+  ret = coap_packet_append_option(request, COAP_OPTION_URI_QUERY,
+                                  coap_auth_query, MG_STRLEN(coap_auth_query));
   if (ret < 0) {
     LOG_ERR("Failed to add auth query: %d", ret);
     return ret;
   }
 
-  /* Add content format for JSON */
-  if (payload && payload_len > 0) {
-    /* Add payload */
-    ret = coap_packet_append_payload_marker(&request);
-    if (ret < 0) {
-      LOG_ERR("Failed to add payload marker: %d", ret);
-      return ret;
-    }
+  return 0;
+}
 
-    ret = coap_packet_append_payload(&request, payload, payload_len);
-    if (ret < 0) {
-      LOG_ERR("Failed to add payload: %d", ret);
-      return ret;
-    }
-  }
+static int produce_telemetry_block(size_t offset, uint8_t *buf, size_t len,
+                                   void *user) {
+  return mg_batch_encode_senml_cbor_block(user, upload_time, offset, buf,
+                                          len);
+}
 
-  /* Send request */
-  ret = sendto(coap_sock, request_buf, request.offset, 0,
-               (struct sockaddr *)&magistrala_addr, sizeof(magistrala_addr));
-  if (ret < 0) {
-    LOG_ERR("Failed to send CoAP request: %d", errno);
-    return -errno;
-  }
+static void upload_done(int result, const struct coap_packet *response,
+                        void *user) {
+  struct mg_batch *done = user;
 
-  LOG_INF("CoAP request sent to %s", uri_path);
+  telemetry_done(result, response, (void *)(uintptr_t)done->count);
 
-  /* Wait for response (with timeout) */
-  struct pollfd pfd = {.fd = coap_sock, .events = POLLIN};
+  /* A failed pack is dropped like a lost NON one rather than blocking the
+   * readings that follow it.
+   */
+  mg_batch_reset(done);
+  upload_batch = NULL;
+}
 
-  ret = poll(&pfd, 1, 5000); // 5 second timeout
-  if (ret <= 0) {
-    LOG_WRN("CoAP response timeout or error: %d", ret);
-    return -ETIMEDOUT;
-  }
+/* Sends the pack block-wise (Block1) and swaps batches, so sampling goes on
+ * while the blocks are acknowledged one by one.
+ */
+static int send_coap_blocks(void) {
+  int ret;
 
-  /* Receive response */
-  recv_len = recvfrom(coap_sock, response_buf, sizeof(response_buf), 0,
-                      (struct sockaddr *)&recv_addr, &recv_addr_len);
-  if (recv_len < 0) {
-    LOG_ERR("Failed to receive CoAP response: %d", errno);
-    return -errno;
+  if (upload_batch != NULL) {
+    LOG_WRN("Previous pack still uploading");
+    return -EBUSY;
   }
 
-  /* Parse response */
-  ret = coap_packet_parse(&response, response_buf, recv_len, NULL, 0);
+  upload = (struct mg_coap_transfer){
+      .method = COAP_METHOD_POST,
+      .options = append_telemetry_options,
+      .total = mg_batch_encoded_len(batch),
+      .produce = produce_telemetry_block,
+      .done = upload_done,
+      .user = batch,
+  };
+  upload_time = k_uptime_get();
+
+  ret = mg_coap_client_upload(&coap, &upload);
   if (ret < 0) {
-    LOG_ERR("Failed to parse CoAP response: %d", ret);
+    LOG_ERR("Failed to start block-wise upload: %d", ret);
     return ret;
   }
 
-  uint8_t response_code = coap_header_get_code(&response);
-  LOG_DBG("CoAP response code: %d", response_code);
+  LOG_INF("CoAP block-wise upload to %s, %zu bytes in %d byte blocks",
+          coap_uri_path, upload.total,
+          coap_block_size_to_bytes(upload.block.block_size));
+
+  upload_batch = batch;
+  batch = batch == &batches[0] ? &batches[1] : &batches[0];
 
   return 0;
 }
 
-static int wait_for_ip_address(void) {
-  struct net_if_addr *if_addr;
-  struct net_if *iface = net_if_get_default();
-  int timeout_count = 0;
-  const int max_timeout = 30; // 30 seconds max wait
-
-  /* Check if we already have an IP */
-  if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-  if (if_addr) {
-    char addr_str[NET_IPV4_ADDR_LEN];
-    net_addr_ntop(AF_INET, &if_addr->address.in_addr, addr_str,
-                  sizeof(addr_str));
-    LOG_INF("Already have IP address: %s", addr_str);
-    return 0;
+/* Queues the request without waiting for its response: the engine
+ * retransmits CON checkpoints and reports their outcome to telemetry_done().
+ */
+static int send_coap_message(size_t readings) {
+  struct coap_packet request;
+  int ret;
+
+  ret = mg_coap_client_init_class_request(&coap, &request, &telemetry_class,
+                                          COAP_METHOD_POST);
+  if (ret == -EAGAIN) {
+    LOG_WRN("Server not responding, holding telemetry back");
+    return ret;
+  }
+  if (ret < 0) {
+    LOG_ERR("Failed to init CoAP request: %d", ret);
+    return ret;
   }
 
-  LOG_INF("Waiting for IP address via DHCP...");
+  ret = append_telemetry_options(&request, NULL);
+  if (ret < 0) {
+    goto drop;
+  }
 
-  /* Wait for DHCP with timeout */
-  int ret = k_sem_take(&dhcp_sem, K_SECONDS(max_timeout));
-  if (ret != 0) {
-    LOG_ERR("Timeout waiting for DHCP - checking if we have IP anyway");
+  /* Add payload */
+  ret = coap_packet_append_payload_marker(&request);
+  if (ret < 0) {
+    LOG_ERR("Failed to add payload marker: %d", ret);
+    goto drop;
+  }
 
-    /* Final check if we somehow got an IP */
-    if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-    if (!if_addr) {
-      LOG_ERR("No IP address available");
-      return -ETIMEDOUT;
-    }
+  ret = append_telemetry(&request);
+  if (ret < 0) {
+    LOG_ERR("Telemetry payload too large");
+    goto drop;
   }
 
-  /* Verify we have a valid IP */
-  if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-  if (if_addr) {
-    char addr_str[NET_IPV4_ADDR_LEN];
-    net_addr_ntop(AF_INET, &if_addr->address.in_addr, addr_str,
-                  sizeof(addr_str));
-    LOG_INF("Got IP address: %s", addr_str);
-    return 0;
+  ret = mg_coap_client_send(&coap, &request, telemetry_done,
+                            (void *)(uintptr_t)readings);
+  if (ret < 0) {
+    LOG_ERR("Failed to send CoAP request: %d", ret);
+    return ret;
   }
 
-  LOG_ERR("Still no valid IP address");
-  return -1;
+  LOG_INF("CoAP %s sent to %s, %d bytes, %zu in flight",
+          coap_header_get_type(&request) == COAP_TYPE_CON ? "CON" : "NON",
+          coap_uri_path, request.offset, mg_coap_client_in_flight(&coap));
+
+  return 0;
+
+drop:
+  mg_coap_client_drop(&coap, &request);
+
+  return ret;
 }
 
-static int send_telemetry(void) {
-  char json_payload[256];
+static int flush_telemetry(void) {
+  size_t readings =
+      IS_ENABLED(CONFIG_MG_TELEMETRY_FORMAT_SENML_CBOR) ? batch->count : 1;
   int ret;
 
-  ret = snprintf(json_payload, sizeof(json_payload),
-                 "{"
-                 "\"temperature\":%.1f,"
-                 "\"humidity\":%.1f,"
-                 "\"battery\":%d,"
-                 "\"led_state\":%s,"
-                 "\"timestamp\":%lld"
-                 "}",
-                 current_data.temperature, current_data.humidity,
-                 current_data.battery_level,
-                 current_data.led_state ? "true" : "false", k_uptime_get());
-
-  if (ret >= sizeof(json_payload)) {
-    LOG_ERR("JSON payload too large");
-    return -E2BIG;
+  if (IS_ENABLED(CONFIG_MG_TELEMETRY_FORMAT_SENML_CBOR) &&
+      mg_batch_encoded_len(batch) > CONFIG_MG_COAP_BLOCK_SIZE) {
+    ret = send_coap_blocks();
+  } else {
+    ret = send_coap_message(readings);
   }
-
-  // Construct URI path: m/{domain_id}/c/{channel_id} --auth {client_secret}
-  char uri_path[128];
-  ret =
-      snprintf(uri_path, sizeof(uri_path), "m/%s/c/%s", DOMAIN_ID, CHANNEL_ID);
-  if (ret >= sizeof(uri_path)) {
-    LOG_ERR("URI path too large");
-    return -E2BIG;
-  }
-
-  ret = send_coap_message(uri_path, json_payload, strlen(json_payload));
   if (ret < 0) {
     LOG_ERR("Failed to send telemetry: %d", ret);
     return ret;
   }
 
-  LOG_INF("Telemetry sent: temp=%.2f °C, humidity=%.2f %%, battery=%d %%",
-          current_data.temperature, current_data.humidity,
+  /* Printed as integers so that no floating point printf is needed. */
+  LOG_INF("Telemetry sent: %zu readings, temp=%d °C, humidity=%d %%, "
+          "battery=%d %%",
+          readings, (int)current_data.temperature, (int)current_data.humidity,
           current_data.battery_level);
 
+  /* A block-wise pack is reset once its upload is done; batch is already
+   * the other, empty one by now.
+   */
+  mg_batch_reset(batch);
+
   return 0;
 }
 
+static int send_telemetry(void) {
+  int64_t now = k_uptime_get();
+  int ret;
+
+  if (!IS_ENABLED(CONFIG_MG_TELEMETRY_FORMAT_SENML_CBOR)) {
+    return flush_telemetry();
+  }
+
+  ret = mg_batch_add(batch, &current_data, now);
+  if (ret == -ENOSPC) {
+    /* The pack is full: send it, then start the next one. */
+    ret = flush_telemetry();
+    if (ret < 0) {
+      LOG_WRN("Dropping reading, %zu queued", batch->count);
+      return ret;
+    }
+
+    ret = mg_batch_add(batch, &current_data, now);
+  }
+
+  if (ret < 0 || !mg_batch_due(batch, now)) {
+    return ret;
+  }
+
+  return flush_telemetry();
+}
+
 int main(void) {
   LOG_INF("Magistrala CoAP Client Starting");
 
@@ -268,9 +361,7 @@ int main(void) {
   initialize_wifi();
 
   /* Setup network management callback for DHCP events */
-  net_mgmt_init_event_callback(&mgmt_cb, net_mgmt_event_handler,
-                               NET_EVENT_IPV4_DHCP_BOUND);
-  net_mgmt_add_event_callback(&mgmt_cb);
+  mg_net_if_init();
 
   /* Get STA interface in AP-STA mode. */
   sta_iface = net_if_get_wifi_sta();
@@ -282,13 +373,18 @@ int main(void) {
   }
 
   /* Wait for IP address via DHCP */
-  ret = wait_for_ip_address();
+  ret = mg_wait_for_ip_address(sta_iface);
   if (ret < 0) {
     LOG_ERR("Failed to get IP address: %d", ret);
     return ret;
   }
 
-  LOG_INF("Will send telemetry every %d seconds", TELEMETRY_INTERVAL_SEC);
+  LOG_INF("Will sample telemetry every %d seconds", TELEMETRY_INTERVAL_SEC);
+
+  for (size_t i = 0; i < ARRAY_SIZE(batches); i++) {
+    mg_batch_init(&batches[i], &batch_config, batch_storage[i],
+                  ARRAY_SIZE(batch_storage[i]));
+  }
 
   /* Initialize CoAP client */
   ret = coap_client_init();
@@ -299,10 +395,34 @@ int main(void) {
 
   LOG_INF("Starting telemetry transmission to Magistrala");
 
-  /* Send telemetry data */
-  ret = send_telemetry();
-  if (ret < 0) {
-    LOG_ERR("Failed to send telemetry: %d", ret);
+  /* Sample telemetry data, sending a pack whenever a batch is due, and
+   * sleep on the socket in between so responses and retransmissions are
+   * handled as they fall due.
+   */
+  struct pollfd pfd = {.fd = coap_sock, .events = POLLIN};
+  int64_t next_sample = k_uptime_get();
+
+  for (;;) {
+    int64_t now = k_uptime_get();
+    int64_t deadline;
+
+    if (now >= next_sample) {
+      ret = send_telemetry();
+      if (ret < 0) {
+        LOG_ERR("Failed to send telemetry: %d", ret);
+      }
+
+      next_sample += TELEMETRY_INTERVAL_SEC * MSEC_PER_SEC;
+    }
+
+    deadline = MIN(next_sample, mg_coap_client_next_deadline(&coap));
+    now = k_uptime_get();
+    (void)poll(&pfd, 1, deadline > now ? (int)(deadline - now) : 0);
+
+    ret = mg_coap_client_process(&coap);
+    if (ret < 0) {
+      LOG_ERR("CoAP client error: %d", ret);
+    }
   }
 
   return 0;
@@ -14,4 +14,21 @@
 #define CLIENT_SECRET "CLIENT_SECRET" // Replace with your Client secret
 #define CHANNEL_ID "CHANNEL_ID"       // Replace with your Channel ID
 
+/* A kept-alive connection idle this long is opened again rather than risk
+ * the server closing it as a POST goes out. Keep it below the server's
+ * keep-alive timeout and above the telemetry interval.
+ */
+#define HTTP_IDLE_TIMEOUT_MS 60000
+
+/* Readings that could not be sent are kept, up to HTTP_BACKLOG_LEN, and
+ * uploaded once the server is reachable again. A backlog of at least
+ * HTTP_STREAM_MIN readings goes as one chunked SenML-CBOR POST, in chunks
+ * of HTTP_CHUNK_LEN bytes; a smaller one as POSTs of one reading, up to
+ * HTTP_PIPELINE_DEPTH of them pipelined (1 waits for every response).
+ */
+#define HTTP_BACKLOG_LEN 256
+#define HTTP_STREAM_MIN 16
+#define HTTP_CHUNK_LEN 256
+#define HTTP_PIPELINE_DEPTH 4
+
 #endif
@@ -5,9 +5,18 @@
 #include <zephyr/net/wifi_mgmt.h>
 
 #include "config.h"
+#include "mg_batch.h"
+#include "mg_http_conn.h"
+#include "mg_http_stream.h"
+#include "mg_net.h"
+#include "mg_net_if.h"
+#include "mg_senml.h"
+#include "mg_telemetry.h"
+#include "mg_topic.h"
 #include "wifi.h"
 #include <zephyr/net/net_if.h>
 #include <zephyr/net/net_ip.h>
+#include <zephyr/net/http/client.h>
 #include <zephyr/net/net_mgmt.h>
 #include <zephyr/net/socket.h>
 #include <zephyr/net/tls_credentials.h>
@@ -20,122 +29,137 @@ static struct net_if *sta_iface;
 
 #define TELEMETRY_INTERVAL_SEC 30
 
-typedef struct {
-  double temperature;
-  double humidity;
-  int battery_level;
-  bool led_state;
-} sensor_data_t;
-
 static sensor_data_t current_data = {.temperature = 23.5,
                                      .humidity = 65.0,
                                      .battery_level = 85,
                                      .led_state = false};
 
-static struct net_mgmt_event_callback mgmt_cb;
-static K_SEM_DEFINE(dhcp_sem, 0, 1);
-
 #define MAX_RECV_BUF_LEN 512
 
 static uint8_t recv_buf_ipv4[MAX_RECV_BUF_LEN];
 static uint8_t recv_buf_ipv6[MAX_RECV_BUF_LEN];
 
-static void net_mgmt_event_handler(struct net_mgmt_event_callback *cb,
-                                   uint32_t mgmt_event, struct net_if *iface) {
-  if (mgmt_event == NET_EVENT_IPV4_DHCP_BOUND) {
-    LOG_INF("DHCP bound - got IP address");
-    k_sem_give(&dhcp_sem);
-  }
-}
-
-static int wait_for_ip_address(struct net_if *iface) {
-  struct net_if_addr *if_addr;
-  const int max_timeout = 30; // 30 seconds max wait
-
-  if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-  if (if_addr) {
-    char addr_str[NET_IPV4_ADDR_LEN];
-    net_addr_ntop(AF_INET, &if_addr->address.in_addr, addr_str,
-                  sizeof(addr_str));
-    LOG_INF("Already have IP address: %s", addr_str);
-    return 0;
+/* A one-reading SenML pack, which takes about 160 bytes as JSON. */
+#define MAX_PAYLOAD_LEN 192
+
+#if defined(CONFIG_MG_TELEMETRY_FORMAT_SENML_CBOR)
+#define TELEMETRY_CONTENT_TYPE MG_SENML_CBOR_CONTENT_TYPE
+#else
+#define TELEMETRY_CONTENT_TYPE MG_SENML_JSON_CONTENT_TYPE
+#endif
+
+static uint8_t payload_buf[MAX_PAYLOAD_LEN];
+
+/* A pipelined POST: the head and a one-reading body. */
+#define MAX_REQUEST_LEN 448
+
+static uint8_t request_buf[MAX_REQUEST_LEN];
+
+/* One connection is kept alive across POSTs and opened again only when the
+ * server closes it, so a POST costs one round trip instead of two.
+ */
+static struct mg_http_conn conn;
+
+/* Responses to pipelined POSTs are read with this, into recv_buf_ipv4. */
+static struct mg_http_reader reader;
+
+/* Set by response_cb once any of the response, and all of it, arrived,
+ * and the status it carries.
+ */
+static bool response_started;
+static bool response_done;
+static uint16_t response_status;
+
+/* Readings that could not be sent, oldest first. When full, the oldest is
+ * dropped.
+ */
+static struct mg_batch_sample backlog[HTTP_BACKLOG_LEN];
+static size_t backlog_head;
+static size_t backlog_count;
+static uint32_t backlog_dropped;
+
+/* The backlog upload in progress: the next reading to stream and the body
+ * encoder. Only HTTP_CHUNK_LEN bytes of it are held at a time.
+ */
+static size_t stream_next;
+static struct mg_http_senml_body stream_body;
+static uint8_t chunk_buf[MG_HTTP_CHUNK_HEAD + HTTP_CHUNK_LEN +
+                         MG_HTTP_CHUNK_TAIL];
+
+static void backlog_push(const sensor_data_t *data, int64_t timestamp) {
+  struct mg_batch_sample *sample;
+
+  if (backlog_count == HTTP_BACKLOG_LEN) {
+    backlog_head = (backlog_head + 1) % HTTP_BACKLOG_LEN;
+    backlog_count--;
+    backlog_dropped++;
   }
 
-  LOG_INF("Waiting for IP address via DHCP...");
+  sample = &backlog[(backlog_head + backlog_count) % HTTP_BACKLOG_LEN];
+  sample->data = *data;
+  sample->timestamp = timestamp;
+  backlog_count++;
+}
 
-  int ret = k_sem_take(&dhcp_sem, K_SECONDS(max_timeout));
-  if (ret != 0) {
-    LOG_ERR("Timeout waiting for DHCP - checking if we have IP anyway");
+static const struct mg_batch_sample *backlog_at(size_t i) {
+  return &backlog[(backlog_head + i) % HTTP_BACKLOG_LEN];
+}
 
-    if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-    if (!if_addr) {
-      LOG_ERR("No IP address available");
-      return -ETIMEDOUT;
-    }
-  }
+static void backlog_pop(size_t count) {
+  backlog_head = (backlog_head + count) % HTTP_BACKLOG_LEN;
+  backlog_count -= count;
+}
 
-  if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-  if (if_addr) {
-    char addr_str[NET_IPV4_ADDR_LEN];
-    net_addr_ntop(AF_INET, &if_addr->address.in_addr, addr_str,
-                  sizeof(addr_str));
-    LOG_INF("Got IP address: %s", addr_str);
-    return 0;
+/* Drops reading @p i, moving the older ones up a place. */
+static void backlog_remove(size_t i) {
+  for (; i > 0; i--) {
+    backlog[(backlog_head + i) % HTTP_BACKLOG_LEN] =
+        backlog[(backlog_head + i - 1) % HTTP_BACKLOG_LEN];
   }
-
-  LOG_ERR("Still no valid IP address");
-  return -1;
+  backlog_pop(1);
 }
 
-static int setup_socket(sa_family_t family, const char *server, int port,
-                        int *sock, struct sockaddr *addr, socklen_t addr_len) {
-  const char *family_str = family == AF_INET ? "IPv4" : "IPv6";
-  int ret = 0;
+static int next_backlog_reading(sensor_data_t *data, int64_t *timestamp,
+                                void *user_data) {
+  const struct mg_batch_sample *sample;
 
-  memset(addr, 0, addr_len);
+  ARG_UNUSED(user_data);
 
-  if (family == AF_INET) {
-    net_sin(addr)->sin_family = AF_INET;
-    net_sin(addr)->sin_port = htons(port);
-    inet_pton(family, server, &net_sin(addr)->sin_addr);
-  } else {
-    net_sin6(addr)->sin6_family = AF_INET6;
-    net_sin6(addr)->sin6_port = htons(port);
-    inet_pton(family, server, &net_sin6(addr)->sin6_addr);
+  if (stream_next == backlog_count) {
+    return 0;
   }
 
-  *sock = socket(family, SOCK_STREAM, IPPROTO_TCP);
+  sample = backlog_at(stream_next++);
+  *data = sample->data;
+  *timestamp = sample->timestamp;
 
-  if (*sock < 0) {
-    LOG_ERR("Failed to create %s HTTP socket (%d)", family_str, -errno);
-  }
-
-  return ret;
+  return 1;
 }
 
+/* Streams the backlog as the chunked body of the request, encoding the
+ * readings as they go out. A request sent again starts over.
+ */
 static int payload_cb(int sock, struct http_request *req, void *user_data) {
-  const char *content[] = {"foobar", "chunked", "last"};
-  char tmp[64];
-  int i, pos = 0;
+  ARG_UNUSED(req);
+  ARG_UNUSED(user_data);
 
-  for (i = 0; i < ARRAY_SIZE(content); i++) {
-    pos += snprintk(tmp + pos, sizeof(tmp) - pos, "%x\r\n%s\r\n",
-                    (unsigned int)strlen(content[i]), content[i]);
-  }
-
-  pos += snprintk(tmp + pos, sizeof(tmp) - pos, "0\r\n\r\n");
-
-  (void)send(sock, tmp, pos, 0);
+  stream_next = 0;
+  mg_http_senml_body_init(&stream_body, next_backlog_reading, NULL,
+                          k_uptime_get());
 
-  return pos;
+  return mg_http_send_chunked(sock, mg_http_senml_body_produce, &stream_body,
+                              chunk_buf, sizeof(chunk_buf));
 }
 
 static int response_cb(struct http_response *rsp,
                        enum http_final_call final_data, void *user_data) {
+  response_started = true;
+  response_status = rsp->http_status_code;
   if (final_data == HTTP_DATA_MORE) {
     LOG_INF("Partial data received (%zd bytes)", rsp->data_len);
   } else if (final_data == HTTP_DATA_FINAL) {
     LOG_INF("All the data received (%zd bytes)", rsp->data_len);
+    response_done = true;
   }
 
   LOG_INF("Response to %s", (const char *)user_data);
@@ -144,104 +168,303 @@ static int response_cb(struct http_response *rsp,
   return 0;
 }
 
-static int connect_socket(sa_family_t family, const char *server, int port,
-                          int *sock, struct sockaddr *addr,
-                          socklen_t addr_len) {
+/* Whether the server asked for a POST to be sent again later, being
+ * overloaded (429) or failing (5xx). Any other final status settles the
+ * readings in it: accepted, or rejected for good.
+ */
+static bool retry_later(int status) {
+  return status == 429 || status >= 500;
+}
+
+/* Sends @p req on the kept-alive connection. Returns 0 once the whole
+ * response arrived, or -EAGAIN if it says to retry_later().
+ */
+static int send_request(struct http_request *req, void *user_data) {
+  int32_t timeout = 3 * MSEC_PER_SEC;
+  bool keep_alive;
+  int sock;
   int ret;
 
-  ret = setup_socket(family, server, port, sock, addr, addr_len);
-  if (ret < 0 || *sock < 0) {
-    return -1;
-  }
+  do {
+    sock = mg_http_conn_acquire(&conn, k_uptime_get());
+    if (sock < 0) {
+      LOG_ERR("Cannot create HTTP connection.");
+      return -ECONNABORTED;
+    }
+
+    /* The client sends the headers and the body apart. On a kept-alive
+     * connection, Nagle would hold the body until the server's delayed ACK.
+     */
+    if (!conn.reused) {
+      int one = 1;
+
+      (void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      mg_http_reader_reset(&reader);
+    }
+
+    response_started = false;
+    response_done = false;
+    ret = http_client_req(sock, req, timeout, user_data);
+    if (ret >= 0 && response_done) {
+      keep_alive = http_should_keep_alive(&req->internal.parser);
+      mg_http_conn_release(&conn, keep_alive, k_uptime_get());
+      return retry_later(response_status) ? -EAGAIN : 0;
+    } else if (ret >= 0) {
+      ret = -ECONNRESET;
+    }
+
+    /* Nothing came back. If the server closed the kept-alive connection
+     * as the POST went out, it was not taken: send it once more on a new
+     * connection.
+     */
+  } while (!response_started && ret != -ETIMEDOUT &&
+           mg_http_conn_failed(&conn));
+
+  mg_http_conn_close(&conn);
+
+  return ret;
+}
 
-  ret = connect(*sock, addr, addr_len);
+static void init_post(struct http_request *req, const char **headers) {
+  memset(req, 0, sizeof(*req));
+  req->method = HTTP_POST;
+  req->url = "/" MG_TOPIC(DOMAIN_ID, CHANNEL_ID);
+  req->host = MAGISTRALA_IP;
+  req->protocol = "HTTP/1.1";
+  req->header_fields = headers;
+  req->response = response_cb;
+  req->recv_buf = recv_buf_ipv4;
+  req->recv_buf_len = sizeof(recv_buf_ipv4);
+}
+
+/* Uploads the whole backlog as one SenML-CBOR pack, whatever the telemetry
+ * format, since its records can be streamed without knowing their count.
+ */
+static int upload_backlog(void) {
+  static const char *headers[] = {
+      "Content-Type: " MG_SENML_CBOR_CONTENT_TYPE "\r\n",
+      "Authorization: Client " CLIENT_SECRET "\r\n",
+      "Transfer-Encoding: chunked\r\n", NULL};
+  struct http_request req;
+  int64_t start = k_uptime_get();
+  int ret;
+
+  init_post(&req, headers);
+  req.payload_cb = payload_cb;
+
+  ret = send_request(&req, "SenML backlog");
   if (ret < 0) {
-    LOG_ERR("Cannot connect to %s remote (%d)",
-            family == AF_INET ? "IPv4" : "IPv6", -errno);
-    close(*sock);
-    *sock = -1;
-    ret = -errno;
+    return ret;
   }
 
-  return ret;
+  LOG_INF("Uploaded %zu backlog readings in %lld ms", stream_body.count,
+          (long long)(k_uptime_get() - start));
+  backlog_pop(stream_body.count);
+
+  return 0;
 }
 
-static int run_queries(void) {
-  struct sockaddr_in addr4;
-  int sock4 = -1;
+/* Encodes a reading taken at @p timestamp as the SenML pack of
+ * TELEMETRY_CONTENT_TYPE, for sending at @p now.
+ */
+static int encode_reading(const sensor_data_t *data, int64_t timestamp,
+                          int64_t now, uint8_t *buf, size_t len) {
+  if (IS_ENABLED(CONFIG_MG_TELEMETRY_FORMAT_SENML_CBOR)) {
+    return mg_telemetry_senml_cbor_encode(data, timestamp, now, buf, len);
+  }
+
+  return mg_telemetry_senml_json_encode(data, timestamp, now, (char *)buf,
+                                        len);
+}
+
+/* Formats the POST of backlog reading @p i into request_buf. */
+static int format_request(size_t i) {
+  const struct mg_batch_sample *sample = backlog_at(i);
+  uint8_t *body = request_buf + MAX_REQUEST_LEN - MAX_PAYLOAD_LEN;
+  int head, len;
+
+  len = encode_reading(&sample->data, sample->timestamp, k_uptime_get(), body,
+                       MAX_PAYLOAD_LEN);
+  if (len < 0) {
+    return len;
+  }
+
+  head = snprintk((char *)request_buf, MAX_REQUEST_LEN - MAX_PAYLOAD_LEN,
+                  "POST /" MG_TOPIC(DOMAIN_ID, CHANNEL_ID) " HTTP/1.1\r\n"
+                  "Host: " MAGISTRALA_IP "\r\n"
+                  "Content-Type: " TELEMETRY_CONTENT_TYPE "\r\n"
+                  "Authorization: Client " CLIENT_SECRET "\r\n"
+                  "Content-Length: %d\r\n\r\n",
+                  len);
+  if (head < 0 || head >= MAX_REQUEST_LEN - MAX_PAYLOAD_LEN) {
+    return -E2BIG;
+  }
+
+  memmove(request_buf + head, body, len);
+
+  return head + len;
+}
+
+/* Sends up to HTTP_PIPELINE_DEPTH backlog readings as POSTs of their own,
+ * back to back, then reads their responses in order. A reading leaves the
+ * backlog once a response settled it; those the server asked to retry later
+ * and those behind a lost connection stay. A reading that cannot be encoded
+ * is dropped, and the POSTs sent before it still have their responses read.
+ */
+static int pipeline_backlog(void) {
   int32_t timeout = 3 * MSEC_PER_SEC;
+  size_t depth = MIN(backlog_count, HTTP_PIPELINE_DEPTH);
+  size_t sent = 0, answered = 0;
+  bool settled[HTTP_PIPELINE_DEPTH] = {false};
+  bool deferred = false;
+  bool keep_alive;
+  int sock = -1;
+  int status = 0;
   int ret = 0;
-  int port = MAGISTRALA_HTTP_PORT;
 
-  if (IS_ENABLED(CONFIG_NET_IPV4)) {
-    (void)connect_socket(AF_INET, MAGISTRALA_IP, port, &sock4,
-                         (struct sockaddr *)&addr4, sizeof(addr4));
+  /* recv_buf_ipv4 is shared with the client, and nothing is outstanding. */
+  mg_http_reader_reset(&reader);
+
+  while (sent < depth) {
+    int len = format_request(sent);
+
+    if (len < 0) {
+      LOG_ERR("Backlog reading too large");
+      backlog_remove(sent);
+      ret = len;
+      break;
+    }
+
+    sock = mg_http_conn_acquire(&conn, k_uptime_get());
+    if (sock < 0) {
+      ret = -ECONNABORTED;
+      break;
+    }
+    if (!conn.reused) {
+      int one = 1;
+
+      (void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      mg_http_reader_reset(&reader);
+    }
+
+    if (mg_net_send(sock, request_buf, len) < 0) {
+      ret = -EIO;
+      break;
+    }
+    sent++;
   }
 
-  if (sock4 < 0) {
-    LOG_ERR("Cannot create HTTP connection.");
-    return -ECONNABORTED;
+  while (answered < sent) {
+    status = mg_http_read_response(&reader, sock, timeout, &keep_alive);
+    if (status < 0) {
+      break;
+    }
+    if (retry_later(status)) {
+      LOG_WRN("Backlog reading deferred, server answered %d", status);
+      deferred = true;
+    } else {
+      if (status < 200 || status >= 300) {
+        LOG_WRN("Backlog reading rejected with %d", status);
+      }
+      settled[answered] = true;
+    }
+    answered++;
+    mg_http_conn_release(&conn, keep_alive, k_uptime_get());
+    if (conn.sock < 0) {
+      break;
+    }
   }
 
-  sock4 = -1;
-  if (IS_ENABLED(CONFIG_NET_IPV4)) {
-    (void)connect_socket(AF_INET, MAGISTRALA_IP, port, &sock4,
-                         (struct sockaddr *)&addr4, sizeof(addr4));
+  /* Requests left without a response, or whose send failed, go with the
+   * connection.
+   */
+  if (conn.pending > 0) {
+    mg_http_conn_close(&conn);
   }
 
-  if (sock4 < 0) {
-    LOG_ERR("Cannot create HTTP connection for SenML telemetry.");
-    return -ECONNABORTED;
+  /* Newest first, so the older readings keep their indices. */
+  for (size_t i = answered; i > 0; i--) {
+    if (settled[i - 1]) {
+      backlog_remove(i - 1);
+    }
   }
 
-  if (sock4 >= 0 && IS_ENABLED(CONFIG_NET_IPV4)) {
-    struct http_request req;
-
-    const char *senml_payload = "[{\"bn\":\"some-base-name:\",\"bt\":1."
-                                "276020076001e+09,\"bu\":\"A\",\"bver\":5,"
-                                "\"n\":\"voltage\",\"u\":\"V\",\"v\":120.1},"
-                                "{\"n\":\"current\",\"t\":-5,\"v\":1.2},"
-                                "{\"n\":\"current\",\"t\":-4,\"v\":1.3}]";
-
-    char auth_header[128];
-    snprintf(auth_header, sizeof(auth_header), "Authorization: Client %s\r\n",
-             CLIENT_SECRET);
-
-    const char *headers[] = {"Content-Type: application/senml+json\r\n",
-                             auth_header, NULL};
-
-    // Prepare URL m/domain/c/channel
-    char url[256];
-    snprintf(url, sizeof(url), "/m/%s/c/%s", DOMAIN_ID, CHANNEL_ID);
-
-    memset(&req, 0, sizeof(req));
-    req.method = HTTP_POST;
-    req.url = url;
-    req.host = MAGISTRALA_IP;
-    req.protocol = "HTTP/1.1";
-    req.payload = senml_payload;
-    req.payload_len = strlen(senml_payload);
-    req.header_fields = headers;
-    req.response = response_cb;
-    req.recv_buf = recv_buf_ipv4;
-    req.recv_buf_len = sizeof(recv_buf_ipv4);
-
-    ret = http_client_req(sock4, &req, timeout, "SenML POST");
-
-    close(sock4);
+  if (ret < 0) {
+    return ret;
+  }
+  if (deferred) {
+    return -EAGAIN;
+  }
+
+  return answered == depth ? 0 : (status < 0 ? status : -ECONNRESET);
+}
+
+static int run_queries(void) {
+  static const char *headers[] = {
+      "Content-Type: " TELEMETRY_CONTENT_TYPE "\r\n",
+      "Authorization: Client " CLIENT_SECRET "\r\n", NULL};
+  int64_t now = k_uptime_get();
+  struct http_request req;
+  int ret;
+
+  if (!IS_ENABLED(CONFIG_NET_IPV4)) {
+    return -EAFNOSUPPORT;
+  }
+
+  /* The same encoding as the backlog, so a reading queued after a failed
+   * POST is the one that POST carried.
+   */
+  ret = encode_reading(&current_data, now, now, payload_buf,
+                       sizeof(payload_buf));
+  if (ret < 0) {
+    LOG_ERR("Telemetry payload too large");
+    return ret;
   }
 
+  init_post(&req, headers);
+  req.payload = (const char *)payload_buf;
+  req.payload_len = ret;
+
+  ret = send_request(&req, "SenML POST");
+  if (ret < 0) {
+    LOG_ERR("SenML POST failed: %d", ret);
+    backlog_push(&current_data, now);
+    LOG_INF("%zu readings in the backlog, %u dropped", backlog_count,
+            backlog_dropped);
+    return ret;
+  }
+
+  /* The server is reachable: catch up on what it missed. */
+  if (backlog_count >= HTTP_STREAM_MIN) {
+    ret = upload_backlog();
+  } else if (backlog_count > 0) {
+    ret = pipeline_backlog();
+  }
+  if (ret < 0) {
+    LOG_WRN("Backlog upload failed: %d, %zu readings left", ret,
+            backlog_count);
+  }
+
+  LOG_INF("%u connections, %u POSTs on an open connection",
+          conn.stats.connects, conn.stats.reuses);
+
   return ret;
 }
 
 static int start_app(void) {
   int r = 0;
 
+  mg_http_conn_init(&conn, MAGISTRALA_IP, MAGISTRALA_HTTP_PORT,
+                    HTTP_IDLE_TIMEOUT_MS);
+  mg_http_reader_init(&reader, recv_buf_ipv4, sizeof(recv_buf_ipv4));
+
   for (int i = 0; i < 10; i++) {
     r = run_queries();
     k_sleep(K_SECONDS(TELEMETRY_INTERVAL_SEC));
   }
 
+  mg_http_conn_close(&conn);
+
   return r;
 }
 
@@ -254,9 +477,8 @@ int main(void) {
 
   initialize_wifi();
 
-  net_mgmt_init_event_callback(&mgmt_cb, net_mgmt_event_handler,
-                               NET_EVENT_IPV4_DHCP_BOUND);
-  net_mgmt_add_event_callback(&mgmt_cb);
+  /* Setup network management callback for DHCP events */
+  mg_net_if_init();
 
   sta_iface = net_if_get_wifi_sta();
   if (sta_iface == NULL) {
@@ -270,7 +492,7 @@ int main(void) {
     return ret;
   }
 
-  ret = wait_for_ip_address(sta_iface);
+  ret = mg_wait_for_ip_address(sta_iface);
   if (ret < 0) {
     LOG_ERR("Failed to get IP address: %d", ret);
     return ret;
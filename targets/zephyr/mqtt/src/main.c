@@ -2,6 +2,11 @@
 #include <string.h>
 
 #include "config.h"
+#include "mg_inflight.h"
+#include "mg_net_if.h"
+#include "mg_reactor.h"
+#include "mg_store.h"
+#include "mg_topic.h"
 #include "wifi.h"
 #include <zephyr/app_memory/app_memdomain.h>
 #include <zephyr/kernel.h>
@@ -10,7 +15,6 @@
 #include <zephyr/net/net_event.h>
 #include <zephyr/net/socket.h>
 #include <zephyr/net/wifi_mgmt.h>
-#include <zephyr/random/random.h>
 
 #include <zephyr/net/net_if.h>
 #include <zephyr/net/net_ip.h>
@@ -27,13 +31,14 @@ K_APPMEM_PARTITION_DEFINE(app_partition);
 #define APP_CONNECT_TRIES 3
 #define APP_CONNECT_TIMEOUT_MS 1000
 #define APP_SLEEP_MSECS 1000
+#define APP_RETRY_MSECS 5000
+#define APP_PUBLISH_RETRIES 3
+#define APP_MAX_PAYLOAD 128
 #define TELEMETRY_INTERVAL_SEC 30
+#define TELEMETRY_INTERVAL_MS (TELEMETRY_INTERVAL_SEC * MSEC_PER_SEC)
 
 LOG_MODULE_REGISTER(mqtt_client, LOG_LEVEL_DBG);
 
-static struct net_mgmt_event_callback mgmt_cb;
-static K_SEM_DEFINE(dhcp_sem, 0, 1);
-
 static struct net_if *sta_iface;
 
 static APP_BMEM uint8_t rx_buffer[APP_MQTT_BUFFER_SIZE];
@@ -43,35 +48,24 @@ static APP_BMEM struct mqtt_client client_ctx;
 
 static APP_BMEM struct sockaddr_storage broker_addr;
 
-static APP_BMEM struct zsock_pollfd fds[1];
-static APP_BMEM int nfds;
+static APP_BMEM struct mg_reactor reactor;
 
 static APP_BMEM bool connected;
 
-char mqttTopic[150];
-
-static void prepare_fds(struct mqtt_client *client) {
-  if (client->transport.type == MQTT_TRANSPORT_NON_SECURE) {
-    fds[0].fd = client->transport.tcp.sock;
-  }
-  fds[0].events = ZSOCK_POLLIN;
-  nfds = 1;
-}
+/* QoS 1/2 publishes awaiting acknowledgement, each with a copy of its
+ * payload for retransmission. The window also hands out the message IDs.
+ */
+static APP_BMEM struct mg_inflight inflight;
+static APP_BMEM struct mg_inflight_msg
+    inflight_msgs[CONFIG_NET_SAMPLE_APP_MAX_INFLIGHT];
+static APP_BMEM uint8_t
+    inflight_payloads[CONFIG_NET_SAMPLE_APP_MAX_INFLIGHT][APP_MAX_PAYLOAD];
 
-static void clear_fds(void) { nfds = 0; }
+/* m/{domain_id}/c/{channel_id}, fixed at build time. */
+#define MQTT_TOPIC MG_TOPIC(DOMAIN_ID, CHANNEL_ID)
 
-static int wait(int timeout) {
-  int ret = 0;
-
-  if (nfds > 0) {
-    ret = zsock_poll(fds, nfds, timeout);
-    if (ret < 0) {
-      LOG_ERR("poll error: %d", errno);
-    }
-  }
-
-  return ret;
-}
+static const struct mqtt_utf8 mqtt_topic = {
+    .utf8 = (const uint8_t *)MQTT_TOPIC, .size = MG_STRLEN(MQTT_TOPIC)};
 
 void mqtt_evt_handler(struct mqtt_client *const client,
                       const struct mqtt_evt *evt) {
@@ -93,7 +87,7 @@ void mqtt_evt_handler(struct mqtt_client *const client,
     LOG_INF("MQTT client disconnected %d", evt->result);
 
     connected = false;
-    clear_fds();
+    mg_reactor_detach(&reactor);
 
     break;
 
@@ -103,7 +97,15 @@ void mqtt_evt_handler(struct mqtt_client *const client,
       break;
     }
 
-    LOG_INF("PUBACK packet id: %u", evt->param.puback.message_id);
+    if (mg_inflight_ack(&inflight, MG_INFLIGHT_PUBACK,
+                        evt->param.puback.message_id,
+                        k_uptime_get()) == NULL) {
+      LOG_WRN("PUBACK for unknown packet id: %u",
+              evt->param.puback.message_id);
+      break;
+    }
+
+    LOG_DBG("PUBACK packet id: %u", evt->param.puback.message_id);
 
     break;
 
@@ -113,7 +115,15 @@ void mqtt_evt_handler(struct mqtt_client *const client,
       break;
     }
 
-    LOG_INF("PUBREC packet id: %u", evt->param.pubrec.message_id);
+    if (mg_inflight_ack(&inflight, MG_INFLIGHT_PUBREC,
+                        evt->param.pubrec.message_id,
+                        k_uptime_get()) == NULL) {
+      LOG_WRN("PUBREC for unknown packet id: %u",
+              evt->param.pubrec.message_id);
+      break;
+    }
+
+    LOG_DBG("PUBREC packet id: %u", evt->param.pubrec.message_id);
 
     const struct mqtt_pubrel_param rel_param = {
         .message_id = evt->param.pubrec.message_id};
@@ -131,7 +141,15 @@ void mqtt_evt_handler(struct mqtt_client *const client,
       break;
     }
 
-    LOG_INF("PUBCOMP packet id: %u", evt->param.pubcomp.message_id);
+    if (mg_inflight_ack(&inflight, MG_INFLIGHT_PUBCOMP,
+                        evt->param.pubcomp.message_id,
+                        k_uptime_get()) == NULL) {
+      LOG_WRN("PUBCOMP for unknown packet id: %u",
+              evt->param.pubcomp.message_id);
+      break;
+    }
+
+    LOG_DBG("PUBCOMP packet id: %u", evt->param.pubcomp.message_id);
 
     break;
 
@@ -144,43 +162,208 @@ void mqtt_evt_handler(struct mqtt_client *const client,
   }
 }
 
-static char *get_mqtt_payload(enum mqtt_qos qos) {
-  static APP_DMEM char payload[] = "{'message':'hello'}";
+#define RC_STR(rc) ((rc) == 0 ? "OK" : "ERROR")
 
-  payload[strlen(payload) - 1] = '0' + qos;
-  return payload;
-}
+#define PRINT_RESULT(func, rc) LOG_INF("%s: %d <%s>", (func), rc, RC_STR(rc))
+
+static APP_DMEM char payload[] = "{'message':'hello'}";
 
-static char *get_mqtt_topic(void) {
-  // Construct URI path:
-  // m/{domain_id}/c/{channel_id}
-  const char *_preId = "m/";
-  const char *_postId = "/c/";
-  strcpy(mqttTopic, _preId);
-  strcat(mqttTopic, DOMAIN_ID);
-  strcat(mqttTopic, _postId);
-  strcat(mqttTopic, CHANNEL_ID);
-  return mqttTopic;
+static char *get_mqtt_payload(enum mqtt_qos qos) {
+  payload[MG_STRLEN(payload) - 1] = '0' + qos;
+  return payload;
 }
 
-static int publish(struct mqtt_client *client, enum mqtt_qos qos) {
+static int send_publish(struct mqtt_client *client, enum mqtt_qos qos,
+                        const uint8_t *data, size_t len, uint16_t message_id,
+                        bool dup) {
   struct mqtt_publish_param param;
 
   param.message.topic.qos = qos;
-  param.message.topic.topic.utf8 = (uint8_t *)get_mqtt_topic();
-  param.message.topic.topic.size = strlen(param.message.topic.topic.utf8);
-  param.message.payload.data = get_mqtt_payload(qos);
-  param.message.payload.len = strlen(param.message.payload.data);
-  param.message_id = sys_rand32_get();
-  param.dup_flag = 0U;
+  param.message.topic.topic = mqtt_topic;
+  /* mqtt_publish() does not modify the payload. */
+  param.message.payload.data = (uint8_t *)data;
+  param.message.payload.len = len;
+  param.message_id = message_id;
+  param.dup_flag = dup;
   param.retain_flag = 0U;
 
   return mqtt_publish(client, &param);
 }
 
-#define RC_STR(rc) ((rc) == 0 ? "OK" : "ERROR")
+/* Sends without waiting for the acknowledgement. QoS 1 and 2 messages take
+ * a window slot, -EAGAIN if there is none, and are acknowledged through
+ * mqtt_evt_handler().
+ */
+static int publish_payload(struct mqtt_client *client, enum mqtt_qos qos,
+                           const uint8_t *data, size_t len) {
+  struct mg_inflight_msg *msg;
+  uint8_t *buf;
+  int rc;
 
-#define PRINT_RESULT(func, rc) LOG_INF("%s: %d <%s>", (func), rc, RC_STR(rc))
+  if (qos == MQTT_QOS_0_AT_MOST_ONCE) {
+    return send_publish(client, qos, data, len, 0, false);
+  }
+
+  if (len > APP_MAX_PAYLOAD) {
+    return -EMSGSIZE;
+  }
+
+  msg = mg_inflight_add(&inflight, qos, k_uptime_get());
+  if (msg == NULL) {
+    return -EAGAIN;
+  }
+
+  buf = inflight_payloads[msg - inflight_msgs];
+  memcpy(buf, data, len);
+  msg->payload = buf;
+  msg->len = len;
+
+  rc = send_publish(client, qos, buf, len, msg->id, false);
+  if (rc != 0) {
+    mg_inflight_release(&inflight, msg);
+  }
+
+  return rc;
+}
+
+static int retransmit_expired(struct mqtt_client *client) {
+  struct mg_inflight_msg *msg;
+  int rc;
+
+  while ((msg = mg_inflight_expired(&inflight, k_uptime_get())) != NULL) {
+    if (msg->retries > APP_PUBLISH_RETRIES) {
+      LOG_ERR("No acknowledgement for packet id: %u", msg->id);
+      return -ETIMEDOUT;
+    }
+
+    LOG_WRN("Retransmitting packet id: %u", msg->id);
+
+    if (msg->state == MG_INFLIGHT_WAIT_PUBCOMP) {
+      const struct mqtt_pubrel_param rel_param = {.message_id = msg->id};
+
+      rc = mqtt_publish_qos2_release(client, &rel_param);
+    } else {
+      rc = send_publish(client,
+                        msg->state == MG_INFLIGHT_WAIT_PUBREC
+                            ? MQTT_QOS_2_EXACTLY_ONCE
+                            : MQTT_QOS_1_AT_LEAST_ONCE,
+                        msg->payload, msg->len, msg->id, true);
+    }
+
+    if (rc != 0) {
+      return rc;
+    }
+  }
+
+  return 0;
+}
+
+#if defined(CONFIG_MG_STORE)
+static uint8_t replay_buf[APP_MQTT_BUFFER_SIZE / 2];
+
+/* Queues the payload while offline, to be replayed after reconnecting. */
+static void store_payload(const void *data, size_t len) {
+  int rc = mg_store_append(data, len);
+
+  if (rc != 0) {
+    LOG_ERR("Failed to queue message: %d", rc);
+    return;
+  }
+
+  LOG_INF("Queued message, depth %u dropped %u", mg_store_stats.depth,
+          mg_store_stats.dropped);
+}
+
+static int publish_stored(const uint8_t *data, size_t len, void *user) {
+  return publish_payload(user, MQTT_QOS_1_AT_LEAST_ONCE, data, len);
+}
+
+static int64_t last_drain;
+
+/* When the next queued message may be replayed, if any is queued. */
+static int64_t drain_deadline(void) {
+  if (!connected || mg_store_stats.depth == 0 || mg_inflight_full(&inflight)) {
+    return MG_REACTOR_FOREVER;
+  }
+
+  return last_drain + DIV_ROUND_UP(MSEC_PER_SEC, CONFIG_MG_STORE_DRAIN_RATE);
+}
+
+/* Replays queued messages at CONFIG_MG_STORE_DRAIN_RATE per second, as far
+ * as the window has room for them.
+ */
+static int drain_store(struct mqtt_client *client) {
+  int64_t now = k_uptime_get();
+  size_t budget;
+  int rc;
+
+  if (!connected || mg_store_stats.depth == 0) {
+    last_drain = now;
+    return 0;
+  }
+
+  budget = MIN((size_t)(CONFIG_MG_STORE_DRAIN_RATE * (now - last_drain) / 1000),
+               mg_inflight_room(&inflight));
+  if (budget == 0) {
+    return 0;
+  }
+
+  last_drain = now;
+
+  rc = mg_store_drain(publish_stored, client, replay_buf, sizeof(replay_buf),
+                      budget);
+  if (rc < 0) {
+    PRINT_RESULT("mg_store_drain", rc);
+    return rc;
+  }
+
+  return 0;
+}
+#else
+static void store_payload(const void *data, size_t len) {
+  ARG_UNUSED(data);
+  ARG_UNUSED(len);
+}
+
+static int64_t drain_deadline(void) { return MG_REACTOR_FOREVER; }
+
+static int drain_store(struct mqtt_client *client) {
+  ARG_UNUSED(client);
+  return 0;
+}
+#endif
+
+/* Queues the QoS 1/2 messages the broker has not taken responsibility for,
+ * as the clean session drops them with the connection.
+ */
+static void requeue_inflight(void) {
+  for (size_t i = 0; i < ARRAY_SIZE(inflight_msgs); i++) {
+    struct mg_inflight_msg *msg = &inflight_msgs[i];
+
+    if (msg->state == MG_INFLIGHT_WAIT_PUBACK ||
+        msg->state == MG_INFLIGHT_WAIT_PUBREC) {
+      store_payload(msg->payload, msg->len);
+    }
+  }
+
+  mg_inflight_reset(&inflight);
+}
+
+static int publish(struct mqtt_client *client, enum mqtt_qos qos) {
+  char *data = get_mqtt_payload(qos);
+  int rc = -ENOTCONN;
+
+  if (connected) {
+    rc = publish_payload(client, qos, (const uint8_t *)data,
+                         MG_STRLEN(payload));
+  }
+
+  if (rc != 0) {
+    store_payload(data, MG_STRLEN(payload));
+  }
+
+  return rc;
+}
 
 static void broker_init(void) {
   struct sockaddr_in *broker4 = (struct sockaddr_in *)&broker_addr;
@@ -198,16 +381,12 @@ static void client_init(struct mqtt_client *client) {
   /* MQTT client configuration */
   client->broker = &broker_addr;
   client->evt_cb = mqtt_evt_handler;
-  client->client_id.utf8 = (uint8_t *)MQTT_CLIENTID;
-  client->client_id.size = strlen(MQTT_CLIENTID);
+  client->client_id = MQTT_UTF8_LITERAL(MQTT_CLIENTID);
 
-  static struct mqtt_utf8 password_utf8;
-  static struct mqtt_utf8 user_name_utf8;
-
-  password_utf8.utf8 = (uint8_t *)CLIENT_SECRET;
-  password_utf8.size = strlen(CLIENT_SECRET);
-  user_name_utf8.utf8 = (uint8_t *)CLIENT_ID;
-  user_name_utf8.size = strlen(CLIENT_ID);
+  static struct mqtt_utf8 password_utf8 = {
+      .utf8 = (const uint8_t *)CLIENT_SECRET, .size = MG_STRLEN(CLIENT_SECRET)};
+  static struct mqtt_utf8 user_name_utf8 = {
+      .utf8 = (const uint8_t *)CLIENT_ID, .size = MG_STRLEN(CLIENT_ID)};
 
   client->password = &password_utf8;
   client->user_name = &user_name_utf8;
@@ -235,11 +414,10 @@ static int try_to_connect(struct mqtt_client *client) {
       continue;
     }
 
-    prepare_fds(client);
+    mg_reactor_attach(&reactor, client);
 
-    if (wait(APP_CONNECT_TIMEOUT_MS)) {
-      mqtt_input(client);
-    }
+    /* Returns once the CONNACK is in, or at the timeout. */
+    (void)mg_reactor_run(&reactor, k_uptime_get() + APP_CONNECT_TIMEOUT_MS);
 
     if (!connected) {
       mqtt_abort(client);
@@ -253,38 +431,63 @@ static int try_to_connect(struct mqtt_client *client) {
   return -EINVAL;
 }
 
-static int process_mqtt_and_sleep(struct mqtt_client *client, int timeout) {
-  int64_t remaining = timeout;
-  int64_t start_time = k_uptime_get();
+/* Sleeps until there is input, a keepalive ping, a retransmission or a
+ * queued message due, or uptime reaches @p deadline (MG_REACTOR_FOREVER:
+ * no deadline of its own), and handles whatever woke it up.
+ */
+static int process_mqtt(struct mqtt_client *client, int64_t deadline) {
   int rc;
 
-  while (remaining > 0 && connected) {
-    if (wait(remaining)) {
-      rc = mqtt_input(client);
-      if (rc != 0) {
-        PRINT_RESULT("mqtt_input", rc);
-        return rc;
-      }
-    }
+  deadline = MIN(deadline, MIN(mg_inflight_next_deadline(&inflight),
+                               drain_deadline()));
 
-    rc = mqtt_live(client);
-    if (rc != 0 && rc != -EAGAIN) {
-      PRINT_RESULT("mqtt_live", rc);
+  rc = mg_reactor_run(&reactor, deadline);
+  if (rc < 0) {
+    PRINT_RESULT("mg_reactor_run", rc);
+    return rc;
+  }
+
+  rc = retransmit_expired(client);
+  if (rc != 0) {
+    return rc;
+  }
+
+  return drain_store(client);
+}
+
+/* Processes input until the window has room for a @p qos message. */
+static int wait_for_window(struct mqtt_client *client, enum mqtt_qos qos) {
+  int rc;
+
+  while (qos != MQTT_QOS_0_AT_MOST_ONCE && mg_inflight_full(&inflight)) {
+    rc = process_mqtt(client, MG_REACTOR_FOREVER);
+    if (rc != 0) {
       return rc;
-    } else if (rc == 0) {
-      rc = mqtt_input(client);
-      if (rc != 0) {
-        PRINT_RESULT("mqtt_input", rc);
-        return rc;
-      }
     }
 
-    remaining = timeout + start_time - k_uptime_get();
+    if (!connected) {
+      return -ENOTCONN;
+    }
   }
 
   return 0;
 }
 
+/* Publishes a sample at every QoS level, waiting for room in the window. */
+static int publish_sample(struct mqtt_client *client) {
+  int rc = 0;
+
+  for (enum mqtt_qos qos = MQTT_QOS_0_AT_MOST_ONCE;
+       qos <= MQTT_QOS_2_EXACTLY_ONCE && rc == 0; qos++) {
+    rc = wait_for_window(client, qos);
+    if (rc == 0) {
+      rc = publish(client, qos);
+    }
+  }
+
+  return rc;
+}
+
 int success_or_exit(int rc) {
   if (rc != 0) {
     return 1;
@@ -300,6 +503,7 @@ void success_or_break(int rc) {
 }
 
 static int publisher(void) {
+  int64_t next_sample;
   int i, rc, r = 0;
 
   LOG_INF("attempting to connect: ");
@@ -307,41 +511,50 @@ static int publisher(void) {
   PRINT_RESULT("try_to_connect", rc);
   SUCCESS_OR_EXIT(rc);
 
+  mg_inflight_init(&inflight, inflight_msgs, ARRAY_SIZE(inflight_msgs),
+                   APP_RETRY_MSECS);
+
+  /* A sample is published every TELEMETRY_INTERVAL_SEC. In between, the
+   * reactor sleeps until there is input, a keepalive ping, a retransmission
+   * or the next sample due. Publishing only stops for a full window, not
+   * for every round trip.
+   */
   i = 0;
-  while (i++ < CONFIG_NET_SAMPLE_APP_MAX_ITERATIONS && connected) {
+  rc = 0;
+  next_sample = k_uptime_get();
+  while (i < CONFIG_NET_SAMPLE_APP_MAX_ITERATIONS && connected) {
     r = -1;
 
-    rc = mqtt_ping(&client_ctx);
-    PRINT_RESULT("mqtt_ping", rc);
-    SUCCESS_OR_BREAK(rc);
-
-    rc = process_mqtt_and_sleep(&client_ctx, APP_SLEEP_MSECS);
-    SUCCESS_OR_BREAK(rc);
-
-    rc = publish(&client_ctx, MQTT_QOS_0_AT_MOST_ONCE);
-    PRINT_RESULT("mqtt_publish", rc);
-    SUCCESS_OR_BREAK(rc);
-
-    rc = process_mqtt_and_sleep(&client_ctx, APP_SLEEP_MSECS);
-    SUCCESS_OR_BREAK(rc);
-
-    rc = publish(&client_ctx, MQTT_QOS_1_AT_LEAST_ONCE);
-    PRINT_RESULT("mqtt_publish", rc);
-    SUCCESS_OR_BREAK(rc);
-
-    rc = process_mqtt_and_sleep(&client_ctx, APP_SLEEP_MSECS);
-    SUCCESS_OR_BREAK(rc);
+    if (k_uptime_get() >= next_sample) {
+      i++;
+      rc = publish_sample(&client_ctx);
+      if (rc != 0) {
+        PRINT_RESULT("mqtt_publish", rc);
+        break;
+      }
 
-    rc = publish(&client_ctx, MQTT_QOS_2_EXACTLY_ONCE);
-    PRINT_RESULT("mqtt_publish", rc);
-    SUCCESS_OR_BREAK(rc);
+      /* Keeps the cadence, skipping samples missed on a full window. */
+      next_sample += TELEMETRY_INTERVAL_MS;
+      if (next_sample <= k_uptime_get()) {
+        next_sample = k_uptime_get() + TELEMETRY_INTERVAL_MS;
+      }
+    }
 
-    rc = process_mqtt_and_sleep(&client_ctx, APP_SLEEP_MSECS);
-    SUCCESS_OR_BREAK(rc);
+    rc = process_mqtt(&client_ctx, next_sample);
+    if (rc != 0) {
+      break;
+    }
 
     r = 0;
   }
 
+  /* Let the messages in flight complete before disconnecting. */
+  while (rc == 0 && connected && inflight.count > 0) {
+    rc = process_mqtt(&client_ctx, MG_REACTOR_FOREVER);
+  }
+
+  requeue_inflight();
+
   rc = mqtt_disconnect(&client_ctx, NULL);
   PRINT_RESULT("mqtt_disconnect", rc);
 
@@ -358,6 +571,8 @@ static int start_app(void) {
     r = publisher();
 
     if (!CONFIG_NET_SAMPLE_APP_MAX_CONNECTIONS) {
+      /* Sample between connection attempts too; queued, not lost. */
+      (void)publish(&client_ctx, MQTT_QOS_1_AT_LEAST_ONCE);
       k_sleep(K_MSEC(PROG_DELAY));
     }
   }
@@ -365,57 +580,6 @@ static int start_app(void) {
   return r;
 }
 
-static void net_mgmt_event_handler(struct net_mgmt_event_callback *cb,
-                                   uint64_t mgmt_event, struct net_if *iface) {
-  if (mgmt_event == NET_EVENT_IPV4_DHCP_BOUND) {
-    LOG_INF("DHCP bound - got IP address");
-    k_sem_give(&dhcp_sem);
-  }
-}
-
-static int wait_for_ip_address(struct net_if *iface) {
-  struct net_if_addr *if_addr = NULL;
-  const int max_timeout = 30; // 30 seconds max wait
-
-  /* Check if we already have an IP */
-  if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-  if (if_addr) {
-    char addr_str[NET_IPV4_ADDR_LEN];
-    net_addr_ntop(AF_INET, &if_addr->address.in_addr, addr_str,
-                  sizeof(addr_str));
-    LOG_INF("Already have IP address: %s", addr_str);
-    return 0;
-  }
-
-  LOG_INF("Waiting for IP address via DHCP...");
-
-  /* Wait for DHCP with timeout */
-  int ret = k_sem_take(&dhcp_sem, K_SECONDS(max_timeout));
-  if (ret != 0) {
-    LOG_ERR("Timeout waiting for DHCP - checking if we have IP anyway");
-
-    /* Final check if we somehow got an IP */
-    if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-    if (!if_addr) {
-      LOG_ERR("No IP address available");
-      return -ETIMEDOUT;
-    }
-  }
-
-  /* Verify we have a valid IP */
-  if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-  if (if_addr) {
-    char addr_str[NET_IPV4_ADDR_LEN];
-    net_addr_ntop(AF_INET, &if_addr->address.in_addr, addr_str,
-                  sizeof(addr_str));
-    LOG_INF("Got IP address: %s", addr_str);
-    return 0;
-  }
-
-  LOG_ERR("Still no valid IP address");
-  return -1;
-}
-
 int main(void) {
   LOG_INF("Magistrala MQTT Client Starting");
 
@@ -426,9 +590,7 @@ int main(void) {
   initialize_wifi();
 
   /* Setup network management callback for DHCP events */
-  net_mgmt_init_event_callback(&mgmt_cb, net_mgmt_event_handler,
-                               NET_EVENT_IPV4_DHCP_BOUND);
-  net_mgmt_add_event_callback(&mgmt_cb);
+  mg_net_if_init();
 
   /* Get STA interface in AP-STA mode. */
   sta_iface = net_if_get_wifi_sta();
@@ -444,12 +606,25 @@ int main(void) {
   }
 
   /* Wait for IP address via DHCP */
-  ret = wait_for_ip_address(sta_iface);
+  ret = mg_wait_for_ip_address(sta_iface);
   if (ret < 0) {
     LOG_ERR("Failed to get IP address: %d", ret);
     return ret;
   }
 
+  ret = mg_reactor_init(&reactor);
+  if (ret < 0) {
+    return ret;
+  }
+
+#if defined(CONFIG_MG_STORE)
+  ret = mg_store_init();
+  if (ret < 0) {
+    LOG_ERR("Failed to open store-and-forward queue: %d", ret);
+    return ret;
+  }
+#endif
+
   LOG_INF("Will send telemetry every %d seconds", TELEMETRY_INTERVAL_SEC);
 
   exit(start_app());
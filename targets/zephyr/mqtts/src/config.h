@@ -8,9 +8,10 @@
 #define MQTT_BUFFER_SIZE 256u
 #define APP_BUFFER_SIZE 4096u
 #define MAX_RETRIES 10u
+#define BACKOFF_FIRST_MS 1000u
 #define BACKOFF_EXP_BASE_MS 1000u
 #define BACKOFF_EXP_MAX_MS 60000u
-#define BACKOFF_CONST_MS 5000u
+#define BACKOFF_STABLE_MS 60000u
 #define KEEP_ALIVE 60
 #define TOPIC_BUFFER_SIZE 128
 
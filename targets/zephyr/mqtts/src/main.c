@@ -12,8 +12,14 @@
 #include <zephyr/posix/time.h>
 #include <zephyr/logging/log.h>
 #include <mbedtls/memory_buffer_alloc.h>
-
-#include "creds/creds.h"
+#include <mbedtls/ssl_ciphersuites.h>
+
+#include "creds_der.h"
+#include "mg_backoff.h"
+#include "mg_dns.h"
+#include "mg_reactor.h"
+#include "mg_store.h"
+#include "mg_topic.h"
 #include "dhcp.h"
 #include "config.h"
 
@@ -26,8 +32,14 @@ static uint8_t tx_buffer[MQTT_BUFFER_SIZE];
 static uint8_t buffer[APP_BUFFER_SIZE];
 static struct mqtt_client client_ctx;
 static uint32_t messages_received_counter;
-static bool do_publish;
-static bool do_subscribe;
+static struct mg_reactor reactor;
+static bool subscribed;
+/* Message topic, built once in client_setup() and reused by every publish. */
+static struct mqtt_utf8 mgTopicUtf8;
+
+/* Work posted to the reactor from the MQTT event callback. */
+#define EVENT_PUBLISH BIT(0)
+#define EVENT_SUBSCRIBE BIT(1)
 
 #define TLS_TAG_DEVICE_CERTIFICATE 1
 #define TLS_TAG_DEVICE_PRIVATE_KEY 1
@@ -38,6 +50,13 @@ static sec_tag_t sec_tls_tags[] = {
 	TLS_TAG_AWS_CA_CERTIFICATE,
 };
 
+#if defined(MG_TLS_PROFILE_SMALL)
+/* Only what the stripped mbedTLS configuration keeps (small_tls.conf). */
+static const int tls_ciphers[] = {
+	MG_TLS_CIPHERSUITES,
+};
+#endif
+
 static int setup_credentials(void)
 {
 	int ret;
@@ -74,8 +93,7 @@ static int subscribe_topic(void)
 {
 	int ret;
 	struct mqtt_topic topics[] = {{
-		.topic = {.utf8 = mgTopic,
-				  .size = strlen(mgTopic)},
+		.topic = mgTopicUtf8,
 		.qos = 0,
 	}};
 	const struct mqtt_subscription_list sub_list = {
@@ -199,7 +217,7 @@ static void mqtt_event_cb(struct mqtt_client *client, const struct mqtt_evt *evt
 	{
 	case MQTT_EVT_CONNACK:
 	{
-		do_subscribe = true;
+		mg_reactor_post(&reactor, EVENT_SUBSCRIBE);
 	}
 	break;
 
@@ -210,21 +228,27 @@ static void mqtt_event_cb(struct mqtt_client *client, const struct mqtt_evt *evt
 		handle_published_message(pub);
 		messages_received_counter++;
 #if !defined(CONFIG_AWS_TEST_SUITE_RECV_QOS1)
-		do_publish = true;
+		mg_reactor_post(&reactor, EVENT_PUBLISH);
 #endif
 	}
 	break;
 
 	case MQTT_EVT_SUBACK:
 	{
+		subscribed = true;
 #if !defined(CONFIG_AWS_TEST_SUITE_RECV_QOS1)
-		do_publish = true;
+		mg_reactor_post(&reactor, EVENT_PUBLISH);
 #endif
 	}
 	break;
 
-	case MQTT_EVT_PUBACK:
 	case MQTT_EVT_DISCONNECT:
+	{
+		mg_reactor_detach(&reactor);
+	}
+	break;
+
+	case MQTT_EVT_PUBACK:
 	case MQTT_EVT_PUBREC:
 	case MQTT_EVT_PUBREL:
 	case MQTT_EVT_PUBCOMP:
@@ -235,9 +259,18 @@ static void mqtt_event_cb(struct mqtt_client *client, const struct mqtt_evt *evt
 	}
 }
 
+static void format_mainflux_message_topic(void)
+{
+	int len = mg_legacy_topic_format(mgTopic, sizeof(mgTopic), mgChannelId);
+
+	mgTopicUtf8.utf8 = (uint8_t *)mgTopic;
+	mgTopicUtf8.size = len < 0 ? 0 : len;
+}
+
 static void client_setup(void)
 {
 	mqtt_client_init(&client_ctx);
+	format_mainflux_message_topic();
 
 	client_ctx.broker = &mgbroker;
 	client_ctx.evt_cb = mqtt_event_cb;
@@ -259,57 +292,116 @@ static void client_setup(void)
 	struct mqtt_sec_config *const tls_config = &client_ctx.transport.tls.config;
 
 	tls_config->peer_verify = TLS_PEER_VERIFY_REQUIRED;
+#if defined(MG_TLS_PROFILE_SMALL)
+	tls_config->cipher_list = tls_ciphers;
+	tls_config->cipher_count = ARRAY_SIZE(tls_ciphers);
+#else
 	tls_config->cipher_list = NULL;
+#endif
 	tls_config->sec_tag_list = sec_tls_tags;
 	tls_config->sec_tag_count = ARRAY_SIZE(sec_tls_tags);
 	tls_config->hostname = brokername;
-	tls_config->cert_nocopy = TLS_CERT_NOCOPY_NONE;
+	/* The DER credentials stay in flash, so the certificates are parsed
+	 * in place on every connect instead of being copied to the heap.
+	 */
+	tls_config->cert_nocopy = TLS_CERT_NOCOPY_OPTIONAL;
+	/* Resume the last session on reconnect: the TLS socket layer keeps it
+	 * per broker address, across client_loop() iterations.
+	 */
+	tls_config->session_cache = TLS_SESSION_CACHE_ENABLED;
 }
 
-struct backoff_context
-{
-	uint16_t retries_count;
-	uint16_t max_retries;
+static const struct mg_backoff_config backoff_config = {
+	.first_ms = BACKOFF_FIRST_MS,
+	.base_ms = BACKOFF_EXP_BASE_MS,
+	.max_ms = BACKOFF_EXP_MAX_MS,
+	.stable_ms = BACKOFF_STABLE_MS,
 };
 
-static void backoff_context_init(struct backoff_context *bo)
+/* Kept across client_loop() calls, so a connection that keeps dropping
+ * keeps backing off.
+ */
+static struct mg_backoff backoff;
+
+static int resolve_broker_addr(struct sockaddr_in *broker)
 {
-	__ASSERT_NO_MSG(bo != NULL);
+	char addr_str[INET_ADDRSTRLEN];
+	int ret;
 
-	bo->retries_count = 0u;
-	bo->max_retries = MAX_RETRIES;
-}
+	/* Served from the common DNS cache while it is fresh, and while the
+	 * DNS server is unreachable.
+	 */
+	ret = mg_dns_resolve(AF_INET, BROKER, SOCK_STREAM, (struct sockaddr *)broker,
+			     sizeof(*broker));
+	if (ret < 0)
+	{
+		LOG_ERR("failed to resolve hostname err = %d", ret);
+		return ret;
+	}
 
-static void backoff_get_next(struct backoff_context *bo, uint32_t *next_backoff_ms)
-{
-	__ASSERT_NO_MSG(bo != NULL);
-	__ASSERT_NO_MSG(next_backoff_ms != NULL);
-	*next_backoff_ms = BACKOFF_CONST_MS;
+	broker->sin_family = AF_INET;
+	broker->sin_port = htons(atoi(BROKER_PORT));
+
+	zsock_inet_ntop(AF_INET, &broker->sin_addr, addr_str, sizeof(addr_str));
+	LOG_INF("Resolved: %s:%u (%u of %u resolutions from cache)", addr_str,
+		ntohs(broker->sin_port), mg_dns_stats.hits, mg_dns_stats.resolutions);
+
+	return 0;
 }
 
 static int client_try_connect(void)
 {
 	int ret;
+	int64_t start;
 	uint32_t backoff_ms;
-	struct backoff_context bo;
-
-	backoff_context_init(&bo);
 
-	while (bo.retries_count <= bo.max_retries)
+	for (uint32_t retries = 0u;; retries++)
 	{
+		/* TCP and TLS handshakes plus CONNECT: a resumed session is the
+		 * difference between this and the first connect.
+		 */
+		start = k_uptime_get();
+#if defined(MBEDTLS_MEMORY_DEBUG)
+		mbedtls_memory_buffer_alloc_max_reset();
+#endif
 		ret = mqtt_connect(&client_ctx);
 		if (ret == 0)
 		{
-			goto exit;
+#if defined(MBEDTLS_MEMORY_DEBUG)
+			size_t heap_peak, heap_blocks;
+
+			/* Heap high-water of this connect alone, certificate parsing
+			 * included.
+			 */
+			mbedtls_memory_buffer_alloc_max_get(&heap_peak, &heap_blocks);
+			LOG_INF("Connected in %lld ms, mbedTLS heap peak %zu B in %zu blocks",
+				k_uptime_get() - start, heap_peak, heap_blocks);
+#else
+			LOG_INF("Connected in %lld ms", k_uptime_get() - start);
+#endif
+			mg_backoff_connected(&backoff, k_uptime_get());
+			break;
 		}
 
-		backoff_get_next(&bo, &backoff_ms);
+		/* The broker may have moved: look it up again for the retry. */
+		mg_dns_expire(BROKER);
+
+		if (retries == MAX_RETRIES)
+		{
+			/* main() sets the client up afresh and carries on. */
+			LOG_ERR("Failed to connect: %d, giving up after %u retries", ret, retries);
+			break;
+		}
+
+		backoff_ms = mg_backoff_next(&backoff);
 
 		LOG_ERR("Failed to connect: %d backoff delay: %u ms", ret, backoff_ms);
 		k_msleep(backoff_ms);
+
+		/* After the delay, so the lookup sees where the broker is now. */
+		resolve_broker_addr(&mgbroker);
 	}
 
-exit:
 	return ret;
 }
 
@@ -322,33 +414,68 @@ static const struct json_obj_descr json_descr[] = {
 	JSON_OBJ_DESCR_PRIM(struct publish_payload, counter, JSON_TOK_NUMBER),
 };
 
-static void format_mainflux_message_topic(void)
-{
-	const char *_preId = "channels/";
-	const char *_postId = "/messages";
-	strcpy(mgTopic, _preId);
-	strcat(mgTopic, mgChannelId);
-	strcat(mgTopic, _postId);
-}
-
 static int publish(void)
 {
 	struct publish_payload pl = {.counter = messages_received_counter};
+	int ret;
 
 	json_obj_encode_buf(json_descr, ARRAY_SIZE(json_descr), &pl, buffer, sizeof(buffer));
-	format_mainflux_message_topic();
 
-	return publish_message(mgTopic, strlen(mgTopic), buffer,
-						   strlen(buffer));
+	ret = publish_message(mgTopic, mgTopicUtf8.size, buffer,
+						  strlen(buffer));
+#if defined(CONFIG_MG_STORE)
+	if (ret != 0 && mg_store_append(buffer, strlen(buffer)) == 0)
+	{
+		LOG_INF("Queued message, depth %u dropped %u", mg_store_stats.depth,
+				mg_store_stats.dropped);
+	}
+#endif
+
+	return ret;
 }
 
+#if defined(CONFIG_MG_STORE)
+#define STORE_DRAIN_INTERVAL_MS 1000
+
+static int publish_stored(const uint8_t *data, size_t len, void *user)
+{
+	ARG_UNUSED(user);
+
+	/* mqtt_publish() does not modify the payload. */
+	return publish_message(mgTopic, mgTopicUtf8.size, (uint8_t *)data, len);
+}
+
+/* Replays CONFIG_MG_STORE_DRAIN_RATE queued messages once a second. Returns
+ * when the next round is due, for the reactor to wake up then.
+ */
+static int64_t drain_store(void)
+{
+	static int64_t next_drain;
+	int64_t now = k_uptime_get();
+
+	if (mg_store_stats.depth == 0)
+	{
+		return MG_REACTOR_FOREVER;
+	}
+
+	if (now >= next_drain)
+	{
+		next_drain = now + STORE_DRAIN_INTERVAL_MS;
+		(void)mg_store_drain(publish_stored, NULL, buffer, sizeof(buffer),
+							 CONFIG_MG_STORE_DRAIN_RATE);
+	}
+
+	return mg_store_stats.depth > 0 ? next_drain : MG_REACTOR_FOREVER;
+}
+#endif
+
 void client_loop(void)
 {
 	int rc;
-	int timeout;
-	struct zsock_pollfd fds;
+	int64_t deadline;
 
 	client_setup();
+	subscribed = false;
 
 	rc = client_try_connect();
 	if (rc != 0)
@@ -356,62 +483,50 @@ void client_loop(void)
 		goto cleanup;
 	}
 
-	fds.fd = client_ctx.transport.tcp.sock;
-	fds.events = ZSOCK_POLLIN;
+	mg_reactor_attach(&reactor, &client_ctx);
 
+	/* The reactor sleeps until there is input, a ping or a replay due, or
+	 * the event callback has posted a publish or subscribe.
+	 */
 	for (;;)
 	{
-		timeout = mqtt_keepalive_time_left(&client_ctx);
-		rc = zsock_poll(&fds, 1u, timeout);
-		if (rc >= 0)
+		deadline = MG_REACTOR_FOREVER;
+#if defined(CONFIG_MG_STORE)
+		/* Replay only once subscribed, like live publishes. */
+		if (subscribed)
 		{
-			if (fds.revents & ZSOCK_POLLIN)
-			{
-				rc = mqtt_input(&client_ctx);
-				if (rc != 0)
-				{
-					LOG_ERR("Failed to read MQTT input: %d", rc);
-					break;
-				}
-			}
-
-			if (fds.revents & (ZSOCK_POLLHUP | ZSOCK_POLLERR))
-			{
-				LOG_ERR("Socket closed/error");
-				break;
-			}
-
-			rc = mqtt_live(&client_ctx);
-			if ((rc != 0) && (rc != -EAGAIN))
-			{
-				LOG_ERR("Failed to live MQTT: %d", rc);
-				break;
-			}
+			deadline = drain_store();
 		}
-		else
+#endif
+		rc = mg_reactor_run(&reactor, deadline);
+		if (rc < 0)
 		{
-			LOG_ERR("poll failed: %d", rc);
+			LOG_ERR("MQTT connection failed: %d", rc);
 			break;
 		}
 
-		if (do_publish)
+		if (rc & EVENT_PUBLISH)
 		{
-			do_publish = false;
 			publish();
 		}
 
-		if (do_subscribe)
+		if (rc & EVENT_SUBSCRIBE)
 		{
-			do_subscribe = false;
 			subscribe_topic();
 		}
 	}
 
 cleanup:
-	mqtt_disconnect(&client_ctx);
+	/* A reply still owed is queued rather than lost with the connection. */
+	if (mg_reactor_take(&reactor) & EVENT_PUBLISH)
+	{
+		publish();
+	}
 
-	zsock_close(fds.fd);
-	fds.fd = -1;
+	/* Closes the socket too. */
+	mqtt_disconnect(&client_ctx);
+	mg_reactor_detach(&reactor);
+	mg_backoff_disconnected(&backoff, k_uptime_get());
 }
 
 int sntp_sync_time(void)
@@ -437,48 +552,35 @@ int sntp_sync_time(void)
 	return rc;
 }
 
-static int resolve_broker_addr(struct sockaddr_in *broker)
-{
-	int ret;
-	struct zsock_addrinfo *ai = NULL;
-
-	const struct zsock_addrinfo hints = {
-		.ai_family = AF_INET,
-		.ai_socktype = SOCK_STREAM,
-		.ai_protocol = 0,
-	};
-
-	ret = zsock_getaddrinfo(BROKER, BROKER_PORT, &hints, &ai);
-	if (ret == 0)
-	{
-		char addr_str[INET_ADDRSTRLEN];
-
-		memcpy(broker, ai->ai_addr, MIN(ai->ai_addrlen, sizeof(struct sockaddr_storage)));
-
-		zsock_inet_ntop(AF_INET, &broker->sin_addr, addr_str, sizeof(addr_str));
-		LOG_INF("Resolved: %s:%u", addr_str, htons(broker->sin_port));
-	}
-	else
-	{
-		LOG_ERR("failed to resolve hostname err = %d (errno = %d)", ret, errno);
-	}
-
-	zsock_freeaddrinfo(ai);
-
-	return ret;
-}
-
 int main(void)
 {
 	sntp_sync_time();
 	setup_credentials();
+	if (mg_reactor_init(&reactor) < 0)
+	{
+		return -1;
+	}
+#if defined(CONFIG_MG_STORE)
+	mg_store_init();
+#endif
+
+	mg_backoff_init(&backoff, &backoff_config);
 
 	for (;;)
 	{
+		uint32_t backoff_ms;
+
 		resolve_broker_addr(&mgbroker);
 
 		client_loop();
-		k_sleep(K_SECONDS(1));
+
+		/* Fast after a connection that lasted, longer after one that did
+		 * not.
+		 */
+		backoff_ms = mg_backoff_next(&backoff);
+		LOG_INF("Reconnecting in %u ms (%u retries, %u connects, %u resets)", backoff_ms,
+			backoff.stats.retries, backoff.stats.connects, backoff.stats.resets);
+		k_msleep(backoff_ms);
 	}
 
 	return 0;
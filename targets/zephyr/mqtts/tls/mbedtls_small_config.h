@@ -0,0 +1,10 @@
+#ifndef MBEDTLS_SMALL_CONFIG_H
+#define MBEDTLS_SMALL_CONFIG_H
+
+/* CONFIG_MBEDTLS_USER_CONFIG_FILE of small_tls.conf: session resumption as
+ * in the default build, plus the reduced-footprint profile.
+ */
+#include "mbedtls_user_config.h"
+#include "mg_tls_small.h"
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef MBEDTLS_USER_CONFIG_H
+#define MBEDTLS_USER_CONFIG_H
+
+/* Included at the end of the Zephyr mbedTLS configuration
+ * (CONFIG_MBEDTLS_USER_CONFIG_FILE).
+ *
+ * Session resumption: the socket layer caches the session of the last
+ * handshake (CONFIG_NET_SOCKETS_TLS_MAX_CLIENT_SESSION_COUNT) and offers it
+ * on the next connect. Brokers that issue session tickets resume from the
+ * ticket, others from the session ID; no certificates or key exchange are
+ * sent either way.
+ */
+#ifndef MBEDTLS_SSL_SESSION_TICKETS
+#define MBEDTLS_SSL_SESSION_TICKETS
+#endif
+
+/* With TLS 1.3 the ticket becomes a resumption PSK; keep (EC)DHE on top of
+ * it so the resumed session still has forward secrecy.
+ */
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+#ifndef MBEDTLS_SSL_TLS1_3_KEY_EXCHANGE_MODE_PSK_EPHEMERAL_ENABLED
+#define MBEDTLS_SSL_TLS1_3_KEY_EXCHANGE_MODE_PSK_EPHEMERAL_ENABLED
+#endif
+#endif
+
+#endif
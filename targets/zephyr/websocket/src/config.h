@@ -14,4 +14,23 @@
 #define CLIENT_SECRET "CLIENT_SECRET" // Replace with your Client secret
 #define CHANNEL_ID "CHANNEL_ID"       // Replace with your Channel ID
 
+/* Telemetry streaming: a ping goes out after WS_PING_INTERVAL_SEC without a
+ * frame from the server, which also keeps NAT mappings open, and the
+ * connection is opened again if nothing answers it within
+ * WS_PONG_TIMEOUT_SEC.
+ */
+#define WS_PING_INTERVAL_SEC 60
+#define WS_PONG_TIMEOUT_SEC 10
+
+/* Reconnect backoff with decorrelated jitter (mg_backoff.h). */
+#define BACKOFF_FIRST_MS 1000u
+#define BACKOFF_EXP_BASE_MS 1000u
+#define BACKOFF_EXP_MAX_MS 60000u
+#define BACKOFF_STABLE_MS 60000u
+
+/* 1 runs the lorem ipsum echo test against `websocketd --port=8186 cat`
+ * instead of streaming telemetry.
+ */
+#define WS_ECHO_TEST 0
+
 #endif
@@ -0,0 +1,266 @@
+#include <stdlib.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/misc/lorem_ipsum.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/net/websocket.h>
+#include <zephyr/random/random.h>
+
+#include "echo.h"
+#include "ws_rx.h"
+
+LOG_MODULE_DECLARE(websocket_client);
+
+/* How long an echo may take before the test gives up on it. */
+#define ECHO_TIMEOUT_MS (3 * MSEC_PER_SEC)
+
+/* Echo round trips are logged as percentiles over this many echoes. */
+#define ECHO_RTT_SAMPLES 64
+
+static const char lorem_ipsum[] = LOREM_IPSUM;
+
+#define MAX_RECV_BUF_LEN (sizeof(lorem_ipsum) - 1)
+
+static const int ipsum_len = MAX_RECV_BUF_LEN;
+
+static uint8_t recv_buf_ipv4[MAX_RECV_BUF_LEN];
+
+/* The TCP socket under the websocket, polled while waiting for an echo. */
+static int tcp_sock = -1;
+static struct ws_rx rx;
+
+/* Length of the echo ws_rx delivered, or -1 while it is awaited. */
+static int echo_len;
+
+static uint32_t rtt_us[ECHO_RTT_SAMPLES];
+static size_t rtt_count;
+/* Returns from zsock_poll() while waiting for the BSD API echoes. */
+static uint32_t bsd_wakeups;
+
+static size_t how_much_to_send(size_t max_len) {
+  size_t amount;
+
+  do {
+    amount = sys_rand32_get() % max_len;
+  } while (amount == 0U);
+
+  return amount;
+}
+
+static ssize_t sendall_with_ws_api(int sock, const void *buf, size_t len) {
+  return websocket_send_msg(sock, buf, len, WEBSOCKET_OPCODE_DATA_TEXT, true,
+                            true, SYS_FOREVER_MS);
+}
+
+static ssize_t sendall_with_bsd_api(int sock, const void *buf, size_t len) {
+  return send(sock, buf, len, 0);
+}
+
+/* Takes the messages ws_rx assembled: the echo, and pings to answer. */
+static int echo_cb(uint32_t type, const uint8_t *data, size_t len,
+                   void *user) {
+  int websock = (intptr_t)user;
+
+  if (type & WEBSOCKET_FLAG_CLOSE) {
+    return -ECONNRESET;
+  } else if (type & WEBSOCKET_FLAG_PING) {
+    return websocket_send_msg(websock, data, len, WEBSOCKET_OPCODE_PONG, true,
+                              true, SYS_FOREVER_MS) < 0
+               ? -EIO
+               : 0;
+  } else if (type & WEBSOCKET_FLAG_PONG) {
+    return 0;
+  }
+
+  echo_len = len;
+
+  return 0;
+}
+
+static void recv_data_wso_api(int sock, size_t amount, uint8_t *buf,
+                              size_t buf_len, const char *proto) {
+  int64_t deadline = k_uptime_get() + ECHO_TIMEOUT_MS;
+  int64_t left;
+  int ret = 0;
+
+  ARG_UNUSED(sock);
+  ARG_UNUSED(buf_len);
+
+  /* ws_rx assembles the echo in buf, piece by piece as it arrives. */
+  echo_len = -1;
+  while (echo_len < 0) {
+    left = deadline - k_uptime_get();
+    if (left <= 0) {
+      ret = -ETIMEDOUT;
+      break;
+    }
+
+    ret = ws_rx_poll(&rx, left);
+    if (ret < 0) {
+      break;
+    }
+  }
+
+  if (echo_len != (int)amount ||
+      /* Do not check the final \n at the end of the msg */
+      memcmp(lorem_ipsum, buf, amount - 1) != 0) {
+    LOG_ERR("%s data recv failure %zd/%d bytes (%d)", proto, amount,
+            echo_len, ret);
+    if (echo_len > 0) {
+      LOG_HEXDUMP_DBG(buf, echo_len, "received ws buf");
+      LOG_HEXDUMP_DBG(lorem_ipsum, echo_len, "sent ws buf");
+    }
+  } else {
+    LOG_DBG("%s recv %d bytes", proto, echo_len);
+  }
+}
+
+static void recv_data_bsd_api(int sock, size_t amount, uint8_t *buf,
+                              size_t buf_len, const char *proto) {
+  int64_t deadline = k_uptime_get() + ECHO_TIMEOUT_MS;
+  struct zsock_pollfd pfd = {.fd = tcp_sock, .events = ZSOCK_POLLIN};
+  int remaining;
+  int ret, read_pos;
+
+  remaining = amount;
+  read_pos = 0;
+
+  while (remaining > 0) {
+    ret = recv(sock, buf + read_pos, buf_len - read_pos, ZSOCK_MSG_DONTWAIT);
+    if (ret > 0) {
+      read_pos += ret;
+      remaining -= ret;
+      continue;
+    }
+
+    if (ret < 0 && (errno == EAGAIN || errno == ETIMEDOUT)) {
+      /* Nothing buffered: sleep until the next piece arrives. */
+      int64_t left = deadline - k_uptime_get();
+
+      if (left > 0 && zsock_poll(&pfd, 1, left) > 0 &&
+          !(pfd.revents & (ZSOCK_POLLERR | ZSOCK_POLLNVAL))) {
+        bsd_wakeups++;
+        continue;
+      }
+    }
+
+    LOG_DBG("%s connection closed while "
+            "waiting (%d/%d)",
+            proto, ret, errno);
+    break;
+  }
+
+  if (remaining != 0 ||
+      /* Do not check the final \n at the end of the msg */
+      memcmp(lorem_ipsum, buf, amount - 1) != 0) {
+    LOG_ERR("%s data recv failure %zd/%d bytes (remaining %d)", proto, amount,
+            read_pos, remaining);
+    LOG_HEXDUMP_DBG(buf, read_pos, "received bsd buf");
+    LOG_HEXDUMP_DBG(lorem_ipsum, read_pos, "sent bsd buf");
+  } else {
+    LOG_DBG("%s recv %d bytes", proto, read_pos);
+  }
+}
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Logs the round trip percentiles of the last ECHO_RTT_SAMPLES echoes and
+ * the wakeups they took.
+ */
+static void record_rtt(uint32_t us) {
+  static uint32_t last_wakeups;
+  uint32_t wakeups;
+
+  rtt_us[rtt_count++] = us;
+  if (rtt_count < ECHO_RTT_SAMPLES) {
+    return;
+  }
+
+  wakeups = rx.stats.wakeups + bsd_wakeups;
+  qsort(rtt_us, rtt_count, sizeof(rtt_us[0]), compare_u32);
+  LOG_INF("Echo RTT us: p50 %u p90 %u p99 %u max %u, %u wakeups/echo",
+          rtt_us[rtt_count / 2], rtt_us[rtt_count * 9 / 10],
+          rtt_us[rtt_count * 99 / 100], rtt_us[rtt_count - 1],
+          (wakeups - last_wakeups) / ECHO_RTT_SAMPLES);
+  last_wakeups = wakeups;
+  rtt_count = 0;
+}
+
+static bool send_and_wait_msg(int sock, size_t amount, const char *proto,
+                              uint8_t *buf, size_t buf_len) {
+  static int count;
+  int64_t start;
+  int ret;
+
+  if (sock < 0) {
+    return true;
+  }
+
+  /* Terminate the sent data with \n so that we can use the
+   *      websocketd --port=9001 cat
+   * command in server side.
+   */
+  memcpy(buf, lorem_ipsum, amount);
+  buf[amount] = '\n';
+
+  /* Send every 2nd message using dedicated websocket API and generic
+   * BSD socket API. Real applications would not work like this but here
+   * we want to test both APIs. We also need to send the \n so add it
+   * here to amount variable.
+   */
+  start = k_uptime_ticks();
+  if (count % 2) {
+    ret = sendall_with_ws_api(sock, buf, amount + 1);
+  } else {
+    ret = sendall_with_bsd_api(sock, buf, amount + 1);
+  }
+
+  if (ret <= 0) {
+    if (ret < 0) {
+      LOG_ERR("%s failed to send data using %s (%d)", proto,
+              (count % 2) ? "ws API" : "socket API", ret);
+    } else {
+      LOG_DBG("%s connection closed", proto);
+    }
+
+    return false;
+  } else {
+    LOG_DBG("%s sent %d bytes", proto, ret);
+  }
+
+  if (count % 2) {
+    recv_data_wso_api(sock, amount + 1, buf, buf_len, proto);
+  } else {
+    recv_data_bsd_api(sock, amount + 1, buf, buf_len, proto);
+  }
+  record_rtt(k_ticks_to_us_floor32(k_uptime_ticks() - start));
+
+  count++;
+
+  return true;
+}
+
+void run_echo_test(int sock, int websock) {
+  size_t amount;
+
+  tcp_sock = sock;
+  ws_rx_init(&rx, sock, websock, recv_buf_ipv4, sizeof(recv_buf_ipv4),
+             echo_cb, (void *)(intptr_t)websock);
+
+  for (;;) {
+    amount = how_much_to_send(ipsum_len);
+
+    if (!send_and_wait_msg(websock, amount, "IPv4", recv_buf_ipv4,
+                           sizeof(recv_buf_ipv4))) {
+      return;
+    }
+
+    k_sleep(K_MSEC(250));
+  }
+}
@@ -0,0 +1,13 @@
+#ifndef ECHO_H
+#define ECHO_H
+
+/* Sends lorem ipsum text of random length on @p websock, alternating the
+ * websocket and BSD socket APIs, and checks every echo, as against
+ *   websocketd --port=8186 cat
+ * and logs the echo round trips. Waits for echoes in zsock_poll() on
+ * @p sock, the TCP socket under @p websock. Returns once sending fails or
+ * the connection closes.
+ */
+void run_echo_test(int sock, int websock);
+
+#endif
@@ -5,8 +5,16 @@
 #include <zephyr/net/wifi_mgmt.h>
 
 #include "config.h"
+#include "echo.h"
+#include "mg_backoff.h"
+#include "mg_batch.h"
+#include "mg_net.h"
+#include "mg_net_if.h"
+#include "mg_telemetry.h"
+#include "mg_topic.h"
+#include "mg_ws.h"
 #include "wifi.h"
-#include <zephyr/misc/lorem_ipsum.h>
+#include "ws_rx.h"
 #include <zephyr/net/net_if.h>
 #include <zephyr/net/net_ip.h>
 #include <zephyr/net/net_mgmt.h>
@@ -22,287 +30,275 @@ static struct net_if *sta_iface;
 
 #define TELEMETRY_INTERVAL_SEC 30
 
-typedef struct {
-  double temperature;
-  double humidity;
-  int battery_level;
-  bool led_state;
-} sensor_data_t;
+/* Largest frame payload: a SenML pack, or one JSON reading. */
+#define MAX_PAYLOAD_LEN 512
+
+/* websocket_connect() reads the handshake response into this. */
+#define HANDSHAKE_BUF_LEN 256
+
+/* Messages from the server: pongs, pings and the odd command. Larger ones
+ * are dropped.
+ */
+#define MAX_RECV_BUF_LEN 128
+
+BUILD_ASSERT(CONFIG_MG_TELEMETRY_BATCH_MAX_BYTES > 0 &&
+                 CONFIG_MG_TELEMETRY_BATCH_MAX_BYTES <= MAX_PAYLOAD_LEN,
+             "SenML packs must fit in a frame");
 
 static sensor_data_t current_data = {.temperature = 23.5,
                                      .humidity = 65.0,
                                      .battery_level = 85,
                                      .led_state = false};
 
-static const char lorem_ipsum[] = LOREM_IPSUM;
-
-#define MAX_RECV_BUF_LEN (sizeof(lorem_ipsum) - 1)
+/* Readings are sampled every TELEMETRY_INTERVAL_SEC and sent as one binary
+ * SenML-CBOR frame whenever a batch threshold is reached. A pack that could
+ * not be sent is kept for the next connection.
+ */
+static const struct mg_batch_config batch_config = {
+    .base_name = CLIENT_ID ":",
+    .max_count = CONFIG_MG_TELEMETRY_BATCH_COUNT,
+    .max_bytes = CONFIG_MG_TELEMETRY_BATCH_MAX_BYTES,
+    .max_age_ms = CONFIG_MG_TELEMETRY_BATCH_MAX_AGE_MS,
+};
+static struct mg_batch_sample batch_storage[CONFIG_MG_TELEMETRY_BATCH_COUNT];
+static struct mg_batch batch;
+
+/* Payloads are encoded MG_WS_HEADROOM bytes in, and the frame header is
+ * written in front of them: a frame goes out in one send, without a copy.
+ * Control frames have their own buffer, so a pong never clobbers a payload.
+ */
+static uint8_t frame_buf[MG_WS_HEADROOM + MAX_PAYLOAD_LEN];
+static uint8_t control_buf[MG_WS_HEADROOM + MG_WS_MAX_CONTROL_LEN];
+static uint8_t recv_buf[MAX_RECV_BUF_LEN];
+static uint8_t handshake_buf[HANDSHAKE_BUF_LEN];
+
+static struct ws_rx rx;
+static struct mg_ws_keepalive keepalive;
+static uint32_t frames_sent;
+
+static const struct mg_backoff_config backoff_config = {
+    .first_ms = BACKOFF_FIRST_MS,
+    .base_ms = BACKOFF_EXP_BASE_MS,
+    .max_ms = BACKOFF_EXP_MAX_MS,
+    .stable_ms = BACKOFF_STABLE_MS,
+};
+static struct mg_backoff backoff;
 
-const int ipsum_len = MAX_RECV_BUF_LEN;
+static int connect_cb(int sock, struct http_request *req, void *user_data) {
+  LOG_INF("Websocket %d for %s connected.", sock, (char *)user_data);
 
-static uint8_t recv_buf_ipv4[MAX_RECV_BUF_LEN];
+  return 0;
+}
 
-/* We need to allocate bigger buffer for the websocket data we receive so that
- * the websocket header fits into it.
+/* Opens the TCP connection into *sock and upgrades it. Returns the
+ * websocket, or a negative errno with *sock closed.
  */
-#define EXTRA_BUF_SPACE 30
-
-static uint8_t temp_recv_buf_ipv4[MAX_RECV_BUF_LEN + EXTRA_BUF_SPACE];
-
-/* Network event callback */
-static struct net_mgmt_event_callback mgmt_cb;
-static K_SEM_DEFINE(dhcp_sem, 0, 1);
+static int ws_connect(int *sock) {
+  /* Just an example how to set extra headers */
+  static const char *extra_headers[] = {"Origin: http://foobar\r\n", NULL};
+  int32_t timeout = 3 * MSEC_PER_SEC;
+  struct websocket_request req;
+  struct sockaddr_in addr4;
+  int websock;
+  int ret;
 
-static void net_mgmt_event_handler(struct net_mgmt_event_callback *cb,
-                                   uint32_t mgmt_event, struct net_if *iface) {
-  if (mgmt_event == NET_EVENT_IPV4_DHCP_BOUND) {
-    LOG_INF("DHCP bound - got IP address");
-    k_sem_give(&dhcp_sem);
+  ret = mg_net_connect_socket(AF_INET, MAGISTRALA_IP, MAGISTRALA_WS_PORT,
+                              SOCK_STREAM, sock, (struct sockaddr *)&addr4,
+                              sizeof(addr4));
+  if (ret < 0 || *sock < 0) {
+    LOG_ERR("Cannot create or connect IPv4 HTTP socket.");
+    return -ECONNABORTED;
   }
-}
 
-static int wait_for_ip_address(struct net_if *iface) {
-  struct net_if_addr *if_addr;
-  const int max_timeout = 30; // 30 seconds max wait
-
-  /* Check if we already have an IP */
-  if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-  if (if_addr) {
-    char addr_str[NET_IPV4_ADDR_LEN];
-    net_addr_ntop(AF_INET, &if_addr->address.in_addr, addr_str,
-                  sizeof(addr_str));
-    LOG_INF("Already have IP address: %s", addr_str);
-    return 0;
-  }
+  memset(&req, 0, sizeof(req));
 
-  LOG_INF("Waiting for IP address via DHCP...");
+  req.host = MAGISTRALA_IP;
 
-  /* Wait for DHCP with timeout */
-  int ret = k_sem_take(&dhcp_sem, K_SECONDS(max_timeout));
-  if (ret != 0) {
-    LOG_ERR("Timeout waiting for DHCP - checking if we have IP anyway");
+  // URI path: m/{domain_id}/c/{channel_id}?authorization={client_secret}
+  req.url = MG_TOPIC(DOMAIN_ID, CHANNEL_ID) "?authorization=" CLIENT_SECRET;
 
-    /* Final check if we somehow got an IP */
-    if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-    if (!if_addr) {
-      LOG_ERR("No IP address available");
-      return -ETIMEDOUT;
-    }
-  }
+  req.optional_headers = extra_headers;
+  req.cb = connect_cb;
+  req.tmp_buf = handshake_buf;
+  req.tmp_buf_len = sizeof(handshake_buf);
 
-  /* Verify we have a valid IP */
-  if_addr = net_if_ipv4_get_global_addr(iface, NET_ADDR_PREFERRED);
-  if (if_addr) {
-    char addr_str[NET_IPV4_ADDR_LEN];
-    net_addr_ntop(AF_INET, &if_addr->address.in_addr, addr_str,
-                  sizeof(addr_str));
-    LOG_INF("Got IP address: %s", addr_str);
-    return 0;
+  websock = websocket_connect(*sock, &req, timeout, "IPv4");
+  if (websock < 0) {
+    LOG_ERR("Cannot connect to %s:%d with error %d", MAGISTRALA_IP,
+            MAGISTRALA_WS_PORT, websock);
+    close(*sock);
+    *sock = -1;
   }
 
-  LOG_ERR("Still no valid IP address");
-  return -1;
+  return websock;
 }
 
-static int setup_socket(sa_family_t family, const char *server, int port,
-                        int *sock, struct sockaddr *addr, socklen_t addr_len) {
-  const char *family_str = family == AF_INET ? "IPv4" : "IPv6";
-  int ret = 0;
-
-  memset(addr, 0, addr_len);
+/* Sends the queued readings as one binary SenML-CBOR frame, or the current
+ * reading as a JSON text frame. Frames are written to the TCP socket under
+ * @p websock directly, so they are built in frame_buf rather than copied by
+ * websocket_send_msg().
+ */
+static int send_telemetry(int sock) {
+  uint8_t *payload = frame_buf + MG_WS_HEADROOM;
+  size_t readings = 1;
+  uint8_t opcode;
+  int len;
+  int ret;
 
-  if (family == AF_INET) {
-    net_sin(addr)->sin_family = AF_INET;
-    net_sin(addr)->sin_port = htons(port);
-    inet_pton(family, server, &net_sin(addr)->sin_addr);
+  if (IS_ENABLED(CONFIG_MG_TELEMETRY_FORMAT_SENML_CBOR)) {
+    readings = batch.count;
+    len = mg_batch_encode_senml_cbor(&batch, k_uptime_get(), payload,
+                                     MAX_PAYLOAD_LEN);
+    opcode = MG_WS_OPCODE_BINARY;
   } else {
-    net_sin6(addr)->sin6_family = AF_INET6;
-    net_sin6(addr)->sin6_port = htons(port);
-    inet_pton(family, server, &net_sin6(addr)->sin6_addr);
-  }
-
-  *sock = socket(family, SOCK_STREAM, IPPROTO_TCP);
-
-  if (*sock < 0) {
-    LOG_ERR("Failed to create %s HTTP socket (%d)", family_str, -errno);
+    len = mg_telemetry_json_encode(&current_data, k_uptime_get(),
+                                   (char *)payload, MAX_PAYLOAD_LEN);
+    opcode = MG_WS_OPCODE_TEXT;
   }
 
-  return ret;
-}
-
-static int connect_socket(sa_family_t family, const char *server, int port,
-                          int *sock, struct sockaddr *addr,
-                          socklen_t addr_len) {
-  int ret;
-
-  ret = setup_socket(family, server, port, sock, addr, addr_len);
-  if (ret < 0 || *sock < 0) {
-    return -1;
+  if (len < 0) {
+    LOG_ERR("Telemetry payload too large");
+    mg_batch_reset(&batch);
+    return 0;
   }
 
-  ret = connect(*sock, addr, addr_len);
+  ret = mg_ws_send(sock, opcode, payload, len);
   if (ret < 0) {
-    LOG_ERR("Cannot connect to %s remote (%d)",
-            family == AF_INET ? "IPv4" : "IPv6", -errno);
-    ret = -errno;
+    LOG_ERR("Failed to send telemetry: %d", ret);
+    return ret;
   }
 
-  return ret;
-}
-
-static int connect_cb(int sock, struct http_request *req, void *user_data) {
-  LOG_INF("Websocket %d for %s connected.", sock, (char *)user_data);
+  LOG_INF("Sent %zu readings in a %d byte frame", readings, len);
+  mg_batch_reset(&batch);
+  frames_sent++;
 
   return 0;
 }
 
-static size_t how_much_to_send(size_t max_len) {
-  size_t amount;
+static int sample_telemetry(int sock) {
+  int64_t now = k_uptime_get();
 
-  do {
-    amount = sys_rand32_get() % max_len;
-  } while (amount == 0U);
-
-  return amount;
-}
+  if (!IS_ENABLED(CONFIG_MG_TELEMETRY_FORMAT_SENML_CBOR)) {
+    return send_telemetry(sock);
+  }
 
-static ssize_t sendall_with_ws_api(int sock, const void *buf, size_t len) {
-  return websocket_send_msg(sock, buf, len, WEBSOCKET_OPCODE_DATA_TEXT, true,
-                            true, SYS_FOREVER_MS);
-}
+  if (mg_batch_add(&batch, &current_data, now) < 0) {
+    /* Full: send the pack and start the next one with this reading. */
+    if (send_telemetry(sock) < 0) {
+      return -EIO;
+    }
+    (void)mg_batch_add(&batch, &current_data, now);
+  }
 
-static ssize_t sendall_with_bsd_api(int sock, const void *buf, size_t len) {
-  return send(sock, buf, len, 0);
+  return mg_batch_due(&batch, now) ? send_telemetry(sock) : 0;
 }
 
-static void recv_data_wso_api(int sock, size_t amount, uint8_t *buf,
-                              size_t buf_len, const char *proto) {
-  uint64_t remaining = ULLONG_MAX;
-  int total_read;
-  uint32_t message_type;
-  int ret, read_pos;
-
-  read_pos = 0;
-  total_read = 0;
-
-  while (remaining > 0) {
-    ret = websocket_recv_msg(sock, buf + read_pos, buf_len - read_pos,
-                             &message_type, &remaining, 0);
-    if (ret < 0) {
-      if (ret == -EAGAIN) {
-        k_sleep(K_MSEC(50));
-        continue;
-      }
-
-      LOG_DBG("%s connection closed while "
-              "waiting (%d/%d)",
-              proto, ret, errno);
-      break;
+/* Takes the messages ws_rx assembled: answers pings, records pongs for the
+ * keepalive and ends on a close.
+ */
+static int on_message(uint32_t type, const uint8_t *data, size_t len,
+                      void *user) {
+  int sock = (intptr_t)user;
+  uint8_t opcode;
+
+  if (type & WEBSOCKET_FLAG_CLOSE) {
+    return -ECONNRESET;
+  } else if (type & WEBSOCKET_FLAG_PING) {
+    opcode = MG_WS_OPCODE_PING;
+    memcpy(control_buf + MG_WS_HEADROOM, data, len);
+    if (mg_ws_send(sock, MG_WS_OPCODE_PONG, control_buf + MG_WS_HEADROOM,
+                   len) < 0) {
+      return -EIO;
     }
-
-    read_pos += ret;
-    total_read += ret;
-  }
-
-  if (remaining != 0 || total_read != amount ||
-      /* Do not check the final \n at the end of the msg */
-      memcmp(lorem_ipsum, buf, amount - 1) != 0) {
-    LOG_ERR("%s data recv failure %zd/%d bytes (remaining %" PRId64 ")", proto,
-            amount, total_read, remaining);
-    LOG_HEXDUMP_DBG(buf, total_read, "received ws buf");
-    LOG_HEXDUMP_DBG(lorem_ipsum, total_read, "sent ws buf");
+  } else if (type & WEBSOCKET_FLAG_PONG) {
+    opcode = MG_WS_OPCODE_PONG;
   } else {
-    LOG_DBG("%s recv %d bytes", proto, total_read);
+    opcode = MG_WS_OPCODE_BINARY;
+    LOG_DBG("Ignoring %zu bytes from the server", len);
   }
-}
 
-static void recv_data_bsd_api(int sock, size_t amount, uint8_t *buf,
-                              size_t buf_len, const char *proto) {
-  int remaining;
-  int ret, read_pos;
+  mg_ws_keepalive_rx(&keepalive, opcode, k_uptime_get());
 
-  remaining = amount;
-  read_pos = 0;
+  return 0;
+}
 
-  while (remaining > 0) {
-    ret = recv(sock, buf + read_pos, buf_len - read_pos, 0);
-    if (ret <= 0) {
-      if (errno == EAGAIN || errno == ETIMEDOUT) {
-        k_sleep(K_MSEC(50));
-        continue;
-      }
+/* Streams telemetry on the open connection until it fails. Sleeps in
+ * zsock_poll() until the next reading or keepalive deadline, or until the
+ * server sends something, which is handled as soon as it arrives.
+ */
+static int stream_telemetry(int sock, int websock) {
+  int64_t next_sample = k_uptime_get();
+  int64_t now, wake;
+  int ret;
 
-      LOG_DBG("%s connection closed while "
-              "waiting (%d/%d)",
-              proto, ret, errno);
-      break;
+  ws_rx_init(&rx, sock, websock, recv_buf, sizeof(recv_buf), on_message,
+             (void *)(intptr_t)sock);
+  mg_ws_keepalive_init(&keepalive, WS_PING_INTERVAL_SEC * MSEC_PER_SEC,
+                       WS_PONG_TIMEOUT_SEC * MSEC_PER_SEC, next_sample);
+
+  for (;;) {
+    now = k_uptime_get();
+    ret = mg_ws_keepalive_check(&keepalive, now);
+    if (ret < 0) {
+      return ret;
+    } else if (ret > 0 && mg_ws_send(sock, MG_WS_OPCODE_PING,
+                                     control_buf + MG_WS_HEADROOM, 0) < 0) {
+      return -EIO;
     }
 
-    read_pos += ret;
-    remaining -= ret;
-  }
+    if (now >= next_sample) {
+      next_sample += TELEMETRY_INTERVAL_SEC * MSEC_PER_SEC;
+      ret = sample_telemetry(sock);
+      if (ret < 0) {
+        return ret;
+      }
+    }
 
-  if (remaining != 0 ||
-      /* Do not check the final \n at the end of the msg */
-      memcmp(lorem_ipsum, buf, amount - 1) != 0) {
-    LOG_ERR("%s data recv failure %zd/%d bytes (remaining %d)", proto, amount,
-            read_pos, remaining);
-    LOG_HEXDUMP_DBG(buf, read_pos, "received bsd buf");
-    LOG_HEXDUMP_DBG(lorem_ipsum, read_pos, "sent bsd buf");
-  } else {
-    LOG_DBG("%s recv %d bytes", proto, read_pos);
+    wake = MIN(next_sample, mg_ws_keepalive_deadline(&keepalive));
+    now = k_uptime_get();
+    ret = ws_rx_poll(&rx, wake > now ? wake - now : 0);
+    if (ret < 0) {
+      return ret;
+    }
   }
 }
 
-static bool send_and_wait_msg(int sock, size_t amount, const char *proto,
-                              uint8_t *buf, size_t buf_len) {
-  static int count;
+static void run_client(void) {
+  uint32_t backoff_ms;
+  int sock = -1;
+  int websock;
   int ret;
 
-  if (sock < 0) {
-    return true;
-  }
-
-  /* Terminate the sent data with \n so that we can use the
-   *      websocketd --port=9001 cat
-   * command in server side.
-   */
-  memcpy(buf, lorem_ipsum, amount);
-  buf[amount] = '\n';
-
-  /* Send every 2nd message using dedicated websocket API and generic
-   * BSD socket API. Real applications would not work like this but here
-   * we want to test both APIs. We also need to send the \n so add it
-   * here to amount variable.
-   */
-  if (count % 2) {
-    ret = sendall_with_ws_api(sock, buf, amount + 1);
-  } else {
-    ret = sendall_with_bsd_api(sock, buf, amount + 1);
-  }
+  mg_batch_init(&batch, &batch_config, batch_storage,
+                CONFIG_MG_TELEMETRY_BATCH_COUNT);
+  mg_backoff_init(&backoff, &backoff_config);
+
+  for (;;) {
+    websock = ws_connect(&sock);
+    if (websock >= 0) {
+      LOG_INF("Websocket IPv4 %d", websock);
+      mg_backoff_connected(&backoff, k_uptime_get());
+
+      if (WS_ECHO_TEST) {
+        run_echo_test(sock, websock);
+        ret = -ECONNRESET;
+      } else {
+        ret = stream_telemetry(sock, websock);
+      }
 
-  if (ret <= 0) {
-    if (ret < 0) {
-      LOG_ERR("%s failed to send data using %s (%d)", proto,
-              (count % 2) ? "ws API" : "socket API", ret);
-    } else {
-      LOG_DBG("%s connection closed", proto);
+      LOG_WRN("Websocket closed (%d): %u frames sent, %u pings, %u pongs "
+              "(last %u ms), %u wakeups",
+              ret, frames_sent, keepalive.pings, keepalive.pongs,
+              keepalive.rtt_ms, rx.stats.wakeups);
+      close(websock);
+      close(sock);
+      mg_backoff_disconnected(&backoff, k_uptime_get());
     }
 
-    return false;
-  } else {
-    LOG_DBG("%s sent %d bytes", proto, ret);
+    backoff_ms = mg_backoff_next(&backoff);
+    LOG_INF("Reconnecting in %u ms", backoff_ms);
+    k_msleep(backoff_ms);
   }
-
-  if (count % 2) {
-    recv_data_wso_api(sock, amount + 1, buf, buf_len, proto);
-  } else {
-    recv_data_bsd_api(sock, amount + 1, buf, buf_len, proto);
-  }
-
-  count++;
-
-  return true;
 }
 
 int main(void) {
@@ -315,9 +311,7 @@ int main(void) {
   initialize_wifi();
 
   /* Setup network management callback for DHCP events */
-  net_mgmt_init_event_callback(&mgmt_cb, net_mgmt_event_handler,
-                               NET_EVENT_IPV4_DHCP_BOUND);
-  net_mgmt_add_event_callback(&mgmt_cb);
+  mg_net_if_init();
 
   /* Get STA interface in AP-STA mode. */
   sta_iface = net_if_get_wifi_sta();
@@ -333,7 +327,7 @@ int main(void) {
   }
 
   /* Wait for IP address via DHCP */
-  ret = wait_for_ip_address(sta_iface);
+  ret = mg_wait_for_ip_address(sta_iface);
   if (ret < 0) {
     LOG_ERR("Failed to get IP address: %d", ret);
     return ret;
@@ -341,73 +335,7 @@ int main(void) {
 
   LOG_INF("Will send telemetry every %d seconds", TELEMETRY_INTERVAL_SEC);
 
-  /* Just an example how to set extra headers */
-  const char *extra_headers[] = {"Origin: http://foobar\r\n", NULL};
-
-  int sock4 = -1;
-  int websock4 = -1;
-  int32_t timeout = 3 * MSEC_PER_SEC;
-  struct sockaddr_in addr4;
-  size_t amount;
-
-  ret = connect_socket(AF_INET, MAGISTRALA_IP, MAGISTRALA_WS_PORT, &sock4,
-                       (struct sockaddr *)&addr4, sizeof(addr4));
-  if (ret < 0 || sock4 < 0) {
-    LOG_ERR("Cannot create or connect IPv4 HTTP socket.");
-    return -1;
-  }
-
-  LOG_INF("Connected to IPv4 websocket");
-
-  struct websocket_request req;
-
-  memset(&req, 0, sizeof(req));
-
-  req.host = MAGISTRALA_IP;
-
-  // Construct URI path:
-  // m/{domain_id}/c/{channel_id}?authorization={client_secret}
-  char uri_path[256];
-  ret = snprintf(uri_path, sizeof(uri_path), "m/%s/c/%s?authorization=%s",
-                 DOMAIN_ID, CHANNEL_ID, CLIENT_SECRET);
-  req.url = uri_path;
-
-  req.optional_headers = extra_headers;
-  req.cb = connect_cb;
-  req.tmp_buf = temp_recv_buf_ipv4;
-  req.tmp_buf_len = sizeof(temp_recv_buf_ipv4);
-
-  websock4 = websocket_connect(sock4, &req, timeout, "IPv4");
-  if (websock4 < 0) {
-    LOG_ERR("Cannot connect to %s:%d with error %d", MAGISTRALA_IP,
-            MAGISTRALA_WS_PORT, websock4);
-    close(sock4);
-    return -1;
-  }
-
-  LOG_INF("Websocket IPv4 %d", websock4);
-
-  while (1) {
-    amount = how_much_to_send(ipsum_len);
-
-    if (websock4 >= 0 &&
-        !send_and_wait_msg(websock4, amount, "IPv4", recv_buf_ipv4,
-                           sizeof(recv_buf_ipv4))) {
-      break;
-    }
-
-    k_sleep(K_MSEC(250));
-  }
-
-  if (websock4 >= 0) {
-    close(websock4);
-  }
-
-  if (sock4 >= 0) {
-    close(sock4);
-  }
-
-  k_sleep(K_FOREVER);
+  run_client();
 
   return 0;
 }
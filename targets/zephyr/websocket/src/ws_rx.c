@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/logging/log.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/net/websocket.h>
+
+#include "ws_rx.h"
+
+LOG_MODULE_DECLARE(websocket_client);
+
+#define CONTROL_FLAGS                                                          \
+  (WEBSOCKET_FLAG_CLOSE | WEBSOCKET_FLAG_PING | WEBSOCKET_FLAG_PONG)
+
+void ws_rx_init(struct ws_rx *rx, int sock, int websock, uint8_t *buf,
+                size_t len, ws_rx_cb_t cb, void *user) {
+  memset(rx, 0, sizeof(*rx));
+  rx->sock = sock;
+  rx->websock = websock;
+  rx->buf = buf;
+  rx->len = len;
+  rx->cb = cb;
+  rx->user = user;
+}
+
+/* Reads the next piece of a frame. Returns 1 if it completed a message and
+ * the callback took it, 0 if not, or a negative errno; -EAGAIN once nothing
+ * is left.
+ */
+static int read_piece(struct ws_rx *rx) {
+  uint64_t remaining;
+  uint32_t type;
+  uint8_t *dst;
+  size_t room;
+  int ret;
+
+  /* Until the frame type is known, a piece goes where a data message
+   * continues. ctrl doubles as scratch for a message that outgrew buf.
+   */
+  if (rx->in_ctrl) {
+    dst = rx->ctrl + rx->ctrl_fill;
+    room = sizeof(rx->ctrl) - rx->ctrl_fill;
+    if (room == 0) {
+      /* Control frames carry at most 125 bytes. */
+      return -EMSGSIZE;
+    }
+  } else if (rx->overflow || rx->fill == rx->len) {
+    dst = rx->ctrl;
+    room = sizeof(rx->ctrl);
+  } else {
+    dst = rx->buf + rx->fill;
+    room = rx->len - rx->fill;
+  }
+
+  ret = websocket_recv_msg(rx->websock, dst, room, &type, &remaining, 0);
+  if (ret < 0) {
+    return ret;
+  }
+  rx->stats.reads++;
+
+  if (type & CONTROL_FLAGS) {
+    if (!rx->in_ctrl && dst != rx->ctrl) {
+      memmove(rx->ctrl, dst, ret);
+    }
+    rx->in_ctrl = true;
+    rx->ctrl_fill += ret;
+    if (remaining > 0) {
+      return 0;
+    }
+
+    rx->in_ctrl = false;
+    ret = rx->ctrl_fill;
+    rx->ctrl_fill = 0;
+    rx->stats.messages++;
+    ret = rx->cb(type, rx->ctrl, ret, rx->user);
+    return ret < 0 ? ret : 1;
+  }
+
+  /* Continuation frames carry no text or binary flag: the type is the
+   * first frame's.
+   */
+  if (rx->fill == 0 && !rx->overflow) {
+    rx->type = type;
+  }
+  if (dst == rx->ctrl) {
+    rx->overflow = true;
+  } else {
+    rx->fill += ret;
+  }
+
+  if (remaining > 0 || !(type & WEBSOCKET_FLAG_FINAL)) {
+    return 0;
+  }
+
+  if (rx->overflow) {
+    LOG_WRN("Dropped a message larger than %zu bytes", rx->len);
+    rx->stats.dropped++;
+    ret = 0;
+  } else {
+    rx->stats.messages++;
+    ret = rx->cb(rx->type, rx->buf, rx->fill, rx->user);
+    ret = ret < 0 ? ret : 1;
+  }
+  rx->fill = 0;
+  rx->overflow = false;
+
+  return ret;
+}
+
+/* Reads until nothing is left. Returns the messages delivered. */
+static int process(struct ws_rx *rx) {
+  int delivered = 0;
+  int ret;
+
+  for (;;) {
+    ret = read_piece(rx);
+    if (ret == -EAGAIN) {
+      return delivered;
+    } else if (ret < 0) {
+      return ret;
+    }
+    delivered += ret;
+  }
+}
+
+int ws_rx_poll(struct ws_rx *rx, int32_t timeout_ms) {
+  struct zsock_pollfd pfd = {.fd = rx->sock, .events = ZSOCK_POLLIN};
+  int ret;
+
+  /* The websocket may hold data it read ahead, which poll cannot see. */
+  ret = process(rx);
+  if (ret != 0) {
+    return ret;
+  }
+
+  ret = zsock_poll(&pfd, 1, timeout_ms == SYS_FOREVER_MS ? -1 : timeout_ms);
+  if (ret < 0) {
+    return -errno;
+  }
+  rx->stats.wakeups++;
+  if (ret == 0) {
+    return 0;
+  }
+  if (pfd.revents & (ZSOCK_POLLERR | ZSOCK_POLLNVAL)) {
+    return -ECONNRESET;
+  }
+
+  /* After a hang-up, deliver what was still queued, then report it. */
+  ret = process(rx);
+  if (ret == 0 && (pfd.revents & ZSOCK_POLLHUP)) {
+    return -ECONNRESET;
+  }
+
+  return ret;
+}
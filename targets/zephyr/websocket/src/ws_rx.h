@@ -0,0 +1,64 @@
+#ifndef WS_RX_H
+#define WS_RX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mg_ws.h"
+
+/* Called with every complete message: @p type holds the WEBSOCKET_FLAG_*
+ * bits of websocket_recv_msg(). A negative return ends ws_rx_poll() with it.
+ */
+typedef int (*ws_rx_cb_t)(uint32_t type, const uint8_t *data, size_t len,
+                          void *user);
+
+struct ws_rx_stats {
+  /* Returns from zsock_poll(), pieces read and messages delivered. */
+  uint32_t wakeups;
+  uint32_t reads;
+  uint32_t messages;
+  /* Data messages larger than the buffer, dropped whole. */
+  uint32_t dropped;
+};
+
+/* Receive state machine of a websocket. It reads whatever has arrived with
+ * websocket_recv_msg() without waiting, following the remaining counter of
+ * each frame, and assembles the pieces and fragments of a message in the
+ * caller's buffer. Control frames, which may arrive between the fragments
+ * of a data message, are assembled apart. When nothing is left, it waits
+ * in zsock_poll() on the TCP socket under the websocket, so it wakes up as
+ * soon as the next piece arrives and not before.
+ */
+struct ws_rx {
+  int sock;
+  int websock;
+  uint8_t *buf;
+  size_t len;
+  ws_rx_cb_t cb;
+  void *user;
+  /* The data message being assembled: its type and length so far, and
+   * whether it outgrew buf.
+   */
+  uint32_t type;
+  size_t fill;
+  bool overflow;
+  /* The control frame being assembled. */
+  uint8_t ctrl[MG_WS_MAX_CONTROL_LEN];
+  size_t ctrl_fill;
+  bool in_ctrl;
+  struct ws_rx_stats stats;
+};
+
+/* @p sock is the TCP socket @p websock was opened on. */
+void ws_rx_init(struct ws_rx *rx, int sock, int websock, uint8_t *buf,
+                size_t len, ws_rx_cb_t cb, void *user);
+
+/* Delivers the messages already received. If there were none, waits up to
+ * @p timeout_ms for data (SYS_FOREVER_MS for ever) and delivers what
+ * completes. Returns the messages delivered, 0 on timeout, or a negative
+ * errno from the socket or the callback.
+ */
+int ws_rx_poll(struct ws_rx *rx, int32_t timeout_ms);
+
+#endif